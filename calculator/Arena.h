@@ -0,0 +1,160 @@
+// Arena.h — Monotonic allocation for AST nodes
+//
+// An Arena hands out memory by bumping a cursor through large blocks and
+// never frees individual objects; all blocks are released together when the
+// arena is destroyed or reset. The parser uses it to place a whole AST in one
+// contiguous block instead of one heap allocation per node.
+//
+// Objects created with Arena::make<T>() are still RefCounted and managed by
+// Pointer<T>, so the rest of the code base does not need to know where a node
+// lives. The only difference is on release: an arena object is destroyed in
+// place (its destructor runs and releases its children) but its memory is
+// left to the arena. Children that live on the heap, such as the interned
+// Variable nodes, are therefore released correctly.
+//
+// Lifetime rule: every Pointer into an arena must be dropped before the arena
+// is reset or destroyed. ArenaExpression bundles an arena with its root so
+// that the order is enforced automatically.
+
+#pragma once
+
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// Arena — bump allocator over a list of heap blocks.
+class Arena {
+public:
+    // Size of the first block when none is requested explicitly.
+    static constexpr size_t kDefaultBlockSize = 4096;
+
+    explicit Arena(size_t blocksize = kDefaultBlockSize) : _nextsize(std::max<size_t>(blocksize, 64)) {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Moving transfers the blocks; object addresses do not change.
+    Arena(Arena&& rhs) noexcept
+        : _blocks(std::move(rhs._blocks))
+        , _cursor(std::exchange(rhs._cursor, nullptr))
+        , _end(std::exchange(rhs._end, nullptr))
+        , _nextsize(rhs._nextsize)
+        , _allocated(std::exchange(rhs._allocated, 0)) {
+    }
+    Arena& operator=(Arena&& rhs) noexcept {
+        _blocks = std::move(rhs._blocks);
+        _cursor = std::exchange(rhs._cursor, nullptr);
+        _end = std::exchange(rhs._end, nullptr);
+        _nextsize = rhs._nextsize;
+        _allocated = std::exchange(rhs._allocated, 0);
+        return *this;
+    }
+
+    // Returns size bytes aligned to align. Grows by a new block (at least
+    // twice the previous one) when the current block is exhausted.
+    void* allocate(size_t size, size_t align) {
+        auto addr = reinterpret_cast<uintptr_t>(_cursor);
+        uintptr_t aligned = (addr + align - 1) & ~uintptr_t(align - 1);
+        if (_cursor == nullptr || aligned + size > reinterpret_cast<uintptr_t>(_end)) {
+            grow(size + align);
+            addr = reinterpret_cast<uintptr_t>(_cursor);
+            aligned = (addr + align - 1) & ~uintptr_t(align - 1);
+        }
+        _cursor = reinterpret_cast<char*>(aligned + size);
+        _allocated += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // Constructs a T inside the arena and returns an owning Pointer to it.
+    template <typename T, typename... Args>
+    Pointer<T> make(Args&&... args) {
+        void* mem = allocate(sizeof(T), alignof(T));
+        T* obj = new (mem) T(std::forward<Args>(args)...);
+        obj->_arena = true;
+        return Pointer<T>(obj);
+    }
+
+    // Discards all objects at once, keeping the largest block for reuse so a
+    // steady-state parse loop performs no heap allocation at all.
+    void reset() {
+        if (_blocks.empty()) {
+            return;
+        }
+        Block largest = std::move(_blocks.back());
+        _blocks.clear();
+        _cursor = largest.data.get();
+        _end = _cursor + largest.size;
+        _blocks.push_back(std::move(largest));
+        _allocated = 0;
+    }
+
+    // Number of heap blocks currently held.
+    size_t blocks() const {
+        return _blocks.size();
+    }
+
+    // Bytes handed out since construction or the last reset().
+    size_t allocated() const {
+        return _allocated;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void grow(size_t minimum) {
+        size_t size = std::max(_nextsize, minimum);
+        _blocks.push_back(Block{ std::unique_ptr<char[]>(new char[size]), size });
+        _cursor = _blocks.back().data.get();
+        _end = _cursor + size;
+        _nextsize = size * 2;
+    }
+
+    std::vector<Block> _blocks;
+    char* _cursor = nullptr;
+    char* _end = nullptr;
+    size_t _nextsize;
+    size_t _allocated = 0;
+};
+
+// ArenaExpression — a parse result that owns the arena holding its nodes.
+// The root is always released before the arena, so destroying or
+// reassigning the expression frees the whole tree with no per-node free().
+struct ArenaExpression {
+    Arena arena;  // declared first: destroyed after root
+    NodePtr root;
+
+    explicit ArenaExpression(size_t blocksize = Arena::kDefaultBlockSize) : arena(blocksize) {
+    }
+    ArenaExpression(ArenaExpression&&) noexcept = default;
+    ArenaExpression& operator=(ArenaExpression&& rhs) noexcept {
+        root = std::move(rhs.root);  // release the old tree while its arena is alive
+        arena = std::move(rhs.arena);
+        return *this;
+    }
+    ~ArenaExpression() = default;
+    ArenaExpression(const ArenaExpression&) = delete;
+    ArenaExpression& operator=(const ArenaExpression&) = delete;
+
+    explicit operator bool() const {
+        return static_cast<bool>(root);
+    }
+
+    double calc() const {
+        return root->calc();
+    }
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,584 @@
+// Batch.h — Column-at-a-time evaluation of one expression over many rows
+//
+// Evaluates a compiled Program (Bytecode.h) over whole columns of variable
+// values instead of one row at a time. Rows are processed in blocks of
+// kBatchBlock: each instruction runs over the full block before the next one
+// starts, so dispatch cost is paid once per block and the arithmetic becomes
+// a straight loop over contiguous values that maps onto SIMD registers.
+//
+// The evaluator and its kernels are templates over the value type
+// (Numeric.h). Kernel selection is done at compile time from the target ISA
+// and the value type (BatchLanes):
+//   __AVX__   4 doubles or 8 floats per operation (256-bit ymm registers)
+//   __SSE2__  2 doubles or 4 floats per operation (128-bit xmm registers)
+//   otherwise, and for Fixed, plain scalar loops
+// Build with -march=native (CALCULATOR_NATIVE in CMakeLists.txt) to get AVX2
+// machines onto the 256-bit path; baseline x86-64 uses SSE2. The built-in
+// sqrt, abs, min and max also have SIMD kernels (floor needs SSE4.1).
+//
+// Block buffers are register-allocated: an instruction's buffer is released
+// after its last use, so the working set is proportional to the expression's
+// depth rather than its size. Variables read straight from the input columns
+// and constants from a broadcast buffer filled once per call.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "FunctionOps.h"
+#include "Intrinsics.h"
+#include "Node.h"
+#include "Numeric.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Interpreter {
+
+// Number of rows processed per block. 256 rows = 2 KiB per live buffer.
+static constexpr size_t kBatchBlock = 256;
+
+//--------------------------------------------------
+// Kernels
+//--------------------------------------------------
+
+// BatchLanes<T> — the widest SIMD register of T values on the target, with
+// the operations the kernels use. Value types without one (kWidth 0, e.g.
+// Fixed) run every kernel as a scalar loop. floor() exists only where
+// kHasFloor is set: roundpd/roundps need SSE4.1 (implied by AVX).
+template <typename T>
+struct BatchLanes {
+    static constexpr size_t kWidth = 0;
+    static constexpr bool kHasFloor = false;
+};
+
+#if defined(__AVX__)
+template <>
+struct BatchLanes<double> {
+    using Vec = __m256d;
+    static constexpr size_t kWidth = 4;
+    static constexpr bool kHasFloor = true;
+    static Vec load(const double* ptr) {
+        return _mm256_loadu_pd(ptr);
+    }
+    static void store(double* ptr, Vec vec) {
+        _mm256_storeu_pd(ptr, vec);
+    }
+    static Vec add(Vec lhs, Vec rhs) {
+        return _mm256_add_pd(lhs, rhs);
+    }
+    static Vec sub(Vec lhs, Vec rhs) {
+        return _mm256_sub_pd(lhs, rhs);
+    }
+    static Vec mul(Vec lhs, Vec rhs) {
+        return _mm256_mul_pd(lhs, rhs);
+    }
+    static Vec div(Vec lhs, Vec rhs) {
+        return _mm256_div_pd(lhs, rhs);
+    }
+    static Vec min(Vec lhs, Vec rhs) {
+        return _mm256_min_pd(lhs, rhs);
+    }
+    static Vec max(Vec lhs, Vec rhs) {
+        return _mm256_max_pd(lhs, rhs);
+    }
+    static Vec negate(Vec vec) {
+        return _mm256_xor_pd(vec, _mm256_set1_pd(-0.0));
+    }
+    static Vec abs(Vec vec) {
+        return _mm256_andnot_pd(_mm256_set1_pd(-0.0), vec);
+    }
+    static Vec sqrt(Vec vec) {
+        return _mm256_sqrt_pd(vec);
+    }
+    static Vec floor(Vec vec) {
+        return _mm256_floor_pd(vec);
+    }
+};
+
+template <>
+struct BatchLanes<float> {
+    using Vec = __m256;
+    static constexpr size_t kWidth = 8;
+    static constexpr bool kHasFloor = true;
+    static Vec load(const float* ptr) {
+        return _mm256_loadu_ps(ptr);
+    }
+    static void store(float* ptr, Vec vec) {
+        _mm256_storeu_ps(ptr, vec);
+    }
+    static Vec add(Vec lhs, Vec rhs) {
+        return _mm256_add_ps(lhs, rhs);
+    }
+    static Vec sub(Vec lhs, Vec rhs) {
+        return _mm256_sub_ps(lhs, rhs);
+    }
+    static Vec mul(Vec lhs, Vec rhs) {
+        return _mm256_mul_ps(lhs, rhs);
+    }
+    static Vec div(Vec lhs, Vec rhs) {
+        return _mm256_div_ps(lhs, rhs);
+    }
+    static Vec min(Vec lhs, Vec rhs) {
+        return _mm256_min_ps(lhs, rhs);
+    }
+    static Vec max(Vec lhs, Vec rhs) {
+        return _mm256_max_ps(lhs, rhs);
+    }
+    static Vec negate(Vec vec) {
+        return _mm256_xor_ps(vec, _mm256_set1_ps(-0.0F));
+    }
+    static Vec abs(Vec vec) {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.0F), vec);
+    }
+    static Vec sqrt(Vec vec) {
+        return _mm256_sqrt_ps(vec);
+    }
+    static Vec floor(Vec vec) {
+        return _mm256_floor_ps(vec);
+    }
+};
+#elif defined(__SSE2__)
+template <>
+struct BatchLanes<double> {
+    using Vec = __m128d;
+    static constexpr size_t kWidth = 2;
+#if defined(__SSE4_1__)
+    static constexpr bool kHasFloor = true;
+    static Vec floor(Vec vec) {
+        return _mm_floor_pd(vec);
+    }
+#else
+    static constexpr bool kHasFloor = false;
+#endif
+    static Vec load(const double* ptr) {
+        return _mm_loadu_pd(ptr);
+    }
+    static void store(double* ptr, Vec vec) {
+        _mm_storeu_pd(ptr, vec);
+    }
+    static Vec add(Vec lhs, Vec rhs) {
+        return _mm_add_pd(lhs, rhs);
+    }
+    static Vec sub(Vec lhs, Vec rhs) {
+        return _mm_sub_pd(lhs, rhs);
+    }
+    static Vec mul(Vec lhs, Vec rhs) {
+        return _mm_mul_pd(lhs, rhs);
+    }
+    static Vec div(Vec lhs, Vec rhs) {
+        return _mm_div_pd(lhs, rhs);
+    }
+    static Vec min(Vec lhs, Vec rhs) {
+        return _mm_min_pd(lhs, rhs);
+    }
+    static Vec max(Vec lhs, Vec rhs) {
+        return _mm_max_pd(lhs, rhs);
+    }
+    static Vec negate(Vec vec) {
+        return _mm_xor_pd(vec, _mm_set1_pd(-0.0));
+    }
+    static Vec abs(Vec vec) {
+        return _mm_andnot_pd(_mm_set1_pd(-0.0), vec);
+    }
+    static Vec sqrt(Vec vec) {
+        return _mm_sqrt_pd(vec);
+    }
+};
+
+template <>
+struct BatchLanes<float> {
+    using Vec = __m128;
+    static constexpr size_t kWidth = 4;
+#if defined(__SSE4_1__)
+    static constexpr bool kHasFloor = true;
+    static Vec floor(Vec vec) {
+        return _mm_floor_ps(vec);
+    }
+#else
+    static constexpr bool kHasFloor = false;
+#endif
+    static Vec load(const float* ptr) {
+        return _mm_loadu_ps(ptr);
+    }
+    static void store(float* ptr, Vec vec) {
+        _mm_storeu_ps(ptr, vec);
+    }
+    static Vec add(Vec lhs, Vec rhs) {
+        return _mm_add_ps(lhs, rhs);
+    }
+    static Vec sub(Vec lhs, Vec rhs) {
+        return _mm_sub_ps(lhs, rhs);
+    }
+    static Vec mul(Vec lhs, Vec rhs) {
+        return _mm_mul_ps(lhs, rhs);
+    }
+    static Vec div(Vec lhs, Vec rhs) {
+        return _mm_div_ps(lhs, rhs);
+    }
+    static Vec min(Vec lhs, Vec rhs) {
+        return _mm_min_ps(lhs, rhs);
+    }
+    static Vec max(Vec lhs, Vec rhs) {
+        return _mm_max_ps(lhs, rhs);
+    }
+    static Vec negate(Vec vec) {
+        return _mm_xor_ps(vec, _mm_set1_ps(-0.0F));
+    }
+    static Vec abs(Vec vec) {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0F), vec);
+    }
+    static Vec sqrt(Vec vec) {
+        return _mm_sqrt_ps(vec);
+    }
+};
+#endif
+
+// Element-wise out[i] = op(lhs[i], rhs[i]): kWidth values per step with
+// vop where T has lanes, then the remainder with sop. out may alias an input.
+// vop takes a BatchLanes<T> as its first argument, so that a generic lambda
+// naming lane operations is only instantiated for types that have them.
+template <typename T, typename VecOp, typename ScalarOp>
+inline void batchBinary(const T* lhs, const T* rhs, T* out, size_t size, VecOp vop, ScalarOp sop) {
+    using Lanes = BatchLanes<T>;
+    size_t j = 0;
+    if constexpr (Lanes::kWidth > 0) {
+        for (; j + Lanes::kWidth <= size; j += Lanes::kWidth) {
+            Lanes::store(out + j, vop(Lanes(), Lanes::load(lhs + j), Lanes::load(rhs + j)));
+        }
+    }
+    for (; j < size; ++j) {
+        out[j] = sop(lhs[j], rhs[j]);
+    }
+}
+
+// Element-wise out[i] = op(in[i]), as batchBinary().
+template <typename T, typename VecOp, typename ScalarOp>
+inline void batchUnary(const T* operand, T* out, size_t size, VecOp vop, ScalarOp sop) {
+    using Lanes = BatchLanes<T>;
+    size_t j = 0;
+    if constexpr (Lanes::kWidth > 0) {
+        for (; j + Lanes::kWidth <= size; j += Lanes::kWidth) {
+            Lanes::store(out + j, vop(Lanes(), Lanes::load(operand + j)));
+        }
+    }
+    for (; j < size; ++j) {
+        out[j] = sop(operand[j]);
+    }
+}
+
+// The four arithmetic operators.
+template <typename T>
+inline void batchAdd(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::add(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs + vrhs; });
+}
+
+template <typename T>
+inline void batchSubtract(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::sub(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs - vrhs; });
+}
+
+template <typename T>
+inline void batchMultiply(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::mul(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs * vrhs; });
+}
+
+template <typename T>
+inline void batchDivide(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::div(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs / vrhs; });
+}
+
+// Element-wise out[i] = -in[i]; a sign-bit flip in the lanes.
+template <typename T>
+inline void batchNegate(const T* operand, T* out, size_t size) {
+    batchUnary(operand, out, size, [](auto lanes, auto vec) { return decltype(lanes)::negate(vec); },
+        [](T value) { return -value; });
+}
+
+// Element-wise out[i] = (lhs[i] CMP rhs[i]) ? lhs[i] : rhs[i], i.e. the
+// Intrinsics.h min/max, which is exactly what minpd/maxpd compute.
+template <typename T>
+inline void batchMin(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::min(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs < vrhs ? vlhs : vrhs; });
+}
+
+template <typename T>
+inline void batchMax(const T* lhs, const T* rhs, T* out, size_t size) {
+    batchBinary(lhs, rhs, out, size, [](auto lanes, auto vlhs, auto vrhs) { return decltype(lanes)::max(vlhs, vrhs); },
+        [](T vlhs, T vrhs) { return vlhs > vrhs ? vlhs : vrhs; });
+}
+
+// Element-wise out[i] = sqrt(in[i]); sqrtpd/sqrtps are correctly rounded
+// like std::sqrt.
+template <typename T>
+inline void batchSqrt(const T* operand, T* out, size_t size) {
+    batchUnary(operand, out, size, [](auto lanes, auto vec) { return decltype(lanes)::sqrt(vec); },
+        [](T value) { return ValueTraits<T>::intrinsic(Intrinsic::Sqrt, value, T()); });
+}
+
+// Element-wise out[i] = |in[i]|; a sign-bit clear in the lanes.
+template <typename T>
+inline void batchAbs(const T* operand, T* out, size_t size) {
+    batchUnary(operand, out, size, [](auto lanes, auto vec) { return decltype(lanes)::abs(vec); },
+        [](T value) { return ValueTraits<T>::intrinsic(Intrinsic::Abs, value, T()); });
+}
+
+// Element-wise out[i] = floor(in[i]).
+template <typename T>
+inline void batchFloor(const T* operand, T* out, size_t size) {
+    auto floor = [](T value) { return ValueTraits<T>::intrinsic(Intrinsic::Floor, value, T()); };
+    if constexpr (BatchLanes<T>::kHasFloor) {
+        batchUnary(operand, out, size, [](auto lanes, auto vec) { return decltype(lanes)::floor(vec); }, floor);
+    } else {
+        for (size_t j = 0; j < size; ++j) {
+            out[j] = floor(operand[j]);
+        }
+    }
+}
+
+// Applies an intrinsic over a block. exp, log and pow have no exact SIMD
+// instruction; they run as straight loops over libm, which at least removes
+// the per-row callfn() dispatch of a generic call.
+template <typename T>
+inline void batchIntrinsic(Intrinsic op, const T* lhs, const T* rhs, T* out, size_t size) {
+    switch (op) {
+        case Intrinsic::Sqrt: batchSqrt(lhs, out, size); return;
+        case Intrinsic::Abs: batchAbs(lhs, out, size); return;
+        case Intrinsic::Floor: batchFloor(lhs, out, size); return;
+        case Intrinsic::Min: batchMin(lhs, rhs, out, size); return;
+        case Intrinsic::Max: batchMax(lhs, rhs, out, size); return;
+        case Intrinsic::Exp:
+        case Intrinsic::Log:
+        case Intrinsic::Pow:
+            for (size_t j = 0; j < size; ++j) {
+                out[j] = ValueTraits<T>::intrinsic(op, lhs[j], rhs[j]);
+            }
+            return;
+        case Intrinsic::None: break;
+    }
+}
+
+//--------------------------------------------------
+// Batch evaluator
+//--------------------------------------------------
+
+// BasicBatchEvaluator — evaluates one compiled expression over column inputs
+// of value type T (Numeric.h); BatchEvaluator evaluates doubles.
+// Column j holds the values of prog.variables[j] for every row.
+// Not thread-safe: block buffers are reused across calls. Use one evaluator
+// per thread (the Program can be shared).
+template <typename T>
+struct BasicBatchEvaluator {
+    BasicBatchEvaluator(Program prog) : _program(std::move(prog)) {
+        allocate();
+    }
+
+    // Compiles and wraps an AST. Returns empty if the tree cannot be compiled.
+    static std::optional<BasicBatchEvaluator> create(const NodePtr& root) {
+        if (auto prog = Compiler::compile(root)) {
+            return BasicBatchEvaluator(std::move(prog.value()));
+        }
+        return {};
+    }
+
+    const Program& program() const {
+        return _program;
+    }
+
+    // Evaluates rows [0, rows) and writes one result per row into output.
+    // columns must hold one pointer per program variable, in slot order,
+    // each pointing at (at least) rows values.
+    void evaluate(const T* const* columns, size_t rows, T* output) {
+        if (_program.code.empty()) {
+            std::fill(output, output + rows, std::numeric_limits<T>::quiet_NaN());
+            return;
+        }
+        for (size_t start = 0; start < rows; start += kBatchBlock) {
+            size_t count = std::min(kBatchBlock, rows - start);
+            evaluateBlock(columns, start, count, output + start);
+        }
+    }
+
+    // Convenience overload for owning column vectors.
+    void evaluate(const std::vector<const T*>& columns, size_t rows, T* output) {
+        evaluate(columns.data(), rows, output);
+    }
+
+private:
+    // Where an instruction's block of results can be read from.
+    enum class Source : uint8_t { Register, Column, Broadcast };
+
+    // Assigns a block register to every computed instruction, reusing the
+    // register of any value whose last use has passed. Constants get their
+    // own broadcast buffer, filled once.
+    void allocate() {
+        const auto& code = _program.code;
+        size_t size = code.size();
+        if (size == 0) {
+            return;
+        }
+        std::vector<size_t> lastuse(size, 0);
+        auto touch = [&lastuse](uint32_t operand, size_t user) { lastuse[operand] = user; };
+        for (size_t j = 0; j < size; ++j) {
+            const Instruction& ins = code[j];
+            switch (ins.code) {
+                case OpCode::Constant:
+                case OpCode::Variable: break;
+                case OpCode::Negate: touch(ins.lhs, j); break;
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide:
+                case OpCode::Sqrt:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Pow:
+                case OpCode::Abs:
+                case OpCode::Min:
+                case OpCode::Max:
+                case OpCode::Floor:
+                    touch(ins.lhs, j);
+                    touch(ins.rhs, j);
+                    break;
+                case OpCode::Call: {
+                    const Callee& callee = _program.callees[ins.lhs];
+                    for (uint32_t k = 0; k < callee.num_args; ++k) {
+                        touch(_program.arguments[ins.rhs + k], j);
+                    }
+                    break;
+                }
+            }
+        }
+        // The root must survive to the end of the block.
+        lastuse[size - 1] = size;
+
+        _source.assign(size, Source::Register);
+        _slot.assign(size, 0);
+        std::vector<uint32_t> freelist;
+        uint32_t registers = 0;
+        std::vector<std::vector<uint32_t>> release(size + 1);
+        for (size_t j = 0; j < size; ++j) {
+            const Instruction& ins = code[j];
+            if (ins.code == OpCode::Constant) {
+                _source[j] = Source::Broadcast;
+                _slot[j] = static_cast<uint32_t>(_broadcast.size() / kBatchBlock);
+                _broadcast.resize(_broadcast.size() + kBatchBlock, ValueTraits<T>::fromDouble(_program.constants[ins.lhs]));
+                continue;
+            }
+            if (ins.code == OpCode::Variable) {
+                _source[j] = Source::Column;
+                _slot[j] = ins.lhs;
+                continue;
+            }
+            // Free registers whose values were last read by this instruction
+            // before allocating: the kernels support out aliasing an input.
+            for (uint32_t reg : release[j]) {
+                freelist.push_back(reg);
+            }
+            uint32_t reg;
+            if (!freelist.empty()) {
+                reg = freelist.back();
+                freelist.pop_back();
+            } else {
+                reg = registers++;
+            }
+            _slot[j] = reg;
+            release[lastuse[j]].push_back(reg);
+        }
+        _registers.resize(size_t(registers) * kBatchBlock);
+    }
+
+    // Returns where the block of values for instruction index can be read.
+    const T* input(uint32_t index, const T* const* columns, size_t start) const {
+        switch (_source[index]) {
+            case Source::Column: return columns[_slot[index]] + start;
+            case Source::Broadcast: return &_broadcast[size_t(_slot[index]) * kBatchBlock];
+            case Source::Register: break;
+        }
+        return &_registers[size_t(_slot[index]) * kBatchBlock];
+    }
+
+    void evaluateBlock(const T* const* columns, size_t start, size_t count, T* output) {
+        const auto& code = _program.code;
+        size_t size = code.size();
+        for (size_t j = 0; j < size; ++j) {
+            const Instruction& ins = code[j];
+            if (_source[j] != Source::Register) {
+                continue;
+            }
+            T* out = &_registers[size_t(_slot[j]) * kBatchBlock];
+            switch (ins.code) {
+                case OpCode::Constant:
+                case OpCode::Variable: break;
+                case OpCode::Negate: batchNegate(input(ins.lhs, columns, start), out, count); break;
+                case OpCode::Add:
+                    batchAdd(input(ins.lhs, columns, start), input(ins.rhs, columns, start), out, count);
+                    break;
+                case OpCode::Subtract:
+                    batchSubtract(input(ins.lhs, columns, start), input(ins.rhs, columns, start), out, count);
+                    break;
+                case OpCode::Multiply:
+                    batchMultiply(input(ins.lhs, columns, start), input(ins.rhs, columns, start), out, count);
+                    break;
+                case OpCode::Divide:
+                    batchDivide(input(ins.lhs, columns, start), input(ins.rhs, columns, start), out, count);
+                    break;
+                case OpCode::Call: {
+                    // Opaque C functions cannot be vectorized; call them per row.
+                    const Callee& callee = _program.callees[ins.lhs];
+                    std::array<const T*, MAX_FN_ARGS> inputs;
+                    for (uint32_t k = 0; k < callee.num_args; ++k) {
+                        inputs[k] = input(_program.arguments[ins.rhs + k], columns, start);
+                    }
+                    std::array<T, MAX_FN_ARGS> args;
+                    for (size_t row = 0; row < count; ++row) {
+                        for (uint32_t k = 0; k < callee.num_args; ++k) {
+                            args[k] = inputs[k][row];
+                        }
+                        out[row] = callAs<T>(callee.fnptr, args.data(), callee.num_args);
+                    }
+                    break;
+                }
+                case OpCode::Sqrt:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Pow:
+                case OpCode::Abs:
+                case OpCode::Min:
+                case OpCode::Max:
+                case OpCode::Floor:
+                    batchIntrinsic(opcodeIntrinsic(ins.code), input(ins.lhs, columns, start),
+                        input(ins.rhs, columns, start), out, count);
+                    break;
+            }
+        }
+        const T* result = input(static_cast<uint32_t>(size - 1), columns, start);
+        std::copy(result, result + count, output);
+    }
+
+    Program _program;
+    std::vector<Source> _source;    // per instruction: where its block lives
+    std::vector<uint32_t> _slot;    // per instruction: register, column or broadcast index
+    std::vector<T> _registers;      // block buffers, kBatchBlock values each
+    std::vector<T> _broadcast;      // constants replicated kBatchBlock times
+};
+
+using BatchEvaluator = BasicBatchEvaluator<double>;
+
+}  // namespace Interpreter
@@ -0,0 +1,250 @@
+// Bulk.h — Parallel evaluation of newline-separated expression files
+//
+// Input is one expression per line, optionally followed by variable
+// bindings separated by semicolons:
+//
+//   x*x + y;x=3;y=1
+//   (1+2)*4
+//
+// Variables not bound on a line evaluate to 0. Results are produced in input
+// order, one per line: the value, "error" for a line that does not parse or
+// has a malformed binding, or an empty line for a blank input line.
+//
+// BulkEvaluator splits the input into line ranges and hands fixed-size
+// chunks to worker threads through an atomic cursor. Each worker owns its own
+// Calculator, PrecedenceParser and Arena, so nothing is shared while parsing
+// or evaluating; results go to per-line slots and are written out in order
+// after all workers finish. Workers time their parse and evaluate stages
+// separately so that the cost of each can be reported.
+//
+// MappedInput (MappedInput.h) provides the text: a file is mmap'd read-only
+// (no copy), and "-" reads standard input to the end.
+
+#pragma once
+
+#include "Arena.h"
+#include "Calculator.h"
+#include "MappedInput.h"
+#include "PrecedenceParser.h"
+#include "Predicates.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// Wall-clock and per-stage timings of one BulkEvaluator::run().
+// parse and evaluate are summed over all workers (thread-seconds).
+struct BulkStats {
+    size_t lines = 0;
+    size_t errors = 0;
+    size_t threads = 0;
+    double split = 0;     // finding line boundaries (wall)
+    double process = 0;   // parsing and evaluating all lines (wall)
+    double parse = 0;     // bindings and expression parsing (all workers)
+    double evaluate = 0;  // tree evaluation (all workers)
+};
+
+// BulkEvaluator — parses and evaluates every line of an input in parallel.
+class BulkEvaluator {
+public:
+    // Lines handed to a worker at a time.
+    static constexpr size_t kDefaultChunk = 1024;
+
+    enum class Status : uint8_t { Ok, Error, Blank };
+
+    // threads == 0 uses one worker per hardware thread.
+    explicit BulkEvaluator(size_t threads = 0, size_t chunk = kDefaultChunk)
+        : _threads(threads != 0 ? threads : std::max(1U, std::thread::hardware_concurrency()))
+        , _chunk(std::max<size_t>(chunk, 1)) {
+    }
+
+    // Evaluates every line of text. The text must outlive the call only.
+    void run(std::string_view text) {
+        using Clock = std::chrono::steady_clock;
+        _stats = BulkStats{};
+        _stats.threads = _threads;
+
+        auto start = Clock::now();
+        split(text);
+        auto split_done = Clock::now();
+
+        _values.assign(_lines.size(), 0.0);
+        _status.assign(_lines.size(), Status::Ok);
+        std::atomic<size_t> cursor{ 0 };
+        std::vector<WorkerStats> workers(_threads);
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < _threads; ++t) {
+            pool.emplace_back([this, &cursor, &workers, t] { work(cursor, workers[t]); });
+        }
+        work(cursor, workers[0]);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        auto done = Clock::now();
+
+        _stats.lines = _lines.size();
+        for (const WorkerStats& worker : workers) {
+            _stats.errors += worker.errors;
+            _stats.parse += worker.parse;
+            _stats.evaluate += worker.evaluate;
+        }
+        _stats.split = std::chrono::duration<double>(split_done - start).count();
+        _stats.process = std::chrono::duration<double>(done - split_done).count();
+        _lines.clear();
+    }
+
+    // Writes one result line per input line, in input order.
+    void write(FILE* out) const {
+        char line[64];
+        for (size_t j = 0; j < _values.size(); ++j) {
+            switch (_status[j]) {
+                case Status::Ok: {
+                    int len = snprintf(line, sizeof(line), "%.17g\n", _values[j]);
+                    fwrite(line, 1, static_cast<size_t>(len), out);
+                    break;
+                }
+                case Status::Error: fputs("error\n", out); break;
+                case Status::Blank: fputc('\n', out); break;
+            }
+        }
+    }
+
+    size_t size() const {
+        return _values.size();
+    }
+    Status status(size_t line) const {
+        return _status[line];
+    }
+    double value(size_t line) const {
+        return _values[line];
+    }
+    const BulkStats& stats() const {
+        return _stats;
+    }
+
+private:
+    struct WorkerStats {
+        size_t errors = 0;
+        double parse = 0;
+        double evaluate = 0;
+    };
+
+    void split(std::string_view text) {
+        _lines.clear();
+        while (!text.empty()) {
+            size_t end = text.find('\n');
+            std::string_view line = text.substr(0, end);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            _lines.push_back(line);
+            if (end == std::string_view::npos) {
+                break;
+            }
+            text.remove_prefix(end + 1);
+        }
+    }
+
+    // Claims chunks of lines until none are left.
+    void work(std::atomic<size_t>& cursor, WorkerStats& stats) {
+        using Clock = std::chrono::steady_clock;
+        Calculator calc;
+        PrecedenceParser parser(calc);
+        Arena arena;
+        std::vector<Variable*> bound;
+        for (;;) {
+            size_t first = cursor.fetch_add(_chunk, std::memory_order_relaxed);
+            if (first >= _lines.size()) {
+                break;
+            }
+            size_t last = std::min(first + _chunk, _lines.size());
+            for (size_t j = first; j < last; ++j) {
+                auto start = Clock::now();
+                NodePtr ast = parseLine(calc, parser, arena, _lines[j], bound, _status[j]);
+                auto parsed = Clock::now();
+                if (ast) {
+                    _values[j] = ast->calc();
+                    ast.reset();  // before the arena is reset
+                } else if (_status[j] == Status::Error) {
+                    ++stats.errors;
+                }
+                auto evaluated = Clock::now();
+                for (Variable* var : bound) {
+                    var->value = 0;
+                }
+                bound.clear();
+                arena.reset();
+                stats.parse += std::chrono::duration<double>(parsed - start).count();
+                stats.evaluate += std::chrono::duration<double>(evaluated - parsed).count();
+            }
+        }
+    }
+
+    // Parses "expression[;name=value]*". Returns null and sets status on a
+    // blank or malformed line. Bound variables are appended to bound.
+    static NodePtr parseLine(Calculator& calc, PrecedenceParser& parser, Arena& arena, std::string_view line,
+        std::vector<Variable*>& bound, Status& status) {
+        size_t semi = line.find(';');
+        std::string_view expr = line.substr(0, semi);
+        if (expr.find_first_not_of(" \t") == std::string_view::npos && semi == std::string_view::npos) {
+            status = Status::Blank;
+            return {};
+        }
+        status = Status::Error;
+        while (semi != std::string_view::npos) {
+            line.remove_prefix(semi + 1);
+            semi = line.find(';');
+            if (!bind(calc, line.substr(0, semi), bound)) {
+                return {};
+            }
+        }
+        NodePtr ast = parser.parseAll(expr, arena);
+        if (!ast) {
+            return {};
+        }
+        status = Status::Ok;
+        return ast;
+    }
+
+    // Applies one "name=value" binding.
+    static bool bind(Calculator& calc, std::string_view binding, std::vector<Variable*>& bound) {
+        calc.reset(binding);
+        calc.skipws();
+        auto name = calc.skip(isidentifier());
+        calc.skipws();
+        if (!name || !calc.test(ischar('='))) {
+            return false;
+        }
+        calc.skipws();
+        auto value = calc.parsedouble();
+        calc.skipws();
+        if (!value || calc.it != calc.code.end()) {
+            return false;
+        }
+        Pointer<Variable> var = calc.internVariable(name.value());
+        var->value = value.value();
+        bound.push_back(var.get());
+        return true;
+    }
+
+    size_t _threads;
+    size_t _chunk;
+    std::vector<std::string_view> _lines;
+    std::vector<double> _values;
+    std::vector<Status> _status;
+    BulkStats _stats;
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,379 @@
+// Bytecode.h — Linear bytecode compiler and interpreter for expression trees
+//
+// Lowers an AST produced by Calculator::parse() into a flat array of
+// three-address instructions and evaluates it with a single switch loop.
+// Every instruction produces exactly one value, stored at the same index in a
+// scratch array, so operands are plain indices into earlier results:
+//
+//   (x + 2) * x   →   0: Variable  slot 0
+//                     1: Constant  #0 (2.0)
+//                     2: Add       v0, v1
+//                     3: Multiply  v2, v0
+//
+// Compared to the tree walk this removes one virtual call and one pointer
+// chase per node, keeps all the code in one contiguous vector, and lets
+// shared nodes (interned variables, DAGs) be evaluated only once.
+//
+// Variables are bound by slot: the program records which Variable node each
+// slot came from, so calc() reads the current values from the AST, while
+// run() takes an explicit slot array and never touches the tree.
+//
+// Several trees can also be compiled into one program, with one output index
+// per tree; the root is then no longer the last instruction (Formulas.h).
+//
+// The interpreter is a template over the value type (Numeric.h): a Program
+// is compiled from doubles and runs as-is in double, or wrapped in a
+// TypedProgram<T> that holds its constants converted to float or Fixed.
+
+#pragma once
+
+#include "FunctionOps.h"
+#include "Intrinsics.h"
+#include "Node.h"
+#include "Numeric.h"
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// Instruction opcodes. Operand meaning depends on the opcode:
+//   Constant  lhs = index into the constant pool
+//   Variable  lhs = variable slot
+//   Negate    lhs = operand value
+//   Add..Divide lhs, rhs = operand values
+//   Call      lhs = index into the callee table,
+//             rhs = offset of the first argument in the argument list
+//   Sqrt..Floor  built-in functions (Intrinsics.h), in Intrinsic order;
+//             lhs, rhs = operand values (rhs == lhs for one-argument ones)
+enum class OpCode : uint8_t {
+    Constant, Variable, Negate, Add, Subtract, Multiply, Divide, Call,
+    Sqrt, Exp, Log, Pow, Abs, Min, Max, Floor
+};
+
+// Maps between intrinsic opcodes and Intrinsic tags, which share an order.
+constexpr OpCode intrinsicOpCode(Intrinsic op) {
+    return static_cast<OpCode>(static_cast<uint8_t>(OpCode::Sqrt) + static_cast<uint8_t>(op)
+        - static_cast<uint8_t>(Intrinsic::Sqrt));
+}
+constexpr Intrinsic opcodeIntrinsic(OpCode code) {
+    return static_cast<Intrinsic>(static_cast<uint8_t>(code) - static_cast<uint8_t>(OpCode::Sqrt)
+        + static_cast<uint8_t>(Intrinsic::Sqrt));
+}
+constexpr bool isIntrinsic(OpCode code) {
+    return code >= OpCode::Sqrt;
+}
+static_assert(intrinsicOpCode(Intrinsic::Floor) == OpCode::Floor, "OpCode and Intrinsic order differ");
+static_assert(opcodeIntrinsic(OpCode::Pow) == Intrinsic::Pow, "OpCode and Intrinsic order differ");
+
+// Instruction — one three-address operation. Its result is stored at the
+// instruction's own index in the value array.
+struct Instruction {
+    OpCode code;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+// Callee — a function referenced by a Call instruction.
+struct Callee {
+    FnPtr fnptr;
+    uint32_t num_args;
+};
+
+// BasicProgramView — non-owning view of a compiled program, the minimal state
+// the interpreter loop needs, with constants in the value type T
+// (Numeric.h). Kept separate from Program so that code and constants can
+// live in any contiguous storage.
+template <typename T>
+struct BasicProgramView {
+    const Instruction* code;
+    size_t size;
+    const T* constants;
+    const Callee* callees;
+    const uint32_t* arguments;
+};
+
+using ProgramView = BasicProgramView<double>;
+
+// Number of values that fit in the on-stack scratch buffer.
+static constexpr size_t kInlineValues = 1024;
+
+// Number of values that fit in the scratch buffer of small programs.
+static constexpr size_t kSmallValues = 16;
+
+// Runs run(values) with scratch storage for size values of type T, where
+// size exceeds kSmallValues: on the stack up to kInlineValues, otherwise on
+// the heap. Kept out of line so that the large frame is only set up when it
+// is needed.
+template <typename T, typename Run>
+__attribute__((noinline)) T withLargeScratch(size_t size, const Run& run) {
+    if (size <= kInlineValues) {
+        std::array<T, kInlineValues> local;
+        return run(local.data());
+    }
+    std::vector<T> heap(size);
+    return run(heap.data());
+}
+
+// Runs run(values) with scratch storage for size values of type T, sized
+// to the program: small programs get a small array on the caller's stack,
+// so a short evaluation costs no more stack than it uses.
+template <typename T, typename Run>
+inline T withScratch(size_t size, const Run& run) {
+    if (size <= kSmallValues) {
+        std::array<T, kSmallValues> local;
+        return run(local.data());
+    }
+    return withLargeScratch<T>(size, run);
+}
+
+// Computes the result of one instruction from the slots and the results of
+// earlier instructions.
+template <typename T>
+inline T evaluate(const BasicProgramView<T>& prog, const Instruction& ins, const T* slots, const T* values) {
+    using Traits = ValueTraits<T>;
+    switch (ins.code) {
+        case OpCode::Constant: return prog.constants[ins.lhs];
+        case OpCode::Variable: return slots[ins.lhs];
+        case OpCode::Negate: return -values[ins.lhs];
+        case OpCode::Add: return values[ins.lhs] + values[ins.rhs];
+        case OpCode::Subtract: return values[ins.lhs] - values[ins.rhs];
+        case OpCode::Multiply: return values[ins.lhs] * values[ins.rhs];
+        case OpCode::Divide: return values[ins.lhs] / values[ins.rhs];
+        case OpCode::Call: {
+            const Callee& callee = prog.callees[ins.lhs];
+            const uint32_t* argidx = prog.arguments + ins.rhs;
+            std::array<T, MAX_FN_ARGS> args;
+            for (uint32_t k = 0; k < callee.num_args; ++k) {
+                args[k] = values[argidx[k]];
+            }
+            return callAs<T>(callee.fnptr, args.data(), callee.num_args);
+        }
+        case OpCode::Sqrt: return Traits::intrinsic(Intrinsic::Sqrt, values[ins.lhs], T());
+        case OpCode::Exp: return Traits::intrinsic(Intrinsic::Exp, values[ins.lhs], T());
+        case OpCode::Log: return Traits::intrinsic(Intrinsic::Log, values[ins.lhs], T());
+        case OpCode::Pow: return Traits::intrinsic(Intrinsic::Pow, values[ins.lhs], values[ins.rhs]);
+        case OpCode::Abs: return Traits::intrinsic(Intrinsic::Abs, values[ins.lhs], T());
+        case OpCode::Min: return Traits::intrinsic(Intrinsic::Min, values[ins.lhs], values[ins.rhs]);
+        case OpCode::Max: return Traits::intrinsic(Intrinsic::Max, values[ins.lhs], values[ins.rhs]);
+        case OpCode::Floor: return Traits::intrinsic(Intrinsic::Floor, values[ins.lhs], T());
+    }
+    return T();
+}
+
+// Runs the program over the given variable slots, writing each instruction's
+// result into values[]. Returns the value of the last instruction, which is
+// the root of the expression. An empty program evaluates to NaN (to T() for
+// a value type without NaN).
+template <typename T>
+inline T execute(const BasicProgramView<T>& prog, const T* slots, T* values) {
+    for (size_t j = 0; j < prog.size; ++j) {
+        values[j] = evaluate(prog, prog.code[j], slots, values);
+    }
+    return prog.size > 0 ? values[prog.size - 1] : std::numeric_limits<T>::quiet_NaN();
+}
+
+// Program — an owning, compiled expression.
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<double> constants;
+    std::vector<Callee> callees;
+    std::vector<uint32_t> arguments;  // flattened argument value indices for Call
+
+    // Variable bound to each slot, in slot order.
+    std::vector<Pointer<Variable>> variables;
+
+    ProgramView view() const {
+        return ProgramView{ code.data(), code.size(), constants.data(), callees.data(), arguments.data() };
+    }
+
+    // Evaluates with explicit slot values (one per entry in variables).
+    // Does not read or modify the AST, so it is safe to call concurrently.
+    double run(const double* slots) const {
+        return withScratch<double>(code.size(), [&](double* values) {
+            return execute(view(), slots, values);
+        });
+    }
+
+    // Evaluates with the values currently assigned to the bound Variable nodes,
+    // matching what calc() on the source tree would return.
+    // Slots and values share one scratch buffer.
+    double calc() const {
+        return withScratch<double>(variables.size() + code.size(), [&](double* slots) {
+            for (size_t j = 0; j < variables.size(); ++j) {
+                slots[j] = variables[j]->value;
+            }
+            return execute(view(), slots, slots + variables.size());
+        });
+    }
+};
+
+// TypedProgram — a Program evaluated in the value type T (Numeric.h). The
+// constants are converted once, when the program is wrapped.
+template <typename T>
+struct TypedProgram {
+    explicit TypedProgram(Program prog) : program(std::move(prog)) {
+        constants.reserve(program.constants.size());
+        for (double value : program.constants) {
+            constants.push_back(ValueTraits<T>::fromDouble(value));
+        }
+    }
+
+    BasicProgramView<T> view() const {
+        return BasicProgramView<T>{ program.code.data(), program.code.size(), constants.data(),
+            program.callees.data(), program.arguments.data() };
+    }
+
+    // Evaluates with explicit slot values (one per entry in
+    // program.variables). Safe to call concurrently.
+    T run(const T* slots) const {
+        return withScratch<T>(program.code.size(), [&](T* values) {
+            return execute(view(), slots, values);
+        });
+    }
+
+    Program program;
+    std::vector<T> constants;
+};
+
+// Compiler — Visitor that lowers an AST into a Program in post-order.
+// Each visited node leaves the index of its result in _index. Nodes are
+// memoized by address, so a subtree reachable through several parents
+// (interned variables, shared subexpressions) is emitted only once.
+struct Compiler : public Visitor {
+
+    // Compiles the tree rooted at node. Returns empty if the tree contains
+    // a node type the bytecode cannot express, such as a stateful window
+    // aggregate (WindowCall), which only the tree walk evaluates.
+    static std::optional<Program> compile(const NodePtr& root) {
+        if (!root) {
+            return {};
+        }
+        Compiler compiler;
+        compiler.visit(root.get());
+        if (compiler._failed) {
+            return {};
+        }
+        return std::move(compiler._program);
+    }
+
+    // Compiles several trees into one program, appending the value index of
+    // each root to outputs. A node reachable from several roots is emitted
+    // once. Returns empty, and leaves outputs unchanged, if any root is null
+    // or cannot be compiled.
+    static std::optional<Program> compile(const std::vector<NodePtr>& roots, std::vector<uint32_t>& outputs) {
+        Compiler compiler;
+        std::vector<uint32_t> indexes;
+        indexes.reserve(roots.size());
+        for (const NodePtr& root : roots) {
+            if (!root) {
+                return {};
+            }
+            indexes.push_back(compiler.emit(root.get()));
+        }
+        if (compiler._failed) {
+            return {};
+        }
+        outputs.insert(outputs.end(), indexes.begin(), indexes.end());
+        return std::move(compiler._program);
+    }
+
+    void visit(Node* node) override {
+        auto iter = _emitted.find(node);
+        if (iter != _emitted.end()) {
+            _index = iter->second;
+            return;
+        }
+        _index = lower(node);
+        _emitted.emplace(node, _index);
+    }
+
+private:
+    // Visits a child node and returns the index of its result.
+    uint32_t emit(Node* node) {
+        visit(node);
+        return _index;
+    }
+
+    uint32_t push(OpCode code, uint32_t lhs, uint32_t rhs = 0) {
+        _program.code.push_back(Instruction{ code, lhs, rhs });
+        return static_cast<uint32_t>(_program.code.size() - 1);
+    }
+
+    // Emits the instructions for one node, after its children.
+    uint32_t lower(Node* node) {
+        if (auto* cst = nodeCast<Constant>(node)) {
+            _program.constants.push_back(cst->value);
+            return push(OpCode::Constant, static_cast<uint32_t>(_program.constants.size() - 1));
+        }
+        if (auto* var = nodeCast<Variable>(node)) {
+            _program.variables.emplace_back(var);
+            return push(OpCode::Variable, static_cast<uint32_t>(_program.variables.size() - 1));
+        }
+        if (auto* paren = nodeCast<Parenthesis>(node)) {
+            // Grouping is already encoded in the tree shape; no instruction needed.
+            return emit(paren->node.get());
+        }
+        if (auto* shared = nodeCast<Shared>(node)) {
+            // Sharing is already handled by memoizing on node address.
+            return emit(shared->node.get());
+        }
+        if (auto* root = nodeCast<DagRoot>(node)) {
+            return emit(root->node.get());
+        }
+        if (auto* uop = nodeCast<UnaryOp>(node)) {
+            uint32_t operand = emit(uop->node.get());
+            if (uop->op == UnaryOp::Operation::Negative) {
+                return push(OpCode::Negate, operand);
+            }
+            return operand;
+        }
+        if (auto* binop = nodeCast<BinaryOp>(node)) {
+            uint32_t lhs = emit(binop->left.get());
+            uint32_t rhs = emit(binop->right.get());
+            switch (binop->op) {
+                case BinaryOp::Operation::Addition: return push(OpCode::Add, lhs, rhs);
+                case BinaryOp::Operation::Subtraction: return push(OpCode::Subtract, lhs, rhs);
+                case BinaryOp::Operation::Multiplication: return push(OpCode::Multiply, lhs, rhs);
+                case BinaryOp::Operation::Division: return push(OpCode::Divide, lhs, rhs);
+                case BinaryOp::Operation::NA: break;
+            }
+            // BinaryOp::calc() returns 0 for NA; keep the same semantics.
+            _program.constants.push_back(0.0);
+            return push(OpCode::Constant, static_cast<uint32_t>(_program.constants.size() - 1));
+        }
+        if (auto* call = nodeCast<FunctionCall>(node); call != nullptr && call->intrinsic != Intrinsic::None) {
+            uint32_t lhs = emit(call->argument(0).get());
+            uint32_t rhs = call->arity() > 1 ? emit(call->argument(1).get()) : lhs;
+            return push(intrinsicOpCode(call->intrinsic), lhs, rhs);
+        }
+        if (auto* call = nodeCast<FunctionCall>(node)) {
+            std::array<uint32_t, MAX_FN_ARGS> args;
+            size_t arity = call->arity();
+            for (size_t j = 0; j < arity; ++j) {
+                args[j] = emit(call->argument(j).get());
+            }
+            auto offset = static_cast<uint32_t>(_program.arguments.size());
+            _program.arguments.insert(_program.arguments.end(), args.begin(), args.begin() + arity);
+            _program.callees.push_back(Callee{ call->fnptr, static_cast<uint32_t>(arity) });
+            return push(OpCode::Call, static_cast<uint32_t>(_program.callees.size() - 1), offset);
+        }
+        _failed = true;
+        return 0;
+    }
+
+    Program _program;
+    std::unordered_map<Node*, uint32_t> _emitted;
+    uint32_t _index = 0;
+    bool _failed = false;
+};
+
+}  // namespace Interpreter
@@ -10,43 +10,60 @@
 //   parenthesis = '(' expression ')'
 //   variable    = identifier
 //   function    = identifier '(' expression (',' expression)* ')'
-//   dbl64       = [+-]? digits ['.' digits]?
+//   dbl64       = [+-]? digits ['.' digits]? ([eE] [+-]? digits)?
 //
 // Operator precedence is handled post-parse by adjustPrecedence(), which
 // rotates the tree so that higher-precedence operators end up deeper,
 // ensuring correct evaluation order without an explicit precedence-climbing
 // or Pratt parser.
 //
+// Nodes are heap-allocated by default. parse(code, arena) and parseArena()
+// place every node of the result except the interned variables in an Arena
+// (Arena.h), turning dozens of malloc/free pairs per parse into bump
+// allocations that are released together.
+//
+// Identifiers are looked up in SymbolMaps (Symbols.h), which hash the parsed
+// string_view directly, so parsing a known variable or function name does not
+// allocate. Built-in function names are resolved by findIntrinsic()'s perfect
+// hash before the general table is probed.
+//
 // Note: function() is defined but not yet wired into primitive(), so
 // function calls like log(10) are currently parsed as variable references.
 
 #pragma once
 
+#include "Arena.h"
 #include "FunctionOps.h"
+#include "Intrinsics.h"
 #include "Lexer.h"
 #include "Pointer.h"
 #include "Predicates.h"
+#include "Profiler.h"
+#include "Symbols.h"
 #include "TreeNodes.h"
 
 #include <array>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace Interpreter {
 
 // Factory function type: creates a FunctionCallWithArgs<N> for a given
-// function pointer and argument list.
-using FnCallFactory = Pointer<FunctionCall>(*)(FnPtr, const std::vector<NodePtr>&);
+// function pointer and argument list, in the arena if one is given.
+using FnCallFactory = Pointer<FunctionCall>(*)(Arena*, FnPtr, const std::vector<NodePtr>&);
 
 // Factory function template: creates FunctionCallWithArgs<N>.
 template <std::size_t N>
-Pointer<FunctionCall> makeFunctionCall(FnPtr func, const std::vector<NodePtr>& args) {
+Pointer<FunctionCall> makeFunctionCall(Arena* arena, FnPtr func, const std::vector<NodePtr>& args) {
+    if (arena != nullptr) {
+        return arena->make<FunctionCallWithArgs<N>>(func, args);
+    }
     return Pointer<FunctionCall>(new FunctionCallWithArgs<N>(func, args));
 }
 
@@ -60,14 +77,57 @@ make_factory_table(std::index_sequence<I...> /*indices*/) {
 static constexpr auto fn_call_factory_table =
     make_factory_table(std::make_index_sequence<MAX_FN_ARGS + 1>{});
 
+// Creates a call node: an IntrinsicCall for a built-in function, otherwise
+// the FunctionCallWithArgs<N> matching the number of arguments.
+inline Pointer<FunctionCall> makeCall(Arena* arena, FnPtr func, Intrinsic op, const std::vector<NodePtr>& args) {
+    if (op != Intrinsic::None) {
+        if (arena != nullptr) {
+            return arena->make<IntrinsicCall>(op, args);
+        }
+        return Pointer<FunctionCall>(new IntrinsicCall(op, args));
+    }
+    return fn_call_factory_table[args.size()](arena, func, args);
+}
+
 // Calculator — the full expression parser.
 // Inherits Lexer's scanning primitives and adds grammar-level productions.
 struct Calculator : public Lexer {
 
+    // Arena receiving new nodes during the current parse, or null for the heap.
+    Arena* _arena = nullptr;
+
+    // Points _arena at an arena for its lifetime and restores the previous
+    // one on destruction, also when the parse throws (e.g. std::bad_alloc).
+    struct ArenaSaver {
+        ArenaSaver(Calculator& calc, Arena& arena) : _calc(calc), _previous(std::exchange(calc._arena, &arena)) {
+        }
+        ~ArenaSaver() {
+            _calc._arena = _previous;
+        }
+        ArenaSaver(const ArenaSaver&) = delete;
+        ArenaSaver& operator=(const ArenaSaver&) = delete;
+        Calculator& _calc;
+        Arena* _previous;
+    };
+
+    // Map receiving the source span of each operator, call and parenthesis
+    // PrecedenceParser creates, or null (Profiler.h). Ignored unless
+    // profiling is compiled in.
+    SourceSpans* _spans = nullptr;
+
+    // Allocates a parser-produced node in the current arena or on the heap.
+    template <typename T, typename... Args>
+    Pointer<T> make(Args&&... args) {
+        if (_arena != nullptr) {
+            return _arena->make<T>(std::forward<Args>(args)...);
+        }
+        return Pointer<T>(new T(std::forward<Args>(args)...));
+    }
+
     // Parses a floating-point literal and wraps it in a Constant node.
     NodePtr dbl64() {
         if (auto dbl = parsedouble()) {
-            return NodePtr(new Constant(dbl.value()));
+            return make<Constant>(dbl.value());
         }
         return NodePtr();
     }
@@ -81,7 +141,7 @@ struct Calculator : public Lexer {
             if (auto expr = expression()) {
                 if (test(ischar(')'))) {
                     saver.commit();
-                    return NodePtr(new Parenthesis(expr));
+                    return make<Parenthesis>(expr);
                 }
             }
         }
@@ -108,14 +168,14 @@ struct Calculator : public Lexer {
     //   After:   (lhs OP rhs_left) RHSOP rhs_right   [correct: OP binds tighter]
     //
     // Otherwise, we simply create: (lhs OP rhs).
-    static void adjustPrecedence(NodePtr& lhs, NodePtr& rhs, BinaryOp::Operation oper) {
+    void adjustPrecedence(NodePtr& lhs, NodePtr& rhs, BinaryOp::Operation oper) {
         auto binop = rhs.as<BinaryOp>();
         if (binop && (BinaryOp::precedence(binop->op) < BinaryOp::precedence(oper))) {
             // Steal rhs's left child as our right operand, push ourselves down.
-            binop->left.reset(new BinaryOp(oper, lhs, binop->left));
+            binop->left = make<BinaryOp>(oper, lhs, binop->left);
             lhs = rhs;
         } else {
-            lhs.reset(new BinaryOp(oper, lhs, rhs));
+            lhs = make<BinaryOp>(oper, lhs, rhs);
         }
     }
 
@@ -140,21 +200,27 @@ struct Calculator : public Lexer {
 
     // Parses a variable name (identifier) and interns it in the variable map.
     // Repeated references to the same name return the same Variable node,
-    // so assigning a value to "x" is visible to all occurrences.
+    // so assigning a value to "x" is visible to all occurrences. Variables
+    // outlive any single parse, so they always live on the heap.
     NodePtr variable() {
         StackSaver saver(this);
         if (auto name = skip(isidentifier())) {
-            // Look up or create the Variable in the interning map.
-            Pointer<Variable>& var(_variable_map[std::string(name.value())]);
-            if (!var) {
-                var = new Variable(name.value());
-            }
             saver.commit();
-            return var;
+            return internVariable(name.value());
         }
         return {};
     }
 
+    // Looks up or creates the Variable for name in the interning map.
+    // Allocates only the first time a name is seen.
+    Pointer<Variable> internVariable(std::string_view name) {
+        Pointer<Variable>& var(_variable_map[name]);
+        if (!var) {
+            var = new Variable(name);
+        }
+        return var;
+    }
+
     // Creates the correct FunctionCallWithArgs<N> node for a given function
     // name and argument list. Returns null if the function is unknown or if
     // the argument count doesn't match the function's declared arity.
@@ -163,12 +229,38 @@ struct Calculator : public Lexer {
                                              const std::vector<NodePtr>& args) {
         if (auto func = findFunction(name)) {
             if (args.size() == func->num_args && func->num_args <= MAX_FN_ARGS) {
-                return fn_call_factory_table[func->num_args](func->fnptr, args);
+                return makeCall(_arena, func->fnptr, func->intrinsic, args);
             }
         }
         return {};
     }
 
+    // Creates the WindowCall for a window aggregate such as msum(x, 100)
+    // (Window.h). Returns null unless name is a window aggregate that no
+    // registered function shadows, called with an argument and a length that
+    // is an integer constant from 1 to kMaxWindowLength.
+    Pointer<WindowCall> createWindowCall(std::string_view name, const std::vector<NodePtr>& args) {
+        WindowOp op = findWindow(name);
+        if (op == WindowOp::None || args.size() != 2 || findFunction(name) != nullptr) {
+            return {};
+        }
+        auto* length = nodeCast<Constant>(args[1].get());
+        if (length == nullptr || !(length->value >= 1 && length->value <= static_cast<double>(kMaxWindowLength))
+            || length->value != std::floor(length->value)) {
+            return {};
+        }
+        return make<WindowCall>(op, static_cast<size_t>(length->value), args[0]);
+    }
+
+    // Creates the node for a call written in a formula: a window aggregate
+    // or, failing that, a function call. Returns null if neither applies.
+    NodePtr createCall(std::string_view name, const std::vector<NodePtr>& args) {
+        if (auto window = createWindowCall(name, args)) {
+            return window;
+        }
+        return createFunctionCall(name, args);
+    }
+
     // Parses a function call: identifier '(' expression (',' expression)* ')'.
     // Collects arguments into a vector, then delegates to createFunctionCall().
     // Note: not yet called from primitive(), so this production is unreachable.
@@ -199,30 +291,66 @@ struct Calculator : public Lexer {
     }
 
     // Looks up a function by name in the function map.
-    // Returns a copy of the Function descriptor, or empty if not found.
-    std::optional<Function> findFunction(std::string_view name) {
-        auto iter = _function_map.find(std::string(name));
-        if (iter != _function_map.end()) {
-            return iter->second;
+    // Returns the Function descriptor, or null if not found. The built-ins
+    // are interned first, in Intrinsic order, so a built-in name resolves to
+    // its symbol ID without probing the hash table (the entry may since have
+    // been replaced by a user function, which is what gets returned).
+    const Function* findFunction(std::string_view name) const {
+        Intrinsic op = findIntrinsic(name);
+        if (op != Intrinsic::None) {
+            auto symbol = static_cast<uint32_t>(op) - 1;
+            if (symbol < _function_map.size() && _function_map.name(symbol) == name) {
+                return &_function_map.at(symbol);
+            }
         }
-        return {};
+        return _function_map.find(name);
     }
 
     // Symbol table for variables. Shared references ensure that assigning
     // to a variable is visible wherever that variable appears in the AST.
-    using VariableMap = std::unordered_map<std::string, Pointer<Variable>>;
+    using VariableMap = SymbolMap<Pointer<Variable>>;
     VariableMap _variable_map;
 
-    // Registry of callable functions. Pre-populated with log() as an example.
-    // To add more functions: insert Function{name, arity, reinterpret_cast<FnPtr>(&fn)}.
-    using FunctionMap = std::unordered_map<std::string, Function>;
-    FunctionMap _function_map = {{"log", Function{"log", 1, reinterpret_cast<FnPtr>(&::log)}}};
+    // Registry of callable functions. Pre-populated with the built-in math
+    // functions (Intrinsics.h): sqrt, exp, log, pow, abs, min, max, floor.
+    // To add more functions: _function_map[name] = Function{name, arity, toFnPtr(&fn)}.
+    using FunctionMap = SymbolMap<Function>;
+    FunctionMap _function_map = builtinFunctions();
+
+    // Function map entries for every intrinsic, with symbol IDs in
+    // Intrinsic order (see findFunction()).
+    static FunctionMap builtinFunctions() {
+        FunctionMap map;
+        for (const IntrinsicInfo& info : intrinsicTable()) {
+            map[info.name] = Function{ info.name, intrinsicArity(info.op), info.fnptr, info.op };
+        }
+        return map;
+    }
 
     // Entry point: resets the lexer to the given input and parses a full expression.
     NodePtr parse(std::string_view code) {
         reset(code);
         return expression();
     };
+
+    // Parses into a caller-provided arena. The arena must outlive the
+    // returned tree; resetting it between parses makes the loop malloc-free.
+    NodePtr parse(std::string_view code, Arena& arena) {
+        ArenaSaver saver(*this, arena);
+        return parse(code);
+    }
+
+    // Parses into a fresh arena owned by the result. The first block is sized
+    // from the input length so typical expressions fit in one allocation.
+    ArenaExpression parseArena(std::string_view code) {
+        ArenaExpression result(kArenaBytesPerChar * (code.size() + 1));
+        result.root = parse(code, result.arena);
+        return result;
+    }
+
+    // Arena block bytes reserved per input character by parseArena(): about
+    // one BinaryOp and one Constant for every two characters.
+    static constexpr size_t kArenaBytesPerChar = 64;
 };
 
 }  // namespace Interpreter
@@ -0,0 +1,151 @@
+// Context.h — Thread-safe evaluation through per-call variable frames
+//
+// A parsed AST cannot be evaluated from several threads at once: variable
+// values live inside the shared Variable nodes and RefCounted counters are
+// not atomic. This header splits an expression into two parts:
+//
+//   SharedExpression  the immutable compiled program plus the variable names,
+//                     built once and reference counted atomically, so one
+//                     Pointer<SharedExpression> can be handed to every thread.
+//   EvalContext       a frame owned by one thread: the value of each variable
+//                     slot and the scratch array the interpreter writes to.
+//
+//   auto expr = SharedExpression::compile(calc.parse("x*x + y"));
+//   // on each worker:
+//   EvalContext ctx(expr);
+//   ctx.set("x", 2.0);
+//   ctx.set("y", 1.0);
+//   double result = ctx.evaluate();
+//
+// A SharedExpression keeps no reference to the AST it was compiled from, so
+// the source tree (and the Calculator that interned its variables) may be
+// destroyed or reused while workers are still evaluating.
+
+#pragma once
+
+#include "Batch.h"
+#include "Bytecode.h"
+#include "Node.h"
+#include "Pointer.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// SharedExpression — immutable, thread-shareable compiled expression.
+class SharedExpression : public AtomicRefCounted {
+public:
+    // Compiles root. Returns null if the tree cannot be compiled.
+    static Pointer<SharedExpression> compile(const NodePtr& root) {
+        std::optional<Program> prog = Compiler::compile(root);
+        if (!prog) {
+            return {};
+        }
+        return Pointer<SharedExpression>(new SharedExpression(std::move(*prog)));
+    }
+
+    // Number of variable slots a frame must provide.
+    size_t slots() const {
+        return _names.size();
+    }
+
+    // Number of scratch values written by one evaluation.
+    size_t values() const {
+        return _program.code.size();
+    }
+
+    // Name of the variable bound to each slot, in slot order.
+    const std::vector<std::string>& names() const {
+        return _names;
+    }
+
+    // Returns the slot of the named variable, or empty if the expression
+    // does not reference it.
+    std::optional<size_t> slot(std::string_view name) const {
+        for (size_t j = 0; j < _names.size(); ++j) {
+            if (_names[j] == name) {
+                return j;
+            }
+        }
+        return {};
+    }
+
+    // Evaluates with caller-owned storage: slots[slots()] and values[values()].
+    // Reads only immutable state, so any number of threads may call it.
+    double evaluate(const double* slots, double* values) const {
+        return execute(_program.view(), slots, values);
+    }
+
+    // A column-at-a-time evaluator of this expression, for one thread.
+    // Its columns are in slot order.
+    BatchEvaluator batch() const {
+        return BatchEvaluator(_program);
+    }
+
+private:
+    explicit SharedExpression(Program prog) : _program(std::move(prog)) {
+        // Record the names and drop the Variable nodes: their non-atomic
+        // counters must not be touched when the last worker releases us.
+        // Without them Program::calc() would read no variables, so the
+        // program is only ever run with explicit slots and never handed out.
+        _names.reserve(_program.variables.size());
+        for (const auto& var : _program.variables) {
+            _names.push_back(var->name);
+        }
+        _program.variables.clear();
+    }
+
+    Program _program;
+    std::vector<std::string> _names;
+};
+
+// EvalContext — one thread's variable bindings for a SharedExpression.
+// Slots start at 0.0, matching a freshly interned Variable. A context is not
+// itself thread-safe; create one per thread (they are cheap to copy).
+class EvalContext {
+public:
+    explicit EvalContext(Pointer<SharedExpression> expr)
+        : _expr(std::move(expr)), _slots(_expr->slots(), 0.0), _values(_expr->values()) {
+    }
+
+    // Binds a variable by name. Returns false if the expression does not
+    // reference it (the value is then ignored).
+    bool set(std::string_view name, double value) {
+        if (auto slot = _expr->slot(name)) {
+            _slots[*slot] = value;
+            return true;
+        }
+        return false;
+    }
+
+    // Binds a variable by slot, as returned by SharedExpression::slot().
+    void set(size_t slot, double value) {
+        _slots[slot] = value;
+    }
+
+    double get(size_t slot) const {
+        return _slots[slot];
+    }
+
+    // Evaluates the expression with the current bindings.
+    // Performs no allocation: the scratch array is owned by the context.
+    double evaluate() {
+        return _expr->evaluate(_slots.data(), _values.data());
+    }
+
+    const Pointer<SharedExpression>& expression() const {
+        return _expr;
+    }
+
+private:
+    Pointer<SharedExpression> _expr;
+    std::vector<double> _slots;
+    std::vector<double> _values;
+};
+
+}  // namespace Interpreter
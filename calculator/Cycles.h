@@ -0,0 +1,40 @@
+// Cycles.h — High-resolution timestamps for benchmarks and profiling
+//
+// now() reads the x86 time-stamp counter (RDTSC), which costs a few tens of
+// cycles and does not enter the kernel; time_unit names its unit for
+// reports. On other architectures it falls back to std::chrono::steady_clock
+// in nanoseconds.
+//
+// RDTSC is not serializing, so very short intervals can be reordered with
+// the surrounding code by a few cycles; average over many evaluations.
+
+#pragma once
+
+#include <cstdint>
+
+// Platform-specific high-resolution timer selection.
+// On x86/x64: use RDTSC for cycle-accurate measurement.
+// On other architectures: fall back to std::chrono nanoseconds.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAS_RDTSC 1
+#endif
+
+#ifndef HAS_RDTSC
+#include <chrono>
+#endif
+
+namespace Interpreter {
+
+#ifdef HAS_RDTSC
+inline uint64_t now() {
+    return __builtin_ia32_rdtsc();
+}
+static constexpr const char* time_unit = "cycles";
+#else
+inline uint64_t now() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+static constexpr const char* time_unit = "ns";
+#endif
+
+}  // namespace Interpreter
@@ -0,0 +1,107 @@
+// Formulas.h — Many expressions evaluated as one program
+//
+// Related formulas over the same variables often repeat large sub-terms:
+//
+//   margin  = (price - cost) * volume
+//   tax     = (price - cost) * volume * rate
+//   net     = (price - cost) * volume * (1 - rate)
+//
+// Evaluating each tree with calc() computes "(price - cost) * volume" three
+// times. FormulaSet parses nothing itself; given trees from one Calculator
+// (so that their variables are the same interned nodes) it
+//
+//   1. hash-conses all of them together (Optimizer::merge), so each distinct
+//      subtree, across formulas, becomes one node, and constants are folded;
+//   2. compiles the resulting DAG into a single Program (Compiler), which
+//      emits every node once and records the value index of each formula.
+//
+// One execute() over that program then computes every distinct subtree once
+// and fills an output array with one value per formula, in input order.
+//
+// Function calls are merged as in Optimizer.h, that is, assumed pure.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "Node.h"
+#include "Optimizer.h"
+#include "TreeNodes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// FormulaSet — a set of expressions compiled into one shared program.
+class FormulaSet {
+public:
+    // Compiles roots, merging the subtrees they have in common. Returns empty
+    // if a root is null or cannot be compiled.
+    static std::optional<FormulaSet> compile(const std::vector<NodePtr>& roots) {
+        Optimizer optimizer;
+        std::vector<NodePtr> merged = optimizer.merge(roots);
+        std::vector<uint32_t> outputs;
+        std::optional<Program> prog = Compiler::compile(merged, outputs);
+        if (!prog) {
+            return {};
+        }
+        return FormulaSet(std::move(*prog), std::move(outputs), optimizer.stats().merged);
+    }
+
+    // Evaluates every formula with one value per slot (see Program::variables)
+    // and writes one result per formula to out. Does not read the AST.
+    void run(const double* slots, double* out) {
+        execute(_program.view(), slots, _values.data());
+        for (size_t j = 0; j < _outputs.size(); ++j) {
+            out[j] = _values[_outputs[j]];
+        }
+    }
+
+    // Evaluates every formula with the values assigned to the bound Variable
+    // nodes, matching calc() on each source tree.
+    void calc(double* out) {
+        for (size_t slot = 0; slot < _slots.size(); ++slot) {
+            _slots[slot] = _program.variables[slot]->value;
+        }
+        run(_slots.data(), out);
+    }
+
+    // Number of formulas, which is the size of the output array.
+    size_t size() const {
+        return _outputs.size();
+    }
+
+    // Nodes found identical to an earlier one while merging.
+    size_t merged() const {
+        return _merged;
+    }
+
+    // Value index of each formula in the program.
+    const std::vector<uint32_t>& outputs() const {
+        return _outputs;
+    }
+
+    const Program& program() const {
+        return _program;
+    }
+
+private:
+    FormulaSet(Program prog, std::vector<uint32_t> outputs, size_t merged)
+        : _program(std::move(prog))
+        , _outputs(std::move(outputs))
+        , _merged(merged)
+        , _slots(_program.variables.size())
+        , _values(_program.code.size()) {
+    }
+
+    Program _program;
+    std::vector<uint32_t> _outputs;
+    size_t _merged;
+    std::vector<double> _slots;   // slot values read by calc()
+    std::vector<double> _values;  // scratch for execute()
+};
+
+}  // namespace Interpreter
@@ -22,6 +22,13 @@ namespace Interpreter {
 // unlike void* which is not guaranteed to hold function pointers.
 using FnPtr = double(*)();
 
+// Converts any function pointer to FnPtr. The cast goes through void(*)(),
+// which -Wcast-function-type accepts as a generic function pointer type.
+template <typename F>
+FnPtr toFnPtr(F func) {
+    return reinterpret_cast<FnPtr>(reinterpret_cast<void (*)()>(func));
+}
+
 // Helper alias: maps any size_t index to double, used to expand parameter packs.
 template <size_t>
 using double_t = double;
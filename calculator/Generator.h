@@ -0,0 +1,137 @@
+// Generator.h — Deterministic random expression generator
+//
+// Produces arithmetic expressions with a controlled shape for benchmarks and
+// tests. The same options (including the seed) always produce the same text,
+// so timings taken on different builds measure the same input.
+//
+// Shape parameters:
+//   terms        number of leaf operands (literals and variables) in total
+//   depth        maximum nesting of parentheses and call arguments
+//   variables    number of distinct variable names (v0, v1, ...); 0 for
+//                literals only
+//   call_percent chance, per operand, of emitting a function call instead of
+//                a leaf (requires depth > 0)
+//
+// Operators are drawn uniformly from + - * /. Calls use the functions listed
+// in the options (log(x) by default, the only function Calculator registers),
+// so the text can be parsed by PrecedenceParser; Calculator::parse() does not
+// recognize calls and should only be fed call-free expressions.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// A function the generator may call, by name and argument count.
+struct GeneratedFunction {
+    std::string name;
+    size_t arity;
+};
+
+struct GeneratorOptions {
+    size_t terms = 10;
+    size_t depth = 0;
+    size_t variables = 1;
+    unsigned call_percent = 0;
+    unsigned group_percent = 20;  // chance of a parenthesized group per operand
+    uint64_t seed = 1;
+    std::vector<GeneratedFunction> functions = { { "log", 1 } };
+};
+
+// ExpressionGenerator — builds one expression text per call to generate().
+class ExpressionGenerator {
+public:
+    explicit ExpressionGenerator(GeneratorOptions options) : _options(std::move(options)), _rng(_options.seed) {
+    }
+
+    // Returns a new expression with exactly options.terms leaf operands.
+    std::string generate() {
+        _text.clear();
+        expression(std::max<size_t>(_options.terms, 1), _options.depth);
+        return _text;
+    }
+
+    // Convenience wrapper for a single expression.
+    static std::string generate(const GeneratorOptions& options) {
+        ExpressionGenerator generator(options);
+        return generator.generate();
+    }
+
+private:
+    // Plain modulo rather than std::uniform_int_distribution, whose output
+    // differs between standard libraries; the bias is irrelevant here.
+    size_t uniform(size_t count) {
+        return static_cast<size_t>(_rng() % count);
+    }
+
+    bool chance(unsigned percent) {
+        return uniform(100) < percent;
+    }
+
+    // Emits operands separated by operators until terms leaves are used.
+    void expression(size_t terms, size_t depth) {
+        bool first = true;
+        while (terms > 0) {
+            if (!first) {
+                _text += "+-*/"[uniform(4)];
+            }
+            first = false;
+            terms -= operand(terms, depth);
+        }
+    }
+
+    // Emits one operand using at most budget leaves; returns the number used.
+    size_t operand(size_t budget, size_t depth) {
+        if (depth > 0 && !_options.functions.empty() && chance(_options.call_percent)) {
+            const GeneratedFunction& fn = _options.functions[uniform(_options.functions.size())];
+            if (fn.arity <= budget) {
+                size_t used = 0;
+                _text += fn.name;
+                _text += '(';
+                for (size_t k = 0; k < fn.arity; ++k) {
+                    if (k > 0) {
+                        _text += ',';
+                    }
+                    // Spread the spare leaves over the arguments.
+                    size_t spare = budget - fn.arity - (used - k);
+                    size_t terms = 1 + uniform(std::min<size_t>(spare, 3) + 1);
+                    expression(terms, depth - 1);
+                    used += terms;
+                }
+                _text += ')';
+                return used;
+            }
+        }
+        if (depth > 0 && budget > 1 && chance(_options.group_percent)) {
+            size_t terms = 2 + uniform(std::min<size_t>(budget - 1, 4));
+            _text += '(';
+            expression(terms, depth - 1);
+            _text += ')';
+            return terms;
+        }
+        if (_options.variables > 0 && chance(50)) {
+            _text += 'v';
+            _text += std::to_string(uniform(_options.variables));
+        } else {
+            _text += std::to_string(1 + uniform(99));
+            if (chance(50)) {
+                _text += '.';
+                _text += std::to_string(uniform(100));
+            }
+        }
+        return 1;
+    }
+
+    GeneratorOptions _options;
+    std::mt19937_64 _rng;
+    std::string _text;
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,481 @@
+// Image.h — Versioned binary images of compiled expressions
+//
+// Loading a large set of formulas by parsing every one of them at startup
+// costs a parse, a tree and a compile per formula. An image stores the
+// compiled bytecode (Bytecode.h) of many named expressions in one flat
+// buffer, laid out so that it can be used where it lies: ExpressionImage
+// points ProgramViews straight into the bytes of an mmap'd file, and loading
+// reduces to checking the header and a directory of fixed-size records. The
+// code and constants of a formula are paged in the first time it runs.
+//
+// Layout (all offsets relative to the start of the image; every section is
+// 8-byte aligned and holds an array of fixed-size records):
+//
+//   ImageHeader   magic, version, byte order, total size, section table
+//   programs      ImageProgram per expression: name and element ranges
+//   code          Instruction, exactly as in memory
+//   constants     double
+//   arguments     uint32_t argument indices of Call instructions
+//   callees       ImageCallee: function name and arity
+//   slots         ImageString: variable name of each slot
+//   strings       characters of all names (deduplicated)
+//
+// Images are written in native byte order and struct layout; load() rejects
+// a different byte order or version. kImageVersion must change whenever
+// OpCode numbering or any structure below changes.
+//
+// Function pointers cannot be stored, so Call instructions refer to callees
+// by name: ImageWriter finds the name of each function pointer in its
+// Calculator's function map, and load() resolves the names against the
+// loading Calculator, failing if a function is missing or has another
+// arity. Built-in functions compile to opcodes and need no resolution.
+//
+// load() trusts the instructions themselves, since checking every operand
+// would touch every page. verify() does that check for images from
+// untrusted sources.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "Calculator.h"
+#include "FunctionOps.h"
+#include "MappedInput.h"
+#include "Symbols.h"
+#include "Writer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+static constexpr char kImageMagic[8] = { 'C', 'A', 'L', 'C', 'I', 'M', 'G', '\0' };
+static constexpr uint32_t kImageVersion = 1;
+static constexpr uint32_t kImageByteOrder = 0x01020304;
+static constexpr size_t kImageAlignment = 8;
+
+// Byte offset and element count of one section.
+struct ImageSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+// A name in the string section.
+struct ImageString {
+    uint32_t offset;
+    uint32_t size;
+};
+
+// A run of elements of one section.
+struct ImageRange {
+    uint32_t begin;
+    uint32_t count;
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;  // bytes in the whole image
+    ImageSection programs;
+    ImageSection code;
+    ImageSection constants;
+    ImageSection arguments;
+    ImageSection callees;
+    ImageSection slots;
+    ImageSection strings;
+};
+
+// One expression: its name and the parts of each section it owns. Indices
+// inside the code (constants, arguments, callees, slots) are relative to
+// these ranges, as in Program.
+struct ImageProgram {
+    ImageString name;
+    ImageRange code;
+    ImageRange constants;
+    ImageRange arguments;
+    ImageRange callees;
+    ImageRange slots;
+};
+
+struct ImageCallee {
+    ImageString name;
+    uint32_t num_args;
+};
+
+static_assert(std::is_trivially_copyable_v<Instruction> && sizeof(Instruction) == 12,
+    "Instruction is stored in images as is; bump kImageVersion if it changes");
+static_assert(sizeof(ImageHeader) == 136 && sizeof(ImageProgram) == 48 && sizeof(ImageCallee) == 12,
+    "image records changed; bump kImageVersion");
+
+// ImageWriter — collects compiled expressions and lays them out as an image.
+class ImageWriter {
+public:
+    // Call instructions are written with the names calc registers for their
+    // function pointers.
+    explicit ImageWriter(const Calculator& calc) {
+        for (const auto& entry : calc._function_map) {
+            _functions.emplace_back(entry.second.fnptr, entry.first);
+        }
+    }
+
+    // Adds a compiled expression. Returns false if it calls a function that
+    // is not in the Calculator's function map, or if the image would exceed
+    // the 32-bit section limits.
+    bool add(std::string_view name, const Program& prog) {
+        if (_code.size() + prog.code.size() > UINT32_MAX || _arguments.size() + prog.arguments.size() > UINT32_MAX
+            || _constants.size() + prog.constants.size() > UINT32_MAX) {
+            return false;
+        }
+        std::vector<ImageCallee> callees;
+        for (const Callee& callee : prog.callees) {
+            const std::string* fname = functionName(callee.fnptr);
+            if (fname == nullptr) {
+                return false;
+            }
+            callees.push_back(ImageCallee{ intern(*fname), callee.num_args });
+        }
+        ImageProgram record;
+        record.name = intern(name);
+        record.code = ImageRange{ static_cast<uint32_t>(_code.size()), static_cast<uint32_t>(prog.code.size()) };
+        for (const Instruction& ins : prog.code) {
+            // Zero the padding after the opcode so images are reproducible.
+            Instruction copy;
+            memset(&copy, 0, sizeof(copy));
+            copy.code = ins.code;
+            copy.lhs = ins.lhs;
+            copy.rhs = ins.rhs;
+            _code.push_back(copy);
+        }
+        record.constants = append(_constants, prog.constants);
+        record.arguments = append(_arguments, prog.arguments);
+        record.callees = append(_callees, callees);
+        record.slots = ImageRange{ static_cast<uint32_t>(_slots.size()), static_cast<uint32_t>(prog.variables.size()) };
+        for (const Pointer<Variable>& var : prog.variables) {
+            _slots.push_back(intern(var->name));
+        }
+        _programs.push_back(record);
+        return true;
+    }
+
+    // Compiles and adds a tree. Returns false if it cannot be compiled or added.
+    bool add(std::string_view name, const NodePtr& root) {
+        std::optional<Program> prog = Compiler::compile(root);
+        return prog && add(name, *prog);
+    }
+
+    size_t size() const {
+        return _programs.size();
+    }
+
+    // Appends the image to out, starting at an 8-byte aligned offset.
+    void write(Writer& out) const {
+        out.align(kImageAlignment);
+        size_t base = out.data.size();
+        ImageHeader header{};
+        memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+        header.version = kImageVersion;
+        header.byte_order = kImageByteOrder;
+        out.writeRaw(header);
+        header.programs = section(out, base, _programs);
+        header.code = section(out, base, _code);
+        header.constants = section(out, base, _constants);
+        header.arguments = section(out, base, _arguments);
+        header.callees = section(out, base, _callees);
+        header.slots = section(out, base, _slots);
+        header.strings = section(out, base, _strings);
+        out.align(kImageAlignment);
+        header.size = out.data.size() - base;
+        memcpy(&out.data[base], &header, sizeof(header));
+    }
+
+    // Writes the image to a file. Returns false on I/O errors.
+    bool save(const char* path) const {
+        Writer out;
+        write(out);
+        FILE* file = fopen(path, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(out.data.data(), 1, out.data.size(), file) == out.data.size();
+        return (fclose(file) == 0) && ok;
+    }
+
+private:
+    const std::string* functionName(FnPtr fnptr) const {
+        for (const auto& function : _functions) {
+            if (function.first == fnptr) {
+                return &function.second;
+            }
+        }
+        return nullptr;
+    }
+
+    // Adds a name to the string section, once per distinct name.
+    ImageString intern(std::string_view text) {
+        auto& offset = _string_offsets[text];
+        if (offset == 0) {
+            _strings.insert(_strings.end(), text.begin(), text.end());
+            offset = _strings.size() - text.size() + 1;  // 0 marks "not yet stored"
+        }
+        return ImageString{ static_cast<uint32_t>(offset - 1), static_cast<uint32_t>(text.size()) };
+    }
+
+    template <typename T>
+    static ImageRange append(std::vector<T>& section, const std::vector<T>& items) {
+        ImageRange range{ static_cast<uint32_t>(section.size()), static_cast<uint32_t>(items.size()) };
+        section.insert(section.end(), items.begin(), items.end());
+        return range;
+    }
+
+    template <typename T>
+    static ImageSection section(Writer& out, size_t base, const std::vector<T>& items) {
+        out.align(kImageAlignment);
+        ImageSection result{ out.data.size() - base, items.size() };
+        out.writeRaw(items.data(), items.size());
+        return result;
+    }
+
+    std::vector<std::pair<FnPtr, std::string>> _functions;
+    std::vector<ImageProgram> _programs;
+    std::vector<Instruction> _code;
+    std::vector<double> _constants;
+    std::vector<uint32_t> _arguments;
+    std::vector<ImageCallee> _callees;
+    std::vector<ImageString> _slots;
+    std::vector<char> _strings;
+    SymbolMap<size_t> _string_offsets;  // name → offset + 1
+};
+
+// ExpressionImage — the expressions of an image, evaluated in place.
+class ExpressionImage {
+public:
+    // Validates and indexes an image. bytes must start on an 8-byte boundary
+    // and stay unchanged while the result is in use. Call instructions are
+    // bound to calc's functions of the same name. Returns empty if the image
+    // is malformed, has another version or byte order, or calls a function
+    // calc does not provide.
+    static std::optional<ExpressionImage> load(std::string_view bytes, const Calculator& calc) {
+        ExpressionImage image;
+        if (!image.index(bytes, calc)) {
+            return {};
+        }
+        return image;
+    }
+
+    // Maps and loads an image file ("-" reads standard input).
+    static std::optional<ExpressionImage> open(const char* path, const Calculator& calc) {
+        std::optional<MappedInput> input = MappedInput::open(path);
+        if (!input) {
+            return {};
+        }
+        ExpressionImage image;
+        // The mapping (or the owned stdin copy) does not move with the
+        // MappedInput, so the indexed pointers stay valid.
+        image._input = std::move(input);
+        if (!image.index(image._input->text(), calc)) {
+            return {};
+        }
+        return image;
+    }
+
+    // Number of expressions.
+    size_t size() const {
+        return _header->programs.count;
+    }
+
+    std::string_view name(size_t index) const {
+        return text(_programs[index].name);
+    }
+
+    // Number of variable slots of an expression, and the name of each.
+    size_t slots(size_t index) const {
+        return _programs[index].slots.count;
+    }
+    std::string_view slot(size_t index, size_t slot) const {
+        return text(_slots[_programs[index].slots.begin + slot]);
+    }
+
+    // Number of instructions, which is also the scratch values run() needs.
+    size_t instructions(size_t index) const {
+        return _programs[index].code.count;
+    }
+
+    // Bytecode of an expression, pointing into the image.
+    ProgramView view(size_t index) const {
+        const ImageProgram& prog = _programs[index];
+        return ProgramView{ _code + prog.code.begin, prog.code.count, _constants + prog.constants.begin,
+            _callees.data() + prog.callees.begin, _arguments + prog.arguments.begin };
+    }
+
+    // Evaluates an expression with one value per slot.
+    double run(size_t index, const double* slots) const {
+        return withScratch<double>(instructions(index), [&](double* values) {
+            return execute(view(index), slots, values);
+        });
+    }
+
+    // Copies an expression out into a Program whose slots are bound to
+    // calc's variables, for use with the other backends (Jit.h, Batch.h...).
+    Program program(size_t index, Calculator& calc) const {
+        const ImageProgram& rec = _programs[index];
+        ProgramView prog = view(index);
+        Program result;
+        result.code.assign(prog.code, prog.code + prog.size);
+        result.constants.assign(prog.constants, prog.constants + rec.constants.count);
+        result.callees.assign(prog.callees, prog.callees + rec.callees.count);
+        result.arguments.assign(prog.arguments, prog.arguments + rec.arguments.count);
+        for (size_t slot = 0; slot < rec.slots.count; ++slot) {
+            result.variables.push_back(calc.internVariable(this->slot(index, slot)));
+        }
+        return result;
+    }
+
+    // Checks every instruction: known opcode, operands that refer to
+    // earlier results, and indices inside the expression's ranges.
+    bool verify() const {
+        for (size_t index = 0; index < size(); ++index) {
+            const ImageProgram& rec = _programs[index];
+            const Instruction* code = _code + rec.code.begin;
+            for (uint32_t j = 0; j < rec.code.count; ++j) {
+                if (!valid(rec, code[j], j)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    ExpressionImage() = default;
+
+    bool index(std::string_view bytes, const Calculator& calc) {
+        if (bytes.size() < sizeof(ImageHeader) || reinterpret_cast<uintptr_t>(bytes.data()) % kImageAlignment != 0) {
+            return false;
+        }
+        _bytes = bytes;
+        _header = reinterpret_cast<const ImageHeader*>(bytes.data());
+        if (memcmp(_header->magic, kImageMagic, sizeof(kImageMagic)) != 0 || _header->version != kImageVersion
+            || _header->byte_order != kImageByteOrder || _header->size > bytes.size()) {
+            return false;
+        }
+        if (!fits<ImageProgram>(_header->programs) || !fits<Instruction>(_header->code)
+            || !fits<double>(_header->constants) || !fits<uint32_t>(_header->arguments)
+            || !fits<ImageCallee>(_header->callees) || !fits<ImageString>(_header->slots)
+            || !fits<char>(_header->strings)) {
+            return false;
+        }
+        _programs = at<ImageProgram>(_header->programs);
+        _code = at<Instruction>(_header->code);
+        _constants = at<double>(_header->constants);
+        _arguments = at<uint32_t>(_header->arguments);
+        _slots = at<ImageString>(_header->slots);
+        _strings = at<char>(_header->strings);
+
+        for (size_t index = 0; index < size(); ++index) {
+            const ImageProgram& rec = _programs[index];
+            if (!within(rec.name) || !within(rec.code, _header->code) || !within(rec.constants, _header->constants)
+                || !within(rec.arguments, _header->arguments) || !within(rec.callees, _header->callees)
+                || !within(rec.slots, _header->slots)) {
+                return false;
+            }
+        }
+        for (uint64_t slot = 0; slot < _header->slots.count; ++slot) {
+            if (!within(_slots[slot])) {
+                return false;
+            }
+        }
+        const auto* callees = at<ImageCallee>(_header->callees);
+        _callees.reserve(_header->callees.count);
+        for (uint64_t j = 0; j < _header->callees.count; ++j) {
+            if (!within(callees[j].name)) {
+                return false;
+            }
+            const Function* func = calc.findFunction(text(callees[j].name));
+            if (func == nullptr || func->num_args != callees[j].num_args || func->num_args > MAX_FN_ARGS) {
+                return false;
+            }
+            _callees.push_back(Callee{ func->fnptr, callees[j].num_args });
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool fits(const ImageSection& section) const {
+        return section.offset % alignof(T) == 0 && section.offset <= _header->size
+            && section.count <= (_header->size - section.offset) / sizeof(T);
+    }
+
+    template <typename T>
+    const T* at(const ImageSection& section) const {
+        return reinterpret_cast<const T*>(_bytes.data() + section.offset);
+    }
+
+    bool within(const ImageString& name) const {
+        return uint64_t(name.offset) + name.size <= _header->strings.count;
+    }
+
+    static bool within(const ImageRange& range, const ImageSection& section) {
+        return uint64_t(range.begin) + range.count <= section.count;
+    }
+
+    std::string_view text(const ImageString& name) const {
+        return std::string_view(_strings + name.offset, name.size);
+    }
+
+    bool valid(const ImageProgram& rec, const Instruction& ins, uint32_t position) const {
+        switch (ins.code) {
+            case OpCode::Constant: return ins.lhs < rec.constants.count;
+            case OpCode::Variable: return ins.lhs < rec.slots.count;
+            case OpCode::Negate: return ins.lhs < position;
+            case OpCode::Call: {
+                if (ins.lhs >= rec.callees.count) {
+                    return false;
+                }
+                uint32_t num_args = _callees[rec.callees.begin + ins.lhs].num_args;
+                if (uint64_t(ins.rhs) + num_args > rec.arguments.count) {
+                    return false;
+                }
+                for (uint32_t k = 0; k < num_args; ++k) {
+                    if (_arguments[rec.arguments.begin + ins.rhs + k] >= position) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case OpCode::Add:
+            case OpCode::Subtract:
+            case OpCode::Multiply:
+            case OpCode::Divide:
+            case OpCode::Sqrt:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Pow:
+            case OpCode::Abs:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Floor: return ins.lhs < position && ins.rhs < position;
+        }
+        return false;  // unknown opcode
+    }
+
+    std::optional<MappedInput> _input;  // set by open()
+    std::string_view _bytes;
+    const ImageHeader* _header = nullptr;
+    const ImageProgram* _programs = nullptr;
+    const Instruction* _code = nullptr;
+    const double* _constants = nullptr;
+    const uint32_t* _arguments = nullptr;
+    const ImageString* _slots = nullptr;
+    const char* _strings = nullptr;
+    std::vector<Callee> _callees;  // resolved function pointers, all expressions
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,234 @@
+// Incremental.h — Re-evaluation of only the subexpressions whose inputs changed
+//
+// calc() on a tree, or on a Program, recomputes every node even when a single
+// variable has moved since the last call. IncrementalExpression compiles the
+// tree to bytecode (Bytecode.h) once and keeps, next to it:
+//
+//   - the cached result of every instruction from the previous evaluation;
+//   - for every instruction, the instructions that consume it, all lists
+//     packed into one array indexed by per-instruction offsets;
+//   - a dirty byte per instruction and the range [first, end) that holds
+//     every dirty instruction.
+//
+// set() stores a variable and marks its Variable instruction dirty. calc()
+// then sweeps the dirty range in program order (which is topological, since
+// every operand precedes its user), recomputes the dirty instructions and
+// marks the consumers of an instruction dirty only if its result actually
+// changed. Consumers always come later in the program, so marking them only
+// extends the end of the sweep. An update to one variable therefore
+// recomputes only the paths from that variable to the root, and stops early
+// where a value is unaffected (e.g. multiplied by zero).
+//
+// The bound Variable nodes stay the source of truth: set() writes through to
+// them, and calc() also picks up values assigned directly to a Variable (for
+// example via Calculator::_variable_map) by comparing them against the slot
+// cache, which costs one load per variable.
+//
+// Function calls are assumed pure, as in Optimizer.h: a call is recomputed
+// only when one of its arguments changed.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "Node.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// How much work incremental evaluation did.
+struct IncrementalStats {
+    size_t evaluations = 0;  // calls to calc()
+    size_t recomputed = 0;   // instructions recomputed by the last calc()
+    size_t total = 0;        // instructions recomputed over all calls
+};
+
+// IncrementalExpression — compiled expression with cached subtree values.
+class IncrementalExpression {
+public:
+    // Compiles root. Returns empty if the tree cannot be compiled.
+    static std::optional<IncrementalExpression> create(const NodePtr& root) {
+        std::optional<Program> prog = Compiler::compile(root);
+        if (!prog) {
+            return {};
+        }
+        return IncrementalExpression(std::move(*prog));
+    }
+
+    // Assigns a variable (both the slot and the bound Variable node) and
+    // invalidates the instructions that read it. Returns false if the
+    // expression does not reference the name.
+    bool set(std::string_view name, double value) {
+        for (size_t slot = 0; slot < _program.variables.size(); ++slot) {
+            if (_program.variables[slot]->name == name) {
+                set(slot, value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Assigns a variable by slot (see Program::variables).
+    void set(size_t slot, double value) {
+        _program.variables[slot]->value = value;
+        store(slot, value);
+    }
+
+    // Returns the value of the root, recomputing only what changed since the
+    // previous call.
+    double calc() {
+        for (size_t slot = 0; slot < _slots.size(); ++slot) {
+            store(slot, _program.variables[slot]->value);
+        }
+        ProgramView view = _program.view();
+        size_t recomputed = 0;
+        size_t end = _end;
+        for (size_t j = _first; j < end; ++j) {
+            if (_dirty[j] == 0) {
+                // Skip clean instructions a word at a time; _dirty is padded
+                // so that the load never runs past it.
+                uint64_t word;
+                std::memcpy(&word, &_dirty[j], sizeof(word));
+                if (word == 0) {
+                    j += sizeof(word) - 1;
+                }
+                continue;
+            }
+            _dirty[j] = 0;
+            ++recomputed;
+            double value = evaluate(view, view.code[j], _slots.data(), _values.data());
+            if (!same(value, _values[j])) {
+                _values[j] = value;
+                uint32_t begin = _consumerOffsets[j];
+                uint32_t stop = _consumerOffsets[j + 1];
+                for (uint32_t k = begin; k < stop; ++k) {
+                    _dirty[_consumers[k]] = 1;
+                }
+                if (begin != stop) {
+                    // Consumers are listed in program order.
+                    end = std::max<size_t>(end, _consumers[stop - 1] + size_t(1));
+                }
+            }
+        }
+        _first = _values.size();
+        _end = 0;
+        ++_stats.evaluations;
+        _stats.recomputed = recomputed;
+        _stats.total += recomputed;
+        return _values.empty() ? std::numeric_limits<double>::quiet_NaN() : _values.back();
+    }
+
+    const IncrementalStats& stats() const {
+        return _stats;
+    }
+
+    const Program& program() const {
+        return _program;
+    }
+
+private:
+    explicit IncrementalExpression(Program prog)
+        : _program(std::move(prog))
+        , _slots(_program.variables.size())
+        , _values(_program.code.size())
+        , _dirty(_program.code.size() + sizeof(uint64_t))
+        , _first(0)
+        , _end(_program.code.size()) {
+        std::vector<std::vector<uint32_t>> consumers(_program.code.size());
+        std::vector<std::vector<uint32_t>> readers(_program.variables.size());
+        for (uint32_t j = 0; j < _program.code.size(); ++j) {
+            const Instruction& ins = _program.code[j];
+            switch (ins.code) {
+                case OpCode::Constant: break;
+                case OpCode::Variable: readers[ins.lhs].push_back(j); break;
+                case OpCode::Negate: consumers[ins.lhs].push_back(j); break;
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide:
+                case OpCode::Sqrt:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Pow:
+                case OpCode::Abs:
+                case OpCode::Min:
+                case OpCode::Max:
+                case OpCode::Floor:
+                    consumers[ins.lhs].push_back(j);
+                    if (ins.rhs != ins.lhs) {
+                        consumers[ins.rhs].push_back(j);
+                    }
+                    break;
+                case OpCode::Call: {
+                    const Callee& callee = _program.callees[ins.lhs];
+                    for (uint32_t k = 0; k < callee.num_args; ++k) {
+                        uint32_t arg = _program.arguments[ins.rhs + k];
+                        if (consumers[arg].empty() || consumers[arg].back() != j) {
+                            consumers[arg].push_back(j);
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+        // The first calc() computes everything.
+        std::fill(_dirty.begin(), _dirty.begin() + static_cast<ptrdiff_t>(_values.size()), 1);
+        flatten(consumers, _consumerOffsets, _consumers);
+        flatten(readers, _readerOffsets, _readers);
+        for (size_t slot = 0; slot < _slots.size(); ++slot) {
+            _slots[slot] = _program.variables[slot]->value;
+        }
+    }
+
+    // Packs lists into one array: list j is items[offsets[j], offsets[j + 1]).
+    static void flatten(const std::vector<std::vector<uint32_t>>& lists, std::vector<uint32_t>& offsets,
+        std::vector<uint32_t>& items) {
+        offsets.reserve(lists.size() + 1);
+        offsets.push_back(0);
+        for (const auto& list : lists) {
+            items.insert(items.end(), list.begin(), list.end());
+            offsets.push_back(static_cast<uint32_t>(items.size()));
+        }
+    }
+
+    // Bitwise comparison, so that NaN results compare equal to themselves.
+    static bool same(double lhs, double rhs) {
+        return std::memcmp(&lhs, &rhs, sizeof(double)) == 0;
+    }
+
+    void store(size_t slot, double value) {
+        if (same(_slots[slot], value)) {
+            return;
+        }
+        _slots[slot] = value;
+        for (uint32_t k = _readerOffsets[slot]; k < _readerOffsets[slot + 1]; ++k) {
+            uint32_t reader = _readers[k];
+            _dirty[reader] = 1;
+            _first = std::min<size_t>(_first, reader);
+            _end = std::max<size_t>(_end, reader + size_t(1));
+        }
+    }
+
+    Program _program;
+    std::vector<double> _slots;             // last value seen per slot
+    std::vector<double> _values;            // cached result per instruction
+    std::vector<uint8_t> _dirty;            // to be recomputed by the next calc()
+    size_t _first;                          // every dirty instruction is in [_first, _end)
+    size_t _end;
+    std::vector<uint32_t> _consumerOffsets;  // instruction → its range of _consumers
+    std::vector<uint32_t> _consumers;        // instructions using each instruction, in order
+    std::vector<uint32_t> _readerOffsets;    // slot → its range of _readers
+    std::vector<uint32_t> _readers;          // Variable instructions reading each slot
+    IncrementalStats _stats;
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,149 @@
+// Intrinsics.h — Built-in math functions known to every evaluator
+//
+// A call to a user function goes through a type-erased FnPtr and callfn()'s
+// dispatch table, so no backend can inline or vectorize it. The functions
+// below are instead identified by an Intrinsic tag, which each backend
+// implements directly:
+//
+//   tree       IntrinsicCall (TreeNodes.h) switches on the tag inline
+//   bytecode   one opcode per intrinsic (Bytecode.h)
+//   batch      SIMD kernels where the ISA has them (Batch.h)
+//   JIT        sqrtsd/minsd/maxsd/andpd inline, direct calls otherwise (Jit.h)
+//
+// Calculator registers them under their names, so createFunctionCall()
+// builds an IntrinsicCall for "sqrt(x)". Every intrinsic also has an ordinary
+// FnPtr with the same semantics, used wherever a backend falls back to a
+// generic call. Replacing an entry in Calculator::_function_map with a user
+// function (intrinsic None) turns the name back into a plain call.
+//
+// min and max are defined as (a < b ? a : b) and (a > b ? a : b), which is
+// what the minpd/maxpd instructions compute, so every backend returns the
+// same value, including for NaN operands (the second operand is returned).
+//
+// findIntrinsic() maps a name to its tag with a perfect hash: the first and
+// third characters and the length select one of 16 slots, which holds the
+// only candidate name. The hash is checked for collisions at compile time.
+
+#pragma once
+
+#include "FunctionOps.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace Interpreter {
+
+// Intrinsic — built-in function tag; None marks an ordinary FnPtr call.
+enum class Intrinsic : uint8_t { None, Sqrt, Exp, Log, Pow, Abs, Min, Max, Floor };
+
+// Scalar semantics shared by all backends. Unary intrinsics ignore rhs.
+inline double applyIntrinsic(Intrinsic op, double lhs, double rhs) {
+    switch (op) {
+        case Intrinsic::Sqrt: return std::sqrt(lhs);
+        case Intrinsic::Exp: return std::exp(lhs);
+        case Intrinsic::Log: return std::log(lhs);
+        case Intrinsic::Pow: return std::pow(lhs, rhs);
+        case Intrinsic::Abs: return std::fabs(lhs);
+        case Intrinsic::Min: return lhs < rhs ? lhs : rhs;
+        case Intrinsic::Max: return lhs > rhs ? lhs : rhs;
+        case Intrinsic::Floor: return std::floor(lhs);
+        case Intrinsic::None: break;
+    }
+    return 0;
+}
+
+// Number of arguments an intrinsic takes.
+constexpr size_t intrinsicArity(Intrinsic op) {
+    return (op == Intrinsic::Pow || op == Intrinsic::Min || op == Intrinsic::Max) ? 2 : 1;
+}
+
+// Plain C entry points with the semantics above, for generic call paths.
+template <Intrinsic Op>
+double unaryIntrinsic(double arg) {
+    return applyIntrinsic(Op, arg, 0);
+}
+
+template <Intrinsic Op>
+double binaryIntrinsic(double lhs, double rhs) {
+    return applyIntrinsic(Op, lhs, rhs);
+}
+
+// Names of the intrinsics, in enum order (Sqrt first).
+constexpr std::array<std::string_view, 8> kIntrinsicNames = {
+    "sqrt", "exp", "log", "pow", "abs", "min", "max", "floor",
+};
+
+// Perfect hash of the intrinsic names into 16 slots; any name shorter than
+// three characters is not an intrinsic.
+constexpr size_t intrinsicHash(std::string_view name) {
+    return (static_cast<unsigned char>(name[0]) + 2U * static_cast<unsigned char>(name[2]) + name.size()) & 15U;
+}
+
+// Slot → intrinsic table for findIntrinsic().
+constexpr std::array<Intrinsic, 16> makeIntrinsicSlots() {
+    std::array<Intrinsic, 16> slots{};
+    for (size_t j = 0; j < kIntrinsicNames.size(); ++j) {
+        slots[intrinsicHash(kIntrinsicNames[j])] = static_cast<Intrinsic>(j + 1);
+    }
+    return slots;
+}
+
+constexpr std::array<Intrinsic, 16> kIntrinsicSlots = makeIntrinsicSlots();
+
+// True if every name hashes to its own slot.
+constexpr bool intrinsicHashIsPerfect() {
+    for (size_t j = 0; j < kIntrinsicNames.size(); ++j) {
+        if (kIntrinsicSlots[intrinsicHash(kIntrinsicNames[j])] != static_cast<Intrinsic>(j + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(intrinsicHashIsPerfect(), "intrinsic names collide in intrinsicHash()");
+
+// Tag of the intrinsic called name, or None.
+constexpr Intrinsic findIntrinsic(std::string_view name) {
+    if (name.size() < 3) {
+        return Intrinsic::None;
+    }
+    Intrinsic op = kIntrinsicSlots[intrinsicHash(name)];
+    if (op == Intrinsic::None || kIntrinsicNames[static_cast<size_t>(op) - 1] != name) {
+        return Intrinsic::None;
+    }
+    return op;
+}
+
+// Name, tag and fallback function pointer of one intrinsic.
+struct IntrinsicInfo {
+    const char* name;
+    Intrinsic op;
+    FnPtr fnptr;
+};
+
+// All intrinsics, in enum order (Sqrt first).
+inline const std::array<IntrinsicInfo, 8>& intrinsicTable() {
+    static const std::array<IntrinsicInfo, 8> table = { {
+        { "sqrt", Intrinsic::Sqrt, toFnPtr(&unaryIntrinsic<Intrinsic::Sqrt>) },
+        { "exp", Intrinsic::Exp, toFnPtr(&unaryIntrinsic<Intrinsic::Exp>) },
+        { "log", Intrinsic::Log, toFnPtr(&unaryIntrinsic<Intrinsic::Log>) },
+        { "pow", Intrinsic::Pow, toFnPtr(&binaryIntrinsic<Intrinsic::Pow>) },
+        { "abs", Intrinsic::Abs, toFnPtr(&unaryIntrinsic<Intrinsic::Abs>) },
+        { "min", Intrinsic::Min, toFnPtr(&binaryIntrinsic<Intrinsic::Min>) },
+        { "max", Intrinsic::Max, toFnPtr(&binaryIntrinsic<Intrinsic::Max>) },
+        { "floor", Intrinsic::Floor, toFnPtr(&unaryIntrinsic<Intrinsic::Floor>) },
+    } };
+    return table;
+}
+
+// Fallback function pointer of an intrinsic (null for None).
+inline FnPtr intrinsicFunction(Intrinsic op) {
+    if (op == Intrinsic::None) {
+        return nullptr;
+    }
+    return intrinsicTable()[static_cast<size_t>(op) - 1].fnptr;
+}
+
+}  // namespace Interpreter
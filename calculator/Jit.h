@@ -0,0 +1,548 @@
+// Jit.h — Native x86-64 code generation for compiled expressions
+//
+// Translates a bytecode Program (Bytecode.h) into x86-64 machine code with
+// scalar SSE2 arithmetic, written into an mmap'd buffer that is flipped from
+// writable to executable before use (never both at once). No external code
+// generator is involved; the handful of instruction encodings needed are
+// emitted by hand in CodeBuffer below.
+//
+// Generated function signature (System V AMD64 ABI):
+//   double fn(const double* slots, double* values)
+// slots holds the variable values (as for Program::run) and values is a
+// scratch array with one double per bytecode instruction. slots and values
+// are kept in the callee-saved registers rbx and r13 so they survive calls.
+//
+// Code shape per instruction, with xmm0 acting as an accumulator:
+//   Constant  nothing emitted; operands load the immediate when used
+//   Variable  nothing emitted; operands read [rbx + 8*slot]
+//   Add..Div  xmm0 = lhs (skipped if already in xmm0); xmm0 OP= rhs
+//   Negate    xmm0 = operand; xorpd with the sign mask
+//   Call      arguments loaded into xmm0..xmm7; call to the function's
+//             address, rel32 when in range, otherwise through rax
+//   Sqrt, Abs, Min, Max  sqrtsd, andnpd with the sign mask, minsd, maxsd
+//   Exp, Log, Pow, Floor  direct call to the intrinsic's C entry point
+// Each computed result is stored to [r13 + 8*index] for later operands.
+//
+// Functions with more than 8 arguments (which would need stack arguments)
+// are not supported; compile() returns empty and callers should keep using
+// the interpreter. On non-x86-64 targets compile() always returns empty.
+//
+// TieredExpression adds a promotion policy on top: it starts with the tree
+// walk, moves to bytecode after a number of evaluations and to native code
+// after more, so only hot expressions pay for compilation.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "FunctionOps.h"
+#include "Intrinsics.h"
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// Signature of generated code.
+using JitFunction = double (*)(const double* slots, double* values);
+
+// ExecutableBuffer — owns an mmap'd region holding generated code.
+class ExecutableBuffer {
+public:
+    ExecutableBuffer() = default;
+    ExecutableBuffer(const ExecutableBuffer&) = delete;
+    ExecutableBuffer& operator=(const ExecutableBuffer&) = delete;
+    ExecutableBuffer(ExecutableBuffer&& rhs) noexcept
+        : _memory(std::exchange(rhs._memory, nullptr)), _size(std::exchange(rhs._size, 0)) {
+    }
+    ExecutableBuffer& operator=(ExecutableBuffer&& rhs) noexcept {
+        release();
+        _memory = std::exchange(rhs._memory, nullptr);
+        _size = std::exchange(rhs._size, 0);
+        return *this;
+    }
+    ~ExecutableBuffer() {
+        release();
+    }
+
+    // Maps a fresh writable region of at least size bytes. The address is
+    // final, so code can be relocated against data() before sealing.
+    bool reserve(size_t size) {
+        release();
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size = ((size + page - 1) / page) * page;
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        _memory = mem;
+        _size = size;
+        return true;
+    }
+
+    // Copies code into the reserved region and makes it read+execute.
+    // Returns false if the system refuses executable mappings.
+    bool seal(const std::vector<uint8_t>& code) {
+        if (code.size() > _size) {
+            return false;
+        }
+        std::memcpy(_memory, code.data(), code.size());
+        if (mprotect(_memory, _size, PROT_READ | PROT_EXEC) != 0) {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    const void* data() const {
+        return _memory;
+    }
+    size_t size() const {
+        return _size;
+    }
+
+private:
+    void release() {
+        if (_memory != nullptr) {
+            munmap(_memory, _size);
+            _memory = nullptr;
+            _size = 0;
+        }
+    }
+
+    void* _memory = nullptr;
+    size_t _size = 0;
+};
+
+// JitExpression — native code for one Program plus the variables it binds.
+struct JitExpression {
+    ExecutableBuffer buffer;
+    JitFunction function = nullptr;
+    size_t num_values = 0;  // scratch doubles needed per call
+    std::vector<Pointer<Variable>> variables;
+
+    // Evaluates with explicit slot values; safe to call concurrently.
+    double run(const double* slots) const {
+        return withScratch<double>(num_values, [&](double* values) {
+            return function(slots, values);
+        });
+    }
+
+    // Evaluates with the values currently assigned to the bound variables.
+    double calc() const {
+        return withScratch<double>(variables.size() + num_values, [&](double* slots) {
+            for (size_t j = 0; j < variables.size(); ++j) {
+                slots[j] = variables[j]->value;
+            }
+            return function(slots, slots + variables.size());
+        });
+    }
+};
+
+#if defined(__x86_64__)
+
+// CodeBuffer — minimal x86-64 assembler for the instructions the JIT uses.
+// Only xmm0..xmm7 and the general registers rax, rbx, r13 are referenced.
+class CodeBuffer {
+public:
+    // Memory operand [base + disp32] with base rbx (slots) or r13 (values).
+    struct Memory {
+        bool r13;
+        int32_t disp;
+    };
+
+    // SSE2 opcodes (second byte after 0x0F).
+    enum : uint8_t {
+        kMovLoad = 0x10,
+        kMovStore = 0x11,
+        kSqrt = 0x51,
+        kAdd = 0x58,
+        kMul = 0x59,
+        kSub = 0x5C,
+        kMin = 0x5D,
+        kDiv = 0x5E,
+        kMax = 0x5F
+    };
+
+    std::vector<uint8_t> bytes;
+
+    void byte(uint8_t val) {
+        bytes.push_back(val);
+    }
+    void u32(uint32_t val) {
+        for (int j = 0; j < 4; ++j) {
+            byte(static_cast<uint8_t>(val >> (8 * j)));
+        }
+    }
+    void u64(uint64_t val) {
+        for (int j = 0; j < 8; ++j) {
+            byte(static_cast<uint8_t>(val >> (8 * j)));
+        }
+    }
+
+    // F2 [REX] 0F op /r with a memory operand: movsd/addsd/... xmm, [mem].
+    void sd(uint8_t opcode, int xmm, Memory mem) {
+        byte(0xF2);
+        if (mem.r13) {
+            byte(0x41);  // REX.B selects r13 as base
+        }
+        byte(0x0F);
+        byte(opcode);
+        byte(static_cast<uint8_t>(0x80 | (xmm << 3) | (mem.r13 ? 5 : 3)));  // mod=10, disp32
+        u32(static_cast<uint32_t>(mem.disp));
+    }
+
+    // F2 0F op /r with register operands: addsd/... xmm, xmm.
+    void sd(uint8_t opcode, int dst, int src) {
+        byte(0xF2);
+        byte(0x0F);
+        byte(opcode);
+        byte(static_cast<uint8_t>(0xC0 | (dst << 3) | src));
+    }
+
+    // movapd dst, src.
+    void movapd(int dst, int src) {
+        byte(0x66);
+        byte(0x0F);
+        byte(0x28);
+        byte(static_cast<uint8_t>(0xC0 | (dst << 3) | src));
+    }
+
+    // xorpd dst, src.
+    void xorpd(int dst, int src) {
+        byte(0x66);
+        byte(0x0F);
+        byte(0x57);
+        byte(static_cast<uint8_t>(0xC0 | (dst << 3) | src));
+    }
+
+    // andnpd dst, src: dst = ~dst & src.
+    void andnpd(int dst, int src) {
+        byte(0x66);
+        byte(0x0F);
+        byte(0x55);
+        byte(static_cast<uint8_t>(0xC0 | (dst << 3) | src));
+    }
+
+    // xmm = bit pattern of value, through rax.
+    void loadImmediate(int xmm, double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        byte(0x48);  // mov rax, imm64
+        byte(0xB8);
+        u64(bits);
+        byte(0x66);  // movq xmm, rax
+        byte(0x48);
+        byte(0x0F);
+        byte(0x6E);
+        byte(static_cast<uint8_t>(0xC0 | (xmm << 3)));
+    }
+
+    // Calls an absolute address: rel32 if the target is within reach of the
+    // final code location, otherwise mov rax, imm64; call rax. Since the
+    // buffer address is not known yet, rel32 calls are recorded for patching.
+    void call(const void* target) {
+        _calls.push_back(Relocation{ bytes.size(), reinterpret_cast<uintptr_t>(target) });
+        // Emit the long form; relocate() may rewrite it in place into
+        // "call rel32" padded with a 7-byte nop.
+        byte(0x48);
+        byte(0xB8);
+        u64(reinterpret_cast<uintptr_t>(target));
+        byte(0xFF);  // call rax
+        byte(0xD0);
+    }
+
+    // Rewrites long calls into direct rel32 calls for a given load address.
+    void relocate(uintptr_t base) {
+        for (const Relocation& rel : _calls) {
+            uintptr_t next = base + rel.offset + 5;  // end of a 5-byte call rel32
+            auto delta = static_cast<int64_t>(rel.target - next);
+            if (delta != static_cast<int32_t>(delta)) {
+                continue;  // out of range: keep the absolute form
+            }
+            uint8_t* site = bytes.data() + rel.offset;
+            site[0] = 0xE8;
+            auto rel32 = static_cast<uint32_t>(static_cast<int32_t>(delta));
+            std::memcpy(site + 1, &rel32, sizeof(rel32));
+            // 7-byte nop: 0F 1F 80 00 00 00 00
+            const uint8_t nop7[] = { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 };
+            std::memcpy(site + 5, nop7, sizeof(nop7));
+        }
+    }
+
+private:
+    struct Relocation {
+        size_t offset;
+        uintptr_t target;
+    };
+    std::vector<Relocation> _calls;
+};
+
+// JitCompiler — emits native code for a Program.
+class JitCompiler {
+public:
+    // Maximum number of arguments passed in xmm registers by the ABI.
+    static constexpr uint32_t kMaxRegisterArgs = 8;
+
+    static std::optional<JitExpression> compile(const Program& prog) {
+        if (prog.code.empty()) {
+            return {};
+        }
+        for (const Callee& callee : prog.callees) {
+            if (callee.num_args > kMaxRegisterArgs) {
+                return {};
+            }
+        }
+        JitCompiler jit(prog);
+        jit.emitProgram();
+
+        // Map first to learn the final address, then patch calls and seal.
+        JitExpression result;
+        if (!result.buffer.reserve(jit._code.bytes.size())) {
+            return {};
+        }
+        jit._code.relocate(reinterpret_cast<uintptr_t>(result.buffer.data()));
+        if (!result.buffer.seal(jit._code.bytes)) {
+            return {};
+        }
+        result.function = reinterpret_cast<JitFunction>(const_cast<void*>(result.buffer.data()));
+        result.num_values = prog.code.size();
+        result.variables = prog.variables;
+        return result;
+    }
+
+private:
+    explicit JitCompiler(const Program& prog) : _prog(prog) {
+    }
+
+    using Memory = CodeBuffer::Memory;
+
+    static Memory value(uint32_t index) {
+        return Memory{ true, static_cast<int32_t>(8 * index) };
+    }
+
+    // Loads the result of instruction index into xmm register reg.
+    void load(int reg, uint32_t index) {
+        const Instruction& ins = _prog.code[index];
+        switch (ins.code) {
+            case OpCode::Constant: _code.loadImmediate(reg, _prog.constants[ins.lhs]); break;
+            case OpCode::Variable:
+                _code.sd(CodeBuffer::kMovLoad, reg, Memory{ false, static_cast<int32_t>(8 * ins.lhs) });
+                break;
+            default:
+                if (reg == 0 && _acc == index) {
+                    return;
+                }
+                _code.sd(CodeBuffer::kMovLoad, reg, value(index));
+                break;
+        }
+    }
+
+    // xmm0 = xmm0 OP operand.
+    void arith(uint8_t opcode, uint32_t index) {
+        const Instruction& ins = _prog.code[index];
+        switch (ins.code) {
+            case OpCode::Constant:
+                _code.loadImmediate(1, _prog.constants[ins.lhs]);
+                _code.sd(opcode, 0, 1);
+                break;
+            case OpCode::Variable:
+                _code.sd(opcode, 0, Memory{ false, static_cast<int32_t>(8 * ins.lhs) });
+                break;
+            default: _code.sd(opcode, 0, value(index)); break;
+        }
+    }
+
+    void binary(uint8_t opcode, const Instruction& ins) {
+        if (ins.rhs == _acc && ins.lhs != _acc) {
+            // The right operand is in xmm0; move it aside before loading lhs.
+            _code.movapd(1, 0);
+            load(0, ins.lhs);
+            _code.sd(opcode, 0, 1);
+            return;
+        }
+        load(0, ins.lhs);
+        arith(opcode, ins.rhs);
+    }
+
+    void emitProgram() {
+        // Prologue: keep slots/values in callee-saved registers, align rsp.
+        _code.byte(0x53);  // push rbx
+        _code.byte(0x41);  // push r13
+        _code.byte(0x55);
+        _code.byte(0x48);  // sub rsp, 8
+        _code.byte(0x83);
+        _code.byte(0xEC);
+        _code.byte(0x08);
+        _code.byte(0x48);  // mov rbx, rdi
+        _code.byte(0x89);
+        _code.byte(0xFB);
+        _code.byte(0x49);  // mov r13, rsi
+        _code.byte(0x89);
+        _code.byte(0xF5);
+
+        const auto& code = _prog.code;
+        for (uint32_t j = 0; j < code.size(); ++j) {
+            const Instruction& ins = code[j];
+            switch (ins.code) {
+                case OpCode::Constant:
+                case OpCode::Variable: continue;  // materialized by their users
+                case OpCode::Negate:
+                    load(0, ins.lhs);
+                    _code.loadImmediate(1, -0.0);
+                    _code.xorpd(0, 1);
+                    break;
+                case OpCode::Add: binary(CodeBuffer::kAdd, ins); break;
+                case OpCode::Subtract: binary(CodeBuffer::kSub, ins); break;
+                case OpCode::Multiply: binary(CodeBuffer::kMul, ins); break;
+                case OpCode::Divide: binary(CodeBuffer::kDiv, ins); break;
+                case OpCode::Call: {
+                    const Callee& callee = _prog.callees[ins.lhs];
+                    // Load every argument from memory (xmm0 may be overwritten
+                    // by argument 0 before a later argument reads it).
+                    _acc = kNone;
+                    for (uint32_t k = 0; k < callee.num_args; ++k) {
+                        load(static_cast<int>(k), _prog.arguments[ins.rhs + k]);
+                    }
+                    _code.call(reinterpret_cast<const void*>(callee.fnptr));
+                    break;
+                }
+                case OpCode::Sqrt:
+                    load(0, ins.lhs);
+                    _code.sd(CodeBuffer::kSqrt, 0, 0);
+                    break;
+                case OpCode::Abs:
+                    load(0, ins.lhs);
+                    _code.loadImmediate(1, -0.0);
+                    _code.andnpd(1, 0);
+                    _code.movapd(0, 1);
+                    break;
+                case OpCode::Min: binary(CodeBuffer::kMin, ins); break;
+                case OpCode::Max: binary(CodeBuffer::kMax, ins); break;
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Pow:
+                case OpCode::Floor:
+                    // No SSE2 instruction: call the C entry point directly.
+                    _acc = kNone;
+                    load(0, ins.lhs);
+                    load(1, ins.rhs);
+                    _code.call(reinterpret_cast<const void*>(intrinsicFunction(opcodeIntrinsic(ins.code))));
+                    break;
+            }
+            _acc = j;
+            _code.sd(CodeBuffer::kMovStore, 0, value(j));
+        }
+
+        // The root may be a leaf that was never loaded.
+        load(0, static_cast<uint32_t>(code.size() - 1));
+
+        // Epilogue.
+        _code.byte(0x48);  // add rsp, 8
+        _code.byte(0x83);
+        _code.byte(0xC4);
+        _code.byte(0x08);
+        _code.byte(0x41);  // pop r13
+        _code.byte(0x5D);
+        _code.byte(0x5B);  // pop rbx
+        _code.byte(0xC3);  // ret
+    }
+
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    const Program& _prog;
+    CodeBuffer _code;
+    uint32_t _acc = kNone;  // instruction whose result is currently in xmm0
+};
+
+#else
+
+// Native code generation is only implemented for x86-64.
+class JitCompiler {
+public:
+    static std::optional<JitExpression> compile(const Program& /*prog*/) {
+        return {};
+    }
+};
+
+#endif
+
+// TierPolicy — evaluation counts at which a TieredExpression promotes itself.
+struct TierPolicy {
+    size_t bytecode_after = 16;
+    size_t native_after = 1024;
+};
+
+// TieredExpression — evaluates an AST through the cheapest engine that has
+// paid off so far: tree walk, then bytecode, then native code. If a stage
+// cannot compile the expression, evaluation stays on the previous tier.
+class TieredExpression {
+public:
+    enum class Tier { Tree, Bytecode, Native };
+
+    TieredExpression(NodePtr ast, TierPolicy policy = TierPolicy{}) : _ast(std::move(ast)), _policy(policy) {
+    }
+
+    double calc() {
+        ++_count;
+        switch (_tier) {
+            case Tier::Native: return _native->calc();
+            case Tier::Bytecode:
+                if (_count > _policy.native_after && promoteNative()) {
+                    return _native->calc();
+                }
+                return _program->calc();
+            case Tier::Tree:
+                if (_count > _policy.bytecode_after && promoteBytecode()) {
+                    return _program->calc();
+                }
+                break;
+        }
+        return _ast->calc();
+    }
+
+    Tier tier() const {
+        return _tier;
+    }
+    size_t evaluations() const {
+        return _count;
+    }
+
+private:
+    bool promoteBytecode() {
+        _program = Compiler::compile(_ast);
+        if (!_program) {
+            _policy.bytecode_after = SIZE_MAX;  // do not retry
+            return false;
+        }
+        _tier = Tier::Bytecode;
+        return true;
+    }
+
+    bool promoteNative() {
+        _native = JitCompiler::compile(*_program);
+        if (!_native) {
+            _policy.native_after = SIZE_MAX;
+            return false;
+        }
+        _tier = Tier::Native;
+        return true;
+    }
+
+    NodePtr _ast;
+    TierPolicy _policy;
+    Tier _tier = Tier::Tree;
+    size_t _count = 0;
+    std::optional<Program> _program;
+    std::optional<JitExpression> _native;
+};
+
+}  // namespace Interpreter
@@ -10,7 +10,8 @@
 //   - StackSaver (RAII guard) ensures the iterator is restored on parse
 //     failure and committed only on success, preventing position leaks.
 //   - Predicate-driven scanning: test() and skip() accept callable objects
-//     (see Predicates.h) that classify characters.
+//     (see Predicates.h) that classify characters. skip() hands whitespace,
+//     digit and identifier runs to the vector scanner in Scan.h.
 //   - All parse methods return std::optional — empty means "no match" and
 //     the caller can try an alternative production.
 
@@ -19,14 +20,27 @@
 #include "Predicates.h"
 #include "TreeNodes.h"
 
-#include <cmath>
+#include <algorithm>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <optional>
 #include <stack>
+#include <string>
 #include <string_view>
+#include <system_error>
+#include <type_traits>
 
 namespace Interpreter {
 
+// Whether predicate type Fn has a static run(first, last) run scanner.
+template <typename Fn, typename = void>
+struct hasRun : std::false_type {};
+template <typename Fn>
+struct hasRun<Fn, std::void_t<decltype(Fn::run(static_cast<const char*>(nullptr), static_cast<const char*>(nullptr)))>>
+    : std::true_type {};
+
 // Lexer — character-level parsing engine with backtracking support.
 // Maintains a current position (iterator) into a string_view and a stack
 // of saved positions for speculative parsing.
@@ -116,12 +130,18 @@ public:
 
     // Consumes characters while the predicate holds, returning the matched
     // span as a string_view. Returns empty if no characters matched.
+    // Predicates with a run() (see Predicates.h) scan the whole run at once.
     template <typename Fn>
     std::optional<std::string_view> skip(Fn&& pred) {
         sviterator start = it;
-        for (; it != code.end(); ++it) {
-            if (!pred(*it)) {
-                break;
+        if constexpr (hasRun<std::decay_t<Fn>>::value) {
+            const char* first = code.data() + (it - code.begin());
+            it += pred.run(first, code.data() + code.size()) - first;
+        } else {
+            for (; it != code.end(); ++it) {
+                if (!pred(*it)) {
+                    break;
+                }
             }
         }
         if (it == start) {
@@ -154,51 +174,106 @@ public:
         return skip(isspace());
     }
 
-    // Multiplies val by 10^iexp using integer arithmetic (no floating point).
-    static size_t ipow10(size_t val, size_t iexp) {
-        for (; iexp > 0; --iexp) {
-            val = val * kDecimalBase;
-        }
-        return val;
-    }
+    // Largest number of decimal digits that always fits in a uint64_t.
+    static constexpr int kMaxMantissaDigits = 19;
+
+    // Exact powers of ten: every 10^k with k <= 22 is representable in a double.
+    static constexpr double kExactPowers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
 
-    // Parses a floating-point number: [+-]? digits ['.' digits]?
-    // Uses raw save/commit/restore instead of StackSaver because it needs
-    // to commit at two different points (integer-only vs decimal paths).
+    // Parses a floating-point number: [+-]? digits ['.' digits]? ([eE] [+-]? digits)?
+    //
+    // The digits are accumulated once into a 64-bit mantissa and a decimal
+    // exponent. When the mantissa is at most 2^53 and the exponent at most 22
+    // in magnitude, both are exact doubles and a single multiply or divide
+    // gives the correctly rounded result (Clinger's fast path), which covers
+    // nearly every literal written by hand. Anything else (long digit strings,
+    // large exponents) is handed to std::from_chars, which is also correctly
+    // rounded. An 'e' not followed by digits is left unconsumed.
     std::optional<double> parsedouble() {
-        save();
+        sviterator start = it;
         bool neg = false;
 
         // Optional leading sign.
         if (auto sgn = test(isany("+-"))) {
             neg = sgn.value() == '-';
         }
+        sviterator body = it;
 
-        if (auto sint = skip(isdigit())) {
-            size_t ival = svtoul(sint.value());  // integer part
-
-            // Try to consume a decimal point followed by fractional digits.
-            if (test(ischar('.'))) {
-                if (auto sfrac = skip(isdigit())) {
-                    size_t fval = svtoul(sfrac.value());  // fractional digits as int
-                    size_t len = sfrac.value().size();    // number of fractional digits
-                    ival = ipow10(ival, len);             // scale integer part up
-                    double dval =
-                        static_cast<double>(ival + fval) * pow(kDecimalBase, -static_cast<double>(len));  // combine and scale back down
-                    commit();
-                    return neg ? -dval : dval;
+        uint64_t mantissa = 0;
+        int digits = 0;        // significant digits accumulated in mantissa
+        int exponent = 0;      // decimal exponent applied to mantissa
+        bool inexact = false;  // digits beyond kMaxMantissaDigits were dropped
+        auto accumulate = [&](std::string_view run, bool fraction) {
+            for (char chr : run) {
+                if (digits < kMaxMantissaDigits) {
+                    mantissa = kDecimalBase * mantissa + static_cast<uint64_t>(chr - '0');
+                    digits += (mantissa != 0) ? 1 : 0;  // leading zeros are not significant
+                    exponent -= fraction ? 1 : 0;
+                } else {
+                    inexact = inexact || chr != '0';
+                    exponent += fraction ? 0 : 1;
                 }
             }
+        };
 
-            // No decimal point — return the integer part as double.
-            double dval = static_cast<double>(ival);
-            commit();
-            return neg ? -dval : dval;
+        auto sint = skip(isdigit());
+        if (!sint) {
+            // No digits found at all — restore position and signal failure.
+            it = start;
+            return {};
         }
+        accumulate(sint.value(), false);
 
-        // No digits found at all — restore position and signal failure.
-        restore();
-        return {};
+        // Optional fraction. A trailing '.' with no digits is accepted.
+        if (test(ischar('.'))) {
+            if (auto sfrac = skip(isdigit())) {
+                accumulate(sfrac.value(), true);
+            }
+        }
+
+        // Optional exponent, only if at least one digit follows.
+        sviterator mark = it;
+        if (test(isany("eE"))) {
+            bool eneg = false;
+            if (auto esgn = test(isany("+-"))) {
+                eneg = esgn.value() == '-';
+            }
+            if (auto sexp = skip(isdigit())) {
+                int evalue = 0;
+                for (char chr : sexp.value()) {
+                    // Saturate: anything this large over- or underflows anyway.
+                    evalue = std::min(static_cast<int>(kDecimalBase) * evalue + (chr - '0'), 100000);
+                }
+                exponent += eneg ? -evalue : evalue;
+            } else {
+                it = mark;
+            }
+        }
+
+        double dval;
+        constexpr uint64_t kMaxExactMantissa = uint64_t(1) << 53;
+        if (mantissa == 0 && !inexact) {
+            dval = 0.0;
+        } else if (!inexact && mantissa <= kMaxExactMantissa && exponent >= -22 && exponent <= 22) {
+            dval = static_cast<double>(mantissa);
+            dval = exponent < 0 ? dval / kExactPowers[-exponent] : dval * kExactPowers[exponent];
+        } else {
+            dval = slowdouble(std::string_view{ &*body, size_t(it - body) });
+        }
+        return neg ? -dval : dval;
+    }
+
+    // Correctly rounded conversion of an unsigned decimal literal.
+    static double slowdouble(std::string_view text) {
+        double dval = 0;
+        auto result = std::from_chars(text.data(), text.data() + text.size(), dval);
+        if (result.ec == std::errc::result_out_of_range) {
+            // libstdc++ reports subnormal results as out of range too; strtod
+            // returns the rounded value (or 0 / HUGE_VAL) in every such case.
+            return std::strtod(std::string(text).c_str(), nullptr);
+        }
+        return dval;
     }
 
     // Tries to consume an arithmetic operator (+, -, *, /) and returns the
@@ -0,0 +1,110 @@
+// MappedInput.h — Read-only view of a whole file or of standard input
+//
+// A regular file is mmap'd read-only and private, so its contents are paged
+// in on demand instead of being copied into a buffer; "-" reads standard
+// input to the end into an owned string. Either way text() covers the whole
+// input. The mapping starts on a page boundary, which lets binary formats
+// (Image.h) read aligned structures from it in place.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace Interpreter {
+
+// MappedInput — read-only view of a whole input file or of standard input.
+class MappedInput {
+public:
+    // Maps path, or reads stdin when path is "-". Returns empty on failure.
+    static std::optional<MappedInput> open(const char* path) {
+        MappedInput input;
+        if (strcmp(path, "-") == 0) {
+            char buffer[1 << 16];
+            size_t count;
+            while ((count = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+                input._copy.append(buffer, count);
+            }
+            if (ferror(stdin) != 0) {
+                return {};
+            }
+            input._text = input._copy;
+            return input;
+        }
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return {};
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return {};
+        }
+        auto size = static_cast<size_t>(info.st_size);
+        if (size > 0) {
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                return {};
+            }
+            madvise(addr, size, MADV_SEQUENTIAL);
+            input._mapped = addr;
+            input._size = size;
+            input._text = std::string_view(static_cast<const char*>(addr), size);
+        }
+        ::close(fd);
+        return input;
+    }
+
+    MappedInput(MappedInput&& rhs) noexcept {
+        *this = std::move(rhs);
+    }
+    MappedInput& operator=(MappedInput&& rhs) noexcept {
+        if (this != &rhs) {
+            unmap();
+            _copy = std::move(rhs._copy);
+            _mapped = std::exchange(rhs._mapped, nullptr);
+            _size = std::exchange(rhs._size, 0);
+            _text = _mapped != nullptr ? rhs._text : std::string_view(_copy);
+            rhs._text = {};
+        }
+        return *this;
+    }
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+
+    ~MappedInput() {
+        unmap();
+    }
+
+    std::string_view text() const {
+        return _text;
+    }
+
+private:
+    MappedInput() = default;
+
+    void unmap() {
+        if (_mapped != nullptr) {
+            munmap(_mapped, _size);
+            _mapped = nullptr;
+        }
+    }
+
+    std::string _copy;  // stdin contents
+    void* _mapped = nullptr;
+    size_t _size = 0;
+    std::string_view _text;
+};
+
+}  // namespace Interpreter
@@ -3,15 +3,30 @@
 // Every node in the expression tree inherits from Node and implements calc()
 // to evaluate its subtree. The Visitor interface enables tree traversal for
 // serialization, pretty-printing, or other AST transformations.
+//
+// Each node also carries a NodeKind tag, set by the constructor of its type
+// (TreeNodes.h), so that passes over the tree can switch on the kind instead
+// of trying dynamic_casts in turn, and nodeCast<U>() and Pointer::as<U>()
+// test a tag instead of walking RTTI. Node types outside TreeNodes.h keep the
+// Other tag and are downcast with dynamic_cast.
 
 #pragma once
 
 #include "Pointer.h"
 
+#include <cstdint>
+#include <type_traits>
+
 namespace Interpreter {
 
 struct Node;
 
+// NodeKind — the concrete type of a node. FunctionCall covers every
+// FunctionCallWithArgs<N>; IntrinsicCall is tagged on its own.
+enum class NodeKind : uint8_t {
+    Other, Constant, Variable, Parenthesis, UnaryOp, BinaryOp, Shared, DagRoot, FunctionCall, IntrinsicCall, WindowCall
+};
+
 // Visitor — interface for traversing the AST without modifying node classes.
 struct Visitor : public RefCounted {
     virtual void visit(Node*) = 0;
@@ -20,7 +35,9 @@ struct Visitor : public RefCounted {
 // Node — base class for all expression tree nodes.
 // Subclasses implement calc() to return the evaluated result of their subtree.
 struct Node : public RefCounted {
-    using RefCounted::RefCounted;
+    Node() = default;
+    explicit Node(NodeKind tag) : kind(tag) {
+    }
     virtual ~Node() {
     }
 
@@ -31,6 +48,41 @@ struct Node : public RefCounted {
     virtual void visit(Visitor& visitor) {
         visitor.visit(this);
     }
+
+    const NodeKind kind = NodeKind::Other;
+};
+
+// NodeKindTest<U> — the kinds a node of type U can have. Specialized in
+// TreeNodes.h for every tagged type (deriving from NodeKinds); other types
+// are not tagged.
+template <typename U>
+struct NodeKindTest {
+    static constexpr bool kTagged = false;
 };
 
+template <NodeKind... Kinds>
+struct NodeKinds {
+    static constexpr bool kTagged = true;
+    static constexpr bool matches(NodeKind kind) {
+        return ((kind == Kinds) || ...);
+    }
+};
+
+// Downcasts to a tagged node type are a tag comparison.
+template <typename U>
+struct Downcast<U, std::enable_if_t<NodeKindTest<U>::kTagged>> {
+    static U* from(Node* node) {
+        if (node != nullptr && NodeKindTest<U>::matches(node->kind)) {
+            return static_cast<U*>(node);
+        }
+        return nullptr;
+    }
+};
+
+// node as a U*, or null if it is not one.
+template <typename U>
+U* nodeCast(Node* node) {
+    return Downcast<U>::from(node);
+}
+
 }  // namespace Interpreter
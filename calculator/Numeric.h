@@ -0,0 +1,340 @@
+// Numeric.h — Value types for evaluation: double, float and decimal fixed point
+//
+// The parser, the tree and every Variable hold doubles, but evaluation does
+// not have to: the bytecode interpreter (Bytecode.h) and the batch evaluator
+// (Batch.h) are templates over the value type T, and calcAs<T>() walks a tree
+// in T. ValueTraits<T> supplies what they need beyond the arithmetic
+// operators:
+//
+//   fromDouble / toDouble   conversion at the edges: constants, variables
+//                           and the arguments and result of user functions
+//   intrinsic               applyIntrinsic() (Intrinsics.h) in T
+//
+// float halves the memory traffic and doubles the SIMD width of the batch
+// kernels, at 24 bits of precision. Fixed<Decimals> is an int64_t count of
+// 10^-Decimals units, so sums and differences of amounts such as 0.10 and
+// 0.20 are exact; products and quotients are rounded to the nearest unit,
+// halves away from zero. Its range is ±9.2e18 units (±9.2e14 at four
+// decimals) and, as with int64_t, overflow is not detected. Division by zero
+// saturates to the largest magnitude of the dividend's sign (0/0 is 0), since
+// there is no infinity or NaN to return.
+//
+// User functions are C functions of doubles (FunctionOps.h); callAs<T>()
+// converts their arguments to double and the result back, so they work with
+// every T but are only as exact as the conversion. Of the intrinsics, abs,
+// min, max and floor are computed in Fixed itself; sqrt, exp, log and pow
+// round trip through double.
+
+#pragma once
+
+#include "FunctionOps.h"
+#include "Intrinsics.h"
+#include "Node.h"
+#include "TreeNodes.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace Interpreter {
+
+// 10^exponent as an integer, for exponent in [0, 18].
+constexpr int64_t decimalScale(int exponent) {
+    int64_t scale = 1;
+    for (int j = 0; j < exponent; ++j) {
+        scale *= 10;
+    }
+    return scale;
+}
+
+// Fixed<Decimals> — signed decimal fixed-point number: raw / 10^Decimals.
+template <int Decimals>
+struct Fixed {
+    static_assert(Decimals >= 0 && Decimals <= 18, "Fixed holds at most 18 decimals in an int64_t");
+
+    static constexpr int64_t kScale = decimalScale(Decimals);
+
+    static constexpr Fixed fromRaw(int64_t raw) {
+        Fixed value;
+        value.raw = raw;
+        return value;
+    }
+
+    // Nearest representable value; NaN converts to 0 and values out of range
+    // saturate.
+    static Fixed fromDouble(double value) {
+        double scaled = value * static_cast<double>(kScale);
+        constexpr double kLimit = 9.2e18;
+        if (!(scaled > -kLimit)) {
+            return fromRaw(std::isnan(scaled) ? 0 : std::numeric_limits<int64_t>::min());
+        }
+        if (!(scaled < kLimit)) {
+            return fromRaw(std::numeric_limits<int64_t>::max());
+        }
+        return fromRaw(std::llround(scaled));
+    }
+
+    constexpr double toDouble() const {
+        return static_cast<double>(raw) / static_cast<double>(kScale);
+    }
+
+    constexpr Fixed operator-() const {
+        return fromRaw(-raw);
+    }
+
+    friend constexpr Fixed operator+(Fixed lhs, Fixed rhs) {
+        return fromRaw(lhs.raw + rhs.raw);
+    }
+    friend constexpr Fixed operator-(Fixed lhs, Fixed rhs) {
+        return fromRaw(lhs.raw - rhs.raw);
+    }
+    // The exact product or scaled dividend needs 128 bits in general, but
+    // 128-bit division is a library call; when it fits in 64 bits, as it
+    // does for everyday amounts, the division by kScale compiles to a
+    // multiply.
+    friend constexpr Fixed operator*(Fixed lhs, Fixed rhs) {
+        int64_t product = 0;
+        if (!__builtin_mul_overflow(lhs.raw, rhs.raw, &product)) {
+            return fromRaw(divideRounded<int64_t>(product, kScale));
+        }
+        return fromRaw(static_cast<int64_t>(divideRounded<__int128>(static_cast<__int128>(lhs.raw) * rhs.raw, kScale)));
+    }
+    friend constexpr Fixed operator/(Fixed lhs, Fixed rhs) {
+        if (rhs.raw == 0) {
+            return fromRaw(lhs.raw > 0 ? std::numeric_limits<int64_t>::max()
+                    : lhs.raw < 0      ? std::numeric_limits<int64_t>::min()
+                                       : 0);
+        }
+        int64_t scaled = 0;
+        // INT64_MIN / -1 and -INT64_MIN overflow in 64 bits.
+        bool wide = rhs.raw == -1 || rhs.raw == std::numeric_limits<int64_t>::min();
+        if (!wide && !__builtin_mul_overflow(lhs.raw, kScale, &scaled)) {
+            return fromRaw(divideRounded<int64_t>(scaled, rhs.raw));
+        }
+        return fromRaw(static_cast<int64_t>(divideRounded<__int128>(static_cast<__int128>(lhs.raw) * kScale, rhs.raw)));
+    }
+
+    friend constexpr bool operator==(Fixed lhs, Fixed rhs) {
+        return lhs.raw == rhs.raw;
+    }
+    friend constexpr bool operator!=(Fixed lhs, Fixed rhs) {
+        return lhs.raw != rhs.raw;
+    }
+    friend constexpr bool operator<(Fixed lhs, Fixed rhs) {
+        return lhs.raw < rhs.raw;
+    }
+    friend constexpr bool operator>(Fixed lhs, Fixed rhs) {
+        return lhs.raw > rhs.raw;
+    }
+
+    // Largest whole number not above this value.
+    constexpr Fixed floor() const {
+        int64_t whole = raw / kScale * kScale;
+        return fromRaw(whole > raw ? whole - kScale : whole);
+    }
+
+    int64_t raw = 0;
+
+private:
+    // num / den rounded to nearest, halves away from zero. The remainder is
+    // compared with den - |remainder| rather than doubled, which could
+    // overflow.
+    template <typename Int>
+    static constexpr Int divideRounded(Int num, Int den) {
+        Int quotient = num / den;
+        Int remainder = num % den;
+        Int magnitude = remainder < 0 ? -remainder : remainder;
+        Int divisor = den < 0 ? -den : den;
+        if (magnitude >= divisor - magnitude) {
+            quotient += (num < 0) == (den < 0) ? 1 : -1;
+        }
+        return quotient;
+    }
+};
+
+// ValueTraits<T> — conversions and intrinsics for evaluating in T.
+template <typename T>
+struct ValueTraits;
+
+template <>
+struct ValueTraits<double> {
+    static constexpr const char* kName = "double";
+    static double fromDouble(double value) {
+        return value;
+    }
+    static double toDouble(double value) {
+        return value;
+    }
+    static double intrinsic(Intrinsic op, double lhs, double rhs) {
+        return applyIntrinsic(op, lhs, rhs);
+    }
+};
+
+template <>
+struct ValueTraits<float> {
+    static constexpr const char* kName = "float";
+    static float fromDouble(double value) {
+        return static_cast<float>(value);
+    }
+    static double toDouble(float value) {
+        return value;
+    }
+    // The float overloads of <cmath>, with the same min/max as applyIntrinsic().
+    static float intrinsic(Intrinsic op, float lhs, float rhs) {
+        switch (op) {
+            case Intrinsic::Sqrt: return std::sqrt(lhs);
+            case Intrinsic::Exp: return std::exp(lhs);
+            case Intrinsic::Log: return std::log(lhs);
+            case Intrinsic::Pow: return std::pow(lhs, rhs);
+            case Intrinsic::Abs: return std::fabs(lhs);
+            case Intrinsic::Min: return lhs < rhs ? lhs : rhs;
+            case Intrinsic::Max: return lhs > rhs ? lhs : rhs;
+            case Intrinsic::Floor: return std::floor(lhs);
+            case Intrinsic::None: break;
+        }
+        return 0;
+    }
+};
+
+template <int Decimals>
+struct ValueTraits<Fixed<Decimals>> {
+    using Value = Fixed<Decimals>;
+    static constexpr const char* kName = "fixed";
+    static Value fromDouble(double value) {
+        return Value::fromDouble(value);
+    }
+    static double toDouble(Value value) {
+        return value.toDouble();
+    }
+    static Value intrinsic(Intrinsic op, Value lhs, Value rhs) {
+        switch (op) {
+            case Intrinsic::Abs: return lhs < Value() ? -lhs : lhs;
+            case Intrinsic::Min: return lhs < rhs ? lhs : rhs;
+            case Intrinsic::Max: return lhs > rhs ? lhs : rhs;
+            case Intrinsic::Floor: return lhs.floor();
+            case Intrinsic::Sqrt:
+            case Intrinsic::Exp:
+            case Intrinsic::Log:
+            case Intrinsic::Pow:
+                return Value::fromDouble(applyIntrinsic(op, lhs.toDouble(), rhs.toDouble()));
+            case Intrinsic::None: break;
+        }
+        return Value();
+    }
+};
+
+// Calls a user function on size values of T (see callfn()).
+template <typename T>
+inline T callAs(FnPtr func, const T* args, size_t size) {
+    if constexpr (std::is_same_v<T, double>) {
+        return callfn(func, args, size);
+    } else {
+        std::array<double, MAX_FN_ARGS> values;
+        for (size_t j = 0; j < size && j < MAX_FN_ARGS; ++j) {
+            values[j] = ValueTraits<T>::toDouble(args[j]);
+        }
+        return ValueTraits<T>::fromDouble(callfn(func, values.data(), size));
+    }
+}
+
+template <typename T>
+T calcAs(Node* node);
+
+// Operand of an operator: leaves are read in place, so the half of the
+// nodes that are leaves cost neither a call nor the shared jump table of
+// calcAs().
+template <typename T>
+inline T operandAs(Node* node) {
+    if (node->kind == NodeKind::Variable) {
+        return ValueTraits<T>::fromDouble(static_cast<Variable*>(node)->value);
+    }
+    if (node->kind == NodeKind::Constant) {
+        return ValueTraits<T>::fromDouble(static_cast<Constant*>(node)->value);
+    }
+    return calcAs<T>(node);
+}
+
+// Calls and DAG nodes of calcAs(), kept out of line so that the argument
+// array does not enlarge the frame of every recursive calcAs() call.
+template <typename T>
+T calcCallAs(FunctionCall* call) {
+    size_t arity = call->arity();
+    std::array<T, MAX_FN_ARGS> args;
+    for (size_t j = 0; j < arity && j < MAX_FN_ARGS; ++j) {
+        args[j] = operandAs<T>(call->argument(j).get());
+    }
+    if (call->intrinsic != Intrinsic::None) {
+        return ValueTraits<T>::intrinsic(call->intrinsic, args[0], arity > 1 ? args[1] : T());
+    }
+    return callAs<T>(call->fnptr, args.data(), arity);
+}
+
+template <typename T>
+T calcSharedAs(Shared* shared) {
+    if constexpr (std::is_same_v<T, double>) {
+        if (shared->seen != shared->epoch->value) {
+            shared->value = calcAs<T>(shared->node.get());
+            shared->seen = shared->epoch->value;
+        }
+        return shared->value;
+    } else {
+        return calcAs<T>(shared->node.get());
+    }
+}
+
+// Evaluates the tree rooted at node in T, reading constants and variables
+// through ValueTraits<T>::fromDouble(). This is the tree walk with one switch
+// on NodeKind per node instead of a virtual calc() call; calcAs<double>()
+// returns what node->calc() does, including the once-per-DagRoot evaluation
+// of Shared subtrees. In other types a Shared subtree is evaluated at each
+// use, as the tree it stands for would be. A WindowCall keeps its window in
+// double whatever T is. Untagged nodes (NodeKind::Other) are evaluated with
+// calc().
+template <typename T>
+T calcAs(Node* node) {
+    switch (node->kind) {
+        case NodeKind::BinaryOp: {
+            auto* binop = static_cast<BinaryOp*>(node);
+            T lhs = operandAs<T>(binop->left.get());
+            T rhs = operandAs<T>(binop->right.get());
+            switch (binop->op) {
+                case BinaryOp::Operation::Addition: return lhs + rhs;
+                case BinaryOp::Operation::Subtraction: return lhs - rhs;
+                case BinaryOp::Operation::Multiplication: return lhs * rhs;
+                case BinaryOp::Operation::Division: return lhs / rhs;
+                case BinaryOp::Operation::NA: break;
+            }
+            return T();
+        }
+        case NodeKind::Variable: return ValueTraits<T>::fromDouble(static_cast<Variable*>(node)->value);
+        case NodeKind::Constant: return ValueTraits<T>::fromDouble(static_cast<Constant*>(node)->value);
+        case NodeKind::Parenthesis: return calcAs<T>(static_cast<Parenthesis*>(node)->node.get());
+        case NodeKind::UnaryOp: {
+            auto* uop = static_cast<UnaryOp*>(node);
+            T value = operandAs<T>(uop->node.get());
+            return uop->op == UnaryOp::Operation::Negative ? -value : value;
+        }
+        case NodeKind::FunctionCall:
+        case NodeKind::IntrinsicCall: return calcCallAs<T>(static_cast<FunctionCall*>(node));
+        case NodeKind::Shared: return calcSharedAs<T>(static_cast<Shared*>(node));
+        case NodeKind::WindowCall: {
+            auto* window = static_cast<WindowCall*>(node);
+            T value = calcAs<T>(window->argument.get());
+            return ValueTraits<T>::fromDouble(window->window.push(ValueTraits<T>::toDouble(value)));
+        }
+        case NodeKind::DagRoot: {
+            auto* root = static_cast<DagRoot*>(node);
+            if constexpr (std::is_same_v<T, double>) {
+                ++root->epoch->value;
+            }
+            return calcAs<T>(root->node.get());
+        }
+        case NodeKind::Other: break;
+    }
+    return ValueTraits<T>::fromDouble(node->calc());
+}
+
+}  // namespace Interpreter
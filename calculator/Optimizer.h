@@ -0,0 +1,321 @@
+// Optimizer.h — Constant folding and common-subexpression elimination
+//
+// A Visitor that rewrites an AST into an equivalent, cheaper DAG in one
+// post-order pass:
+//
+//   - Constant folding: a UnaryOp or BinaryOp whose operands are all
+//     constants is replaced by a single Constant, so "(2*3.5)/7" becomes 1.
+//   - Parenthesis removal: grouping is already encoded in the tree shape,
+//     so Parenthesis nodes are dropped instead of costing a virtual hop.
+//   - Hash-consing: structurally identical subtrees are merged into one node,
+//     keyed by operator and (already merged) child addresses. Variables are
+//     interned by the parser, so "x*y + x*y" shares a single "x*y".
+//
+// Interior nodes that end up with more than one parent are wrapped in a
+// Shared node and the result is rooted in a DagRoot, so the tree walk
+// evaluates each shared subtree once per calc(). Compiler (Bytecode.h)
+// treats both wrappers as transparent and emits shared subtrees once.
+//
+// merge() hash-conses several trees against one table instead, so that a
+// subtree occurring in more than one of them becomes a single node; compiled
+// together (FormulaSet, Formulas.h) it is then evaluated once for all.
+//
+// The input tree is never modified; all rewritten nodes are new. Function
+// calls are assumed pure (all registered functions are math functions) and
+// are merged and folded like operators unless Options::pure_functions is off.
+// Window aggregates (WindowCall) are not pure: each is copied with an empty
+// window and neither folded nor merged.
+
+#pragma once
+
+#include "Calculator.h"
+#include "Node.h"
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <boost/container_hash/hash.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// Optimizer — rewrites an AST into a folded, hash-consed DAG.
+struct Optimizer : public Visitor {
+
+    struct Options {
+        bool pure_functions = true;  // allow folding and merging of calls
+    };
+
+    // What the last optimize() call changed.
+    struct Stats {
+        size_t folded = 0;     // operator/call nodes replaced by a constant
+        size_t unwrapped = 0;  // Parenthesis nodes removed
+        size_t merged = 0;     // nodes found identical to an existing one
+        size_t shared = 0;     // Shared wrappers inserted
+    };
+
+    Optimizer() = default;
+    explicit Optimizer(Options options) : _options(options) {
+    }
+
+    // Returns the optimized equivalent of root (null for a null root).
+    NodePtr optimize(const NodePtr& root) {
+        _stats = Stats{};
+        if (!root) {
+            return {};
+        }
+        visit(root.get());
+        NodePtr dag = std::move(_result);
+        bool shared = share(dag);
+        _unique.clear();
+        _rewritten.clear();
+        _parents.clear();
+        if (!shared) {
+            return dag;
+        }
+        return NodePtr(new DagRoot(dag, std::move(_epoch)));
+    }
+
+    // Optimizes several trees with one hash-consing table and returns their
+    // rewritten roots in order (null for a null root). Subtrees equal across
+    // roots become the same node. No Shared wrappers are inserted: the result
+    // is meant for Compiler, which emits every node once, while calc() on a
+    // returned root would evaluate a shared subtree once per parent.
+    std::vector<NodePtr> merge(const std::vector<NodePtr>& roots) {
+        _stats = Stats{};
+        std::vector<NodePtr> result;
+        result.reserve(roots.size());
+        for (const NodePtr& root : roots) {
+            if (root) {
+                visit(root.get());
+            }
+            result.push_back(root ? std::move(_result) : NodePtr());
+        }
+        _unique.clear();
+        _rewritten.clear();
+        return result;
+    }
+
+    // Convenience wrapper with default options.
+    static NodePtr run(const NodePtr& root) {
+        Optimizer optimizer;
+        return optimizer.optimize(root);
+    }
+
+    const Stats& stats() const {
+        return _stats;
+    }
+
+    // Rewrites one node (after its children) and leaves the result in _result.
+    void visit(Node* node) override {
+        auto iter = _rewritten.find(node);
+        if (iter != _rewritten.end()) {
+            _result = iter->second;
+            return;
+        }
+        _result = rewrite(node);
+        _rewritten.emplace(node, _result);
+    }
+
+private:
+    using Key = std::vector<uintptr_t>;
+
+    // Key tags, one per kind of node that can be hash-consed.
+    enum class Tag : uintptr_t { Constant, Negate, Binary, Call };
+
+    NodePtr optimized(Node* node) {
+        visit(node);
+        return _result;
+    }
+
+    static bool isConstant(const NodePtr& node, double& value) {
+        if (auto* cst = nodeCast<Constant>(node.get())) {
+            value = cst->value;
+            return true;
+        }
+        return false;
+    }
+
+    // Returns the existing node equal to key, or registers and returns fresh.
+    NodePtr intern(Key key, const NodePtr& fresh) {
+        auto found = _unique.find(key);
+        if (found != _unique.end()) {
+            ++_stats.merged;
+            return found->second;
+        }
+        _unique.emplace(std::move(key), fresh);
+        return fresh;
+    }
+
+    NodePtr constant(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        auto found = _unique.find(Key{ uintptr_t(Tag::Constant), uintptr_t(bits) });
+        if (found != _unique.end()) {
+            return found->second;
+        }
+        NodePtr node(new Constant(value));
+        _unique.emplace(Key{ uintptr_t(Tag::Constant), uintptr_t(bits) }, node);
+        return node;
+    }
+
+    NodePtr rewrite(Node* node) {
+        if (auto* cst = nodeCast<Constant>(node)) {
+            return constant(cst->value);
+        }
+        if (nodeCast<Variable>(node) != nullptr) {
+            return NodePtr(node);  // already interned by the parser
+        }
+        if (auto* paren = nodeCast<Parenthesis>(node)) {
+            ++_stats.unwrapped;
+            return optimized(paren->node.get());
+        }
+        if (auto* shared = nodeCast<Shared>(node)) {
+            return optimized(shared->node.get());
+        }
+        if (auto* root = nodeCast<DagRoot>(node)) {
+            return optimized(root->node.get());
+        }
+        if (auto* uop = nodeCast<UnaryOp>(node)) {
+            NodePtr operand = optimized(uop->node.get());
+            if (uop->op != UnaryOp::Operation::Negative) {
+                return operand;
+            }
+            double value;
+            if (isConstant(operand, value)) {
+                ++_stats.folded;
+                return constant(-value);
+            }
+            auto* neg = new UnaryOp;
+            neg->op = UnaryOp::Operation::Negative;
+            neg->node = operand;
+            return intern(Key{ uintptr_t(Tag::Negate), uintptr_t(operand.get()) }, NodePtr(neg));
+        }
+        if (auto* binop = nodeCast<BinaryOp>(node)) {
+            NodePtr lhs = optimized(binop->left.get());
+            NodePtr rhs = optimized(binop->right.get());
+            NodePtr fresh(new BinaryOp(binop->op, lhs, rhs));
+            double lval;
+            double rval;
+            if (isConstant(lhs, lval) && isConstant(rhs, rval)) {
+                ++_stats.folded;
+                return constant(fresh->calc());
+            }
+            Key key{ uintptr_t(Tag::Binary), uintptr_t(binop->op), uintptr_t(lhs.get()), uintptr_t(rhs.get()) };
+            return intern(std::move(key), fresh);
+        }
+        if (auto* call = nodeCast<FunctionCall>(node)) {
+            size_t arity = call->arity();
+            std::vector<NodePtr> args(arity);
+            bool allconst = true;
+            for (size_t j = 0; j < arity; ++j) {
+                args[j] = optimized(call->argument(j).get());
+                double value;
+                allconst = allconst && isConstant(args[j], value);
+            }
+            NodePtr fresh = makeCall(nullptr, call->fnptr, call->intrinsic, args);
+            if (!_options.pure_functions) {
+                return fresh;
+            }
+            if (allconst) {
+                ++_stats.folded;
+                return constant(fresh->calc());
+            }
+            Key key{ uintptr_t(Tag::Call), reinterpret_cast<uintptr_t>(call->fnptr) };
+            for (const NodePtr& arg : args) {
+                key.push_back(uintptr_t(arg.get()));
+            }
+            return intern(std::move(key), fresh);
+        }
+        if (auto* window = nodeCast<WindowCall>(node)) {
+            // Stateful: every window keeps its own samples, so it is never
+            // folded or merged, even over a constant argument.
+            NodePtr argument = optimized(window->argument.get());
+            return NodePtr(new WindowCall(window->op(), window->length(), argument));
+        }
+        // Unknown node types are kept as opaque leaves.
+        return NodePtr(node);
+    }
+
+    // Returns the children of a rewritten interior node, or an empty list.
+    static std::vector<NodePtr*> children(Node* node) {
+        std::vector<NodePtr*> result;
+        if (auto* uop = nodeCast<UnaryOp>(node)) {
+            result.push_back(&uop->node);
+        } else if (auto* binop = nodeCast<BinaryOp>(node)) {
+            result.push_back(&binop->left);
+            result.push_back(&binop->right);
+        } else if (auto* call = nodeCast<FunctionCall>(node)) {
+            for (size_t j = 0; j < call->arity(); ++j) {
+                result.push_back(&call->argument(j));
+            }
+        } else if (auto* window = nodeCast<WindowCall>(node)) {
+            result.push_back(&window->argument);
+        }
+        return result;
+    }
+
+    // Counts parents of every interior node reachable from node.
+    void countParents(Node* node) {
+        for (NodePtr* child : children(node)) {
+            Node* target = child->get();
+            if (children(target).empty()) {
+                continue;  // leaves are as cheap as a memo lookup
+            }
+            if (++_parents[target] == 1) {
+                countParents(target);
+            }
+        }
+    }
+
+    // Wraps every interior node with several parents in one Shared node.
+    // Returns whether any Shared node was inserted.
+    bool share(const NodePtr& root) {
+        countParents(root.get());
+        std::unordered_map<Node*, NodePtr> wrappers;
+        for (const auto& entry : _parents) {
+            if (entry.second > 1) {
+                wrappers.emplace(entry.first, NodePtr());
+            }
+        }
+        if (wrappers.empty()) {
+            return false;
+        }
+        _epoch = Pointer<Epoch>(new Epoch);
+        for (auto& entry : wrappers) {
+            entry.second = NodePtr(new Shared(NodePtr(entry.first), _epoch));
+            ++_stats.shared;
+        }
+        // All interior nodes were created by rewrite(), so relinking the
+        // children in place does not touch the caller's tree.
+        for (const auto& entry : _parents) {
+            for (NodePtr* child : children(entry.first)) {
+                auto wrapper = wrappers.find(child->get());
+                if (wrapper != wrappers.end()) {
+                    *child = wrapper->second;
+                }
+            }
+        }
+        for (NodePtr* child : children(root.get())) {
+            auto wrapper = wrappers.find(child->get());
+            if (wrapper != wrappers.end()) {
+                *child = wrapper->second;
+            }
+        }
+        return true;
+    }
+
+    Options _options;
+    Stats _stats;
+    NodePtr _result;
+    Pointer<Epoch> _epoch;
+    std::unordered_map<Key, NodePtr, boost::hash<Key>> _unique;  // hash-consing table
+    std::unordered_map<Node*, NodePtr> _rewritten;                // input node → output
+    std::unordered_map<Node*, size_t> _parents;                   // interior node → parent count
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,133 @@
+// ParseCache.h — Bounded LRU cache of parsed expressions
+//
+// Maps expression text to the AST (and optionally the bytecode) built from
+// it, so repeated calls with the same text skip the backtracking parse.
+//
+// The index is keyed by std::string_view pointing at the text stored inside
+// each entry, so a lookup hashes the caller's string_view directly: a hit is
+// one hash probe plus a list splice, with no allocation. Entries are
+// RefCounted and handed out as Pointer<CachedExpression>, so a caller may keep
+// using an expression after it has been evicted.
+//
+// Cached trees share the interned Variable nodes of the owning Calculator, so
+// assigning a variable affects every cached expression that references it.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "Calculator.h"
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <cstddef>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Interpreter {
+
+// CachedExpression — one cache entry: the source text, its AST and, when
+// the cache compiles on insert, its bytecode.
+struct CachedExpression : public RefCounted {
+    CachedExpression(std::string_view text) : code(text) {
+    }
+    std::string code;
+    NodePtr ast;
+    std::optional<Program> program;
+
+    // Evaluates through the bytecode when available, else the tree.
+    double calc() const {
+        return program ? program->calc() : ast->calc();
+    }
+};
+
+// Counters for sizing the cache. evictions counts entries dropped to stay
+// within capacity; failed parses are counted as misses and never cached.
+struct ParseCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+};
+
+// ParseCache — LRU cache in front of Calculator::parse().
+class ParseCache {
+public:
+    ParseCache(Calculator& calc, size_t capacity, bool compile = false)
+        : _calc(calc), _capacity(capacity == 0 ? 1 : capacity), _compile(compile) {
+        _index.reserve(_capacity);
+    }
+
+    ParseCache(const ParseCache&) = delete;
+    ParseCache& operator=(const ParseCache&) = delete;
+
+    // Returns the cached expression for code, parsing (and compiling) it on a
+    // miss. Returns null if the text does not parse.
+    Pointer<CachedExpression> get(std::string_view code) {
+        auto iter = _index.find(code);
+        if (iter != _index.end()) {
+            ++_stats.hits;
+            _entries.splice(_entries.begin(), _entries, iter->second);
+            return *iter->second;
+        }
+        ++_stats.misses;
+        NodePtr ast = _calc.parse(code);
+        if (!ast) {
+            return {};
+        }
+        Pointer<CachedExpression> entry(new CachedExpression(code));
+        entry->ast = std::move(ast);
+        if (_compile) {
+            entry->program = Compiler::compile(entry->ast);
+        }
+        if (_index.size() >= _capacity) {
+            evict();
+        }
+        _entries.push_front(entry);
+        _index.emplace(std::string_view(entry->code), _entries.begin());
+        return entry;
+    }
+
+    // Returns the cached expression without parsing, or null on a miss.
+    // Does not update the counters or the recency order.
+    Pointer<CachedExpression> peek(std::string_view code) const {
+        auto iter = _index.find(code);
+        return iter != _index.end() ? *iter->second : Pointer<CachedExpression>();
+    }
+
+    // Drops all entries. Counters are kept.
+    void clear() {
+        _index.clear();
+        _entries.clear();
+    }
+
+    size_t size() const {
+        return _index.size();
+    }
+    size_t capacity() const {
+        return _capacity;
+    }
+    const ParseCacheStats& stats() const {
+        return _stats;
+    }
+
+private:
+    using EntryList = std::list<Pointer<CachedExpression>>;
+
+    // Removes the least recently used entry.
+    void evict() {
+        _index.erase(std::string_view(_entries.back()->code));
+        _entries.pop_back();
+        ++_stats.evictions;
+    }
+
+    Calculator& _calc;
+    size_t _capacity;
+    bool _compile;
+    EntryList _entries;  // most recently used first
+    std::unordered_map<std::string_view, EntryList::iterator> _index;
+    ParseCacheStats _stats;
+};
+
+}  // namespace Interpreter
@@ -4,11 +4,18 @@
 // top of boost::intrusive_ptr. Objects managed by Pointer<T> must inherit from
 // RefCounted, which embeds the reference counter directly in the object (no
 // separate control block), giving cache-friendly single-allocation semantics.
+//
+// Two counting policies are available: RefCounted uses a plain int and is
+// meant for objects owned by one thread (the AST), while AtomicRefCounted uses
+// an atomic counter so that a Pointer can be copied and released from several
+// threads at once (compiled expressions shared between workers).
 
 #pragma once
 
 #include <boost/smart_ptr/intrusive_ptr.hpp>
 
+#include <atomic>
+
 namespace Interpreter {
 
 //--------------------------------------------------
@@ -17,6 +24,17 @@ namespace Interpreter {
 template <typename T>
 using IntrusivePointer = boost::intrusive_ptr<T>;
 
+// Downcast<U> — how Pointer::as() converts to U*. The default is
+// dynamic_cast; Node.h specializes it for node types that carry a kind tag,
+// which are tested with one comparison instead of an RTTI lookup.
+template <typename U, typename Enable = void>
+struct Downcast {
+    template <typename T>
+    static U* from(T* ptr) {
+        return dynamic_cast<U*>(ptr);
+    }
+};
+
 // Pointer<T> — extends boost::intrusive_ptr with a safe downcast helper
 // and equality comparison for use in hash containers.
 template <typename T>
@@ -24,10 +42,11 @@ class Pointer : public IntrusivePointer<T> {
 public:
     using IntrusivePointer<T>::IntrusivePointer;
 
-    // Attempts a dynamic_cast to Pointer<U>. Returns null Pointer on failure.
+    // Attempts a downcast to Pointer<U> (see Downcast). Returns null Pointer
+    // on failure.
     template <typename U>
     Pointer<U> as() const {
-        U* ptr = dynamic_cast<U*>(this->get());
+        U* ptr = Downcast<U>::from(this->get());
         if (ptr != nullptr) {
             return Pointer<U>(ptr);
         }
@@ -43,6 +62,8 @@ public:
 // RefCounted — base class for all objects managed by Pointer<T>.
 // Embeds a non-atomic reference counter (single-threaded use only).
 // Copy and move are deleted to prevent accidental counter duplication.
+// Objects placed in an Arena (Arena.h) are flagged so that releasing the
+// last reference runs the destructor without freeing the memory.
 struct RefCounted {
     RefCounted() = default;
     virtual ~RefCounted() = default;
@@ -61,10 +82,40 @@ struct RefCounted {
             ptr->_counter--;
             return;
         }
+        if (ptr->_arena) {
+            // The owning Arena reclaims the memory in bulk.
+            ptr->~RefCounted();
+            return;
+        }
         delete ptr;
     }
 
     int _counter = 0;
+    bool _arena = false;  // memory owned by an Arena, not the heap
+};
+
+// AtomicRefCounted — base class for objects shared between threads.
+// Same contract as RefCounted, but the counter is atomic: increments are
+// relaxed and the final decrement synchronizes with every earlier release,
+// so the deleting thread sees all writes made through other references.
+// Arena placement is not supported.
+struct AtomicRefCounted {
+    AtomicRefCounted() = default;
+    virtual ~AtomicRefCounted() = default;
+    AtomicRefCounted(const AtomicRefCounted&) = delete;
+    AtomicRefCounted(AtomicRefCounted&&) = delete;
+
+    friend void intrusive_ptr_add_ref(AtomicRefCounted* ptr) {
+        ptr->_counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(AtomicRefCounted* ptr) {
+        if (ptr->_counter.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete ptr;
+        }
+    }
+
+    std::atomic<int> _counter{ 0 };
 };
 
 }  // namespace Interpreter
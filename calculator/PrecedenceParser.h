@@ -0,0 +1,317 @@
+// PrecedenceParser.h — Single-pass operator-precedence parser
+//
+// An alternative to Calculator::parse() that builds the AST in one left-to-
+// right scan with explicit operand and operator stacks (the iterative form of
+// precedence climbing, a.k.a. shunting-yard). Every token is pushed and
+// reduced exactly once, so parse time is linear in the input and the native
+// call stack does not grow with the number of operators or nesting depth.
+// There is no backtracking and no post-parse tree rotation.
+//
+// Grammar accepted:
+//   expression = operand (arithop operand)*
+//   operand    = [+-]* ( number | identifier | call | '(' expression ')' )
+//   call       = identifier '(' [expression (',' expression)*] ')'
+//
+// Differences from Calculator::parse():
+//   - Operators of equal precedence associate to the left, so "10-2+3" is 11
+//     (the rotating parser yields 5).
+//   - Whitespace is allowed between any two tokens.
+//   - Function calls are recognized; prefix +/- is accepted before any
+//     operand, not only numeric literals (a signed literal still folds into
+//     its Constant, as in parsedouble()).
+//   - A dangling operator or unbalanced '(' fails the whole parse instead of
+//     returning the longest valid prefix.
+//
+// Nodes come from the Calculator: variables are interned in its map, calls
+// resolve through createCall() (window aggregates, then functions), and an
+// active arena is honoured through Calculator::make().
+//
+// With profiling compiled in (Profiler.h) and Calculator::_spans set, the
+// parser also records the source span of every operator, call and
+// parenthesis node, tracking the span of each pending operand on a stack
+// parallel to the operand stack.
+
+#pragma once
+
+#include "Arena.h"
+#include "Calculator.h"
+#include "Predicates.h"
+#include "TreeNodes.h"
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// PrecedenceParser — iterative parser sharing a Calculator's symbol tables.
+struct PrecedenceParser {
+    PrecedenceParser(Calculator& calc) : _calc(calc) {
+    }
+
+    // Parses the longest expression at the start of code and stops at the
+    // first token that cannot continue it, leaving _calc.it there. Returns
+    // null if code does not start with an expression.
+    NodePtr parse(std::string_view code) {
+        _calc.reset(code);
+        _operands.clear();
+        _operators.clear();
+        _spans.clear();
+        NodePtr result = expression();
+        _operands.clear();
+        _operators.clear();
+        return result;
+    }
+
+    // Parses into a caller-provided arena (see Calculator::parse(code, arena)).
+    NodePtr parse(std::string_view code, Arena& arena) {
+        Calculator::ArenaSaver saver(_calc, arena);
+        return parse(code);
+    }
+
+    // Parses code as exactly one expression. Returns null on a syntax error
+    // or if anything but whitespace follows the expression.
+    NodePtr parseAll(std::string_view code) {
+        return complete(parse(code));
+    }
+    NodePtr parseAll(std::string_view code, Arena& arena) {
+        return complete(parse(code, arena));
+    }
+
+private:
+    // root if the parse consumed all of the input, otherwise null.
+    NodePtr complete(NodePtr root) {
+        _calc.skipws();
+        if (!root || _calc.it != _calc.code.end()) {
+            return {};
+        }
+        return root;
+    }
+
+    // Pending operator on the stack, waiting for its right operand(s).
+    struct Frame {
+        enum class Kind { Binary, Negate, Group, Call };
+        Kind kind = Kind::Binary;
+        BinaryOp::Operation op = BinaryOp::Operation::NA;
+        std::string_view name = {};  // function name for Call
+        size_t base = 0;             // operand stack size when a Call was opened
+        uint32_t begin = 0;          // source offset of '-', '(' or the call name
+    };
+
+    // Prefix operators bind tighter than any binary operator.
+    static constexpr int kUnaryPrecedence = 3;
+
+    static int precedence(const Frame& frame) {
+        switch (frame.kind) {
+            case Frame::Kind::Binary: return BinaryOp::precedence(frame.op);
+            case Frame::Kind::Negate: return kUnaryPrecedence;
+            case Frame::Kind::Group:
+            case Frame::Kind::Call: break;
+        }
+        return 0;  // barriers: never reduced by an operator
+    }
+
+    // Pops the top operator and combines its operands into a node.
+    void reduce() {
+        Frame frame = _operators.back();
+        _operators.pop_back();
+        if (frame.kind == Frame::Kind::Negate) {
+            Pointer<UnaryOp> uop = _calc.make<UnaryOp>();
+            uop->op = UnaryOp::Operation::Negative;
+            uop->node = std::move(_operands.back());
+            _operands.back() = uop;
+            if (recording()) {
+                _spans.back().begin = frame.begin;
+                record(uop.get(), _spans.back());
+            }
+            return;
+        }
+        NodePtr rhs = std::move(_operands.back());
+        _operands.pop_back();
+        _operands.back() = _calc.make<BinaryOp>(frame.op, _operands.back(), rhs);
+        if (recording()) {
+            uint32_t end = _spans.back().end;
+            _spans.pop_back();
+            _spans.back().end = end;
+            record(_operands.back().get(), _spans.back());
+        }
+    }
+
+    // Reduces every operator that binds at least as tightly as minprec.
+    void reduceWhile(int minprec) {
+        while (!_operators.empty() && precedence(_operators.back()) >= minprec
+            && precedence(_operators.back()) > 0) {
+            reduce();
+        }
+    }
+
+    // Parses one operand, pushing prefix operators and openers as needed.
+    // Returns false on a syntax error; sets expect_operand to false once a
+    // complete operand has been pushed.
+    bool operand(bool& expect_operand) {
+        Calculator& calc = _calc;
+        uint32_t begin = position();
+        if (auto dbl = calc.parsedouble()) {
+            _operands.push_back(calc.make<Constant>(dbl.value()));
+            pushSpan(begin, position());
+            expect_operand = false;
+            return true;
+        }
+        if (auto sign = calc.test(isany("+-"))) {
+            if (sign.value() == '-') {
+                Frame frame{ Frame::Kind::Negate };
+                frame.begin = begin;
+                _operators.push_back(frame);
+            }
+            return true;
+        }
+        if (calc.test(ischar('('))) {
+            Frame frame{ Frame::Kind::Group };
+            frame.begin = begin;
+            _operators.push_back(frame);
+            return true;
+        }
+        if (auto name = calc.skip(isidentifier())) {
+            uint32_t end = position();
+            calc.skipws();
+            if (calc.test(ischar('('))) {
+                Frame frame{ Frame::Kind::Call };
+                frame.name = name.value();
+                frame.base = _operands.size();
+                frame.begin = begin;
+                _operators.push_back(frame);
+                calc.skipws();
+                if (calc.test(ischar(')'))) {
+                    return closeCall(expect_operand);
+                }
+                return true;
+            }
+            _operands.push_back(calc.internVariable(name.value()));
+            pushSpan(begin, end);
+            expect_operand = false;
+            return true;
+        }
+        return false;
+    }
+
+    // Completes the Call frame on top of the stack.
+    bool closeCall(bool& expect_operand) {
+        Frame frame = _operators.back();
+        _operators.pop_back();
+        _arguments.assign(std::make_move_iterator(_operands.begin() + frame.base),
+            std::make_move_iterator(_operands.end()));
+        _operands.resize(frame.base);
+        auto call = _calc.createCall(frame.name, _arguments);
+        _arguments.clear();
+        if (!call) {
+            return false;
+        }
+        _operands.push_back(call);
+        if (recording()) {
+            _spans.resize(frame.base);
+            pushSpan(frame.begin, position());
+            record(call.get(), _spans.back());
+        }
+        expect_operand = false;
+        return true;
+    }
+
+    // Handles ')' after an operand. Returns false on a syntax error and
+    // sets done when the parenthesis belongs to an enclosing context.
+    bool closeGroup(bool& expect_operand, bool& done) {
+        reduceWhile(1);
+        if (_operators.empty()) {
+            done = true;  // unmatched ')': end of this expression
+            return true;
+        }
+        if (_operators.back().kind == Frame::Kind::Call) {
+            return closeCall(expect_operand);
+        }
+        uint32_t begin = _operators.back().begin;
+        _operators.pop_back();
+        _operands.back() = _calc.make<Parenthesis>(_operands.back());
+        if (recording()) {
+            _spans.back() = SourceSpan{ begin, position() };
+            record(_operands.back().get(), _spans.back());
+        }
+        return true;
+    }
+
+    NodePtr expression() {
+        Calculator& calc = _calc;
+        bool expect_operand = true;
+        bool done = false;
+        while (!done) {
+            calc.skipws();
+            if (expect_operand) {
+                if (!operand(expect_operand)) {
+                    return {};
+                }
+                continue;
+            }
+            Lexer::sviterator mark = calc.it;
+            if (auto oper = calc.arithop()) {
+                reduceWhile(BinaryOp::precedence(oper.value()));
+                _operators.push_back(Frame{ Frame::Kind::Binary, oper.value() });
+                expect_operand = true;
+            } else if (calc.test(ischar(')'))) {
+                if (!closeGroup(expect_operand, done)) {
+                    return {};
+                }
+                if (done) {
+                    calc.it = mark;  // leave the ')' unconsumed
+                }
+            } else if (!_operators.empty() && calc.test(ischar(','))) {
+                reduceWhile(1);
+                if (_operators.empty() || _operators.back().kind != Frame::Kind::Call) {
+                    calc.it = mark;
+                    done = true;
+                } else {
+                    expect_operand = true;
+                }
+            } else {
+                done = true;
+            }
+        }
+        reduceWhile(1);
+        if (!_operators.empty() || _operands.size() != 1) {
+            return {};  // unclosed '(' or call
+        }
+        return std::move(_operands.back());
+    }
+
+    // Whether source spans are being recorded; false at compile time when
+    // profiling is not compiled in, which removes all span bookkeeping.
+    bool recording() const {
+        if constexpr (kProfilingEnabled) {
+            return _calc._spans != nullptr;
+        }
+        return false;
+    }
+
+    uint32_t position() const {
+        return static_cast<uint32_t>(_calc.it - _calc.code.begin());
+    }
+
+    // Pushes the span of the operand just pushed.
+    void pushSpan(uint32_t begin, uint32_t end) {
+        if (recording()) {
+            _spans.push_back(SourceSpan{ begin, end });
+        }
+    }
+
+    void record(const Node* node, SourceSpan span) {
+        if constexpr (kProfilingEnabled) {
+            (*_calc._spans)[node] = span;
+        }
+    }
+
+    Calculator& _calc;
+    std::vector<NodePtr> _operands;
+    std::vector<Frame> _operators;
+    std::vector<NodePtr> _arguments;  // scratch for closeCall(), reused across calls
+    std::vector<SourceSpan> _spans;   // span of each operand, while recording
+};
+
+}  // namespace Interpreter
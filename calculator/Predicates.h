@@ -4,57 +4,136 @@
 // a condition. They are designed to be passed by value into Lexer::test()
 // and Lexer::skip(), which consume characters while the predicate holds.
 //
+// Classification is a lookup in kCharClasses, a constexpr 256-entry table of
+// class bits, instead of the locale-aware <cctype> functions: one load per
+// character with no call, and the same answer in every locale (only ASCII
+// letters, digits and whitespace are classified; bytes >= 0x80 are in no
+// class, where std::isalpha(char) was undefined behaviour). isany tests a
+// 256-bit set built once when the predicate is constructed.
+//
+// The predicates for runs (isdigit, isspace, isidentifier) also provide
+// run(first, last), which returns the end of the run starting at first.
+// Lexer::skip() uses it when present, so skipping goes through the vector
+// scanner in Scan.h instead of one predicate call per character.
+//
 // Note: isidentifier is stateful — it uses a counter to enforce that the
 // first character must be alpha/underscore while subsequent characters may
 // also be digits. A fresh instance is created on each call to skip().
 
 #pragma once
 
-#include <algorithm>
-#include <cctype>
+#include "Scan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string_view>
 
 namespace Interpreter {
 
+// Character class bits of kCharClasses.
+enum CharClass : uint8_t {
+    kSpaceClass = 1 << 0,       // ' ', '\t', '\n', '\v', '\f', '\r'
+    kDigitClass = 1 << 1,       // 0-9
+    kAlphaClass = 1 << 2,       // a-z A-Z
+    kUnderscoreClass = 1 << 3,  // _
+};
+
+constexpr std::array<uint8_t, 256> makeCharClasses() {
+    std::array<uint8_t, 256> table{};
+    for (size_t chr = 0; chr < table.size(); ++chr) {
+        if (chr == ' ' || (chr >= '\t' && chr <= '\r')) {
+            table[chr] |= kSpaceClass;
+        }
+        if (chr >= '0' && chr <= '9') {
+            table[chr] |= kDigitClass;
+        }
+        if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z')) {
+            table[chr] |= kAlphaClass;
+        }
+        if (chr == '_') {
+            table[chr] |= kUnderscoreClass;
+        }
+    }
+    return table;
+}
+
+// Class bits of every byte value.
+constexpr std::array<uint8_t, 256> kCharClasses = makeCharClasses();
+
+// Whether chr has any of the class bits in mask.
+constexpr bool hasClass(char chr, uint8_t mask) {
+    return (kCharClasses[static_cast<uint8_t>(chr)] & mask) != 0;
+}
+
+// The vector scanner's ranges (Scan.h) must agree with the table.
+constexpr bool runsMatchClasses() {
+    for (size_t byte = 0; byte < kCharClasses.size(); ++byte) {
+        auto chr = static_cast<char>(byte);
+        if (inRuns<SpaceRuns>(chr) != hasClass(chr, kSpaceClass)
+            || inRuns<DigitRuns>(chr) != hasClass(chr, kDigitClass)
+            || inRuns<IdentifierRuns>(chr) != hasClass(chr, kAlphaClass | kDigitClass | kUnderscoreClass)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(runsMatchClasses(), "Scan.h ranges differ from kCharClasses");
+
 // Matches C-style identifiers: first char is [a-zA-Z_], rest are [a-zA-Z0-9_].
 // Stateful: tracks position via an internal counter.
 struct isidentifier {
     bool operator()(char chr) {
         // First character: must be alpha or underscore
         if (counter++ == 0) {
-            return (chr == '_') || (std::isalpha(chr) != 0);
+            return hasClass(chr, kAlphaClass | kUnderscoreClass);
         }
         // Subsequent characters: also allow digits
-        return (chr == '_') || (std::isalnum(chr) != 0);
+        return hasClass(chr, kAlphaClass | kUnderscoreClass | kDigitClass);
     }
+
+    // End of the identifier starting at first (first itself if none does).
+    static const char* run(const char* first, const char* last) {
+        if (first == last || !hasClass(*first, kAlphaClass | kUnderscoreClass)) {
+            return first;
+        }
+        return scanRun<IdentifierRuns>(first + 1, last);
+    }
+
     int counter = 0;
 };
 
 // Matches any alphabetic character [a-zA-Z].
 struct isalpha {
-    bool operator()(char chr) {
-        return (std::isalpha(chr) != 0);
+    bool operator()(char chr) const {
+        return hasClass(chr, kAlphaClass);
     }
 };
 
 // Matches any digit [0-9].
 struct isdigit {
-    bool operator()(char chr) {
-        return (std::isdigit(chr) != 0);
+    bool operator()(char chr) const {
+        return hasClass(chr, kDigitClass);
+    }
+    static const char* run(const char* first, const char* last) {
+        return scanRun<DigitRuns>(first, last);
     }
 };
 
 // Matches any alphanumeric character [a-zA-Z0-9].
 struct isalnum {
-    bool operator()(char chr) {
-        return (std::isalnum(chr) != 0);
+    bool operator()(char chr) const {
+        return hasClass(chr, kAlphaClass | kDigitClass);
     }
 };
 
 // Matches any whitespace character (space, tab, newline, etc.).
 struct isspace {
-    bool operator()(char chr) {
-        return (std::isspace(chr) != 0);
+    bool operator()(char chr) const {
+        return hasClass(chr, kSpaceClass);
+    }
+    static const char* run(const char* first, const char* last) {
+        return scanRun<SpaceRuns>(first, last);
     }
 };
 
@@ -70,12 +149,17 @@ struct ischar {
 
 // Matches any character present in the given string_view.
 struct isany {
-    isany(std::string_view str) : _str(str) {
+    constexpr isany(std::string_view str) {
+        for (char chr : str) {
+            auto byte = static_cast<uint8_t>(chr);
+            _bits[byte / 64] |= uint64_t(1) << (byte % 64);
+        }
     }
-    bool operator()(char chr) const {
-        return std::any_of(_str.begin(), _str.end(), [chr](char val) { return val == chr; });
+    constexpr bool operator()(char chr) const {
+        auto byte = static_cast<uint8_t>(chr);
+        return ((_bits[byte / 64] >> (byte % 64)) & 1) != 0;
     }
-    std::string_view _str;
+    std::array<uint64_t, 4> _bits{};  // one bit per byte value
 };
 
 }  // namespace Interpreter
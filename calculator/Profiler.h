@@ -0,0 +1,313 @@
+// Profiler.h — Per-node evaluation counts and cycles for expression trees
+//
+// Profiler is a Visitor that instruments a parsed tree in place: every
+// operator and call node is put behind a ProfileNode, which counts the
+// evaluations of its subtree and accumulates the cycles spent in it with
+// now() (Cycles.h). detach(), or the destructor, puts the original nodes
+// back. Constants and variables are not wrapped, since timing them would cost
+// more than evaluating them; their time counts toward their parent.
+//
+// For every profiled node the report gives:
+//   count   evaluations
+//   incl    cycles spent in the subtree
+//   self    incl minus the incl of the profiled nodes directly below it
+// and lists the nodes with the most self time first, each annotated with its
+// source text. Spans come from the parser: while Calculator::_spans points to
+// a SourceSpans map, PrecedenceParser records the [begin, end) offsets of
+// every operator, call and parenthesis it creates. (The rotating parser,
+// Calculator::parse(), does not record spans; its nodes are reported by
+// kind only.)
+//
+// Each profiled node adds two timer reads to its inclusive time, so the
+// figures of small subtrees are dominated by that overhead; compare nodes
+// with each other rather than with an uninstrumented run.
+//
+// Profiling is compiled in only when CALCULATOR_PROFILE is defined to 1 (the
+// CMake option of the same name). Otherwise kProfilingEnabled is false: the
+// parser's span bookkeeping is discarded by `if constexpr`, attach() leaves
+// the tree untouched and no ProfileNode is ever created, so evaluation and
+// parsing are exactly as without this header. Define it consistently across
+// all translation units of a program.
+
+#pragma once
+
+#include "Cycles.h"
+#include "Intrinsics.h"
+#include "Node.h"
+#include "Pointer.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifndef CALCULATOR_PROFILE
+#define CALCULATOR_PROFILE 0
+#endif
+
+namespace Interpreter {
+
+// Whether the profiler and parser span recording are compiled in.
+static constexpr bool kProfilingEnabled = CALCULATOR_PROFILE != 0;
+
+// Offsets [begin, end) of a node's text in the parsed source.
+struct SourceSpan {
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Source span of each node created while spans were being recorded.
+using SourceSpans = std::unordered_map<const Node*, SourceSpan>;
+
+// ProfileNode — transparent wrapper that times the evaluation of its subtree.
+struct ProfileNode : public Node {
+    explicit ProfileNode(NodePtr wrapped) : node(std::move(wrapped)) {
+    }
+
+    double calc() override {
+        uint64_t start = now();
+        double value = node->calc();
+        cycles += now() - start;
+        ++count;
+        return value;
+    }
+
+    // Visits self first, then the wrapped node.
+    void visit(Visitor& visitor) override {
+        visitor.visit(this);
+        visitor.visit(node.get());
+    }
+
+    NodePtr node;
+    uint64_t count = 0;   // evaluations
+    uint64_t cycles = 0;  // inclusive
+};
+
+// Profiler — instruments a tree and reports where its evaluation time goes.
+struct Profiler : public Visitor {
+
+    // Measurements of one profiled node, summed over every place it occurs.
+    struct Entry {
+        const Node* node;
+        std::optional<SourceSpan> span;
+        uint64_t count = 0;
+        uint64_t cycles = 0;  // inclusive
+        uint64_t self = 0;    // exclusive of profiled children
+    };
+
+    Profiler() = default;
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    ~Profiler() override {
+        detach();
+    }
+
+    // Instruments the tree rooted at root in place; root itself may be
+    // replaced by a wrapper. spans supplies source spans, usually the map
+    // Calculator::_spans pointed to while the tree was parsed. Does nothing
+    // when profiling is compiled out.
+    //
+    // The profiler keeps a reference to every node whose child it wrapped,
+    // so the tree stays valid for detach() even if the caller drops it. The
+    // root pointer itself belongs to the caller: root (and the Arena of a
+    // tree parsed into one) must outlive the Profiler or its detach().
+    void attach(NodePtr& root, const SourceSpans* spans = nullptr) {
+        if constexpr (kProfilingEnabled) {
+            detach();
+            _spans = spans;
+            _parent = nullptr;
+            _owner = nullptr;
+            instrument(root);
+            _visited.clear();
+        }
+    }
+
+    // Restores the original nodes, root included. Counters are lost.
+    void detach() {
+        for (auto site = _sites.rbegin(); site != _sites.rend(); ++site) {
+            *site->slot = site->wrapper->node;
+        }
+        _sites.clear();
+    }
+
+    // Clears the counters, keeping the instrumentation.
+    void reset() {
+        for (Site& site : _sites) {
+            site.wrapper->count = 0;
+            site.wrapper->cycles = 0;
+        }
+    }
+
+    // Profiled nodes, the most self time first.
+    std::vector<Entry> entries() const {
+        std::unordered_map<const ProfileNode*, uint64_t> children;
+        for (const Site& site : _sites) {
+            if (site.parent != nullptr) {
+                children[site.parent] += site.wrapper->cycles;
+            }
+        }
+        std::vector<Entry> result;
+        std::unordered_map<const Node*, size_t> index;
+        for (const Site& site : _sites) {
+            const ProfileNode& wrapper = *site.wrapper;
+            auto inserted = index.emplace(wrapper.node.get(), result.size());
+            if (inserted.second) {
+                result.push_back(Entry{ wrapper.node.get(), span(wrapper.node.get()) });
+            }
+            Entry& entry = result[inserted.first->second];
+            uint64_t below = children[&wrapper];
+            entry.count += wrapper.count;
+            entry.cycles += wrapper.cycles;
+            entry.self += wrapper.cycles > below ? wrapper.cycles - below : 0;
+        }
+        std::stable_sort(result.begin(), result.end(),
+            [](const Entry& lhs, const Entry& rhs) { return lhs.self > rhs.self; });
+        return result;
+    }
+
+    // Prints the limit nodes with the most self time. source is the parsed
+    // text the spans refer to.
+    void report(FILE* out, std::string_view source, size_t limit = 10) const {
+        if constexpr (!kProfilingEnabled) {
+            (void)fprintf(out, "Profile: not compiled in (build with -DCALCULATOR_PROFILE=ON)\n");
+            return;
+        }
+        if (_sites.empty()) {
+            (void)fprintf(out, "Profile: no operator or call nodes\n");
+            return;
+        }
+        const ProfileNode& root = *_sites.front().wrapper;
+        double total = static_cast<double>(std::max<uint64_t>(root.cycles, 1));
+        (void)fprintf(out, "Profile: %llu evaluations, %llu %s\n", static_cast<unsigned long long>(root.count),
+            static_cast<unsigned long long>(root.cycles), time_unit);
+        (void)fprintf(out, "  self%%  incl%%      count   self/eval  node\n");
+        std::vector<Entry> list = entries();
+        for (size_t j = 0; j < list.size() && j < limit; ++j) {
+            const Entry& entry = list[j];
+            double perEval = static_cast<double>(entry.self) / static_cast<double>(std::max<uint64_t>(entry.count, 1));
+            (void)fprintf(out, "  %5.1f  %5.1f %10llu %11.1f  ", 100.0 * static_cast<double>(entry.self) / total,
+                100.0 * static_cast<double>(entry.cycles) / total, static_cast<unsigned long long>(entry.count), perEval);
+            if (entry.span && entry.span->end <= source.size()) {
+                std::string_view text = source.substr(entry.span->begin, entry.span->end - entry.span->begin);
+                constexpr size_t kMaxText = 48;
+                if (text.size() > kMaxText) {
+                    (void)fprintf(out, "%.*s... [%u,%u)\n", static_cast<int>(kMaxText - 3), text.data(),
+                        entry.span->begin, entry.span->end);
+                } else {
+                    (void)fprintf(out, "%.*s [%u,%u)\n", static_cast<int>(text.size()), text.data(),
+                        entry.span->begin, entry.span->end);
+                }
+            } else {
+                (void)fprintf(out, "%s\n", kind(entry.node));
+            }
+        }
+    }
+
+    // Instruments the children of node (see attach()).
+    void visit(Node* node) override {
+        switch (node->kind) {
+            case NodeKind::UnaryOp: instrument(static_cast<UnaryOp*>(node)->node); break;
+            case NodeKind::BinaryOp:
+                instrument(static_cast<BinaryOp*>(node)->left);
+                instrument(static_cast<BinaryOp*>(node)->right);
+                break;
+            case NodeKind::FunctionCall:
+            case NodeKind::IntrinsicCall: {
+                auto* call = static_cast<FunctionCall*>(node);
+                for (size_t j = 0; j < call->arity(); ++j) {
+                    instrument(call->argument(j));
+                }
+                break;
+            }
+            case NodeKind::WindowCall: instrument(static_cast<WindowCall*>(node)->argument); break;
+            case NodeKind::Parenthesis: instrument(static_cast<Parenthesis*>(node)->node); break;
+            case NodeKind::Shared: instrument(static_cast<Shared*>(node)->node); break;
+            case NodeKind::DagRoot: instrument(static_cast<DagRoot*>(node)->node); break;
+            case NodeKind::Constant:
+            case NodeKind::Variable:
+            case NodeKind::Other: break;
+        }
+    }
+
+private:
+    // A wrapped child pointer, the node holding it (null for the root, whose
+    // pointer the caller holds) and the wrapper nearest above it.
+    struct Site {
+        NodePtr owner;  // keeps slot alive until detach()
+        NodePtr* slot;
+        Pointer<ProfileNode> wrapper;
+        const ProfileNode* parent;
+    };
+
+    static bool profiled(Node* node) {
+        switch (node->kind) {
+            case NodeKind::UnaryOp:
+            case NodeKind::BinaryOp:
+            case NodeKind::FunctionCall:
+            case NodeKind::IntrinsicCall:
+            case NodeKind::WindowCall: return true;
+            default: return false;
+        }
+    }
+
+    static const char* kind(const Node* node) {
+        switch (node->kind) {
+            case NodeKind::UnaryOp: return "UnaryOp";
+            case NodeKind::BinaryOp: return "BinaryOp";
+            case NodeKind::WindowCall: return "WindowCall";
+            case NodeKind::IntrinsicCall:
+                // The names are string literals, so data() is terminated.
+                return kIntrinsicNames[static_cast<size_t>(static_cast<const FunctionCall*>(node)->intrinsic) - 1].data();
+            default: return "FunctionCall";
+        }
+    }
+
+    std::optional<SourceSpan> span(const Node* node) const {
+        if (_spans != nullptr) {
+            auto found = _spans->find(node);
+            if (found != _spans->end()) {
+                return found->second;
+            }
+        }
+        return {};
+    }
+
+    // Wraps the node in slot if it is profiled, then instruments its children
+    // the first time the node is reached.
+    void instrument(NodePtr& slot) {
+        Node* node = slot.get();
+        if (node == nullptr) {
+            return;
+        }
+        const ProfileNode* parent = _parent;
+        if (profiled(node)) {
+            Pointer<ProfileNode> wrapper(new ProfileNode(slot));
+            _sites.push_back(Site{ NodePtr(_owner), &slot, wrapper, parent });
+            slot = wrapper;
+            _parent = wrapper.get();
+        }
+        if (_visited.insert(node).second) {
+            Node* owner = _owner;
+            _owner = node;
+            visit(node);
+            _owner = owner;
+        }
+        _parent = parent;
+    }
+
+    const SourceSpans* _spans = nullptr;
+    const ProfileNode* _parent = nullptr;  // wrapper of the node being instrumented
+    Node* _owner = nullptr;                // node whose children are being instrumented
+    std::vector<Site> _sites;              // in pre-order; the root's wrapper first
+    std::unordered_set<Node*> _visited;
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,329 @@
+// Protocol.h — Binary protocol of the evaluation server, and a client for it
+//
+// The server (Server.h) holds a set of compiled formulas and evaluates them
+// for clients connected to a UNIX domain socket. Every message is a frame: a
+// fixed-size header followed by size bytes of payload.
+//
+//   RequestHeader   type, tag, formula index, row count
+//     Evaluate      payload: the variable values of rows rows, column by
+//                   column (rows values for slot 0, then slot 1, ...), in
+//                   the slot order listed by Describe
+//     Describe      no payload
+//   ResponseHeader  status, type, the request's tag, row count
+//     Evaluate      payload: rows results
+//     Describe      payload: one line per formula, "name var1 var2 ...\n",
+//                   in formula index order; rows is the formula count
+//
+// A request that fails (unknown formula, payload size that does not match
+// the formula) gets a response with an error status and no payload, and the
+// connection stays usable. A header announcing more than kMaxFrameBytes, or
+// a size that is not a multiple of kFrameAlignment, closes the connection.
+//
+// Requests may be pipelined: a client can write any number of frames before
+// reading, and the responses come back in request order; the tag is echoed
+// so that the client can match them without counting. Each request can
+// carry a batch of rows, so the per-message costs (syscalls, dispatch) are
+// shared by all the rows it holds.
+//
+// Frames are in native byte order and struct layout: both ends run on the
+// same machine. Every frame is padded to a multiple of kFrameAlignment bytes,
+// so a reader that keeps whole frames in an aligned buffer can use the
+// payload as an array of doubles where it lies.
+//
+// ServerClient is a blocking client: evaluate() and describe() queue
+// requests, flush() writes them all in one call, and receive() returns the
+// next response.
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+static constexpr size_t kFrameAlignment = 8;
+static constexpr size_t kMaxFrameBytes = size_t(64) << 20;
+
+enum class RequestType : uint16_t { Evaluate = 1, Describe = 2 };
+
+enum class ResponseStatus : uint16_t {
+    Ok = 0,
+    UnknownType = 1,     // the request type is not a RequestType
+    UnknownFormula = 2,  // no formula has the requested index
+    BadSize = 3,         // the payload does not hold rows rows of the formula
+};
+
+struct RequestHeader {
+    uint32_t size;  // payload bytes after the header
+    uint16_t type;  // RequestType
+    uint16_t reserved;
+    uint64_t tag;  // echoed in the response
+    uint32_t formula;
+    uint32_t rows;
+};
+
+struct ResponseHeader {
+    uint32_t size;    // payload bytes after the header
+    uint16_t status;  // ResponseStatus
+    uint16_t type;    // RequestType of the request
+    uint64_t tag;
+    uint32_t rows;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RequestHeader) == 24 && sizeof(ResponseHeader) == 24, "frame headers changed");
+static_assert(sizeof(RequestHeader) % kFrameAlignment == 0 && sizeof(ResponseHeader) % kFrameAlignment == 0,
+    "frame headers must keep payloads aligned");
+
+// Bytes of padding after a payload of size bytes.
+inline size_t framePadding(size_t size) {
+    return (kFrameAlignment - size % kFrameAlignment) % kFrameAlignment;
+}
+
+// Fills addr with the socket path. Returns false if the path does not fit.
+inline bool unixAddress(const char* path, sockaddr_un& addr) {
+    size_t length = strlen(path);
+    if (length == 0 || length >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, length + 1);
+    return true;
+}
+
+// A formula as listed by Describe.
+struct FormulaInfo {
+    std::string name;
+    std::vector<std::string> variables;  // in slot order
+};
+
+// Parses the payload of a Describe response. Returns empty if it is
+// malformed.
+inline std::optional<std::vector<FormulaInfo>> parseDescription(std::string_view text) {
+    std::vector<FormulaInfo> formulas;
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        if (end == std::string_view::npos) {
+            return {};
+        }
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end + 1);
+        FormulaInfo info;
+        while (!line.empty()) {
+            size_t space = line.find(' ');
+            std::string_view word = line.substr(0, space);
+            if (word.empty()) {
+                return {};
+            }
+            if (info.name.empty()) {
+                info.name = word;
+            } else {
+                info.variables.emplace_back(word);
+            }
+            line.remove_prefix(space == std::string_view::npos ? line.size() : space + 1);
+        }
+        if (info.name.empty()) {
+            return {};
+        }
+        formulas.push_back(std::move(info));
+    }
+    return formulas;
+}
+
+// A response received by ServerClient.
+struct Response {
+    ResponseHeader header{};
+    std::vector<double> values;  // Evaluate: one result per row
+    std::string text;            // Describe: the formula listing
+
+    ResponseStatus status() const {
+        return static_cast<ResponseStatus>(header.status);
+    }
+};
+
+// ServerClient — blocking connection to a Server.
+class ServerClient {
+public:
+    // Connects to the server listening at path. Returns empty on failure,
+    // with errno set.
+    static std::optional<ServerClient> connect(const char* path) {
+        sockaddr_un addr;
+        if (!unixAddress(path, addr)) {
+            errno = ENAMETOOLONG;
+            return {};
+        }
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return {};
+        }
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return {};
+        }
+        return ServerClient(fd);
+    }
+
+    ServerClient(ServerClient&& other) noexcept
+        : _fd(std::exchange(other._fd, -1))
+        , _output(std::move(other._output))
+        , _input(std::move(other._input))
+        , _begin(other._begin)
+        , _end(other._end) {
+    }
+
+    ServerClient& operator=(ServerClient other) noexcept {
+        std::swap(_fd, other._fd);
+        std::swap(_output, other._output);
+        std::swap(_input, other._input);
+        std::swap(_begin, other._begin);
+        std::swap(_end, other._end);
+        return *this;
+    }
+
+    ~ServerClient() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    // Queues an evaluation of rows rows. columns holds the values of every
+    // slot of the formula, column by column (count = slots * rows values).
+    void evaluate(uint64_t tag, uint32_t formula, uint32_t rows, const double* columns, size_t count) {
+        queue(RequestType::Evaluate, tag, formula, rows, columns, count * sizeof(double));
+    }
+
+    // Queues a request for the formula listing.
+    void describe(uint64_t tag) {
+        queue(RequestType::Describe, tag, 0, 0, nullptr, 0);
+    }
+
+    // Queues a raw frame; for tests of the server's error handling.
+    void queue(RequestType type, uint64_t tag, uint32_t formula, uint32_t rows, const void* payload, size_t size) {
+        RequestHeader header{};
+        header.size = static_cast<uint32_t>(size + framePadding(size));
+        header.type = static_cast<uint16_t>(type);
+        header.tag = tag;
+        header.formula = formula;
+        header.rows = rows;
+        append(&header, sizeof(header));
+        append(payload, size);
+        _output.resize(_output.size() + framePadding(size), 0);
+    }
+
+    // Writes every queued request. Returns false if the connection failed.
+    bool flush() {
+        size_t done = 0;
+        while (done < _output.size()) {
+            ssize_t count = ::send(_fd, _output.data() + done, _output.size() - done, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(count);
+        }
+        _output.clear();
+        return true;
+    }
+
+    // Whether a whole response is already buffered, so that receive() will
+    // not block.
+    bool ready() const {
+        if (_end - _begin < sizeof(ResponseHeader)) {
+            return false;
+        }
+        ResponseHeader header;
+        memcpy(&header, _input.data() + _begin, sizeof(header));
+        return _end - _begin >= sizeof(header) + header.size;
+    }
+
+    // Reads the next response. Returns false when the server closed the
+    // connection or sent a malformed frame.
+    bool receive(Response& response) {
+        if (!fill(sizeof(ResponseHeader))) {
+            return false;
+        }
+        memcpy(&response.header, _input.data() + _begin, sizeof(ResponseHeader));
+        size_t size = response.header.size;
+        if (size > kMaxFrameBytes || !fill(sizeof(ResponseHeader) + size)) {
+            return false;
+        }
+        const char* payload = _input.data() + _begin + sizeof(ResponseHeader);
+        response.values.clear();
+        response.text.clear();
+        if (response.header.type == static_cast<uint16_t>(RequestType::Describe)) {
+            response.text.assign(payload, size);
+            response.text.resize(strnlen(response.text.data(), size));
+        } else if (size >= response.header.rows * sizeof(double)) {
+            response.values.resize(response.header.rows);
+            memcpy(response.values.data(), payload, response.values.size() * sizeof(double));
+        } else {
+            return false;
+        }
+        _begin += sizeof(ResponseHeader) + size;
+        return true;
+    }
+
+private:
+    explicit ServerClient(int fd) : _fd(fd) {
+    }
+
+    void append(const void* data, size_t size) {
+        if (size != 0) {
+            size_t offset = _output.size();
+            _output.resize(offset + size);
+            memcpy(_output.data() + offset, data, size);
+        }
+    }
+
+    // Reads until at least size bytes are buffered.
+    bool fill(size_t size) {
+        static constexpr size_t kReadChunk = 64 * 1024;
+        if (_end - _begin >= size) {
+            return true;
+        }
+        if (_begin != 0) {
+            memmove(_input.data(), _input.data() + _begin, _end - _begin);
+            _end -= _begin;
+            _begin = 0;
+        }
+        if (_input.size() < std::max(size, kReadChunk)) {
+            _input.resize(std::max(size, kReadChunk));
+        }
+        while (_end < size) {
+            ssize_t count = ::recv(_fd, _input.data() + _end, _input.size() - _end, 0);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            _end += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    int _fd = -1;
+    std::vector<char> _output;  // queued requests
+    std::vector<char> _input;   // received bytes; [_begin, _end) unread
+    size_t _begin = 0;
+    size_t _end = 0;
+};
+
+}  // namespace Interpreter
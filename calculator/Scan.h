@@ -0,0 +1,133 @@
+// Scan.h — Vectorized scanning of character runs
+//
+// Whitespace, digit strings and identifiers are runs of bytes drawn from a
+// few contiguous ranges ([0-9], [a-zA-Z0-9_], ' ' and [\t-\r]). scanRun()
+// finds the end of such a run a whole vector at a time: each range test is a
+// subtract, an unsigned min and a compare, the per-range masks are ORed, and
+// the first byte outside every range is found with movemask and a
+// count-trailing-zeros. Most tokens in formulas are a byte or two long, and
+// for them the vector setup costs more than it saves, so the first
+// kScanPrefix bytes are tested one at a time and the vector loop starts only
+// on longer runs. (calc --bench-scanner: about the same throughput as the
+// per-byte table on typical expressions, 1.3x with SSE2 and 1.8x with AVX2 on
+// text with long identifiers and numbers.)
+//
+// Kernel selection is done at compile time from the target ISA, as in
+// Batch.h:
+//   __AVX2__  32 bytes per step (256-bit ymm registers)
+//   __SSE2__  16 bytes per step (128-bit xmm registers)
+//   otherwise a scalar loop over the same ranges
+// Vectors are loaded only while a full one lies inside [first, last), so
+// nothing past the end of the input is read; the remainder is scanned with
+// the scalar loop. SSE4.2's PCMPISTRI can test ranges too, but it is slower
+// than these compares on current cores and adds nothing AVX2 does not
+// cover, so it is not used.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Interpreter {
+
+// Inclusive byte range.
+struct ByteRange {
+    uint8_t lo;
+    uint8_t hi;
+};
+
+// Ranges of the runs the lexer skips, matching the classes in Predicates.h.
+struct SpaceRuns {
+    static constexpr std::array<ByteRange, 2> kRanges = { { { ' ', ' ' }, { '\t', '\r' } } };
+};
+struct DigitRuns {
+    static constexpr std::array<ByteRange, 1> kRanges = { { { '0', '9' } } };
+};
+struct IdentifierRuns {
+    static constexpr std::array<ByteRange, 4> kRanges = { { { 'a', 'z' }, { 'A', 'Z' }, { '0', '9' }, { '_', '_' } } };
+};
+
+// Whether chr lies in one of Runs' ranges.
+template <typename Runs>
+constexpr bool inRuns(char chr) {
+    auto byte = static_cast<uint8_t>(chr);
+    for (const ByteRange& range : Runs::kRanges) {
+        if (static_cast<uint8_t>(byte - range.lo) <= static_cast<uint8_t>(range.hi - range.lo)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if defined(__AVX2__)
+// Bit j set when byte j of the 32 at ptr lies in one of Runs' ranges.
+template <typename Runs>
+inline uint32_t runMask(const char* ptr) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    __m256i inside = _mm256_setzero_si256();
+    for (const ByteRange& range : Runs::kRanges) {
+        if (range.lo == range.hi) {
+            inside = _mm256_or_si256(inside, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(static_cast<char>(range.lo))));
+        } else {
+            __m256i shifted = _mm256_sub_epi8(chunk, _mm256_set1_epi8(static_cast<char>(range.lo)));
+            __m256i clamped = _mm256_min_epu8(shifted, _mm256_set1_epi8(static_cast<char>(range.hi - range.lo)));
+            inside = _mm256_or_si256(inside, _mm256_cmpeq_epi8(shifted, clamped));
+        }
+    }
+    return static_cast<uint32_t>(_mm256_movemask_epi8(inside));
+}
+static constexpr size_t kScanWidth = 32;
+static constexpr uint32_t kScanFull = 0xFFFFFFFFU;
+#elif defined(__SSE2__)
+template <typename Runs>
+inline uint32_t runMask(const char* ptr) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    __m128i inside = _mm_setzero_si128();
+    for (const ByteRange& range : Runs::kRanges) {
+        if (range.lo == range.hi) {
+            inside = _mm_or_si128(inside, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(static_cast<char>(range.lo))));
+        } else {
+            __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8(static_cast<char>(range.lo)));
+            __m128i clamped = _mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(range.hi - range.lo)));
+            inside = _mm_or_si128(inside, _mm_cmpeq_epi8(shifted, clamped));
+        }
+    }
+    return static_cast<uint32_t>(_mm_movemask_epi8(inside));
+}
+static constexpr size_t kScanWidth = 16;
+static constexpr uint32_t kScanFull = 0xFFFFU;
+#endif
+
+// Bytes tested one at a time before the vector loop starts.
+static constexpr size_t kScanPrefix = 8;
+
+// End of the run of Runs bytes starting at first: the first position in
+// [first, last) outside every range, or last.
+template <typename Runs>
+inline const char* scanRun(const char* first, const char* last) {
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (size_t k = 0; k < kScanPrefix; ++k, ++first) {
+        if (first == last || !inRuns<Runs>(*first)) {
+            return first;
+        }
+    }
+    while (static_cast<size_t>(last - first) >= kScanWidth) {
+        uint32_t outside = ~runMask<Runs>(first) & kScanFull;
+        if (outside != 0) {
+            return first + __builtin_ctz(outside);
+        }
+        first += kScanWidth;
+    }
+#endif
+    while (first != last && inRuns<Runs>(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+}  // namespace Interpreter
@@ -0,0 +1,621 @@
+// Server.h — Evaluation server for a fixed set of compiled formulas
+//
+// Processes that embed a Calculator each parse and compile the formulas they
+// use. A Server does it once: it holds a FormulaCatalog of compiled
+// expressions (Context.h) and evaluates them for any number of local clients
+// over a UNIX domain socket, speaking the framed binary protocol of
+// Protocol.h. (Formulas.h's FormulaSet is different: one program computing
+// many formulas together.)
+//
+//   FormulaCatalog formulas;
+//   formulas.add("area", "pi*r*r");
+//   auto server = Server::listen(std::move(formulas), "/tmp/calc.sock");
+//   ...
+//   server->stop();
+//
+// The server runs one worker thread per core. Each worker owns an epoll
+// instance and the connections assigned to it, and nothing else is shared
+// between workers but the immutable formulas, so requests are served
+// without locks. Worker 0 also watches the listening socket and hands new
+// connections to the workers in turn, registering each one with the chosen
+// worker's epoll instance; the worker creates its state for the connection
+// on its first event. With pin set, worker j is bound to CPU j.
+//
+// A connection's bytes are read into one buffer and every complete request
+// in it is answered before the next read, so a pipelined client gets many
+// responses per syscall. Responses are built in an output buffer and written
+// together once the input is drained; if the socket does not take them all,
+// the connection waits for EPOLLOUT and is not read meanwhile, so a client
+// that does not read its responses cannot make the server buffer without
+// bound.
+//
+// An evaluation of one row runs the bytecode interpreter on the request
+// payload in place (one row of column-major values is its slot array); a
+// batch of rows goes through the worker's BatchEvaluator (Batch.h) for the
+// formula, which reads the payload columns directly.
+
+#pragma once
+
+#include "Batch.h"
+#include "Calculator.h"
+#include "Context.h"
+#include "Optimizer.h"
+#include "PrecedenceParser.h"
+#include "Predicates.h"
+#include "Protocol.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// FormulaCatalog — named formulas compiled for evaluation from any thread.
+class FormulaCatalog {
+public:
+    // Parses (PrecedenceParser), optimizes and compiles expression under
+    // name. Returns false if the name is not an identifier or is taken, or
+    // if the expression does not parse or compile.
+    bool add(std::string_view name, std::string_view expression) {
+        if (isidentifier::run(name.data(), name.data() + name.size()) != name.data() + name.size() || name.empty()
+            || find(name)) {
+            return false;
+        }
+        Calculator calc;
+        PrecedenceParser parser(calc);
+        NodePtr ast = parser.parseAll(expression);
+        if (!ast) {
+            return false;
+        }
+        Pointer<SharedExpression> expr = SharedExpression::compile(Optimizer::run(ast));
+        if (!expr) {
+            return false;
+        }
+        _names.emplace_back(name);
+        _expressions.push_back(std::move(expr));
+        return true;
+    }
+
+    // Adds one "name=expression" formula per line; blank lines and lines
+    // starting with '#' are skipped. Returns 0, or the number (from 1) of the
+    // first line that could not be added; the formulas before it are kept.
+    size_t load(std::string_view text) {
+        for (size_t number = 1; !text.empty(); ++number) {
+            size_t end = text.find('\n');
+            std::string_view line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            size_t first = line.find_first_not_of(" \t");
+            if (first == std::string_view::npos || line[first] == '#') {
+                continue;
+            }
+            size_t equals = line.find('=');
+            if (equals == std::string_view::npos) {
+                return number;
+            }
+            std::string_view name = line.substr(first, equals - first);
+            name = name.substr(0, name.find_last_not_of(" \t") + 1);
+            if (!add(name, line.substr(equals + 1))) {
+                return number;
+            }
+        }
+        return 0;
+    }
+
+    size_t size() const {
+        return _expressions.size();
+    }
+
+    const std::string& name(size_t index) const {
+        return _names[index];
+    }
+
+    const Pointer<SharedExpression>& expression(size_t index) const {
+        return _expressions[index];
+    }
+
+    // Index of the named formula, or empty.
+    std::optional<size_t> find(std::string_view name) const {
+        for (size_t j = 0; j < _names.size(); ++j) {
+            if (_names[j] == name) {
+                return j;
+            }
+        }
+        return {};
+    }
+
+    // The payload of a Describe response (Protocol.h).
+    std::string describe() const {
+        std::string text;
+        for (size_t j = 0; j < _names.size(); ++j) {
+            text += _names[j];
+            for (const std::string& var : _expressions[j]->names()) {
+                text += ' ';
+                text += var;
+            }
+            text += '\n';
+        }
+        return text;
+    }
+
+private:
+    std::vector<std::string> _names;
+    std::vector<Pointer<SharedExpression>> _expressions;
+};
+
+// Totals over all workers of a Server.
+struct ServerStats {
+    uint64_t connections = 0;
+    uint64_t requests = 0;
+    uint64_t rows = 0;
+    uint64_t errors = 0;  // requests answered with an error status
+};
+
+// Server — serves a FormulaCatalog on a UNIX domain socket until stopped.
+class Server : public RefCounted {
+public:
+    struct Options {
+        size_t threads = 0;  // workers; 0 for one per hardware thread
+        bool pin = false;    // bind worker j to CPU j
+    };
+
+    // Binds path and starts the workers. A socket file left at path by an
+    // earlier server is replaced; any other file there makes this fail.
+    // Returns null on failure, with errno set.
+    static Pointer<Server> listen(FormulaCatalog formulas, const char* path, Options options) {
+        Pointer<Server> server(new Server(std::move(formulas), path));
+        if (!server->open(options)) {
+            int error = errno;
+            server.reset();
+            errno = error;
+            return {};
+        }
+        return server;
+    }
+
+    static Pointer<Server> listen(FormulaCatalog formulas, const char* path) {
+        return listen(std::move(formulas), path, Options{});
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    ~Server() override {
+        stop();
+        for (int fd : { _listener, _wakeup }) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        if (_bound) {
+            ::unlink(_path.c_str());
+        }
+    }
+
+    // Stops every worker and closes all connections. Idempotent.
+    void stop() {
+        if (_wakeup >= 0 && !_threads.empty()) {
+            uint64_t one = 1;
+            ssize_t written = ::write(_wakeup, &one, sizeof(one));
+            (void)written;
+        }
+        for (auto& thread : _threads) {
+            thread.join();
+        }
+        _threads.clear();
+        for (const auto& worker : _workers) {
+            worker->disconnect();
+        }
+    }
+
+    size_t threads() const {
+        return _workers.size();
+    }
+
+    const FormulaCatalog& formulas() const {
+        return _formulas;
+    }
+
+    // Totals so far; may be read while the server runs.
+    ServerStats stats() const {
+        ServerStats total;
+        for (const auto& worker : _workers) {
+            const Counters& counters = worker->counters;
+            total.connections += counters.connections.load(std::memory_order_relaxed);
+            total.requests += counters.requests.load(std::memory_order_relaxed);
+            total.rows += counters.rows.load(std::memory_order_relaxed);
+            total.errors += counters.errors.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    // Bytes requested from recv() at a time.
+    static constexpr size_t kReadChunk = 64 * 1024;
+    // Buffers larger than this are released when a connection goes idle.
+    static constexpr size_t kIdleBuffer = 4 * kReadChunk;
+
+    // Per-worker totals behind stats().
+    struct Counters {
+        std::atomic<uint64_t> connections{ 0 };
+        std::atomic<uint64_t> requests{ 0 };
+        std::atomic<uint64_t> rows{ 0 };
+        std::atomic<uint64_t> errors{ 0 };
+    };
+
+    // State of one client connection, owned by its worker.
+    struct Connection {
+        std::vector<char> input;  // [0, end) received, not yet answered
+        size_t end = 0;
+        std::vector<char> output;  // [sent, size) responses not yet written
+        size_t sent = 0;
+        bool writing = false;  // waiting for EPOLLOUT
+        bool closing = false;  // the client shut down its side
+    };
+
+    class Worker {
+    public:
+        Worker(const Server& server, int epoll) : _server(server), _epoll(epoll) {
+        }
+
+        ~Worker() {
+            disconnect();
+            ::close(_epoll);
+        }
+
+        // Closes every connection, including those accepted for this worker
+        // that it has not seen yet. Only while run() is not running.
+        void disconnect() {
+            for (size_t fd = 0; fd < _connections.size(); ++fd) {
+                if (_connections[fd]) {
+                    ::close(static_cast<int>(fd));
+                    _connections[fd].reset();
+                }
+            }
+            std::lock_guard<std::mutex> lock(_pendingMutex);
+            for (int fd : _pending) {
+                ::close(fd);
+            }
+            _pending.clear();
+        }
+
+        // Registers a connection accepted by worker 0 for this worker. The
+        // worker owns it from its first event on; until then it is pending.
+        bool adopt(int fd) {
+            std::lock_guard<std::mutex> lock(_pendingMutex);
+            if (!Server::watch(_epoll, fd, EPOLLIN | EPOLLOUT)) {
+                return false;
+            }
+            _pending.push_back(fd);
+            return true;
+        }
+
+        int epoll() const {
+            return _epoll;
+        }
+
+        void run() {
+            static constexpr int kEvents = 64;
+            epoll_event events[kEvents];
+            for (;;) {
+                int count = epoll_wait(_epoll, events, kEvents, -1);
+                if (count < 0 && errno != EINTR) {
+                    return;
+                }
+                for (int j = 0; j < count; ++j) {
+                    int fd = events[j].data.fd;
+                    if (fd == _server._wakeup) {
+                        return;
+                    }
+                    if (fd == _server._listener) {
+                        _server.accept();
+                        continue;
+                    }
+                    ready(fd, events[j].events);
+                }
+            }
+        }
+
+        Counters counters;
+
+    private:
+        void ready(int fd, uint32_t events) {
+            auto index = static_cast<size_t>(fd);
+            if (index >= _connections.size()) {
+                _connections.resize(index + 1);
+            }
+            if (!_connections[index]) {
+                // A new connection, registered by accept() for EPOLLOUT as
+                // well so that this first event comes at once.
+                _connections[index] = std::make_unique<Connection>();
+                _connections[index]->writing = true;
+                counters.connections.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(_pendingMutex);
+                auto pending = std::find(_pending.begin(), _pending.end(), fd);
+                if (pending != _pending.end()) {
+                    _pending.erase(pending);
+                }
+            }
+            Connection& conn = *_connections[index];
+            bool open = true;
+            if ((events & (EPOLLERR | EPOLLHUP)) != 0 && (events & EPOLLIN) == 0) {
+                open = false;
+            } else if (conn.writing) {
+                open = flush(fd, conn);
+            } else if ((events & EPOLLIN) != 0) {
+                open = receive(fd, conn) && flush(fd, conn);
+            }
+            if (!open || (conn.closing && !conn.writing)) {
+                epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+                ::close(fd);
+                _connections[index].reset();
+            }
+        }
+
+        // Reads what the socket holds and answers every complete request.
+        // Returns false if the connection must be closed.
+        bool receive(int fd, Connection& conn) {
+            if (conn.input.size() - conn.end < kReadChunk) {
+                conn.input.resize(conn.end + kReadChunk);
+            }
+            ssize_t count = ::recv(fd, conn.input.data() + conn.end, conn.input.size() - conn.end, 0);
+            if (count < 0) {
+                return errno == EAGAIN || errno == EINTR;
+            }
+            if (count == 0) {
+                conn.closing = true;
+                return true;
+            }
+            conn.end += static_cast<size_t>(count);
+
+            size_t begin = 0;
+            while (conn.end - begin >= sizeof(RequestHeader)) {
+                RequestHeader header;
+                memcpy(&header, conn.input.data() + begin, sizeof(header));
+                if (header.size > kMaxFrameBytes || header.size % kFrameAlignment != 0) {
+                    return false;
+                }
+                size_t frame = sizeof(header) + header.size;
+                if (conn.end - begin < frame) {
+                    if (conn.input.size() < frame) {
+                        conn.input.resize(frame);
+                    }
+                    break;
+                }
+                respond(header, conn.input.data() + begin + sizeof(header), conn.output);
+                begin += frame;
+            }
+            // Frames are multiples of kFrameAlignment, so the unanswered
+            // bytes keep their alignment when moved to the front.
+            memmove(conn.input.data(), conn.input.data() + begin, conn.end - begin);
+            conn.end -= begin;
+            if (conn.end == 0 && conn.input.size() > kIdleBuffer) {
+                std::vector<char>().swap(conn.input);
+            }
+            return true;
+        }
+
+        // Appends the response to one request to out.
+        void respond(const RequestHeader& request, const char* payload, std::vector<char>& out) {
+            counters.requests.fetch_add(1, std::memory_order_relaxed);
+            ResponseHeader header{};
+            header.type = request.type;
+            header.tag = request.tag;
+            size_t offset = out.size();
+            switch (static_cast<RequestType>(request.type)) {
+                case RequestType::Evaluate: header.status = static_cast<uint16_t>(evaluate(request, payload, out)); break;
+                case RequestType::Describe: {
+                    const std::string& text = _server._description;
+                    out.resize(offset + sizeof(header) + text.size() + framePadding(text.size()), 0);
+                    memcpy(out.data() + offset + sizeof(header), text.data(), text.size());
+                    header.rows = static_cast<uint32_t>(_server._formulas.size());
+                    header.status = static_cast<uint16_t>(ResponseStatus::Ok);
+                    break;
+                }
+                default: header.status = static_cast<uint16_t>(ResponseStatus::UnknownType); break;
+            }
+            if (header.status != static_cast<uint16_t>(ResponseStatus::Ok)) {
+                counters.errors.fetch_add(1, std::memory_order_relaxed);
+                out.resize(offset + sizeof(header));
+            } else if (header.type == static_cast<uint16_t>(RequestType::Evaluate)) {
+                header.rows = request.rows;
+            }
+            header.size = static_cast<uint32_t>(out.size() - offset - sizeof(header));
+            memcpy(out.data() + offset, &header, sizeof(header));
+        }
+
+        // Appends a response header's room and the results of an Evaluate
+        // request to out.
+        ResponseStatus evaluate(const RequestHeader& request, const char* payload, std::vector<char>& out) {
+            if (request.formula >= _server._formulas.size()) {
+                return ResponseStatus::UnknownFormula;
+            }
+            const SharedExpression& expr = *_server._formulas.expression(request.formula);
+            size_t rows = request.rows;
+            size_t bytes = expr.slots() * rows * sizeof(double);
+            // The payload size bounds rows only if the formula has
+            // variables; the results must fit in a frame either way.
+            if (rows > kMaxFrameBytes / sizeof(double) || request.size != bytes + framePadding(bytes)) {
+                return ResponseStatus::BadSize;
+            }
+            size_t offset = out.size() + sizeof(ResponseHeader);
+            out.resize(offset + rows * sizeof(double));
+            auto* results = reinterpret_cast<double*>(out.data() + offset);
+            const auto* values = reinterpret_cast<const double*>(payload);
+            if (rows == 1) {
+                _scratch.resize(std::max<size_t>(expr.values(), 1));
+                results[0] = expr.evaluate(values, _scratch.data());
+            } else if (rows > 1) {
+                _columns.clear();
+                for (size_t j = 0; j < expr.slots(); ++j) {
+                    _columns.push_back(values + j * rows);
+                }
+                batch(request.formula).evaluate(_columns.data(), rows, results);
+            }
+            counters.rows.fetch_add(rows, std::memory_order_relaxed);
+            return ResponseStatus::Ok;
+        }
+
+        // This worker's BatchEvaluator for a formula, created on first use.
+        BatchEvaluator& batch(size_t formula) {
+            if (_batches.size() <= formula) {
+                _batches.resize(formula + 1);
+            }
+            if (!_batches[formula]) {
+                _batches[formula].emplace(_server._formulas.expression(formula)->batch());
+            }
+            return *_batches[formula];
+        }
+
+        // Writes pending responses. Waits for EPOLLOUT if the socket is
+        // full. Returns false if the connection must be closed.
+        bool flush(int fd, Connection& conn) {
+            while (conn.sent < conn.output.size()) {
+                ssize_t count = ::send(fd, conn.output.data() + conn.sent, conn.output.size() - conn.sent, MSG_NOSIGNAL);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count < 0 && errno == EAGAIN) {
+                    return watch(fd, conn, true);
+                }
+                if (count < 0) {
+                    return false;
+                }
+                conn.sent += static_cast<size_t>(count);
+            }
+            conn.output.clear();
+            conn.sent = 0;
+            if (conn.output.capacity() > kIdleBuffer) {
+                std::vector<char>().swap(conn.output);
+            }
+            return watch(fd, conn, false);
+        }
+
+        // Switches the connection between reading and waiting to write.
+        bool watch(int fd, Connection& conn, bool writing) {
+            if (conn.writing == writing) {
+                return true;
+            }
+            conn.writing = writing;
+            epoll_event event{};
+            event.events = writing ? EPOLLOUT : EPOLLIN;
+            event.data.fd = fd;
+            return epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &event) == 0;
+        }
+
+        const Server& _server;
+        int _epoll;
+        std::vector<std::unique_ptr<Connection>> _connections;  // by fd
+        std::vector<std::optional<BatchEvaluator>> _batches;    // by formula
+        std::vector<const double*> _columns;
+        std::vector<double> _scratch;
+        std::mutex _pendingMutex;
+        std::vector<int> _pending;  // accepted, first event not yet handled
+    };
+
+    Server(FormulaCatalog formulas, const char* path)
+        : _formulas(std::move(formulas)), _description(_formulas.describe()), _path(path) {
+    }
+
+    bool open(Options options) {
+        sockaddr_un addr;
+        if (!unixAddress(_path.c_str(), addr)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        struct stat info;
+        if (::lstat(_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            ::unlink(_path.c_str());
+        }
+        _listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_listener < 0 || ::bind(_listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+            return false;
+        }
+        _bound = true;
+        _wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (::listen(_listener, SOMAXCONN) != 0 || _wakeup < 0) {
+            return false;
+        }
+
+        size_t count = options.threads != 0 ? options.threads : std::max(1U, std::thread::hardware_concurrency());
+        for (size_t j = 0; j < count; ++j) {
+            int epoll = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll < 0) {
+                return false;
+            }
+            _workers.push_back(std::make_unique<Worker>(*this, epoll));
+            if (!watch(epoll, _wakeup, EPOLLIN) || (j == 0 && !watch(epoll, _listener, EPOLLIN))) {
+                return false;
+            }
+        }
+        for (size_t j = 0; j < count; ++j) {
+            _threads.emplace_back([worker = _workers[j].get()] { worker->run(); });
+            if (options.pin) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(j % CPU_SETSIZE, &cpus);
+                pthread_setaffinity_np(_threads.back().native_handle(), sizeof(cpus), &cpus);
+            }
+        }
+        return true;
+    }
+
+    static bool watch(int epoll, int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    // Accepts every pending connection, handing them to the workers in turn.
+    // Runs on worker 0 only.
+    void accept() const {
+        for (;;) {
+            int fd = ::accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            size_t next = _next++ % _workers.size();
+            if (!_workers[next]->adopt(fd)) {
+                ::close(fd);
+            }
+        }
+    }
+
+    FormulaCatalog _formulas;
+    std::string _description;  // payload of Describe responses
+    std::string _path;
+    bool _bound = false;
+    int _listener = -1;
+    int _wakeup = -1;
+    mutable size_t _next = 0;  // worker for the next connection
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,465 @@
+// StaticExpression.h — Compile-time parsing into inlined expression templates
+//
+// A formula fixed at build time still costs a parse, an allocation per node
+// and a virtual calc() per node when it goes through Calculator. Here the
+// text is parsed by a constexpr parser instead, and every node becomes its
+// own type, so the compiler sees the whole expression as straight-line code
+// it can inline, constant-fold and vectorize:
+//
+//   struct Hypot { static constexpr std::string_view text = "sqrt(x*x + y*y)"; };
+//   using F = StaticExpression<Hypot>;
+//   double a = F::eval(slots);                     // slots[F::slot("x")] ...
+//   double b = F::evalMembers<&P::x, &P::y>(point); // one member per slot
+//   F::evaluate(columns, rows, output);            // column batches (Batch.h)
+//
+// Variables get slots in order of first appearance; slot() and variable()
+// map between names and slots at compile time. A syntax error, an unknown
+// function or too many nodes fails the build at the static_assert in
+// StaticExpression; StaticParser::parse() can be called directly in a
+// constant expression to inspect the error.
+//
+// The grammar and its semantics are those of PrecedenceParser, so the same
+// text gives bit-identical results on both paths:
+//   - operators of equal precedence associate to the left, prefix +/- binds
+//     tighter than any operator, and a signed literal folds into one constant
+//   - built-in functions (Intrinsics.h) evaluate through applyIntrinsic()
+//   - literals are converted as by Lexer::parsedouble()
+// Two things are stricter than at run time. Text after the expression is an
+// error rather than ignored. And std::from_chars is not constexpr in C++17,
+// so only literals that take parsedouble()'s exact fast path (at most 19
+// significant digits and a value of mantissa × 10^k with |k| <= 22) are
+// accepted; that covers everything written by hand. User functions are
+// registered at run time and cannot be called.
+//
+// Identical results also assume the compiler does not contract a*b+c into a
+// fused multiply-add, which GCC does by default with -march=native in GNU
+// mode; build with -ffp-contract=off where exact agreement matters.
+//
+// The parse produces bytecode in the layout of Bytecode.h (StaticProgram),
+// emitted in post-order so every operand precedes its use. StaticTerm<Source,
+// Index> is the type of the node at Index; its eval() recurses through the
+// operand types with if constexpr, so the tree exists only at compile time.
+
+#pragma once
+
+#include "Bytecode.h"
+#include "Intrinsics.h"
+#include "Lexer.h"
+#include "TreeNodes.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <tuple>
+
+namespace Interpreter {
+
+// Capacity of a compile-time expression.
+static constexpr size_t kStaticMaxInstructions = 256;
+static constexpr size_t kStaticMaxVariables = 32;
+
+// StaticProgram — bytecode for an expression parsed at compile time. The
+// root is the last instruction.
+struct StaticProgram {
+    std::array<Instruction, kStaticMaxInstructions> code{};
+    std::array<double, kStaticMaxInstructions> constants{};
+    std::array<std::string_view, kStaticMaxVariables> variables{};  // by slot
+    uint32_t size = 0;
+    uint32_t num_constants = 0;
+    uint32_t num_variables = 0;
+    const char* error = nullptr;  // first error, or null
+    uint32_t error_offset = 0;    // position in the text of the error
+
+    constexpr bool valid() const {
+        return error == nullptr;
+    }
+
+    // Slot of the named variable, or empty if the expression does not use it.
+    constexpr std::optional<uint32_t> slot(std::string_view name) const {
+        for (uint32_t j = 0; j < num_variables; ++j) {
+            if (variables[j] == name) {
+                return j;
+            }
+        }
+        return {};
+    }
+};
+
+// StaticParser — constexpr precedence-climbing parser producing a
+// StaticProgram.
+class StaticParser {
+public:
+    static constexpr StaticProgram parse(std::string_view text) {
+        StaticParser parser(text);
+        uint32_t root = parser.expression(1);
+        parser.skipws();
+        if (parser._prog.valid() && parser._pos != text.size()) {
+            parser.fail("unexpected character");
+        }
+        if (parser._prog.valid() && root != parser._prog.size - 1) {
+            parser.fail("internal error: root is not the last instruction");
+        }
+        return parser._prog;
+    }
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    constexpr explicit StaticParser(std::string_view text) : _text(text) {
+    }
+
+    // expression = operand (arithop operand)*, climbing from minprec.
+    constexpr uint32_t expression(int minprec) {
+        uint32_t lhs = operand();
+        while (lhs != kNone) {
+            skipws();
+            BinaryOp::Operation oper = arithop(peek());
+            if (oper == BinaryOp::Operation::NA || BinaryOp::precedence(oper) < minprec) {
+                return lhs;
+            }
+            ++_pos;
+            uint32_t rhs = expression(BinaryOp::precedence(oper) + 1);
+            if (rhs == kNone) {
+                return kNone;
+            }
+            lhs = emit(opcode(oper), lhs, rhs);
+        }
+        return lhs;
+    }
+
+    // operand = [+-]* ( number | identifier | call | '(' expression ')' )
+    constexpr uint32_t operand() {
+        skipws();
+        if (uint32_t number = literal(); number != kNone || !_prog.valid()) {
+            return number;
+        }
+        char chr = peek();
+        if (chr == '+') {
+            ++_pos;
+            return operand();
+        }
+        if (chr == '-') {
+            ++_pos;
+            uint32_t value = operand();
+            return value == kNone ? kNone : emit(OpCode::Negate, value, 0);
+        }
+        if (chr == '(') {
+            ++_pos;
+            uint32_t value = expression(1);
+            skipws();
+            if (value != kNone && peek() != ')') {
+                return fail("expected ')'");
+            }
+            ++_pos;
+            return value;
+        }
+        if (isIdentifierStart(chr)) {
+            size_t begin = _pos;
+            while (_pos < _text.size() && (isIdentifierStart(_text[_pos]) || isDigit(_text[_pos]))) {
+                ++_pos;
+            }
+            std::string_view name = _text.substr(begin, _pos - begin);
+            skipws();
+            if (peek() == '(') {
+                return call(name);
+            }
+            return variable(name);
+        }
+        return fail("expected an operand");
+    }
+
+    // call = identifier '(' [expression (',' expression)*] ')'; the '(' is next.
+    constexpr uint32_t call(std::string_view name) {
+        Intrinsic op = findIntrinsic(name);
+        if (op == Intrinsic::None) {
+            return fail("unknown function; only built-in functions are available at compile time");
+        }
+        ++_pos;
+        std::array<uint32_t, 2> args = { 0, 0 };
+        size_t count = 0;
+        skipws();
+        bool more = peek() != ')';
+        while (more) {
+            uint32_t arg = expression(1);
+            if (arg == kNone) {
+                return kNone;
+            }
+            if (count < args.size()) {
+                args[count] = arg;
+            }
+            ++count;
+            skipws();
+            more = peek() == ',';
+            _pos += more ? 1 : 0;
+        }
+        if (peek() != ')') {
+            return fail("expected ')' or ','");
+        }
+        ++_pos;
+        if (count != intrinsicArity(op)) {
+            return fail("wrong number of arguments");
+        }
+        return emit(intrinsicOpCode(op), args[0], args[1]);
+    }
+
+    constexpr uint32_t variable(std::string_view name) {
+        std::optional<uint32_t> slot = _prog.slot(name);
+        if (!slot) {
+            if (_prog.num_variables == kStaticMaxVariables) {
+                return fail("too many variables");
+            }
+            _prog.variables[_prog.num_variables] = name;
+            slot = _prog.num_variables++;
+        }
+        return emit(OpCode::Variable, *slot, 0);
+    }
+
+    // A numeric literal as read by Lexer::parsedouble(), or kNone (with the
+    // position unchanged) if there is none here.
+    constexpr uint32_t literal() {
+        size_t start = _pos;
+        bool neg = false;
+        if (peek() == '+' || peek() == '-') {
+            neg = peek() == '-';
+            ++_pos;
+        }
+        if (!isDigit(peek())) {
+            _pos = start;
+            return kNone;
+        }
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool inexact = false;
+        auto accumulate = [&](bool fraction) {
+            for (; isDigit(peek()); ++_pos) {
+                char chr = _text[_pos];
+                if (digits < Lexer::kMaxMantissaDigits) {
+                    mantissa = Lexer::kDecimalBase * mantissa + static_cast<uint64_t>(chr - '0');
+                    digits += (mantissa != 0) ? 1 : 0;
+                    exponent -= fraction ? 1 : 0;
+                } else {
+                    inexact = inexact || chr != '0';
+                    exponent += fraction ? 0 : 1;
+                }
+            }
+        };
+        accumulate(false);
+        if (peek() == '.') {
+            ++_pos;
+            accumulate(true);
+        }
+        size_t mark = _pos;
+        if (peek() == 'e' || peek() == 'E') {
+            ++_pos;
+            bool eneg = false;
+            if (peek() == '+' || peek() == '-') {
+                eneg = peek() == '-';
+                ++_pos;
+            }
+            if (isDigit(peek())) {
+                int evalue = 0;
+                for (; isDigit(peek()); ++_pos) {
+                    evalue = std::min(static_cast<int>(Lexer::kDecimalBase) * evalue + (_text[_pos] - '0'), 100000);
+                }
+                exponent += eneg ? -evalue : evalue;
+            } else {
+                _pos = mark;
+            }
+        }
+        constexpr uint64_t kMaxExactMantissa = uint64_t(1) << 53;
+        double dval = 0.0;
+        if (mantissa == 0 && !inexact) {
+            dval = 0.0;
+        } else if (!inexact && mantissa <= kMaxExactMantissa && exponent >= -22 && exponent <= 22) {
+            dval = static_cast<double>(mantissa);
+            dval = exponent < 0 ? dval / Lexer::kExactPowers[-exponent] : dval * Lexer::kExactPowers[exponent];
+        } else {
+            _pos = start;
+            return fail("literal needs a correctly rounded conversion, which is not available at compile time");
+        }
+        if (_prog.num_constants == kStaticMaxInstructions) {
+            return fail("too many constants");
+        }
+        _prog.constants[_prog.num_constants] = neg ? -dval : dval;
+        return emit(OpCode::Constant, _prog.num_constants++, 0);
+    }
+
+    constexpr uint32_t emit(OpCode code, uint32_t lhs, uint32_t rhs) {
+        if (_prog.size == kStaticMaxInstructions) {
+            return fail("expression too large");
+        }
+        _prog.code[_prog.size] = Instruction{ code, lhs, rhs };
+        return _prog.size++;
+    }
+
+    constexpr uint32_t fail(const char* message) {
+        if (_prog.valid()) {
+            _prog.error = message;
+            _prog.error_offset = static_cast<uint32_t>(_pos);
+        }
+        return kNone;
+    }
+
+    static constexpr BinaryOp::Operation arithop(char chr) {
+        switch (chr) {
+            case '+': return BinaryOp::Operation::Addition;
+            case '-': return BinaryOp::Operation::Subtraction;
+            case '*': return BinaryOp::Operation::Multiplication;
+            case '/': return BinaryOp::Operation::Division;
+            default: return BinaryOp::Operation::NA;
+        }
+    }
+
+    static constexpr OpCode opcode(BinaryOp::Operation oper) {
+        switch (oper) {
+            case BinaryOp::Operation::Addition: return OpCode::Add;
+            case BinaryOp::Operation::Subtraction: return OpCode::Subtract;
+            case BinaryOp::Operation::Multiplication: return OpCode::Multiply;
+            default: return OpCode::Divide;
+        }
+    }
+
+    constexpr char peek() const {
+        return _pos < _text.size() ? _text[_pos] : '\0';
+    }
+
+    // Same set as Predicates.h's isspace in the "C" locale.
+    constexpr void skipws() {
+        while (_pos < _text.size()
+            && (_text[_pos] == ' ' || (_text[_pos] >= '\t' && _text[_pos] <= '\r'))) {
+            ++_pos;
+        }
+    }
+
+    static constexpr bool isDigit(char chr) {
+        return chr >= '0' && chr <= '9';
+    }
+
+    static constexpr bool isIdentifierStart(char chr) {
+        return chr == '_' || (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z');
+    }
+
+    std::string_view _text;
+    size_t _pos = 0;
+    StaticProgram _prog;
+};
+
+// The parsed program of Source::text, computed once per Source.
+template <typename Source>
+struct StaticSource {
+    static constexpr StaticProgram program = StaticParser::parse(Source::text);
+};
+
+// Slot access policies for StaticTerm::eval(): each reads slot Slot of the
+// evaluation input.
+struct IndexedSlots {
+    template <uint32_t Slot, typename Slots>
+    static double get(const Slots& slots) {
+        return slots[Slot];
+    }
+};
+
+template <auto... Members>
+struct MemberSlots {
+    template <uint32_t Slot, typename Object>
+    static double get(const Object& object) {
+        return object.*std::get<Slot>(std::make_tuple(Members...));
+    }
+};
+
+// A row of column-major input, as taken by BatchEvaluator::evaluate().
+struct ColumnRow {
+    const double* const* columns;
+    size_t row;
+};
+
+struct ColumnSlots {
+    template <uint32_t Slot>
+    static double get(const ColumnRow& input) {
+        return input.columns[Slot][input.row];
+    }
+};
+
+// StaticTerm — the node at Index of Source's program, as a type.
+template <typename Source, uint32_t Index>
+struct StaticTerm {
+    static constexpr Instruction ins = StaticSource<Source>::program.code[Index];
+    using Lhs = StaticTerm<Source, ins.lhs>;
+    using Rhs = StaticTerm<Source, ins.rhs>;
+
+    template <typename Access, typename Input>
+    static double eval(const Input& input) {
+        if constexpr (ins.code == OpCode::Constant) {
+            return StaticSource<Source>::program.constants[ins.lhs];
+        } else if constexpr (ins.code == OpCode::Variable) {
+            return Access::template get<ins.lhs>(input);
+        } else if constexpr (ins.code == OpCode::Negate) {
+            return -Lhs::template eval<Access>(input);
+        } else if constexpr (ins.code == OpCode::Add) {
+            return Lhs::template eval<Access>(input) + Rhs::template eval<Access>(input);
+        } else if constexpr (ins.code == OpCode::Subtract) {
+            return Lhs::template eval<Access>(input) - Rhs::template eval<Access>(input);
+        } else if constexpr (ins.code == OpCode::Multiply) {
+            return Lhs::template eval<Access>(input) * Rhs::template eval<Access>(input);
+        } else if constexpr (ins.code == OpCode::Divide) {
+            return Lhs::template eval<Access>(input) / Rhs::template eval<Access>(input);
+        } else {
+            static_assert(isIntrinsic(ins.code), "unexpected opcode in a static expression");
+            constexpr Intrinsic op = opcodeIntrinsic(ins.code);
+            if constexpr (intrinsicArity(op) == 1) {
+                return applyIntrinsic(op, Lhs::template eval<Access>(input), 0.0);
+            } else {
+                return applyIntrinsic(op, Lhs::template eval<Access>(input), Rhs::template eval<Access>(input));
+            }
+        }
+    }
+};
+
+// StaticExpression — the expression Source::text, parsed at compile time.
+template <typename Source>
+struct StaticExpression {
+    static constexpr const StaticProgram& program = StaticSource<Source>::program;
+    static_assert(program.valid(), "Source::text is not a valid compile-time expression (see StaticParser)");
+
+    using Root = StaticTerm<Source, program.size - 1>;
+
+    static constexpr uint32_t num_variables = program.num_variables;
+
+    // Slot of the named variable, or empty if the expression does not use it.
+    static constexpr std::optional<uint32_t> slot(std::string_view name) {
+        return program.slot(name);
+    }
+
+    static constexpr std::string_view variable(uint32_t slot) {
+        return program.variables[slot];
+    }
+
+    // Evaluates with slots[j] as the value of variable j; slots is anything
+    // indexable: a pointer, std::array, std::vector.
+    template <typename Slots>
+    static double eval(const Slots& slots) {
+        return Root::template eval<IndexedSlots>(slots);
+    }
+
+    // Evaluates with object.*Member as the value of each variable, one
+    // member pointer per slot.
+    template <auto... Members, typename Object>
+    static double evalMembers(const Object& object) {
+        static_assert(sizeof...(Members) == num_variables, "one member per variable slot");
+        return Root::template eval<MemberSlots<Members...>>(object);
+    }
+
+    // Evaluates every row of the columns (one per variable, in slot order)
+    // into output.
+    static void evaluate(const double* const* columns, size_t rows, double* output) {
+        for (size_t row = 0; row < rows; ++row) {
+            output[row] = Root::template eval<ColumnSlots>(ColumnRow{ columns, row });
+        }
+    }
+};
+
+}  // namespace Interpreter
@@ -0,0 +1,164 @@
+// Symbols.h — Interned name tables with allocation-free lookup
+//
+// Calculator looks up every identifier it parses: variable names in
+// _variable_map and function names in _function_map. With a
+// std::unordered_map<std::string, T> each probe first builds a std::string
+// from the parsed string_view (C++17 has no heterogeneous lookup), which
+// allocates for any name longer than the small-string buffer.
+//
+// SymbolMap<T> hashes the string_view directly. Names are interned on first
+// insertion and get dense symbol IDs 0, 1, 2, ... in insertion order; the
+// entries live in a vector indexed by ID, so a symbol can be kept as a
+// 32-bit integer and resolved without hashing. Only interning a new name
+// allocates; find() and operator[] on an existing name never do.
+//
+// The hash index is open addressing with linear probing over a power-of-two
+// table kept at most half full. Each slot caches the 32-bit hash, so a probe
+// compares strings only on a full hash match.
+//
+// Entries are std::pair<std::string, T>, and iteration yields them in
+// insertion order, so code written against the old unordered_map
+// (entry.first, entry.second, map["x"]) keeps working. Entries are never
+// erased; IDs stay valid for the lifetime of the map.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+// 32-bit FNV-1a hash of a name.
+inline uint32_t symbolHash(std::string_view name) {
+    uint32_t hash = 2166136261U;
+    for (char c : name) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619U;
+    }
+    return hash;
+}
+
+// SymbolMap — name → T map with dense symbol IDs and string_view lookup.
+template <typename T>
+class SymbolMap {
+public:
+    using Entry = std::pair<std::string, T>;
+    using iterator = typename std::vector<Entry>::iterator;
+    using const_iterator = typename std::vector<Entry>::const_iterator;
+
+    // Symbol ID of name, or empty if it has not been interned.
+    std::optional<uint32_t> id(std::string_view name) const {
+        if (_entries.empty()) {
+            return {};
+        }
+        uint32_t hash = symbolHash(name);
+        for (size_t slot = hash & mask();; slot = (slot + 1) & mask()) {
+            const Slot& probe = _slots[slot];
+            if (probe.id == kEmpty) {
+                return {};
+            }
+            if (probe.hash == hash && _entries[probe.id].first == name) {
+                return probe.id;
+            }
+        }
+    }
+
+    // Symbol ID of name, interning it with a default-constructed value if new.
+    uint32_t intern(std::string_view name) {
+        if (auto existing = id(name)) {
+            return *existing;
+        }
+        if (2 * (_entries.size() + 1) > _slots.size()) {
+            rehash(_slots.empty() ? 16 : 2 * _slots.size());
+        }
+        auto symbol = static_cast<uint32_t>(_entries.size());
+        _entries.emplace_back(std::string(name), T{});
+        insert(symbolHash(name), symbol);
+        return symbol;
+    }
+
+    // Value of name, or null if it has not been interned.
+    T* find(std::string_view name) {
+        auto symbol = id(name);
+        return symbol ? &_entries[*symbol].second : nullptr;
+    }
+    const T* find(std::string_view name) const {
+        auto symbol = id(name);
+        return symbol ? &_entries[*symbol].second : nullptr;
+    }
+
+    // Value of name, interned with a default-constructed value if new.
+    T& operator[](std::string_view name) {
+        return _entries[intern(name)].second;
+    }
+
+    // Value and name of an interned symbol.
+    T& at(uint32_t symbol) {
+        return _entries[symbol].second;
+    }
+    const T& at(uint32_t symbol) const {
+        return _entries[symbol].second;
+    }
+    std::string_view name(uint32_t symbol) const {
+        return _entries[symbol].first;
+    }
+
+    size_t size() const {
+        return _entries.size();
+    }
+    bool empty() const {
+        return _entries.empty();
+    }
+
+    iterator begin() {
+        return _entries.begin();
+    }
+    iterator end() {
+        return _entries.end();
+    }
+    const_iterator begin() const {
+        return _entries.begin();
+    }
+    const_iterator end() const {
+        return _entries.end();
+    }
+
+private:
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    struct Slot {
+        uint32_t hash = 0;
+        uint32_t id = kEmpty;
+    };
+
+    size_t mask() const {
+        return _slots.size() - 1;
+    }
+
+    void insert(uint32_t hash, uint32_t symbol) {
+        size_t slot = hash & mask();
+        while (_slots[slot].id != kEmpty) {
+            slot = (slot + 1) & mask();
+        }
+        _slots[slot] = Slot{ hash, symbol };
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(_slots);
+        for (const Slot& slot : old) {
+            if (slot.id != kEmpty) {
+                insert(slot.hash, slot.id);
+            }
+        }
+    }
+
+    std::vector<Entry> _entries;  // indexed by symbol ID
+    std::vector<Slot> _slots;     // hash index into _entries
+};
+
+}  // namespace Interpreter
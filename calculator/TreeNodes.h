@@ -10,17 +10,26 @@
 //   ├── UnaryOp        — prefix +/- applied to a single operand
 //   ├── BinaryOp       — infix +, -, *, / with two operands
 //   ├── Variable       — named value, looked up from a symbol table
-//   └── FunctionCall   — base for function invocations
-//       └── FunctionCallWithArgs<N> — N-argument function call (template)
+//   ├── Shared         — memoizes a subtree referenced by several parents
+//   ├── DagRoot        — root of a DAG, starts a new evaluation epoch
+//   ├── FunctionCall   — base for function invocations
+//   │   ├── FunctionCallWithArgs<N> — N-argument function call (template)
+//   │   └── IntrinsicCall — built-in math function (Intrinsics.h)
+//   └── WindowCall     — rolling aggregate over past values (Window.h)
+//
+// Each type's constructor sets the node's NodeKind tag (Node.h), and
+// NodeKindTest declares which tags identify the type.
 //
 // Also defines Function, a non-node descriptor that maps a name and arity
-// to a type-erased function pointer (FnPtr).
+// to a type-erased function pointer (FnPtr) or a built-in Intrinsic.
 
 #pragma once
 
 #include "Pointer.h"
 #include "Node.h"
 #include "FunctionOps.h"
+#include "Intrinsics.h"
+#include "Window.h"
 
 #include <array>
 #include <cstddef>
@@ -37,7 +46,7 @@ using NodePtr = Pointer<Node>;
 
 // Constant — a leaf node holding a literal floating-point value.
 struct Constant : public Node {
-    Constant(double dval) {
+    Constant(double dval) : Node(NodeKind::Constant) {
         value = dval;
     }
     double value;
@@ -51,7 +60,7 @@ struct Constant : public Node {
 // Parenthesis — a transparent wrapper that preserves grouping in the AST.
 // Evaluates to whatever its inner expression evaluates to.
 struct Parenthesis : public Node {
-    Parenthesis(NodePtr n) {
+    Parenthesis(NodePtr n) : Node(NodeKind::Parenthesis) {
         node = std::move(n);
     }
     NodePtr node;
@@ -71,6 +80,8 @@ struct Parenthesis : public Node {
 // UnaryOp — applies a prefix sign operator (+/-) to a single operand.
 struct UnaryOp : public Node {
     enum class Operation : uint16_t { NA = 0, Negative = 1, Positive = 2 };
+    UnaryOp() : Node(NodeKind::UnaryOp) {
+    }
     Operation op = Operation::NA;
     NodePtr node;
 
@@ -92,7 +103,7 @@ struct BinaryOp : public Node {
 
     // Returns the precedence level of an operator.
     // Higher values bind more tightly: mul/div (2) > add/sub (1) > NA (0).
-    static int precedence(Operation oper) {
+    static constexpr int precedence(Operation oper) {
         switch (oper) {
             case Operation::NA: return 0;
             case Operation::Addition:
@@ -103,7 +114,7 @@ struct BinaryOp : public Node {
         return 3;
     }
 
-    BinaryOp(Operation oper, NodePtr lhs, NodePtr rhs) {
+    BinaryOp(Operation oper, NodePtr lhs, NodePtr rhs) : Node(NodeKind::BinaryOp) {
         op = oper;
         left = std::move(lhs);
         right = std::move(rhs);
@@ -137,7 +148,7 @@ struct BinaryOp : public Node {
 // Variable — a named leaf node whose value can be assigned externally.
 // The parser interns variables in a map so repeated references share one node.
 struct Variable : public Node {
-    Variable(std::string_view varname) {
+    Variable(std::string_view varname) : Node(NodeKind::Variable) {
         name = varname;
     }
     std::string name;
@@ -152,17 +163,88 @@ struct Variable : public Node {
     }
 };
 
+// Epoch — evaluation counter shared by a DagRoot and its Shared nodes.
+struct Epoch : public RefCounted {
+    uint64_t value = 0;
+};
+
+// Shared — wraps a subtree that is referenced from several parents in a DAG
+// (see Optimizer.h). The subtree is evaluated on the first calc() of each
+// epoch; later calls in the same epoch return the cached value.
+struct Shared : public Node {
+    Shared(NodePtr n, Pointer<Epoch> ep) : Node(NodeKind::Shared) {
+        node = std::move(n);
+        epoch = std::move(ep);
+    }
+    NodePtr node;
+    Pointer<Epoch> epoch;
+    uint64_t seen = 0;  // epoch in which value was computed
+    double value = 0.0;
+
+    double calc() override {
+        if (seen != epoch->value) {
+            value = node->calc();
+            seen = epoch->value;
+        }
+        return value;
+    }
+
+    // Visits self first, then the wrapped node.
+    void visit(Visitor& visitor) override {
+        visitor.visit(this);
+        visitor.visit(node.get());
+    }
+};
+
+// DagRoot — the root of a DAG containing Shared nodes. Each calc() starts a
+// new epoch, so every Shared subtree is evaluated at most once per call.
+struct DagRoot : public Node {
+    DagRoot(NodePtr n, Pointer<Epoch> ep) : Node(NodeKind::DagRoot) {
+        node = std::move(n);
+        epoch = std::move(ep);
+    }
+    NodePtr node;
+    Pointer<Epoch> epoch;
+
+    double calc() override {
+        ++epoch->value;
+        return node->calc();
+    }
+
+    // Visits self first, then the wrapped node.
+    void visit(Visitor& visitor) override {
+        visitor.visit(this);
+        visitor.visit(node.get());
+    }
+};
+
 // Function — a descriptor (not a node) that maps a function name and arity
 // to a type-erased function pointer. Stored in Calculator's function map.
+// Built-in functions also carry their Intrinsic tag.
 struct Function {
     std::string name;
     size_t num_args;
     FnPtr fnptr;
+    Intrinsic intrinsic = Intrinsic::None;
 };
 
 // FunctionCall — abstract base for all function call nodes.
 // The actual implementation lives in the FunctionCallWithArgs<N> template.
-struct FunctionCall : public Node {};
+// The arity-independent accessors let passes over the tree (compilers,
+// optimizers) inspect a call without knowing N at compile time.
+struct FunctionCall : public Node {
+    explicit FunctionCall(NodeKind tag = NodeKind::FunctionCall) : Node(tag) {
+    }
+
+    FnPtr fnptr = nullptr;                   // type-erased pointer to the C function
+    Intrinsic intrinsic = Intrinsic::None;  // set by IntrinsicCall
+
+    // Number of argument nodes held by this call.
+    virtual size_t arity() const = 0;
+
+    // Returns the argument node at the given position (0 <= index < arity()).
+    virtual NodePtr& argument(size_t index) = 0;
+};
 
 // FunctionCallWithArgs<N> — a function call node with exactly N arguments.
 // Stores arguments in a fixed-size array and dispatches through callfn().
@@ -178,7 +260,13 @@ struct FunctionCallWithArgs : public FunctionCall {
     }
 
     std::array<NodePtr, N> args;  // argument expression nodes
-    FnPtr fnptr;                  // type-erased pointer to the C function
+
+    size_t arity() const override {
+        return N;
+    }
+    NodePtr& argument(size_t index) override {
+        return args[index];
+    }
 
     // Evaluates all argument expressions into a values array, then dispatches
     // the function call through callfn() which reinterpret_casts to the
@@ -201,4 +289,97 @@ struct FunctionCallWithArgs : public FunctionCall {
     }
 };
 
+// IntrinsicCall — a call to a built-in math function. Evaluated inline by
+// its tag instead of through callfn(); fnptr holds the equivalent C function
+// for passes that treat every call alike.
+struct IntrinsicCall : public FunctionCall {
+    IntrinsicCall(Intrinsic op, const std::vector<NodePtr>& arguments) : FunctionCall(NodeKind::IntrinsicCall) {
+        intrinsic = op;
+        fnptr = intrinsicFunction(op);
+        count = intrinsicArity(op);
+        for (size_t j = 0; j < count; ++j) {
+            args[j] = arguments[j];
+        }
+    }
+
+    std::array<NodePtr, 2> args;  // argument expression nodes (first count used)
+    size_t count;
+
+    size_t arity() const override {
+        return count;
+    }
+    NodePtr& argument(size_t index) override {
+        return args[index];
+    }
+
+    double calc() override {
+        double lhs = args[0]->calc();
+        double rhs = count > 1 ? args[1]->calc() : 0.0;
+        return applyIntrinsic(intrinsic, lhs, rhs);
+    }
+
+    // Visits self first, then each argument node in order.
+    void visit(Visitor& visitor) override {
+        visitor.visit(this);
+        for (size_t j = 0; j < count; ++j) {
+            visitor.visit(args[j].get());
+        }
+    }
+};
+
+// WindowCall — a rolling-window aggregate such as msum(x, 100). Unlike a
+// function call it has state: every calc() evaluates the argument, pushes
+// the value into the window as the next sample and returns the aggregate
+// of the last length samples (Window.h). Evaluating it twice for the same
+// variable values therefore counts two samples.
+struct WindowCall : public Node {
+    WindowCall(WindowOp op, size_t length, NodePtr arg) : Node(NodeKind::WindowCall), window(op, length) {
+        argument = std::move(arg);
+    }
+
+    NodePtr argument;
+    RollingWindow window;
+
+    WindowOp op() const {
+        return window.op();
+    }
+    size_t length() const {
+        return window.length();
+    }
+
+    double calc() override {
+        return window.push(argument->calc());
+    }
+
+    // Visits self first, then the argument.
+    void visit(Visitor& visitor) override {
+        visitor.visit(this);
+        visitor.visit(argument.get());
+    }
+};
+
+// Kind tags of the node types above (see nodeCast() in Node.h). A
+// FunctionCallWithArgs<N> is not tagged with its N, so downcasts to one
+// still use dynamic_cast.
+template <>
+struct NodeKindTest<Constant> : NodeKinds<NodeKind::Constant> {};
+template <>
+struct NodeKindTest<Parenthesis> : NodeKinds<NodeKind::Parenthesis> {};
+template <>
+struct NodeKindTest<UnaryOp> : NodeKinds<NodeKind::UnaryOp> {};
+template <>
+struct NodeKindTest<BinaryOp> : NodeKinds<NodeKind::BinaryOp> {};
+template <>
+struct NodeKindTest<Variable> : NodeKinds<NodeKind::Variable> {};
+template <>
+struct NodeKindTest<Shared> : NodeKinds<NodeKind::Shared> {};
+template <>
+struct NodeKindTest<DagRoot> : NodeKinds<NodeKind::DagRoot> {};
+template <>
+struct NodeKindTest<FunctionCall> : NodeKinds<NodeKind::FunctionCall, NodeKind::IntrinsicCall> {};
+template <>
+struct NodeKindTest<IntrinsicCall> : NodeKinds<NodeKind::IntrinsicCall> {};
+template <>
+struct NodeKindTest<WindowCall> : NodeKinds<NodeKind::WindowCall> {};
+
 }  // namespace Interpreter
@@ -0,0 +1,358 @@
+// Window.h — Rolling-window aggregates with constant-time updates
+//
+// A window aggregate summarizes the last length samples of a value: its sum,
+// mean, minimum, maximum or standard deviation. Recomputing one from the
+// history costs O(length) per sample; the classes here keep state that is
+// updated in O(1) (amortized for min/max) as each sample enters and the
+// oldest one leaves:
+//
+//   RollingSum      running sum, with Neumaier compensation so that adding
+//                   and removing millions of samples does not drift
+//   RollingMoments  count, mean and sum of squared deviations, updated with
+//                   Welford's recurrence for an added or replaced sample, and
+//                   recomputed from the window once every length samples so
+//                   that rounding errors cannot build up
+//   RollingExtreme  monotonic queue of (sequence, value): each sample evicts
+//                   the queued samples it dominates, so the front is always
+//                   the extreme of the window, and every sample is queued and
+//                   dequeued at most once
+//
+// Infinite and NaN samples are counted apart (NonFinite) instead of entering
+// the sums, where inf - inf would turn them into NaN for good: while the
+// window holds any, the aggregate is what IEEE arithmetic over the window
+// gives (inf, -inf or NaN), and it is finite again once they have left. A
+// NaN in the window makes every aggregate NaN, mmin and mmax included.
+//
+// RollingWindow combines them behind one push() for each WindowOp. Until
+// length samples have been pushed the aggregate covers those seen so far.
+// mstd is the population standard deviation (divided by the sample count).
+//
+// In formulas, msum(expr, N), mmean, mmin, mmax and mstd create a WindowCall
+// node (TreeNodes.h). Each evaluation of the node is one sample: it
+// evaluates expr, pushes the value and returns the aggregate. N must be an
+// integer literal from 1 to kMaxWindowLength.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Interpreter {
+
+enum class WindowOp : uint8_t { None = 0, Sum, Mean, Min, Max, Stddev };
+
+// Function names of the window aggregates, in WindowOp order (from Sum).
+static constexpr std::array<std::string_view, 5> kWindowNames = { "msum", "mmean", "mmin", "mmax", "mstd" };
+
+// Longest window a formula may ask for.
+static constexpr size_t kMaxWindowLength = size_t(1) << 26;
+
+// WindowOp named name, or None.
+constexpr WindowOp findWindow(std::string_view name) {
+    for (size_t j = 0; j < kWindowNames.size(); ++j) {
+        if (kWindowNames[j] == name) {
+            return static_cast<WindowOp>(j + 1);
+        }
+    }
+    return WindowOp::None;
+}
+
+// RingQueue<T> — double-ended queue in a power-of-two ring that grows by
+// doubling; no allocation once it has reached its working size.
+template <typename T>
+class RingQueue {
+public:
+    size_t size() const {
+        return _size;
+    }
+    bool empty() const {
+        return _size == 0;
+    }
+    const T& front() const {
+        return _items[_head];
+    }
+    // The index-th item from the front.
+    const T& operator[](size_t index) const {
+        return _items[(_head + index) & (_items.size() - 1)];
+    }
+    const T& back() const {
+        return _items[(_head + _size - 1) & (_items.size() - 1)];
+    }
+
+    void push_back(const T& item) {
+        if (_size == _items.size()) {
+            grow();
+        }
+        _items[(_head + _size) & (_items.size() - 1)] = item;
+        ++_size;
+    }
+    void pop_front() {
+        _head = (_head + 1) & (_items.size() - 1);
+        --_size;
+    }
+    void pop_back() {
+        --_size;
+    }
+
+private:
+    void grow() {
+        std::vector<T> items(std::max<size_t>(_items.size() * 2, 16));
+        for (size_t j = 0; j < _size; ++j) {
+            items[j] = _items[(_head + j) & (_items.size() - 1)];
+        }
+        _items = std::move(items);
+        _head = 0;
+    }
+
+    std::vector<T> _items;
+    size_t _head = 0;
+    size_t _size = 0;
+};
+
+// NonFinite — counts of the infinite and NaN values among those added and
+// not removed.
+class NonFinite {
+public:
+    // Counts value if it is not finite. Returns whether it was.
+    bool add(double value) {
+        return count(value, 1);
+    }
+    bool remove(double value) {
+        return count(value, size_t(0) - 1);
+    }
+
+    bool any() const {
+        return _nan + _positive + _negative != 0;
+    }
+    // The sum of the counted values: NaN, inf or -inf. Only if any().
+    double sum() const {
+        if (_nan != 0 || (_positive != 0 && _negative != 0)) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return _positive != 0 ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+    }
+
+private:
+    bool count(double value, size_t step) {
+        if (std::isfinite(value)) {
+            return false;
+        }
+        size_t& counter = std::isnan(value) ? _nan : value > 0 ? _positive : _negative;
+        counter += step;
+        return true;
+    }
+
+    size_t _nan = 0;
+    size_t _positive = 0;  // +inf
+    size_t _negative = 0;  // -inf
+};
+
+// RollingSum — sum of the values added and not yet removed.
+class RollingSum {
+public:
+    void add(double value) {
+        if (!_nonFinite.add(value)) {
+            accumulate(value);
+        }
+    }
+    void remove(double value) {
+        if (!_nonFinite.remove(value)) {
+            accumulate(-value);
+        }
+    }
+    double sum() const {
+        return _nonFinite.any() ? _nonFinite.sum() : _sum + _compensation;
+    }
+
+private:
+    void accumulate(double value) {
+        double sum = _sum + value;
+        if (std::fabs(_sum) >= std::fabs(value)) {
+            _compensation += (_sum - sum) + value;
+        } else {
+            _compensation += (value - sum) + _sum;
+        }
+        _sum = sum;
+    }
+
+    double _sum = 0;
+    double _compensation = 0;  // low-order bits lost from _sum
+    NonFinite _nonFinite;
+};
+
+// RollingMoments — mean and variance of the values added and not removed.
+class RollingMoments {
+public:
+    void add(double value) {
+        if (_nonFinite.add(value)) {
+            return;
+        }
+        ++_count;
+        double delta = value - _mean;
+        _mean += delta / static_cast<double>(_count);
+        _m2 += delta * (value - _mean);
+    }
+
+    void remove(double value) {
+        if (_nonFinite.remove(value)) {
+            return;
+        }
+        if (--_count == 0) {
+            _mean = 0;
+            _m2 = 0;
+            return;
+        }
+        double delta = value - _mean;
+        _mean -= delta / static_cast<double>(_count);
+        _m2 = std::max(0.0, _m2 - delta * (value - _mean));
+    }
+
+    // Restarts from values[0] to values[count - 1].
+    template <typename Values>
+    void assign(const Values& values, size_t count) {
+        *this = RollingMoments();
+        for (size_t j = 0; j < count; ++j) {
+            add(values[j]);
+        }
+    }
+
+    // Replaces removed by value.
+    void replace(double removed, double value) {
+        if (!std::isfinite(removed) || !std::isfinite(value)) {
+            remove(removed);
+            add(value);
+            return;
+        }
+        double delta = value - removed;
+        double mean = _mean;
+        _mean += delta / static_cast<double>(_count);
+        _m2 = std::max(0.0, _m2 + delta * (value - _mean + removed - mean));
+    }
+
+    // Population variance; NaN if a value is not finite.
+    double variance() const {
+        if (_nonFinite.any()) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return _count == 0 ? 0.0 : _m2 / static_cast<double>(_count);
+    }
+
+private:
+    size_t _count = 0;  // finite values
+    double _mean = 0;
+    double _m2 = 0;  // sum of squared deviations from the mean
+    NonFinite _nonFinite;
+};
+
+// RollingExtreme — minimum (Compare = std::less) or maximum (std::greater)
+// of the last length values pushed.
+template <typename Compare>
+class RollingExtreme {
+public:
+    explicit RollingExtreme(size_t length) : _length(length) {
+    }
+
+    void push(double value) {
+        if (std::isnan(value)) {
+            // Not comparable: it is remembered by position only.
+            _nan = _sequence + 1;
+        } else {
+            // A queued value that value beats (or ties) can never be the
+            // extreme again: value is newer and at least as extreme.
+            while (!_queue.empty() && !Compare()(_queue.back().second, value)) {
+                _queue.pop_back();
+            }
+            _queue.push_back({ _sequence, value });
+        }
+        if (!_queue.empty() && _queue.front().first + _length <= _sequence) {
+            _queue.pop_front();
+        }
+        ++_sequence;
+    }
+
+    // The extreme, or NaN if the window holds a NaN.
+    double value() const {
+        if (_nan != 0 && _nan + _length > _sequence) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return _queue.front().second;
+    }
+
+private:
+    size_t _length;
+    uint64_t _sequence = 0;                         // samples pushed
+    uint64_t _nan = 0;                              // 1 + sequence of the last NaN, or 0
+    RingQueue<std::pair<uint64_t, double>> _queue;  // extremes, oldest first
+};
+
+// RollingWindow — one WindowOp over the last length samples.
+class RollingWindow {
+public:
+    RollingWindow(WindowOp op, size_t length) : _op(op), _length(std::max<size_t>(length, 1)), _min(_length), _max(_length) {
+    }
+
+    // Adds a sample, dropping the oldest one once the window is full, and
+    // returns the aggregate.
+    double push(double value) {
+        switch (_op) {
+            case WindowOp::Min: _min.push(value); return _min.value();
+            case WindowOp::Max: _max.push(value); return _max.value();
+            case WindowOp::Sum:
+            case WindowOp::Mean: {
+                _sum.add(value);
+                if (_samples.size() == _length) {
+                    _sum.remove(_samples.front());
+                    _samples.pop_front();
+                }
+                _samples.push_back(value);
+                double sum = _sum.sum();
+                return _op == WindowOp::Sum ? sum : sum / static_cast<double>(_samples.size());
+            }
+            case WindowOp::Stddev: {
+                if (_samples.size() == _length) {
+                    _moments.replace(_samples.front(), value);
+                    _samples.pop_front();
+                } else {
+                    _moments.add(value);
+                }
+                _samples.push_back(value);
+                if (++_updates == _length) {
+                    // Rounding errors of the updates accumulate; recomputing
+                    // once per window length bounds them at O(1) amortized.
+                    _moments.assign(_samples, _samples.size());
+                    _updates = 0;
+                }
+                return std::sqrt(_moments.variance());
+            }
+            case WindowOp::None: break;
+        }
+        return 0.0;
+    }
+
+    WindowOp op() const {
+        return _op;
+    }
+    size_t length() const {
+        return _length;
+    }
+
+private:
+    WindowOp _op;
+    size_t _length;
+    RingQueue<double> _samples;  // Sum, Mean, Stddev: the window's samples
+    size_t _updates = 0;         // Stddev: samples since _moments was recomputed
+    RollingSum _sum;
+    RollingMoments _moments;
+    RollingExtreme<std::less<double>> _min;
+    RollingExtreme<std::greater<double>> _max;
+};
+
+}  // namespace Interpreter
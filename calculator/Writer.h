@@ -1,21 +1,49 @@
 // Writer.h — Visitor-based serialization of AST nodes
 //
-// Implements a simple Visitor that accumulates output into a character buffer.
-// The visit(Node*) method is intentionally a no-op; subclasses or callers
-// are expected to dynamic_cast the node to determine its concrete type and
-// call write() with the appropriate representation.
+// Writer is a Visitor that accumulates output into a character buffer.
+// visit(Node*), or write(const NodePtr&), appends the text of an expression
+// tree, which PrecedenceParser reads back to a tree with the same structure
+// and values. (The rotating parser, Calculator::parse(), groups a-b-c as
+// a-(b-c), so its trees print with those parentheses explicit.)
 //
-// This serves as a minimal example of the Visitor pattern applied to the
-// expression tree. A full implementation would override visit() to inspect
-// each node type and produce formatted output.
+//   - Operators are written without spaces, and a subtree is parenthesized
+//     only where the grammar needs it: when its operator binds more loosely
+//     than the context. The right operand of an operator of equal precedence
+//     keeps its parentheses, since a-(b-c) and a*(b*c) would otherwise be
+//     re-associated.
+//   - Parenthesis, Shared and DagRoot nodes are transparent. A Shared subtree
+//     is written out at every use, so a DAG from the Optimizer prints as the
+//     equivalent tree.
+//   - Built-in functions are written by name. User functions are written by
+//     the names given to names(); a call through any other function pointer
+//     is written as "?(...)", as is any node type Writer does not know.
+//   - Constants use the shortest text that parses back to the same double.
+//     Infinities and NaN, which have no literal syntax but can appear after
+//     constant folding, are written as 1/0, -1/0 and 0/0.
+//
+// write(double) formats with std::to_chars directly into the tail of the
+// buffer: the shortest round-trip representation (Ryu in libstdc++), with no
+// locale, no format string and no intermediate copy. This is several times
+// faster than snprintf("%.17g"), which was also needed for exact round trips.
+//
+// writeRaw() and align() append binary data instead of text; ImageWriter
+// (Image.h) lays out binary expression images with them.
 
 #pragma once
 
+#include "FunctionOps.h"
 #include "Node.h"
+#include "Symbols.h"
+#include "TreeNodes.h"
 
-#include <cstdio>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
 #include <cstring>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace Interpreter {
@@ -26,27 +54,183 @@ struct Writer : public Visitor {
     // Character buffer holding the serialized output.
     std::vector<char> data;
 
-    // Called for each visited node. Currently a no-op; serves as the hook
-    // point for subclasses to dispatch on concrete node types.
-    void visit(Node* /*node*/) override {
+    // Appends the text of the expression rooted at node.
+    void visit(Node* node) override {
+        expression(node, 0);
     }
 
-    // Formats a double value and appends it to the buffer.
-    void write(double value) {
-        constexpr int kBufSize = 64;
-        char buf[kBufSize];
-        int len = ::snprintf(buf, sizeof(buf), "%f", value);
-        if (len > 0) {
-            write(std::string_view(buf, static_cast<size_t>(len)));
+    void write(const NodePtr& root) {
+        expression(root.get(), 0);
+    }
+
+    // Names user functions for calls written after this; entries for
+    // built-in functions are skipped, since IntrinsicCall carries its name.
+    void names(const SymbolMap<Function>& functions) {
+        for (const auto& entry : functions) {
+            if (entry.second.intrinsic == Intrinsic::None) {
+                _functions.emplace_back(entry.second.fnptr, entry.first);
+            }
         }
     }
 
+    // Appends the shortest text that parses back to value.
+    void write(double value) {
+        // Longest shortest-round-trip double: "-2.2250738585072014e-308".
+        constexpr size_t kMaxDoubleChars = 24;
+        size_t size = data.size();
+        data.resize(size + kMaxDoubleChars);
+        char* first = data.data() + size;
+        std::to_chars_result result = std::to_chars(first, first + kMaxDoubleChars, value);
+        data.resize(static_cast<size_t>(result.ptr - data.data()));
+    }
+
     // Appends raw text (string_view) to the buffer via memcpy.
     void write(std::string_view str) {
         size_t size = data.size();
         data.resize(size + str.size());
         memcpy(&data[size], str.data(), str.size());
     }
+
+    void write(char chr) {
+        data.push_back(chr);
+    }
+
+    // Appends the bytes of count trivially copyable values.
+    template <typename T>
+    void writeRaw(const T* values, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "writeRaw() copies object bytes");
+        write(std::string_view(reinterpret_cast<const char*>(values), count * sizeof(T)));
+    }
+
+    template <typename T>
+    void writeRaw(const T& value) {
+        writeRaw(&value, 1);
+    }
+
+    // Appends zero bytes until the size is a multiple of alignment.
+    void align(size_t alignment) {
+        data.resize((data.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+private:
+    // Binding strength of a prefix sign, which binds tighter than any
+    // operator (BinaryOp::precedence()). Operands never need parentheses.
+    static constexpr int kPrefixPrecedence = 3;
+
+    // Writes node, parenthesized if its text binds more loosely than outer.
+    void expression(Node* node, int outer) {
+        if (node == nullptr) {
+            write('?');
+            return;
+        }
+        switch (node->kind) {
+            case NodeKind::BinaryOp: binary(*static_cast<BinaryOp*>(node), outer); return;
+            case NodeKind::Variable: write(std::string_view(static_cast<Variable*>(node)->name)); return;
+            case NodeKind::Constant: constant(static_cast<Constant*>(node)->value, outer); return;
+            case NodeKind::Parenthesis: expression(static_cast<Parenthesis*>(node)->node.get(), outer); return;
+            case NodeKind::Shared: expression(static_cast<Shared*>(node)->node.get(), outer); return;
+            case NodeKind::DagRoot: expression(static_cast<DagRoot*>(node)->node.get(), outer); return;
+            case NodeKind::UnaryOp: unary(*static_cast<UnaryOp*>(node), outer); return;
+            case NodeKind::FunctionCall:
+            case NodeKind::IntrinsicCall: call(*static_cast<FunctionCall*>(node)); return;
+            case NodeKind::WindowCall: window(*static_cast<WindowCall*>(node)); return;
+            case NodeKind::Other: break;
+        }
+        write('?');
+    }
+
+    void unary(UnaryOp& uop, int outer) {
+        if (uop.op == UnaryOp::Operation::NA) {
+            expression(uop.node.get(), outer);
+            return;
+        }
+        open(kPrefixPrecedence < outer);
+        write(uop.op == UnaryOp::Operation::Negative ? '-' : '+');
+        expression(uop.node.get(), kPrefixPrecedence);
+        close(kPrefixPrecedence < outer);
+    }
+
+    void call(FunctionCall& call) {
+        write(functionName(call));
+        write('(');
+        for (size_t j = 0; j < call.arity(); ++j) {
+            if (j > 0) {
+                write(',');
+            }
+            expression(call.argument(j).get(), 0);
+        }
+        write(')');
+    }
+
+    void window(WindowCall& window) {
+        write(kWindowNames[static_cast<size_t>(window.op()) - 1]);
+        write('(');
+        expression(window.argument.get(), 0);
+        write(',');
+        write(std::to_string(window.length()));
+        write(')');
+    }
+
+    void binary(BinaryOp& binop, int outer) {
+        int prec = BinaryOp::precedence(binop.op);
+        open(prec < outer);
+        expression(binop.left.get(), prec);
+        write(symbol(binop.op));
+        expression(binop.right.get(), prec + 1);
+        close(prec < outer);
+    }
+
+    void constant(double value, int outer) {
+        if (std::isfinite(value)) {
+            // A negative literal reads back as a prefix minus.
+            bool paren = std::signbit(value) && kPrefixPrecedence < outer;
+            open(paren);
+            write(value);
+            close(paren);
+            return;
+        }
+        int prec = BinaryOp::precedence(BinaryOp::Operation::Division);
+        open(prec < outer);
+        write(std::isnan(value) ? std::string_view("0/0") : value > 0 ? std::string_view("1/0") : "-1/0");
+        close(prec < outer);
+    }
+
+    void open(bool paren) {
+        if (paren) {
+            write('(');
+        }
+    }
+
+    void close(bool paren) {
+        if (paren) {
+            write(')');
+        }
+    }
+
+    static char symbol(BinaryOp::Operation oper) {
+        switch (oper) {
+            case BinaryOp::Operation::Addition: return '+';
+            case BinaryOp::Operation::Subtraction: return '-';
+            case BinaryOp::Operation::Multiplication: return '*';
+            case BinaryOp::Operation::Division: return '/';
+            case BinaryOp::Operation::NA: break;
+        }
+        return '?';
+    }
+
+    std::string_view functionName(const FunctionCall& call) const {
+        if (call.intrinsic != Intrinsic::None) {
+            return kIntrinsicNames[static_cast<size_t>(call.intrinsic) - 1];
+        }
+        for (const auto& function : _functions) {
+            if (function.first == call.fnptr) {
+                return function.second;
+            }
+        }
+        return "?";
+    }
+
+    std::vector<std::pair<FnPtr, std::string>> _functions;  // user functions by pointer
 };
 
 }  // namespace Interpreter
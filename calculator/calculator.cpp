@@ -5,17 +5,102 @@
 // iterations. Uses RDTSC on x86 for cycle-accurate timing, falling back to
 // std::chrono on other architectures.
 //
-// Usage: calc <expression> [expression2] ...
-// Example: calc "2+3*4" "(2+3)*4"
+// With --compiled, each expression is also lowered to bytecode (Bytecode.h)
+// and the evaluate-only cost of the tree walk and the bytecode interpreter
+// are reported side by side.
+//
+// With --batch, each expression is evaluated over BATCH_ROWS rows of random
+// variable values, row by row and column-at-a-time (Batch.h), and the
+// throughput of each path is reported in rows/second.
+//
+// With --arena, the parse+evaluate loop is repeated with the nodes placed in
+// a reused Arena (Arena.h) instead of one heap allocation per node.
+//
+// With --cached, the loop goes through a ParseCache (ParseCache.h), so only
+// the first iteration parses and the rest cost one hash lookup.
+//
+// With --jit, each expression is also compiled to native x86-64 code
+// (Jit.h); the compile cost and the evaluate-only cost of the tree walk, the
+// bytecode interpreter and the native function are reported side by side.
+//
+// With --incremental, one variable of the expression is changed before each
+// evaluation, and a full tree walk is compared with IncrementalExpression
+// (Incremental.h), which recomputes only the nodes that depend on it; the
+// average number of instructions recomputed per update is also reported.
+//
+// With --gradient, the partial derivative with respect to every variable is
+// printed, computed by one reverse-mode sweep (Gradient.h), and the cost of
+// that sweep is compared with N+1 bytecode evaluations for forward
+// differences over N variables.
+//
+// With --profile, the expression is parsed by PrecedenceParser with source
+// spans recorded, instrumented with a Profiler (Profiler.h) and evaluated
+// BENCH_ITERATIONS times; the operator and call nodes with the most self time
+// are listed with their source text. Requires a build with
+// -DCALCULATOR_PROFILE=ON.
+//
+// With --bench-parsers, no expressions are needed: generated expressions of
+// 10, 1,000 and 100,000 terms are parsed by the rotating recursive-descent
+// parser and by PrecedenceParser (PrecedenceParser.h), and the average parse
+// cost of each is reported.
+//
+// With --bench-literals, a generated literal-heavy expression (integers,
+// decimals, exponents and long digit strings) is parsed, and the cost per
+// literal of Lexer::parsedouble() is reported next to std::strtod() together
+// with the full-parse throughput in MB/s.
+//
+// With --bench-scanner, generated expression text and text with long
+// whitespace, digit and identifier runs are split into tokens three ways: with
+// the locale-aware <cctype> calls Predicates.h used to make, with the
+// kCharClasses table one byte at a time, and with the vector scanner of
+// Scan.h. Throughput is reported in bytes per cycle.
+//
+// With --bulk FILE (or --bulk - for stdin), the file is treated as one
+// expression per line with optional ";name=value" bindings (Bulk.h). Lines are
+// parsed and evaluated on all cores (--threads N to override), results are
+// written to stdout in input order, and throughput and per-stage timings are
+// reported on stderr.
+//
+// Usage: calc [--compiled] [--batch] [--arena] [--cached] [--jit] [--incremental]
+//             [--gradient] [--profile] <expression> ...
+//        calc --bench-parsers
+//        calc --bench-literals
+//        calc --bench-scanner
+//        calc [--threads N] --bulk FILE|-
+// Example: calc --compiled "2+3*4" "(2+3)*4"
 
+#include "Arena.h"
+#include "Batch.h"
+#include "Bytecode.h"
+#include "Bulk.h"
 #include "Calculator.h"
+#include "Cycles.h"
+#include "Gradient.h"
+#include "Incremental.h"
+#include "Jit.h"
+#include "Lexer.h"
 #include "Node.h"
+#include "ParseCache.h"
 #include "Pointer.h"
+#include "Predicates.h"
+#include "PrecedenceParser.h"
+#include "Profiler.h"
+#include "Scan.h"
+
+#include <pthread.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <optional>
+#include <random>
 #include <string>
+#include <vector>
 
 // Optimization barrier — prevents the compiler from discarding the result
 // of a computation in a benchmarking loop. Uses an inline asm statement
@@ -28,40 +113,611 @@ static inline void DoNotOptimize(Tp const& value) {
 
 using namespace Interpreter;
 
-// Platform-specific high-resolution timer selection.
-// On x86/x64: use RDTSC for cycle-accurate measurement.
-// On other architectures: fall back to std::chrono nanoseconds.
-#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
-#define HAS_RDTSC 1
-#endif
+// Number of iterations for the benchmark loop.
+static constexpr int BENCH_ITERATIONS = 10000;
+
+// Times evaluate-only calls of fn() and returns the average per call.
+template <typename Fn>
+static double timeEvaluation(Fn&& func) {
+    uint64_t start = now();
+    for (int k = 0; k < BENCH_ITERATIONS; ++k) {
+        double value = func();
+        DoNotOptimize(value);
+    }
+    uint64_t stop = now();
+    return static_cast<double>(stop - start) / double(BENCH_ITERATIONS);
+}
 
-#ifdef HAS_RDTSC
-uint64_t now() {
-    return __builtin_ia32_rdtsc();
+// Reports evaluate-only timings of the tree walk against the bytecode
+// interpreter for an already parsed expression.
+static bool reportCompiled(const NodePtr& ast) {
+    uint64_t start = now();
+    std::optional<Program> prog = Compiler::compile(ast);
+    uint64_t stop = now();
+    if (!prog) {
+        printf("Error: expression cannot be compiled\n");
+        return false;
+    }
+    double tree = timeEvaluation([&ast] { return ast->calc(); });
+    double compiled = timeEvaluation([&prog] { return prog->calc(); });
+    printf("Compiled: %f Instructions:%zu Compile:%.1f %s\n", prog->calc(), prog->code.size(),
+        static_cast<double>(stop - start), time_unit);
+    printf("Evaluate: Tree:%.1f Compiled:%.1f %s\n", tree, compiled, time_unit);
+    return true;
 }
-static constexpr const char* time_unit = "cycles";
-#else
-#include <chrono>
-uint64_t now() {
-    return std::chrono::steady_clock::now().time_since_epoch().count();
+
+// Reports evaluate-only timings of the tree walk, the bytecode interpreter
+// and the native JIT function, plus the time spent generating machine code.
+static bool reportJit(const NodePtr& ast) {
+    std::optional<Program> prog = Compiler::compile(ast);
+    if (!prog) {
+        printf("Error: expression cannot be compiled\n");
+        return false;
+    }
+    uint64_t start = now();
+    std::optional<JitExpression> native = JitCompiler::compile(*prog);
+    uint64_t stop = now();
+    if (!native) {
+        printf("Error: expression cannot be compiled to native code\n");
+        return false;
+    }
+    double tree = timeEvaluation([&ast] { return ast->calc(); });
+    double compiled = timeEvaluation([&prog] { return prog->calc(); });
+    double jit = timeEvaluation([&native] { return native->calc(); });
+    printf("Native: %f Mapped:%zu Compile:%.1f %s\n", native->calc(), native->buffer.size(),
+        static_cast<double>(stop - start), time_unit);
+    printf("Evaluate: Tree:%.1f Compiled:%.1f Native:%.1f %s\n", tree, compiled, jit, time_unit);
+    return true;
 }
-static constexpr const char* time_unit = "ns";
-#endif
 
-// Number of iterations for the benchmark loop.
-static constexpr int BENCH_ITERATIONS = 10000;
+// Reports the cost of re-evaluating after one variable changed: a full tree
+// walk against incremental re-evaluation of the affected paths only.
+static bool reportIncremental(const NodePtr& ast) {
+    std::optional<IncrementalExpression> expr = IncrementalExpression::create(ast);
+    if (!expr) {
+        printf("Error: expression cannot be compiled\n");
+        return false;
+    }
+    if (expr->program().variables.empty()) {
+        printf("Incremental: expression has no variables\n");
+        return true;
+    }
+    // Distinct non-zero inputs, so that no update is masked by a product with 0.
+    const auto& variables = expr->program().variables;
+    for (size_t slot = 0; slot < variables.size(); ++slot) {
+        expr->set(slot, static_cast<double>(slot + 2));
+    }
+    Variable& var = *variables.front();
+    int tick = 0;
+    double tree = timeEvaluation([&] {
+        var.value = static_cast<double>(++tick & 1);
+        return ast->calc();
+    });
+    expr->calc();
+    size_t before = expr->stats().total;
+    double incremental = timeEvaluation([&] {
+        expr->set(size_t(0), static_cast<double>(++tick & 1));
+        return expr->calc();
+    });
+    double recomputed = static_cast<double>(expr->stats().total - before) / double(BENCH_ITERATIONS);
+    printf("Update %s: Tree:%.1f Incremental:%.1f %s Recomputed:%.1f of %zu\n", var.name.c_str(), tree,
+        incremental, time_unit, recomputed, expr->program().code.size());
+    return true;
+}
+
+// Number of rows evaluated by the --batch throughput comparison.
+static constexpr size_t BATCH_ROWS = 1 << 20;
+
+// Runs fn() once and returns the wall-clock time it took in seconds.
+template <typename Fn>
+static double timeSeconds(Fn&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+// Reports rows/second of row-at-a-time evaluation (tree walk and bytecode)
+// against column-at-a-time batch evaluation over random variable values.
+static bool reportBatch(const NodePtr& ast) {
+    auto batch = BatchEvaluator::create(ast);
+    if (!batch) {
+        printf("Error: expression cannot be compiled\n");
+        return false;
+    }
+    const Program& prog = batch->program();
+    size_t nvars = prog.variables.size();
+
+    // Column-major inputs for the batch path, row-major for the others.
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(1.0, 2.0);
+    std::vector<std::vector<double>> columns(nvars, std::vector<double>(BATCH_ROWS));
+    std::vector<double> rows(nvars * BATCH_ROWS);
+    for (size_t row = 0; row < BATCH_ROWS; ++row) {
+        for (size_t var = 0; var < nvars; ++var) {
+            double value = dist(rng);
+            columns[var][row] = value;
+            rows[row * nvars + var] = value;
+        }
+    }
+    std::vector<const double*> inputs;
+    for (const auto& column : columns) {
+        inputs.push_back(column.data());
+    }
+    std::vector<double> output(BATCH_ROWS);
+
+    double tree = timeSeconds([&] {
+        for (size_t row = 0; row < BATCH_ROWS; ++row) {
+            for (size_t var = 0; var < nvars; ++var) {
+                prog.variables[var]->value = rows[row * nvars + var];
+            }
+            output[row] = ast->calc();
+        }
+        DoNotOptimize(output.data());
+    });
+    double compiled = timeSeconds([&] {
+        for (size_t row = 0; row < BATCH_ROWS; ++row) {
+            output[row] = prog.run(&rows[row * nvars]);
+        }
+        DoNotOptimize(output.data());
+    });
+    double batched = timeSeconds([&] {
+        batch->evaluate(inputs, BATCH_ROWS, output.data());
+        DoNotOptimize(output.data());
+    });
+    auto rate = [](double seconds) { return static_cast<double>(BATCH_ROWS) / seconds; };
+    printf("Throughput: Tree:%.3g Compiled:%.3g Batch:%.3g rows/s\n", rate(tree), rate(compiled),
+        rate(batched));
+    return true;
+}
+
+// Reports the parse+evaluate loop with all nodes allocated in one arena that
+// is reset between iterations, next to the heap-allocating loop above.
+static void reportArena(Calculator& calc, const std::string& cmd) {
+    Arena arena;
+    double value = 0;
+    uint64_t start = now();
+    for (int k = 0; k < BENCH_ITERATIONS; ++k) {
+        {
+            NodePtr ast = calc.parse(cmd, arena);
+            value = ast->calc();
+            DoNotOptimize(value);
+        }
+        arena.reset();
+    }
+    uint64_t stop = now();
+    double elapsed = static_cast<double>(stop - start) / double(BENCH_ITERATIONS);
+    printf("Arena: %f Avg:%.1f %s\n", value, elapsed, time_unit);
+}
+
+// Reports the lookup+evaluate loop through an LRU parse cache.
+static void reportCached(ParseCache& cache, const std::string& cmd) {
+    double value = 0;
+    uint64_t start = now();
+    for (int k = 0; k < BENCH_ITERATIONS; ++k) {
+        Pointer<CachedExpression> expr = cache.get(cmd);
+        value = expr->calc();
+        DoNotOptimize(value);
+    }
+    uint64_t stop = now();
+    double elapsed = static_cast<double>(stop - start) / double(BENCH_ITERATIONS);
+    const ParseCacheStats& stats = cache.stats();
+    printf("Cached: %f Avg:%.1f %s Hits:%zu Misses:%zu Evictions:%zu\n", value, elapsed, time_unit,
+        stats.hits, stats.misses, stats.evictions);
+}
+
+// Capacity of the parse cache used by --cached.
+static constexpr size_t CACHE_CAPACITY = 1024;
+
+// Runs fn() on a thread with the given stack size. The rotating parser
+// recurses once per operator, so 100,000-term inputs need far more than the
+// default 8 MiB stack. If the thread cannot be started, fn() runs on the
+// calling thread instead; its argument tells whether it has the large stack.
+template <typename Fn>
+static void runWithStack(size_t bytes, Fn& func) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, bytes);
+    pthread_t thread;
+    auto trampoline = [](void* arg) -> void* {
+        (*static_cast<Fn*>(arg))(true);
+        return nullptr;
+    };
+    int error = pthread_create(&thread, &attr, trampoline, &func);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        fprintf(stderr, "cannot start a thread with a %zu MiB stack (%s); running on the main thread\n",
+            bytes >> 20, strerror(error));
+        func(false);
+        return;
+    }
+    pthread_join(thread, nullptr);
+}
+
+// Stack size for the parser comparison thread.
+static constexpr size_t PARSER_BENCH_STACK = size_t(2) << 30;
+
+// Longest input the rotating parser is given on a default-sized stack.
+static constexpr size_t SHALLOW_STACK_TERMS = 1000;
+
+// Builds a deterministic expression with the given number of terms, mixing
+// literals and a variable with alternating '+' and '*'.
+static std::string makeExpression(size_t terms) {
+    std::string text;
+    for (size_t k = 0; k < terms; ++k) {
+        if (k > 0) {
+            text += (k % 2 != 0) ? '+' : '*';
+        }
+        text += (k % 4 == 0) ? std::string("x") : std::to_string(k % 9 + 1) + ".5";
+    }
+    return text;
+}
+
+// Times parse-only calls of both parsers on expressions of increasing length.
+static void benchParsers() {
+    auto body = [](bool deep) {
+        Calculator calc;
+        PrecedenceParser parser(calc);
+        for (size_t terms : { size_t(10), size_t(1000), size_t(100000) }) {
+            if (!deep && terms > SHALLOW_STACK_TERMS) {
+                printf("Parse %zu terms: skipped, the stack is too small\n", terms);
+                continue;
+            }
+            std::string text = makeExpression(terms);
+            int iterations = static_cast<int>(std::max<size_t>(3, 200000 / terms));
+            auto timeParse = [&](auto&& parse) {
+                uint64_t start = now();
+                for (int k = 0; k < iterations; ++k) {
+                    NodePtr ast = parse(text);
+                    DoNotOptimize(ast.get());
+                }
+                uint64_t stop = now();
+                return static_cast<double>(stop - start) / iterations;
+            };
+            double rotating = timeParse([&calc](const std::string& code) { return calc.parse(code); });
+            double precedence = timeParse([&parser](const std::string& code) { return parser.parse(code); });
+            auto perterm = [terms](double total) { return total / static_cast<double>(terms); };
+            printf("Parse %zu terms: Rotating:%.0f Precedence:%.0f %s (per term %.1f / %.1f)\n", terms,
+                rotating, precedence, time_unit, perterm(rotating), perterm(precedence));
+        }
+    };
+    runWithStack(PARSER_BENCH_STACK, body);
+}
+
+// Number of literals in the --bench-literals input.
+static constexpr size_t LITERAL_COUNT = 100000;
+
+// Times literal conversion on its own and as part of a full parse.
+static void benchLiterals() {
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> shape(0, 7);
+    std::uniform_int_distribution<uint64_t> digits(0, 999999999);
+    std::uniform_int_distribution<int> exponent(-30, 30);
+    std::vector<std::string> literals;
+    for (size_t k = 0; k < LITERAL_COUNT; ++k) {
+        std::string lit = std::to_string(digits(rng));
+        switch (shape(rng)) {
+            case 0:
+            case 1: break;  // integer
+            case 2:
+            case 3:
+            case 4: lit.insert(lit.size() / 2, "."); break;  // decimal
+            case 5:
+            case 6: lit += "e" + std::to_string(exponent(rng)); break;  // exponent
+            default: lit += "." + std::to_string(digits(rng)) + std::to_string(digits(rng)); break;  // long
+        }
+        literals.push_back(lit);
+    }
+    std::string text;
+    for (const std::string& lit : literals) {
+        text += text.empty() ? "" : "+";
+        text += lit;
+    }
+
+    Lexer lexer;
+    double sum = 0;
+    uint64_t start = now();
+    for (const std::string& lit : literals) {
+        lexer.reset(lit);
+        sum += lexer.parsedouble().value_or(0);
+    }
+    uint64_t stop = now();
+    double lexed = static_cast<double>(stop - start) / LITERAL_COUNT;
+    double check = 0;
+    start = now();
+    for (const std::string& lit : literals) {
+        check += std::strtod(lit.c_str(), nullptr);
+    }
+    stop = now();
+    double reference = static_cast<double>(stop - start) / LITERAL_COUNT;
+    DoNotOptimize(sum);
+    DoNotOptimize(check);
+
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast;
+    double seconds = timeSeconds([&] { ast = parser.parse(text); });
+    printf("Literals: %zu parsedouble:%.1f strtod:%.1f %s per literal %s\n", LITERAL_COUNT, lexed, reference,
+        time_unit, sum == check ? "(identical)" : "(MISMATCH)");
+    printf("Parse: %zu bytes %.1f MB/s Result:%g\n", text.size(),
+        static_cast<double>(text.size()) / seconds / 1e6, ast ? ast->calc() : 0.0);
+}
+
+// Run scanners compared by --bench-scanner. Each returns the end of the run
+// of its class starting at first.
+//
+// CctypeRuns is how Predicates.h classified before kCharClasses: locale-aware
+// <cctype> calls, one character at a time.
+struct CctypeRuns {
+    static const char* space(const char* first, const char* last) {
+        while (first != last && std::isspace(static_cast<unsigned char>(*first)) != 0) {
+            ++first;
+        }
+        return first;
+    }
+    static const char* digits(const char* first, const char* last) {
+        while (first != last && std::isdigit(static_cast<unsigned char>(*first)) != 0) {
+            ++first;
+        }
+        return first;
+    }
+    static const char* identifier(const char* first, const char* last) {
+        while (first != last && (*first == '_' || std::isalnum(static_cast<unsigned char>(*first)) != 0)) {
+            ++first;
+        }
+        return first;
+    }
+};
+
+// The kCharClasses table, one character at a time.
+struct TableRuns {
+    static const char* space(const char* first, const char* last) {
+        while (first != last && hasClass(*first, kSpaceClass)) {
+            ++first;
+        }
+        return first;
+    }
+    static const char* digits(const char* first, const char* last) {
+        while (first != last && hasClass(*first, kDigitClass)) {
+            ++first;
+        }
+        return first;
+    }
+    static const char* identifier(const char* first, const char* last) {
+        while (first != last && hasClass(*first, kAlphaClass | kDigitClass | kUnderscoreClass)) {
+            ++first;
+        }
+        return first;
+    }
+};
+
+// The vector scanner (Scan.h), as used by Lexer::skip().
+struct VectorRuns {
+    static const char* space(const char* first, const char* last) {
+        return scanRun<SpaceRuns>(first, last);
+    }
+    static const char* digits(const char* first, const char* last) {
+        return scanRun<DigitRuns>(first, last);
+    }
+    static const char* identifier(const char* first, const char* last) {
+        return scanRun<IdentifierRuns>(first, last);
+    }
+};
+
+// Splits text into whitespace, number, identifier and single-character
+// tokens the way the parsers do, and returns the number of tokens.
+template <typename Runs>
+static size_t scanTokens(std::string_view text) {
+    const char* first = text.data();
+    const char* last = first + text.size();
+    size_t tokens = 0;
+    while (first != last) {
+        char chr = *first;
+        if (hasClass(chr, kSpaceClass)) {
+            first = Runs::space(first, last);
+        } else if (hasClass(chr, kDigitClass)) {
+            first = Runs::digits(first, last);
+        } else if (hasClass(chr, kAlphaClass | kUnderscoreClass)) {
+            first = Runs::identifier(first, last);
+        } else {
+            ++first;
+        }
+        ++tokens;
+    }
+    return tokens;
+}
+
+// Builds text of about size bytes with long whitespace, digit and identifier
+// runs, as in formatted or machine-generated formula files.
+static std::string makeLongRuns(size_t size) {
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<int> length(4, 40);
+    std::uniform_int_distribution<int> letter(0, 25);
+    std::uniform_int_distribution<int> digit(0, 9);
+    std::string text;
+    while (text.size() < size) {
+        text.append(static_cast<size_t>(length(rng)) / 4, ' ');
+        for (int k = length(rng); k > 0; --k) {
+            text += static_cast<char>('a' + letter(rng));
+        }
+        text += " * ";
+        for (int k = length(rng); k > 0; --k) {
+            text += static_cast<char>('0' + digit(rng));
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+// Size of the --bench-scanner inputs.
+static constexpr size_t SCANNER_BYTES = size_t(1) << 20;
+
+// Reports scanner throughput in bytes per cycle (per ns without RDTSC) for
+// the <cctype> loop, the classification table and the vector scanner.
+static void benchScanner() {
+    std::string expressions = makeExpression(SCANNER_BYTES / 4);
+    std::string runs = makeLongRuns(SCANNER_BYTES);
+    for (const auto& input : { std::make_pair("Expressions", &expressions), std::make_pair("Long runs", &runs) }) {
+        std::string_view text = *input.second;
+        size_t counts[3] = {};
+        auto throughput = [&](size_t& count, auto scan) {
+            constexpr int kRounds = 20;
+            uint64_t best = UINT64_MAX;
+            for (int k = 0; k < kRounds; ++k) {
+                uint64_t start = now();
+                count = scan(text);
+                DoNotOptimize(count);
+                best = std::min(best, now() - start);
+            }
+            return static_cast<double>(text.size()) / static_cast<double>(std::max<uint64_t>(best, 1));
+        };
+        double cctype = throughput(counts[0], scanTokens<CctypeRuns>);
+        double table = throughput(counts[1], scanTokens<TableRuns>);
+        double vector = throughput(counts[2], scanTokens<VectorRuns>);
+        printf("Scan %s: %zu bytes %zu tokens cctype:%.2f table:%.2f vector:%.2f bytes/%s %s\n", input.first,
+            text.size(), counts[2], cctype, table, vector, time_unit,
+            counts[0] == counts[2] && counts[1] == counts[2] ? "(identical)" : "(MISMATCH)");
+    }
+}
+
+// Evaluates every line of path (or stdin for "-") and writes the results to
+// stdout. Returns the process exit code.
+static int runBulk(const char* path, size_t threads) {
+    std::optional<MappedInput> input;
+    double read = timeSeconds([&] { input = MappedInput::open(path); });
+    if (!input) {
+        (void)fprintf(stderr, "Error: cannot read %s\n", path);
+        return 1;
+    }
+    BulkEvaluator bulk(threads);
+    bulk.run(input->text());
+    double write = timeSeconds([&bulk] { bulk.write(stdout); });
+    const BulkStats& stats = bulk.stats();
+    double total = read + stats.split + stats.process + write;
+    (void)fprintf(stderr, "Bulk: %zu lines %zu errors %zu threads %.3g expr/s (%.3g expr/s end to end)\n",
+        stats.lines, stats.errors, stats.threads, static_cast<double>(stats.lines) / stats.process,
+        static_cast<double>(stats.lines) / total);
+    (void)fprintf(stderr, "Wall: Read:%.3f Split:%.3f Process:%.3f Write:%.3f s\n", read, stats.split,
+        stats.process, write);
+    (void)fprintf(stderr, "Workers: Parse:%.3f Evaluate:%.3f thread-s\n", stats.parse, stats.evaluate);
+    return 0;
+}
+
+// Reports the gradient at variables = 2, 3, ... and the cost of computing it
+// by reverse mode against forward differences.
+static bool reportGradient(const NodePtr& ast) {
+    std::optional<GradientExpression> expr = GradientExpression::create(ast);
+    if (!expr) {
+        printf("Error: expression cannot be compiled\n");
+        return false;
+    }
+    const Program& prog = expr->program();
+    std::vector<double> slots(prog.variables.size());
+    for (size_t slot = 0; slot < slots.size(); ++slot) {
+        slots[slot] = static_cast<double>(slot + 2);
+    }
+    printf("Gradient: %f", expr->run(slots.data()));
+    for (size_t slot = 0; slot < slots.size(); ++slot) {
+        printf(" d/d%s:%g", prog.variables[slot]->name.c_str(), expr->partials()[slot]);
+    }
+    printf("\n");
+    double reverse = timeEvaluation([&] { return expr->run(slots.data()); });
+    double forward = timeEvaluation([&] {
+        double base = prog.run(slots.data());
+        double sum = 0;
+        for (double& slot : slots) {
+            double arg = slot;
+            slot = arg + 1e-7;
+            sum += prog.run(slots.data()) - base;
+            slot = arg;
+        }
+        return sum;
+    });
+    printf("Gradient of %zu: Reverse:%.1f Differences:%.1f %s\n", slots.size(), reverse, forward, time_unit);
+    return true;
+}
+
+// Profiles BENCH_ITERATIONS evaluations of cmd and prints the hot nodes.
+static bool reportProfile(Calculator& calc, const std::string& cmd) {
+    SourceSpans spans;
+    calc._spans = &spans;
+    NodePtr ast = PrecedenceParser(calc).parse(cmd);
+    calc._spans = nullptr;
+    if (!ast) {
+        printf("Error: failed to parse expression '%s'\n", cmd.c_str());
+        return false;
+    }
+    Profiler profiler;
+    profiler.attach(ast, &spans);
+    for (int k = 0; k < BENCH_ITERATIONS; ++k) {
+        double value = ast->calc();
+        DoNotOptimize(value);
+    }
+    profiler.report(stdout, cmd);
+    return true;
+}
 
 int main(int argc, char* argv[]) {
     try {
-        if (argc < 2) {
-            printf("Usage: calc <expression>\n");
+        int first = 1;
+        bool compiled = false;
+        bool batch = false;
+        bool arena = false;
+        bool cached = false;
+        bool jit = false;
+        bool incremental = false;
+        bool gradient = false;
+        bool profile = false;
+        size_t threads = 0;
+        for (; first < argc && strncmp(argv[first], "--", 2) == 0; ++first) {
+            if (strcmp(argv[first], "--compiled") == 0) {
+                compiled = true;
+            } else if (strcmp(argv[first], "--batch") == 0) {
+                batch = true;
+            } else if (strcmp(argv[first], "--arena") == 0) {
+                arena = true;
+            } else if (strcmp(argv[first], "--cached") == 0) {
+                cached = true;
+            } else if (strcmp(argv[first], "--jit") == 0) {
+                jit = true;
+            } else if (strcmp(argv[first], "--incremental") == 0) {
+                incremental = true;
+            } else if (strcmp(argv[first], "--gradient") == 0) {
+                gradient = true;
+            } else if (strcmp(argv[first], "--profile") == 0) {
+                profile = true;
+            } else if (strcmp(argv[first], "--bench-parsers") == 0) {
+                benchParsers();
+                return 0;
+            } else if (strcmp(argv[first], "--threads") == 0 && first + 1 < argc) {
+                threads = strtoul(argv[++first], nullptr, 10);
+            } else if (strcmp(argv[first], "--bulk") == 0 && first + 1 < argc) {
+                return runBulk(argv[first + 1], threads);
+            } else if (strcmp(argv[first], "--bench-literals") == 0) {
+                benchLiterals();
+                return 0;
+            } else if (strcmp(argv[first], "--bench-scanner") == 0) {
+                benchScanner();
+                return 0;
+            } else {
+                printf("Unknown option %s\n", argv[first]);
+                return 1;
+            }
+        }
+        if (first >= argc) {
+            printf("Usage: calc [--compiled] [--batch] [--arena] [--cached] [--jit] [--incremental] [--gradient] [--profile] <expression>\n");
+            printf("       calc --bench-parsers\n");
+            printf("       calc --bench-literals\n");
+            printf("       calc --bench-scanner\n");
+            printf("       calc [--threads N] --bulk FILE|-\n");
             return 0;
         }
 
         Calculator calc;
+        ParseCache cache(calc, CACHE_CAPACITY);
 
         // Process each command-line argument as an independent expression.
-        for (int j = 1; j < argc; ++j) {
+        for (int j = first; j < argc; ++j) {
             std::string cmd = argv[j];
             printf("Solving %s\n", cmd.c_str());
 
@@ -89,6 +745,31 @@ int main(int argc, char* argv[]) {
             uint64_t stop = now();
             double elapsed = static_cast<double>(stop - start) / double(BENCH_ITERATIONS);
             printf("Result: %f Avg:%.1f %s\n", value, elapsed, time_unit);
+
+            if (arena) {
+                reportArena(calc, cmd);
+            }
+            if (cached && cache.get(cmd)) {
+                reportCached(cache, cmd);
+            }
+            if (compiled && !reportCompiled(calc.parse(cmd))) {
+                return 1;
+            }
+            if (jit && !reportJit(calc.parse(cmd))) {
+                return 1;
+            }
+            if (incremental && !reportIncremental(calc.parse(cmd))) {
+                return 1;
+            }
+            if (gradient && !reportGradient(calc.parse(cmd))) {
+                return 1;
+            }
+            if (batch && !reportBatch(calc.parse(cmd))) {
+                return 1;
+            }
+            if (profile && !reportProfile(calc, cmd)) {
+                return 1;
+            }
         }
     } catch (const std::exception& e) {
         (void)fprintf(stderr, "Error: %s\n", e.what());
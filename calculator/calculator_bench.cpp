@@ -0,0 +1,884 @@
+// calculator_bench.cpp — Google Benchmark suite for the calculator library
+//
+// Parse-only, evaluate-only and parse+evaluate benchmarks over expressions
+// from ExpressionGenerator (Generator.h). Every benchmark takes the same four
+// arguments, so results can be compared across stages:
+//
+//   terms   leaf operands in the expression
+//   depth   maximum nesting of groups and calls
+//   vars    distinct variables
+//   calls   percentage of operands that are function calls
+//
+// Counters:
+//   allocs  heap allocations per iteration (every global operator new is
+//           counted)
+//   nodes   AST nodes processed per second
+//
+// BM_EvaluateSwitch walks the same trees as BM_Evaluate with calcAs<double>()
+// (Numeric.h), one switch on the node kind per node instead of a virtual
+// call, like the dispatch comparison in fnpointers/bm_fnpointer.cpp. The
+// Downcast benchmarks classify every node of a tree with dynamic_cast and
+// with the kind tag (nodeCast, Node.h).
+//
+// The rotating parser (Calculator::parse) does not recognize calls, so its
+// benchmark always uses calls=0 inputs. Filter with --benchmark_filter, e.g.
+//   calculator_bench --benchmark_filter='Parse.*/terms:1000/'
+//
+// The Startup benchmarks compare two ways of getting a set of formulas ready
+// and evaluating each once: parsing and compiling every text with
+// Calculator::parse(), or opening a binary image of the compiled set
+// (Image.h). Their argument is the number of formulas, and the formulas
+// counter reports formulas loaded per second. The image file stays in the
+// page cache between iterations, so its timing covers mapping and faulting
+// the pages in, not disk reads.
+//
+// The Formulas benchmarks evaluate a set of formulas built from a shared pool
+// of sub-terms: every tree with calc(), every formula as its own Program, or
+// the whole set as one FormulaSet (Formulas.h) that evaluates each shared
+// sub-term once. The argument is the number of formulas.
+//
+// The Write benchmarks measure serialization throughput in bytes of output
+// per second: BM_WriteExpressions prints parsed trees with Writer (Writer.h)
+// over the standard grid, and BM_WriteDoubles and BM_WriteDoublesPrintf
+// format random doubles with Writer::write(double) (std::to_chars) and with
+// snprintf("%.17g"), the shortest printf format that round-trips.
+//
+// The Static benchmarks evaluate one fixed formula over 1024 rows of column
+// input: as a StaticExpression (StaticExpression.h) parsed at compile time,
+// with BatchEvaluator (Batch.h), and as a tree with calc() per row. The rows
+// counter reports rows per second.
+//
+// The Value benchmarks evaluate a pricing formula over 4096 rows in each
+// value type of Numeric.h: double, float and Fixed<4> (int64_t units of
+// 1/10000). BM_ValueBatch runs the column-at-a-time BasicBatchEvaluator<T>,
+// BM_ValueProgram a TypedProgram<T> once per row. The rows counter reports
+// rows per second.
+//
+// The Window benchmarks measure one sample of a rolling-window aggregate
+// (Window.h) for window lengths from 10 to 1,000,000: BM_Window evaluates
+// "op(x, length)" as a parsed WindowCall, whose update is O(1), and
+// BM_WindowRescan recomputes the aggregate from the window's samples, as a
+// formula would without window state. The window is full before timing
+// starts, and the samples counter reports samples per second.
+
+#include "Batch.h"
+#include "Bytecode.h"
+#include "Calculator.h"
+#include "Formulas.h"
+#include "Generator.h"
+#include "Image.h"
+#include "Node.h"
+#include "Numeric.h"
+#include "PrecedenceParser.h"
+#include "StaticExpression.h"
+#include "TreeNodes.h"
+#include "Window.h"
+#include "Writer.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+// Heap allocations since program start. Relaxed: only read between
+// iterations on the benchmark thread.
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+// Every form of global operator new is replaced and counted, and every
+// operator delete frees with std::free(), so the pairs always match.
+static void* countedAllocation(size_t size, size_t alignment) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size != 0 ? size : 1;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* checkedAllocation(size_t size, size_t alignment) {
+    if (void* ptr = countedAllocation(size, alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return checkedAllocation(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size) {
+    return checkedAllocation(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return checkedAllocation(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return checkedAllocation(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+using namespace Interpreter;
+
+namespace {
+
+// Builds the generator options from the benchmark arguments.
+GeneratorOptions options(const benchmark::State& state, bool calls = true) {
+    GeneratorOptions opts;
+    opts.terms = static_cast<size_t>(state.range(0));
+    opts.depth = static_cast<size_t>(state.range(1));
+    opts.variables = static_cast<size_t>(state.range(2));
+    opts.call_percent = calls ? static_cast<unsigned>(state.range(3)) : 0;
+    return opts;
+}
+
+// Counts the nodes of a tree (shared subtrees are counted once per parent).
+size_t countNodes(Node* node) {
+    if (auto* binop = nodeCast<BinaryOp>(node)) {
+        return 1 + countNodes(binop->left.get()) + countNodes(binop->right.get());
+    }
+    if (auto* uop = nodeCast<UnaryOp>(node)) {
+        return 1 + countNodes(uop->node.get());
+    }
+    if (auto* paren = nodeCast<Parenthesis>(node)) {
+        return 1 + countNodes(paren->node.get());
+    }
+    if (auto* call = nodeCast<FunctionCall>(node)) {
+        size_t count = 1;
+        for (size_t j = 0; j < call->arity(); ++j) {
+            count += countNodes(call->argument(j).get());
+        }
+        return count;
+    }
+    return 1;
+}
+
+// Publishes the allocation and node-rate counters for a finished loop.
+void report(benchmark::State& state, uint64_t allocations, size_t nodes) {
+    auto iterations = static_cast<double>(state.iterations());
+    state.counters["allocs"] = static_cast<double>(allocations) / iterations;
+    state.counters["nodes"] =
+        benchmark::Counter(static_cast<double>(nodes) * iterations, benchmark::Counter::kIsRate);
+}
+
+// Argument grid shared by every benchmark.
+void grid(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({ "terms", "depth", "vars", "calls" });
+    bench->ArgsProduct({ { 10, 100, 1000 }, { 0, 8 }, { 1, 16 }, { 0, 20 } });
+}
+
+}  // namespace
+
+static void BM_Parse(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    size_t nodes = countNodes(parser.parse(text).get());
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        NodePtr ast = parser.parse(text);
+        benchmark::DoNotOptimize(ast.get());
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * text.size()));
+}
+BENCHMARK(BM_Parse)->Apply(grid);
+
+static void BM_ParseRotating(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state, false));
+    Calculator calc;
+    size_t nodes = countNodes(calc.parse(text).get());
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        NodePtr ast = calc.parse(text);
+        benchmark::DoNotOptimize(ast.get());
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * text.size()));
+}
+BENCHMARK(BM_ParseRotating)->Apply(grid);
+
+static void BM_Evaluate(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    size_t nodes = countNodes(ast.get());
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ast->calc());
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+}
+BENCHMARK(BM_Evaluate)->Apply(grid);
+
+// The same tree walked by calcAs<double>() (Numeric.h), which switches on
+// each node's kind tag instead of making a virtual calc() call.
+static void BM_EvaluateSwitch(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    size_t nodes = countNodes(ast.get());
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(calcAs<double>(ast.get()));
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+}
+BENCHMARK(BM_EvaluateSwitch)->Apply(grid);
+
+namespace {
+
+// Every node of a tree, in pre-order.
+void collectNodes(Node* node, std::vector<Node*>& out) {
+    out.push_back(node);
+    if (auto* binop = nodeCast<BinaryOp>(node)) {
+        collectNodes(binop->left.get(), out);
+        collectNodes(binop->right.get(), out);
+    } else if (auto* uop = nodeCast<UnaryOp>(node)) {
+        collectNodes(uop->node.get(), out);
+    } else if (auto* paren = nodeCast<Parenthesis>(node)) {
+        collectNodes(paren->node.get(), out);
+    } else if (auto* call = nodeCast<FunctionCall>(node)) {
+        for (size_t j = 0; j < call->arity(); ++j) {
+            collectNodes(call->argument(j).get(), out);
+        }
+    }
+}
+
+// Classifies nodes the way tree passes do: operator, call, or leaf.
+template <typename Cast>
+void downcastNodes(benchmark::State& state, Cast cast) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    std::vector<Node*> nodes;
+    collectNodes(ast.get(), nodes);
+    for (auto _ : state) {
+        size_t operators = 0;
+        for (Node* node : nodes) {
+            operators += cast(node);
+        }
+        benchmark::DoNotOptimize(operators);
+    }
+    report(state, 0, nodes.size());
+}
+
+}  // namespace
+
+static void BM_DowncastDynamic(benchmark::State& state) {
+    downcastNodes(state, [](Node* node) {
+        return dynamic_cast<BinaryOp*>(node) != nullptr || dynamic_cast<UnaryOp*>(node) != nullptr
+            || dynamic_cast<FunctionCall*>(node) != nullptr;
+    });
+}
+BENCHMARK(BM_DowncastDynamic)->Apply(grid);
+
+static void BM_DowncastTag(benchmark::State& state) {
+    downcastNodes(state, [](Node* node) {
+        return nodeCast<BinaryOp>(node) != nullptr || nodeCast<UnaryOp>(node) != nullptr
+            || nodeCast<FunctionCall>(node) != nullptr;
+    });
+}
+BENCHMARK(BM_DowncastTag)->Apply(grid);
+
+static void BM_EvaluateBytecode(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    size_t nodes = countNodes(ast.get());
+    std::optional<Program> prog = Compiler::compile(ast);
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prog->calc());
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+}
+BENCHMARK(BM_EvaluateBytecode)->Apply(grid);
+
+static void BM_ParseEvaluate(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    size_t nodes = countNodes(parser.parse(text).get());
+    uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        NodePtr ast = parser.parse(text);
+        benchmark::DoNotOptimize(ast->calc());
+    }
+    report(state, g_allocations.load(std::memory_order_relaxed) - before, nodes);
+}
+BENCHMARK(BM_ParseEvaluate)->Apply(grid);
+
+namespace {
+
+// Formulas of 20 terms over 4 variables, without calls (Calculator::parse()
+// does not parse them).
+std::vector<std::string> startupFormulas(size_t count) {
+    std::vector<std::string> texts;
+    GeneratorOptions opts;
+    opts.terms = 20;
+    opts.depth = 3;
+    opts.variables = 4;
+    for (size_t j = 0; j < count; ++j) {
+        opts.seed = j + 1;
+        texts.push_back(ExpressionGenerator::generate(opts));
+    }
+    return texts;
+}
+
+void startupArgs(benchmark::internal::Benchmark* bench) {
+    bench->ArgName("formulas")->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+}
+
+void reportFormulas(benchmark::State& state) {
+    state.counters["formulas"] = benchmark::Counter(
+        static_cast<double>(state.range(0)) * static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+const double kStartupSlots[] = { 1.5, 2.5, 3.5, 4.5 };
+
+}  // namespace
+
+static void BM_StartupParse(benchmark::State& state) {
+    std::vector<std::string> texts = startupFormulas(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        Calculator calc;
+        double sum = 0;
+        for (const std::string& text : texts) {
+            std::optional<Program> prog = Compiler::compile(calc.parse(text));
+            sum += prog->run(kStartupSlots);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    reportFormulas(state);
+}
+BENCHMARK(BM_StartupParse)->Apply(startupArgs);
+
+static void BM_StartupImage(benchmark::State& state) {
+    std::vector<std::string> texts = startupFormulas(static_cast<size_t>(state.range(0)));
+    char path[] = "/tmp/calculator_bench_image_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        state.SkipWithError("cannot create the image file");
+        return;
+    }
+    ::close(fd);
+    {
+        Calculator calc;
+        ImageWriter writer(calc);
+        for (size_t j = 0; j < texts.size(); ++j) {
+            writer.add(std::to_string(j), calc.parse(texts[j]));
+        }
+        writer.save(path);
+    }
+    for (auto _ : state) {
+        Calculator calc;
+        std::optional<ExpressionImage> image = ExpressionImage::open(path, calc);
+        double sum = 0;
+        for (size_t j = 0; j < image->size(); ++j) {
+            sum += image->run(j, kStartupSlots);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    reportFormulas(state);
+    unlink(path);
+}
+BENCHMARK(BM_StartupImage)->Apply(startupArgs);
+
+namespace {
+
+// Formulas over 8 variables, each combining two of 16 shared sub-terms
+// with a term of its own.
+std::vector<NodePtr> sharedFormulas(PrecedenceParser& parser, size_t count) {
+    GeneratorOptions opts;
+    opts.terms = 8;
+    opts.depth = 2;
+    opts.variables = 8;
+    std::vector<std::string> pool;
+    for (uint64_t seed = 1; pool.size() < 16; ++seed) {
+        opts.seed = seed;
+        pool.push_back(ExpressionGenerator::generate(opts));
+    }
+    opts.terms = 4;
+    std::vector<NodePtr> roots;
+    for (size_t j = 0; j < count; ++j) {
+        opts.seed = 1000 + j;
+        std::string text = "(" + pool[j % 16] + ")*(" + pool[(j * 7 + 3) % 16] + ")+"
+            + ExpressionGenerator::generate(opts);
+        roots.push_back(parser.parse(text));
+    }
+    return roots;
+}
+
+void formulaArgs(benchmark::internal::Benchmark* bench) {
+    bench->ArgName("formulas")->Arg(100)->Arg(500);
+}
+
+}  // namespace
+
+static void BM_FormulasTrees(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::vector<NodePtr> roots = sharedFormulas(parser, static_cast<size_t>(state.range(0)));
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    std::vector<double> out(roots.size());
+    for (auto _ : state) {
+        for (size_t j = 0; j < roots.size(); ++j) {
+            out[j] = roots[j]->calc();
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportFormulas(state);
+}
+BENCHMARK(BM_FormulasTrees)->Apply(formulaArgs);
+
+static void BM_FormulasPrograms(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::vector<Program> programs;
+    for (const NodePtr& root : sharedFormulas(parser, static_cast<size_t>(state.range(0)))) {
+        programs.push_back(*Compiler::compile(root));
+    }
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    std::vector<double> out(programs.size());
+    for (auto _ : state) {
+        for (size_t j = 0; j < programs.size(); ++j) {
+            out[j] = programs[j].calc();
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportFormulas(state);
+}
+BENCHMARK(BM_FormulasPrograms)->Apply(formulaArgs);
+
+static void BM_FormulasMerged(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::optional<FormulaSet> set = FormulaSet::compile(sharedFormulas(parser, static_cast<size_t>(state.range(0))));
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 1.5;
+    }
+    std::vector<double> out(set->size());
+    for (auto _ : state) {
+        set->calc(out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportFormulas(state);
+    state.counters["instructions"] = static_cast<double>(set->program().code.size());
+}
+BENCHMARK(BM_FormulasMerged)->Apply(formulaArgs);
+
+static void BM_WriteExpressions(benchmark::State& state) {
+    std::string text = ExpressionGenerator::generate(options(state));
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    Writer writer;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        writer.data.clear();
+        writer.write(ast);
+        bytes += writer.data.size();
+        benchmark::DoNotOptimize(writer.data.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_WriteExpressions)->Apply(grid);
+
+namespace {
+
+// Doubles spread over many magnitudes, as left by constant folding.
+std::vector<double> randomDoubles() {
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> mantissa(-1.0, 1.0);
+    std::uniform_int_distribution<int> exponent(-20, 20);
+    std::vector<double> values(4096);
+    for (double& value : values) {
+        value = std::ldexp(mantissa(rng), exponent(rng));
+    }
+    return values;
+}
+
+}  // namespace
+
+static void BM_WriteDoubles(benchmark::State& state) {
+    std::vector<double> values = randomDoubles();
+    Writer writer;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        writer.data.clear();
+        for (double value : values) {
+            writer.write(value);
+            writer.write(',');
+        }
+        bytes += writer.data.size();
+        benchmark::DoNotOptimize(writer.data.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_WriteDoubles);
+
+static void BM_WriteDoublesPrintf(benchmark::State& state) {
+    std::vector<double> values = randomDoubles();
+    Writer writer;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        writer.data.clear();
+        for (double value : values) {
+            char buf[32];
+            int len = ::snprintf(buf, sizeof(buf), "%.17g", value);
+            writer.write(std::string_view(buf, static_cast<size_t>(len)));
+            writer.write(',');
+        }
+        bytes += writer.data.size();
+        benchmark::DoNotOptimize(writer.data.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_WriteDoublesPrintf);
+
+namespace {
+
+struct StaticFormula {
+    static constexpr std::string_view text = "(x*1.5 - y) * (x + y*y) / (2 + z*z) + min(x, z)";
+};
+
+constexpr size_t kStaticRows = 1024;
+
+// Column input for StaticFormula, one column per slot.
+struct StaticColumns {
+    StaticColumns() {
+        std::mt19937_64 rng(7);
+        std::uniform_real_distribution<double> dist(-2.0, 2.0);
+        for (auto& column : values) {
+            column.resize(kStaticRows);
+            for (double& value : column) {
+                value = dist(rng);
+            }
+        }
+        for (size_t slot = 0; slot < values.size(); ++slot) {
+            columns[slot] = values[slot].data();
+        }
+    }
+    std::array<std::vector<double>, 3> values;
+    std::array<const double*, 3> columns;
+};
+
+void reportRows(benchmark::State& state) {
+    state.counters["rows"] = benchmark::Counter(
+        static_cast<double>(kStaticRows) * static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+static void BM_StaticExpression(benchmark::State& state) {
+    using Formula = StaticExpression<StaticFormula>;
+    static_assert(Formula::num_variables == 3, "x, y, z");
+    StaticColumns input;
+    std::vector<double> out(kStaticRows);
+    for (auto _ : state) {
+        Formula::evaluate(input.columns.data(), kStaticRows, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportRows(state);
+}
+BENCHMARK(BM_StaticExpression);
+
+static void BM_StaticExpressionBatch(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::optional<BatchEvaluator> batch = BatchEvaluator::create(parser.parse(StaticFormula::text));
+    StaticColumns input;
+    std::vector<double> out(kStaticRows);
+    for (auto _ : state) {
+        batch->evaluate(input.columns.data(), kStaticRows, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportRows(state);
+}
+BENCHMARK(BM_StaticExpressionBatch);
+
+static void BM_StaticExpressionTree(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(StaticFormula::text);
+    std::array<Variable*, 3> variables = { calc._variable_map["x"].get(), calc._variable_map["y"].get(),
+        calc._variable_map["z"].get() };
+    StaticColumns input;
+    std::vector<double> out(kStaticRows);
+    for (auto _ : state) {
+        for (size_t row = 0; row < kStaticRows; ++row) {
+            for (size_t slot = 0; slot < variables.size(); ++slot) {
+                variables[slot]->value = input.columns[slot][row];
+            }
+            out[row] = ast->calc();
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportRows(state);
+}
+BENCHMARK(BM_StaticExpressionTree);
+
+namespace {
+
+struct ValueFormula {
+    static constexpr std::string_view text = "(price*quantity - discount) * (1 + rate) + max(fee, price/100)";
+};
+
+constexpr size_t kValueRows = 4096;
+
+// Column and row-major input for ValueFormula in value type T: amounts with
+// two decimals, as the formula would see them in practice.
+template <typename T>
+struct ValueInput {
+    explicit ValueInput(size_t slots) : values(slots), rows(slots * kValueRows) {
+        std::mt19937_64 rng(11);
+        std::uniform_int_distribution<int> cents(1, 100000);
+        for (size_t slot = 0; slot < slots; ++slot) {
+            values[slot].resize(kValueRows);
+            for (size_t row = 0; row < kValueRows; ++row) {
+                T value = ValueTraits<T>::fromDouble(cents(rng) / 100.0);
+                values[slot][row] = value;
+                rows[row * slots + slot] = value;
+            }
+            columns.push_back(values[slot].data());
+        }
+    }
+    std::vector<std::vector<T>> values;
+    std::vector<const T*> columns;
+    std::vector<T> rows;
+};
+
+void reportValueRows(benchmark::State& state) {
+    state.counters["rows"] = benchmark::Counter(
+        static_cast<double>(kValueRows) * static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+template <typename T>
+static void BM_ValueBatch(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto batch = BasicBatchEvaluator<T>::create(parser.parse(ValueFormula::text));
+    ValueInput<T> input(batch->program().variables.size());
+    std::vector<T> out(kValueRows);
+    for (auto _ : state) {
+        batch->evaluate(input.columns, kValueRows, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetLabel(ValueTraits<T>::kName);
+    reportValueRows(state);
+}
+BENCHMARK_TEMPLATE(BM_ValueBatch, double);
+BENCHMARK_TEMPLATE(BM_ValueBatch, float);
+BENCHMARK_TEMPLATE(BM_ValueBatch, Fixed<4>);
+
+template <typename T>
+static void BM_ValueProgram(benchmark::State& state) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    TypedProgram<T> prog(Compiler::compile(parser.parse(ValueFormula::text)).value());
+    size_t slots = prog.program.variables.size();
+    ValueInput<T> input(slots);
+    std::vector<T> out(kValueRows);
+    for (auto _ : state) {
+        for (size_t row = 0; row < kValueRows; ++row) {
+            out[row] = prog.run(&input.rows[row * slots]);
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetLabel(ValueTraits<T>::kName);
+    reportValueRows(state);
+}
+BENCHMARK_TEMPLATE(BM_ValueProgram, double);
+BENCHMARK_TEMPLATE(BM_ValueProgram, float);
+BENCHMARK_TEMPLATE(BM_ValueProgram, Fixed<4>);
+
+namespace {
+
+constexpr size_t kWindowSamples = 4096;  // distinct sample values, cycled
+
+std::vector<double> windowSamples() {
+    std::mt19937_64 rng(13);
+    std::uniform_real_distribution<double> dist(-100.0, 100.0);
+    std::vector<double> samples(kWindowSamples);
+    for (double& sample : samples) {
+        sample = dist(rng);
+    }
+    return samples;
+}
+
+// Every op with lengths 10, 100, ... 1000000.
+void windowArgs(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({ "op", "length" });
+    for (auto op : { WindowOp::Sum, WindowOp::Mean, WindowOp::Min, WindowOp::Max, WindowOp::Stddev }) {
+        for (int64_t length = 10; length <= 1000000; length *= 10) {
+            bench->Args({ static_cast<int64_t>(op), length });
+        }
+    }
+}
+
+void reportSamples(benchmark::State& state) {
+    state.counters["samples"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+static void BM_Window(benchmark::State& state) {
+    auto op = static_cast<WindowOp>(state.range(0));
+    std::string name(kWindowNames[static_cast<size_t>(op) - 1]);
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(name + "(x, " + std::to_string(state.range(1)) + ")");
+    Pointer<Variable> x = calc.internVariable("x");
+    std::vector<double> samples = windowSamples();
+    size_t next = 0;
+    for (int64_t j = 0; j < state.range(1); ++j) {
+        x->value = samples[next++ % kWindowSamples];
+        ast->calc();
+    }
+    for (auto _ : state) {
+        x->value = samples[next++ % kWindowSamples];
+        benchmark::DoNotOptimize(ast->calc());
+    }
+    state.SetLabel(name);
+    reportSamples(state);
+}
+BENCHMARK(BM_Window)->Apply(windowArgs);
+
+static void BM_WindowRescan(benchmark::State& state) {
+    auto op = static_cast<WindowOp>(state.range(0));
+    auto length = static_cast<size_t>(state.range(1));
+    std::vector<double> samples = windowSamples();
+    std::vector<double> window(length);
+    size_t next = 0;
+    for (; next < length; ++next) {
+        window[next] = samples[next % kWindowSamples];
+    }
+    for (auto _ : state) {
+        window[next % length] = samples[next % kWindowSamples];
+        ++next;
+        double result = 0;
+        switch (op) {
+            case WindowOp::Sum:
+            case WindowOp::Mean: {
+                for (double value : window) {
+                    result += value;
+                }
+                result = op == WindowOp::Sum ? result : result / static_cast<double>(length);
+                break;
+            }
+            case WindowOp::Min: result = *std::min_element(window.begin(), window.end()); break;
+            case WindowOp::Max: result = *std::max_element(window.begin(), window.end()); break;
+            case WindowOp::Stddev: {
+                RollingMoments moments;
+                moments.assign(window, length);
+                result = std::sqrt(moments.variance());
+                break;
+            }
+            case WindowOp::None: break;
+        }
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetLabel(std::string(kWindowNames[static_cast<size_t>(op) - 1]));
+    reportSamples(state);
+}
+BENCHMARK(BM_WindowRescan)->Apply(windowArgs);
+
+BENCHMARK_MAIN();
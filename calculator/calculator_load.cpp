@@ -0,0 +1,204 @@
+// calculator_load.cpp — Load generator for calculator_server
+//
+// Opens --connections connections to the server at SOCKET, one thread each,
+// and sends --requests evaluation requests on every connection, keeping
+// --depth of them in flight (pipelined) and putting --batch rows of random
+// variable values in each. The formulas and their variables come from a
+// Describe request; every formula is used in turn unless --formula names
+// one.
+//
+// The latency of a request runs from the moment it is queued until its
+// response has been read. The p50, p99 and p99.9 latencies over all requests
+// are reported together with the throughput in requests and rows per second.
+// Responses are checked against their tags and row counts.
+//
+// Usage: calculator_load [--connections C] [--depth D] [--batch R]
+//                        [--requests N] [--formula NAME] SOCKET
+// Example: calculator_load --connections 8 --depth 32 --batch 16 /tmp/calc.sock
+
+#include "Protocol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Interpreter;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct LoadOptions {
+    size_t connections = 4;
+    size_t depth = 16;
+    size_t batch = 1;
+    size_t requests = 100000;  // per connection
+    std::string formula;       // empty for all
+};
+
+// Random column-major input for one formula.
+struct FormulaInput {
+    uint32_t index;
+    std::vector<double> columns;  // slots * batch values
+};
+
+// Runs one connection. Appends the latency of every request (ns) to
+// latencies; returns false on a connection or protocol error.
+bool runConnection(const char* path, const LoadOptions& options, const std::vector<FormulaInput>& inputs,
+    std::vector<uint64_t>& latencies) {
+    auto client = ServerClient::connect(path);
+    if (!client) {
+        fprintf(stderr, "cannot connect to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    std::vector<Clock::time_point> queued(options.depth);
+    auto rows = static_cast<uint32_t>(options.batch);
+    size_t sent = 0;
+    auto send = [&] {
+        const FormulaInput& input = inputs[sent % inputs.size()];
+        queued[sent % options.depth] = Clock::now();
+        client->evaluate(sent, input.index, rows, input.columns.data(), input.columns.size());
+        ++sent;
+    };
+    while (sent < std::min(options.depth, options.requests)) {
+        send();
+    }
+    Response response;
+    for (size_t done = 0; done < options.requests; ++done) {
+        if (!client->ready() && !client->flush()) {
+            return false;
+        }
+        if (!client->receive(response)) {
+            fprintf(stderr, "connection closed by the server\n");
+            return false;
+        }
+        auto received = Clock::now();
+        if (response.header.tag != done || response.status() != ResponseStatus::Ok
+            || response.values.size() != rows) {
+            fprintf(stderr, "unexpected response (tag %llu, status %u)\n",
+                static_cast<unsigned long long>(response.header.tag), static_cast<unsigned>(response.header.status));
+            return false;
+        }
+        latencies.push_back(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(received - queued[done % options.depth]).count()));
+        if (sent < options.requests) {
+            send();
+        }
+    }
+    return true;
+}
+
+// Microseconds at quantile q of sorted latencies.
+double percentile(const std::vector<uint64_t>& sorted, double q) {
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(q * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[index]) / 1e3;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    int first = 1;
+    for (; first + 1 < argc && strncmp(argv[first], "--", 2) == 0; first += 2) {
+        const char* value = argv[first + 1];
+        if (strcmp(argv[first], "--connections") == 0) {
+            options.connections = strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[first], "--depth") == 0) {
+            options.depth = strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[first], "--batch") == 0) {
+            options.batch = strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[first], "--requests") == 0) {
+            options.requests = strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[first], "--formula") == 0) {
+            options.formula = value;
+        } else {
+            break;
+        }
+    }
+    if (argc - first != 1 || options.connections == 0 || options.depth == 0 || options.batch == 0
+        || options.batch > UINT32_MAX || options.requests == 0) {
+        fprintf(stderr, "Usage: calculator_load [--connections C] [--depth D] [--batch R]\n"
+                        "                       [--requests N] [--formula NAME] SOCKET\n");
+        return 1;
+    }
+    const char* path = argv[first];
+
+    // List the formulas.
+    auto client = ServerClient::connect(path);
+    if (!client) {
+        fprintf(stderr, "cannot connect to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    Response response;
+    client->describe(0);
+    if (!client->flush() || !client->receive(response)) {
+        fprintf(stderr, "no response from %s\n", path);
+        return 1;
+    }
+    auto formulas = parseDescription(response.text);
+    if (!formulas || formulas->empty()) {
+        fprintf(stderr, "the server lists no formulas\n");
+        return 1;
+    }
+
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(-100.0, 100.0);
+    std::vector<FormulaInput> inputs;
+    for (size_t j = 0; j < formulas->size(); ++j) {
+        const FormulaInfo& info = (*formulas)[j];
+        if (!options.formula.empty() && info.name != options.formula) {
+            continue;
+        }
+        FormulaInput input{ static_cast<uint32_t>(j), std::vector<double>(info.variables.size() * options.batch) };
+        for (double& value : input.columns) {
+            value = dist(rng);
+        }
+        inputs.push_back(std::move(input));
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "the server has no formula named %s\n", options.formula.c_str());
+        return 1;
+    }
+
+    std::vector<std::vector<uint64_t>> latencies(options.connections);
+    std::atomic<bool> failed{ false };
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t j = 0; j < options.connections; ++j) {
+        latencies[j].reserve(options.requests);
+        threads.emplace_back([&, j] {
+            if (!runConnection(path, options, inputs, latencies[j])) {
+                failed = true;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (failed) {
+        return 1;
+    }
+
+    std::vector<uint64_t> all;
+    for (const auto& part : latencies) {
+        all.insert(all.end(), part.begin(), part.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto requests = static_cast<double>(all.size());
+    printf("%zu connections, depth %zu, %zu rows per request, %zu formulas\n", options.connections, options.depth,
+        options.batch, inputs.size());
+    printf("  %.0f requests/s, %.0f rows/s\n", requests / seconds, requests * static_cast<double>(options.batch) / seconds);
+    printf("  latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", percentile(all, 0.50),
+        percentile(all, 0.99), percentile(all, 0.999), static_cast<double>(all.back()) / 1e3);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// calculator_server.cpp — Serves a file of formulas over a UNIX domain socket
+//
+// Loads FORMULAS, one "name=expression" per line (Server.h), compiles every
+// formula once, and answers evaluation requests from local clients on the
+// socket at SOCKET (Protocol.h) until interrupted. Runs one worker per
+// hardware thread unless --threads is given; --pin binds worker j to CPU j.
+// Totals are printed on SIGINT or SIGTERM.
+//
+// calculator_load is the matching load generator.
+//
+// Usage: calculator_server [--threads N] [--pin] SOCKET FORMULAS
+// Example: calculator_server /tmp/calc.sock formulas.txt
+
+#include "MappedInput.h"
+#include "Server.h"
+
+#include <pthread.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+using namespace Interpreter;
+
+int main(int argc, char* argv[]) {
+    Server::Options options;
+    int first = 1;
+    for (; first < argc && strncmp(argv[first], "--", 2) == 0; ++first) {
+        if (strcmp(argv[first], "--threads") == 0 && first + 1 < argc) {
+            options.threads = strtoul(argv[++first], nullptr, 10);
+        } else if (strcmp(argv[first], "--pin") == 0) {
+            options.pin = true;
+        } else {
+            break;
+        }
+    }
+    if (argc - first != 2) {
+        fprintf(stderr, "Usage: calculator_server [--threads N] [--pin] SOCKET FORMULAS\n");
+        return 1;
+    }
+    const char* path = argv[first];
+
+    auto input = MappedInput::open(argv[first + 1]);
+    if (!input) {
+        fprintf(stderr, "cannot read %s: %s\n", argv[first + 1], strerror(errno));
+        return 1;
+    }
+    FormulaCatalog formulas;
+    if (size_t line = formulas.load(input->text())) {
+        fprintf(stderr, "%s:%zu: not a valid name=expression formula\n", argv[first + 1], line);
+        return 1;
+    }
+
+    // Workers inherit the mask, so the signals are left to sigwait() below.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    size_t count = formulas.size();
+    Pointer<Server> server = Server::listen(std::move(formulas), path, options);
+    if (!server) {
+        fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "serving %zu formulas on %s with %zu workers\n", count, path, server->threads());
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server->stop();
+    ServerStats stats = server->stats();
+    fprintf(stderr, "%llu connections, %llu requests (%llu errors), %llu rows\n",
+        static_cast<unsigned long long>(stats.connections), static_cast<unsigned long long>(stats.requests),
+        static_cast<unsigned long long>(stats.errors), static_cast<unsigned long long>(stats.rows));
+    return 0;
+}
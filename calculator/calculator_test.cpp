@@ -3,18 +3,53 @@
 // Tests cover all layers: smart pointers, character predicates, lexer
 // primitives, AST nodes, function dispatch, the full parser, and the writer.
 
+#include "Arena.h"
+#include "Batch.h"
+#include "Bytecode.h"
+#include "Bulk.h"
 #include "Calculator.h"
+#include "Context.h"
+#include "Formulas.h"
 #include "FunctionOps.h"
+#include "Generator.h"
+#include "Gradient.h"
+#include "Image.h"
+#include "Incremental.h"
+#include "Intrinsics.h"
+#include "Jit.h"
 #include "Lexer.h"
 #include "Node.h"
+#include "Numeric.h"
+#include "Optimizer.h"
+#include "ParseCache.h"
 #include "Pointer.h"
+#include "PrecedenceParser.h"
 #include "Predicates.h"
+#include "Profiler.h"
+#include "Protocol.h"
+#include "Scan.h"
+#include "Server.h"
+#include "StaticExpression.h"
+#include "Symbols.h"
 #include "TreeNodes.h"
+#include "Window.h"
 #include "Writer.h"
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <optional>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 // NOLINTBEGIN(readability-magic-numbers)
@@ -79,6 +114,63 @@ TEST(Pointer, DynamicDowncastFailure) {
     EXPECT_FALSE(derived);
 }
 
+TEST(Pointer, TaggedDowncast) {
+    Pointer<Node> cst(new Constant(1.0));
+    EXPECT_TRUE(cst.as<Constant>());
+    EXPECT_FALSE(cst.as<Variable>());
+    EXPECT_FALSE(cst.as<TestNode>());
+    EXPECT_FALSE(Pointer<Node>(new TestNode).as<Constant>());
+    EXPECT_FALSE(Pointer<Node>().as<Constant>());
+
+    // IntrinsicCall is also a FunctionCall; FunctionCallWithArgs<N> is untagged.
+    Pointer<Node> intrinsic(new IntrinsicCall(Intrinsic::Abs, { cst }));
+    EXPECT_TRUE(intrinsic.as<FunctionCall>());
+    EXPECT_TRUE(intrinsic.as<IntrinsicCall>());
+    EXPECT_FALSE(intrinsic.as<FunctionCallWithArgs<1>>());
+    Pointer<Node> call(new FunctionCallWithArgs<1>(intrinsicFunction(Intrinsic::Abs), { cst }));
+    EXPECT_TRUE(call.as<FunctionCall>());
+    EXPECT_FALSE(call.as<IntrinsicCall>());
+    EXPECT_TRUE(call.as<FunctionCallWithArgs<1>>());
+    EXPECT_FALSE(call.as<FunctionCallWithArgs<2>>());
+    EXPECT_EQ(nodeCast<FunctionCall>(call.get()), call.get());
+    EXPECT_EQ(nodeCast<Constant>(call.get()), nullptr);
+}
+
+namespace {
+
+struct AtomicCounted : public AtomicRefCounted {
+    explicit AtomicCounted(int& destroyed) : _destroyed(destroyed) {
+    }
+    ~AtomicCounted() override {
+        ++_destroyed;
+    }
+    int& _destroyed;
+};
+
+}  // namespace
+
+TEST(Pointer, AtomicRefCountAcrossThreads) {
+    int destroyed = 0;
+    {
+        Pointer<AtomicCounted> shared(new AtomicCounted(destroyed));
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([shared] {
+                for (int k = 0; k < 10000; ++k) {
+                    Pointer<AtomicCounted> copy(shared);
+                    (void)copy;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(shared->_counter.load(), 1);
+        EXPECT_EQ(destroyed, 0);
+    }
+    EXPECT_EQ(destroyed, 1);
+}
+
 // ===== Predicates.h =====
 
 TEST(Predicates, IsIdentifier) {
@@ -140,6 +232,41 @@ TEST(Predicates, IsAny) {
     EXPECT_FALSE(pred(' '));
 }
 
+TEST(Predicates, HighBytesAreInNoClass) {
+    for (int byte = 0x80; byte <= 0xFF; ++byte) {
+        auto chr = static_cast<char>(byte);
+        EXPECT_FALSE(Interpreter::isspace()(chr)) << byte;
+        EXPECT_FALSE(Interpreter::isdigit()(chr)) << byte;
+        EXPECT_FALSE(Interpreter::isalnum()(chr)) << byte;
+        EXPECT_FALSE(isidentifier()(chr)) << byte;
+    }
+}
+
+TEST(Predicates, TableMatchesCctypeForAscii) {
+    for (int byte = 0; byte < 0x80; ++byte) {
+        auto chr = static_cast<char>(byte);
+        EXPECT_EQ(Interpreter::isspace()(chr), std::isspace(byte) != 0) << byte;
+        EXPECT_EQ(Interpreter::isdigit()(chr), std::isdigit(byte) != 0) << byte;
+        EXPECT_EQ(Interpreter::isalpha()(chr), std::isalpha(byte) != 0) << byte;
+        EXPECT_EQ(Interpreter::isalnum()(chr), std::isalnum(byte) != 0) << byte;
+    }
+}
+
+TEST(Predicates, IsAnyHighBytes) {
+    isany pred("\xC3\xA9");
+    EXPECT_TRUE(pred('\xC3'));
+    EXPECT_TRUE(pred('\xA9'));
+    EXPECT_FALSE(pred('\xC4'));
+    EXPECT_FALSE(pred('\0'));
+}
+
+TEST(Predicates, IdentifierRun) {
+    std::string_view text = "_x1 y";
+    EXPECT_EQ(isidentifier::run(text.data(), text.data() + text.size()), text.data() + 3);
+    std::string_view digit = "1x";
+    EXPECT_EQ(isidentifier::run(digit.data(), digit.data() + digit.size()), digit.data());
+}
+
 // ===== Lexer.h =====
 
 // Helper: create a Lexer, reset it to input, and return it.
@@ -237,6 +364,49 @@ TEST(Lexer, ParseDoubleSigned) {
     EXPECT_DOUBLE_EQ(val2.value(), 7.0);
 }
 
+TEST(Lexer, ParseDoubleExponent) {
+    auto parse = [](const char* input) { return makeLexer(input).parsedouble(); };
+    EXPECT_EQ(parse("1e-9"), 1e-9);
+    EXPECT_EQ(parse("2.5E3"), 2500.0);
+    EXPECT_EQ(parse("-7e+2"), -700.0);
+    EXPECT_EQ(parse("1e400"), std::numeric_limits<double>::infinity());
+    EXPECT_EQ(parse("1e-400"), 0.0);
+    EXPECT_EQ(parse("4.9406564584124654e-324"), std::numeric_limits<double>::denorm_min());
+}
+
+TEST(Lexer, ParseDoubleExponentNeedsDigits) {
+    Lexer lex = makeLexer("3e+x");
+    auto val = lex.parsedouble();
+    ASSERT_TRUE(val.has_value());
+    EXPECT_EQ(val.value(), 3.0);
+    EXPECT_EQ(*lex.it, 'e');
+}
+
+TEST(Lexer, ParseDoubleTrailingPoint) {
+    Lexer lex = makeLexer("5.+1");
+    EXPECT_EQ(lex.parsedouble(), 5.0);
+    EXPECT_EQ(*lex.it, '+');
+}
+
+TEST(Lexer, ParseDoubleLongDigitStrings) {
+    auto parse = [](const char* input) { return makeLexer(input).parsedouble(); };
+    EXPECT_EQ(parse("123456789012345678901234567890"), 123456789012345678901234567890.0);
+    EXPECT_EQ(parse("0.000000000000000000000000000001"), 1e-30);
+    EXPECT_EQ(parse("3.14159265358979323846264338327950288"), 3.14159265358979323846264338327950288);
+    EXPECT_EQ(parse("9007199254740993"), 9007199254740992.0);  // 2^53+1 rounds to even
+    EXPECT_EQ(parse("100000000000000000000000"), 1e23);
+}
+
+TEST(Lexer, ParseDoubleCorrectlyRounded) {
+    std::mt19937_64 rng(11);
+    std::uniform_int_distribution<uint64_t> mantissa(0, 99999999999999999ULL);
+    std::uniform_int_distribution<int> exponent(-30, 30);
+    for (int k = 0; k < 2000; ++k) {
+        std::string text = std::to_string(mantissa(rng)) + "e" + std::to_string(exponent(rng));
+        EXPECT_EQ(makeLexer(text).parsedouble(), std::strtod(text.c_str(), nullptr)) << text;
+    }
+}
+
 TEST(Lexer, ParseDoubleEmpty) {
     Lexer lex = makeLexer("abc");
     auto val = lex.parsedouble();
@@ -328,28 +498,101 @@ TEST(TreeNodes, Variable) {
     EXPECT_EQ(var->name, "x");
 }
 
+TEST(TreeNodes, KindTags) {
+    NodePtr cst(new Constant(1.0));
+    Pointer<Epoch> epoch(new Epoch);
+    auto* uop = new UnaryOp;
+    EXPECT_EQ(cst->kind, NodeKind::Constant);
+    EXPECT_EQ(NodePtr(new Variable("x"))->kind, NodeKind::Variable);
+    EXPECT_EQ(NodePtr(new Parenthesis(cst))->kind, NodeKind::Parenthesis);
+    EXPECT_EQ(NodePtr(uop)->kind, NodeKind::UnaryOp);
+    EXPECT_EQ(NodePtr(new BinaryOp(BinaryOp::Operation::Addition, cst, cst))->kind, NodeKind::BinaryOp);
+    EXPECT_EQ(NodePtr(new Shared(cst, epoch))->kind, NodeKind::Shared);
+    EXPECT_EQ(NodePtr(new DagRoot(cst, epoch))->kind, NodeKind::DagRoot);
+    EXPECT_EQ(NodePtr(new FunctionCallWithArgs<1>(intrinsicFunction(Intrinsic::Abs), { cst }))->kind,
+        NodeKind::FunctionCall);
+    EXPECT_EQ(NodePtr(new IntrinsicCall(Intrinsic::Abs, { cst }))->kind, NodeKind::IntrinsicCall);
+    EXPECT_EQ(NodePtr(new TestNode)->kind, NodeKind::Other);
+}
+
 TEST(TreeNodes, FunctionCallWithArgs) {
     // Use a simple 1-arg function
     auto square = [](double val) -> double { return val * val; };
-    FnPtr func = reinterpret_cast<FnPtr>(+square);  // + converts lambda to fn ptr
+    FnPtr func = toFnPtr(+square);  // + converts lambda to fn ptr
 
     std::vector<NodePtr> args = {NodePtr(new Constant(5.0))};
     Pointer<FunctionCallWithArgs<1>> call(new FunctionCallWithArgs<1>(func, args));
     EXPECT_DOUBLE_EQ(call->calc(), 25.0);
 }
 
+// ===== Formulas.h =====
+
+TEST(Formulas, SharedSubtermsEvaluatedOnce) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::vector<NodePtr> roots = {
+        parser.parse("(price-cost)*volume"),
+        parser.parse("(price-cost)*volume*rate"),
+        parser.parse("(price-cost)*volume*(1-rate)"),
+        parser.parse("sqrt(price)+(2*3)"),
+        parser.parse("price"),
+    };
+    auto set = FormulaSet::compile(roots);
+    ASSERT_TRUE(set);
+    ASSERT_EQ(set->size(), 5U);
+    EXPECT_GE(set->merged(), 3U);
+    EXPECT_EQ(set->program().variables.size(), 4U);
+    // price, cost, sub, volume, mul, rate, mul, 1, sub, mul, sqrt, 6, add
+    EXPECT_EQ(set->program().code.size(), 13U);
+    calc._variable_map["price"]->value = 9.0;
+    calc._variable_map["cost"]->value = 5.0;
+    calc._variable_map["volume"]->value = 10.0;
+    calc._variable_map["rate"]->value = 0.25;
+    std::vector<double> out(set->size());
+    set->calc(out.data());
+    for (size_t j = 0; j < roots.size(); ++j) {
+        EXPECT_DOUBLE_EQ(out[j], roots[j]->calc()) << j;
+    }
+    EXPECT_DOUBLE_EQ(out[2], 30.0);
+}
+
+TEST(Formulas, RunWithExplicitSlots) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto set = FormulaSet::compile({ parser.parse("x*y"), parser.parse("x*y+1"), parser.parse("y") });
+    ASSERT_TRUE(set);
+    ASSERT_EQ(set->program().variables.size(), 2U);
+    double slots[] = { 3.0, 4.0 };
+    double out[3];
+    set->run(slots, out);
+    EXPECT_EQ(out[0], 12.0);
+    EXPECT_EQ(out[1], 13.0);
+    EXPECT_EQ(out[2], 4.0);
+    EXPECT_EQ(calc._variable_map["x"]->value, 0.0);  // AST untouched
+}
+
+TEST(Formulas, RejectsNullRoots) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    EXPECT_FALSE(FormulaSet::compile({ parser.parse("1+1"), NodePtr() }));
+    auto empty = FormulaSet::compile({});
+    ASSERT_TRUE(empty);
+    EXPECT_EQ(empty->size(), 0U);
+    empty->calc(nullptr);
+}
+
 // ===== FunctionOps.h =====
 
 TEST(FunctionOps, CallFn0Args) {
     auto fn0 = []() -> double { return 99.0; };
-    FnPtr func = reinterpret_cast<FnPtr>(+fn0);
+    FnPtr func = toFnPtr(+fn0);
     double result = callfn(func, nullptr, 0);
     EXPECT_DOUBLE_EQ(result, 99.0);
 }
 
 TEST(FunctionOps, CallFn1Arg) {
     auto fn1 = [](double val) -> double { return val * 2; };
-    FnPtr func = reinterpret_cast<FnPtr>(+fn1);
+    FnPtr func = toFnPtr(+fn1);
     double args[] = {5.0};
     double result = callfn(func, args, 1);
     EXPECT_DOUBLE_EQ(result, 10.0);
@@ -357,7 +600,7 @@ TEST(FunctionOps, CallFn1Arg) {
 
 TEST(FunctionOps, CallFn2Args) {
     auto fn2 = [](double lhs, double rhs) -> double { return lhs + rhs; };
-    FnPtr func = reinterpret_cast<FnPtr>(+fn2);
+    FnPtr func = toFnPtr(+fn2);
     double args[] = {3.0, 4.0};
     double result = callfn(func, args, 2);
     EXPECT_DOUBLE_EQ(result, 7.0);
@@ -365,7 +608,7 @@ TEST(FunctionOps, CallFn2Args) {
 
 TEST(FunctionOps, CallFn3Args) {
     auto fn3 = [](double val1, double val2, double val3) -> double { return (val1 * val2) + val3; };
-    FnPtr func = reinterpret_cast<FnPtr>(+fn3);
+    FnPtr func = toFnPtr(+fn3);
     double args[] = {2.0, 3.0, 1.0};
     double result = callfn(func, args, 3);
     EXPECT_DOUBLE_EQ(result, 7.0);
@@ -498,28 +741,2416 @@ TEST(Calculator, ParseFailureReturnsNull) {
     EXPECT_FALSE(ast);
 }
 
-// ===== Writer.h =====
+// ===== Arena.h =====
 
-TEST(Writer, WriteDouble) {
-    Writer writer;
-    writer.write(3.14);
-    std::string result(writer.data.begin(), writer.data.end());
-    EXPECT_NE(result.find("3.14"), std::string::npos);
+namespace {
+
+// Counts destructor calls so tests can observe in-place destruction.
+struct CountedNode : public Node {
+    explicit CountedNode(int* dtors) : _dtors(dtors) {}
+    ~CountedNode() override { ++*_dtors; }
+    double calc() override { return 1.0; }
+    int* _dtors;
+};
+
+}  // namespace
+
+TEST(Arena, MakeDestroysInPlace) {
+    int dtors = 0;
+    Arena arena;
+    {
+        Pointer<CountedNode> ptr = arena.make<CountedNode>(&dtors);
+        EXPECT_TRUE(ptr->_arena);
+        EXPECT_EQ(ptr->_counter, 1);
+    }
+    EXPECT_EQ(dtors, 1);
+    EXPECT_EQ(arena.blocks(), 1U);
 }
 
-TEST(Writer, WriteStringView) {
-    Writer writer;
-    writer.write(std::string_view("hello"));
-    std::string result(writer.data.begin(), writer.data.end());
-    EXPECT_EQ(result, "hello");
+TEST(Arena, AllocateAlignsAndGrows) {
+    Arena arena(64);
+    void* first = arena.allocate(3, 1);
+    void* second = arena.allocate(8, 8);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(second) % 8, 0U);
+    EXPECT_NE(first, second);
+    arena.allocate(1000, 8);  // larger than the current block
+    EXPECT_EQ(arena.blocks(), 2U);
+    arena.reset();
+    EXPECT_EQ(arena.blocks(), 1U);
+    EXPECT_EQ(arena.allocated(), 0U);
 }
 
-TEST(Writer, WriteAppends) {
-    Writer writer;
-    writer.write(std::string_view("ab"));
-    writer.write(std::string_view("cd"));
-    std::string result(writer.data.begin(), writer.data.end());
-    EXPECT_EQ(result, "abcd");
+TEST(Arena, ParseMatchesHeap) {
+    Calculator calc;
+    for (const char* text : { "42", "2+3*4", "(2+3)*4", "((2+3))*4", "2*3+4", "1/0" }) {
+        ArenaExpression expr = calc.parseArena(text);
+        ASSERT_TRUE(expr) << text;
+        EXPECT_TRUE(expr.root->_arena) << text;
+        EXPECT_EQ(expr.arena.blocks(), 1U) << text;
+        EXPECT_DOUBLE_EQ(expr.calc(), calc.parse(text)->calc()) << text;
+    }
+}
+
+TEST(Arena, VariablesStayOnHeap) {
+    Calculator calc;
+    {
+        ArenaExpression expr = calc.parseArena("x*2+x");
+        ASSERT_TRUE(expr);
+        Pointer<Variable>& var = calc._variable_map["x"];
+        EXPECT_FALSE(var->_arena);
+        EXPECT_EQ(var->_counter, 3);  // map + two references from the tree
+        var->value = 4.0;
+        EXPECT_DOUBLE_EQ(expr.calc(), 12.0);
+    }
+    // Destroying the arena tree released its references to the variable.
+    EXPECT_EQ(calc._variable_map["x"]->_counter, 1);
+}
+
+TEST(Arena, ReusedArenaDoesNotGrow) {
+    Calculator calc;
+    Arena arena;
+    for (int j = 0; j < 100; ++j) {
+        NodePtr ast = calc.parse("(1+2)*(3+4)/x", arena);
+        ASSERT_TRUE(ast);
+        ast.reset();
+        arena.reset();
+    }
+    EXPECT_EQ(arena.blocks(), 1U);
+}
+
+TEST(Arena, MoveAssignReleasesOldTree) {
+    Calculator calc;
+    ArenaExpression expr = calc.parseArena("y+1");
+    expr = calc.parseArena("2*3");
+    ASSERT_TRUE(expr);
+    EXPECT_DOUBLE_EQ(expr.calc(), 6.0);
+    EXPECT_EQ(calc._variable_map["y"]->_counter, 1);
+}
+
+TEST(Arena, SaverRestoresArenaOnThrow) {
+    Calculator calc;
+    Arena outer;
+    Arena inner;
+    calc._arena = &outer;
+    try {
+        Calculator::ArenaSaver saver(calc, inner);
+        EXPECT_EQ(calc._arena, &inner);
+        throw std::bad_alloc();
+    } catch (const std::bad_alloc&) {
+    }
+    EXPECT_EQ(calc._arena, &outer);
+    calc._arena = nullptr;
+}
+
+TEST(Arena, FunctionCallInArena) {
+    Calculator calc;
+    Arena arena;
+    calc._arena = &arena;
+    std::vector<NodePtr> args = { calc.make<Constant>(1.0) };
+    auto call = calc.createFunctionCall("log", args);
+    calc._arena = nullptr;
+    ASSERT_TRUE(call);
+    EXPECT_TRUE(call->_arena);
+    EXPECT_DOUBLE_EQ(call->calc(), 0.0);
+}
+
+// ===== Bulk.h =====
+
+TEST(Bulk, ResultsInInputOrder) {
+    std::string text;
+    for (int k = 0; k < 100; ++k) {
+        text += "x*2+" + std::to_string(k) + ";x=" + std::to_string(k) + "\n";
+    }
+    BulkEvaluator bulk(3, 7);
+    bulk.run(text);
+    ASSERT_EQ(bulk.size(), 100U);
+    for (size_t k = 0; k < 100; ++k) {
+        ASSERT_EQ(bulk.status(k), BulkEvaluator::Status::Ok);
+        EXPECT_DOUBLE_EQ(bulk.value(k), 3.0 * double(k));
+    }
+    EXPECT_EQ(bulk.stats().lines, 100U);
+    EXPECT_EQ(bulk.stats().errors, 0U);
+    EXPECT_EQ(bulk.stats().threads, 3U);
+}
+
+TEST(Bulk, ErrorsBlanksAndBindings) {
+    BulkEvaluator bulk(2, 1);
+    bulk.run("1+2*3\r\n\n(1+\nx+y; x = 1.5 ;y=-2\nx+y\n1+1;x\n2 3\nlog(1e0)");
+    ASSERT_EQ(bulk.size(), 8U);
+    EXPECT_EQ(bulk.value(0), 7.0);  // left-associative precedence parser
+    EXPECT_EQ(bulk.status(1), BulkEvaluator::Status::Blank);
+    EXPECT_EQ(bulk.status(2), BulkEvaluator::Status::Error);
+    EXPECT_EQ(bulk.value(3), -0.5);
+    EXPECT_EQ(bulk.value(4), 0.0);  // bindings do not leak to later lines
+    EXPECT_EQ(bulk.status(5), BulkEvaluator::Status::Error);
+    EXPECT_EQ(bulk.status(6), BulkEvaluator::Status::Error);  // trailing garbage
+    EXPECT_EQ(bulk.value(7), 0.0);
+    EXPECT_EQ(bulk.stats().errors, 3U);
+}
+
+TEST(Bulk, WriteAndMappedInput) {
+    char path[] = "/tmp/calculator_bulk_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    std::string text = "1/4\n\n1+\n";
+    ASSERT_EQ(::write(fd, text.data(), text.size()), ssize_t(text.size()));
+    ::close(fd);
+    auto input = MappedInput::open(path);
+    ASSERT_TRUE(input);
+    EXPECT_EQ(input->text(), text);
+    BulkEvaluator bulk(1);
+    bulk.run(input->text());
+    FILE* out = tmpfile();
+    ASSERT_NE(out, nullptr);
+    bulk.write(out);
+    rewind(out);
+    char buffer[64] = {};
+    size_t count = fread(buffer, 1, sizeof(buffer) - 1, out);
+    fclose(out);
+    EXPECT_EQ(std::string(buffer, count), "0.25\n\nerror\n");
+    unlink(path);
+    EXPECT_FALSE(MappedInput::open("/nonexistent/calculator_bulk"));
+}
+
+// ===== Bytecode.h =====
+
+TEST(Bytecode, MatchesTreeWalk) {
+    Calculator calc;
+    for (const char* text : { "42", "2+3*4", "(2+3)*4", "((2+3))*4", "10/4", "-5+10", "0.5+0.5" }) {
+        auto ast = calc.parse(text);
+        ASSERT_TRUE(ast) << text;
+        auto prog = Compiler::compile(ast);
+        ASSERT_TRUE(prog) << text;
+        EXPECT_DOUBLE_EQ(prog->calc(), ast->calc()) << text;
+    }
+}
+
+TEST(Bytecode, ParenthesisEmitsNoInstruction) {
+    Calculator calc;
+    auto prog = Compiler::compile(calc.parse("(2)"));
+    ASSERT_TRUE(prog);
+    ASSERT_EQ(prog->code.size(), 1U);
+    EXPECT_EQ(prog->code[0].code, OpCode::Constant);
+}
+
+TEST(Bytecode, VariablesShareOneSlot) {
+    Calculator calc;
+    auto ast = calc.parse("x*x+y");
+    ASSERT_TRUE(ast);
+    auto prog = Compiler::compile(ast);
+    ASSERT_TRUE(prog);
+    ASSERT_EQ(prog->variables.size(), 2U);
+    EXPECT_EQ(prog->variables[0]->name, "x");
+    EXPECT_EQ(prog->variables[1]->name, "y");
+
+    // calc() reads the values currently assigned in the AST...
+    calc._variable_map["x"]->value = 3.0;
+    calc._variable_map["y"]->value = 1.0;
+    EXPECT_DOUBLE_EQ(prog->calc(), 10.0);
+
+    // ...while run() takes explicit slots and leaves the AST alone.
+    double slots[] = { 4.0, 2.0 };
+    EXPECT_DOUBLE_EQ(prog->run(slots), 18.0);
+    EXPECT_DOUBLE_EQ(ast->calc(), 10.0);
+}
+
+TEST(Bytecode, UnaryOp) {
+    auto* uop = new UnaryOp;
+    uop->op = UnaryOp::Operation::Negative;
+    uop->node = NodePtr(new Constant(10.0));
+    auto prog = Compiler::compile(NodePtr(uop));
+    ASSERT_TRUE(prog);
+    EXPECT_DOUBLE_EQ(prog->calc(), -10.0);
+}
+
+TEST(Bytecode, FunctionCall) {
+    auto add3 = [](double val1, double val2, double val3) -> double { return val1 + val2 + val3; };
+    FnPtr func = toFnPtr(+add3);
+    std::vector<NodePtr> args = { NodePtr(new Constant(1.0)), NodePtr(new Constant(2.0)),
+        NodePtr(new Constant(4.0)) };
+    NodePtr call(new FunctionCallWithArgs<3>(func, args));
+    auto prog = Compiler::compile(call);
+    ASSERT_TRUE(prog);
+    EXPECT_EQ(prog->code.back().code, OpCode::Call);
+    EXPECT_DOUBLE_EQ(prog->calc(), 7.0);
+}
+
+TEST(Bytecode, ScratchForEveryProgramSize) {
+    // Small, stack and heap scratch (withScratch()).
+    for (size_t terms : { 4, 100, 1000 }) {
+        Calculator calc;
+        std::string text = "x";
+        for (size_t j = 0; j < terms; ++j) {
+            text += "+1";
+        }
+        auto prog = Compiler::compile(calc.parse(text));
+        ASSERT_TRUE(prog);
+        size_t scratch = prog->code.size() + 1;  // with the slot in calc()
+        EXPECT_EQ(scratch <= kSmallValues, terms == 4);
+        EXPECT_EQ(scratch <= kInlineValues, terms != 1000);
+        double x = 0.5;
+        calc._variable_map["x"]->value = x;
+        EXPECT_DOUBLE_EQ(prog->calc(), static_cast<double>(terms) + 0.5);
+        EXPECT_DOUBLE_EQ(prog->run(&x), static_cast<double>(terms) + 0.5);
+    }
+}
+
+TEST(Bytecode, UnknownNodeFails) {
+    EXPECT_FALSE(Compiler::compile(NodePtr(new TestNode)));
+    EXPECT_FALSE(Compiler::compile(NodePtr()));
+}
+
+TEST(Bytecode, FailedMultiRootCompileKeepsOutputs) {
+    Calculator calc;
+    std::vector<uint32_t> outputs = { 7 };
+    EXPECT_FALSE(Compiler::compile({ calc.parse("x+1"), NodePtr(new TestNode) }, outputs));
+    EXPECT_FALSE(Compiler::compile({ calc.parse("x+1"), NodePtr() }, outputs));
+    EXPECT_EQ(outputs, std::vector<uint32_t>{ 7 });
+    auto prog = Compiler::compile({ calc.parse("x+1"), calc.parse("2") }, outputs);
+    ASSERT_TRUE(prog);
+    EXPECT_EQ(outputs.size(), 3U);
+}
+
+// ===== Batch.h =====
+
+TEST(Batch, MatchesRowByRow) {
+    Calculator calc;
+    auto ast = calc.parse("x*x+(3-x)*2/y+1-(x*y)");
+    ASSERT_TRUE(ast);
+    auto batch = BatchEvaluator::create(ast);
+    ASSERT_TRUE(batch);
+
+    // Not a multiple of the block size, so the scalar tail is exercised too.
+    const size_t rows = (2 * kBatchBlock) + 7;
+    std::vector<double> xcol(rows);
+    std::vector<double> ycol(rows);
+    for (size_t row = 0; row < rows; ++row) {
+        xcol[row] = 0.25 * static_cast<double>(row);
+        ycol[row] = 1.0 + static_cast<double>(row % 13);
+    }
+    const Program& prog = batch->program();
+    ASSERT_EQ(prog.variables.size(), 2U);
+    ASSERT_EQ(prog.variables[0]->name, "x");
+    std::vector<const double*> columns = { xcol.data(), ycol.data() };
+    std::vector<double> output(rows);
+    batch->evaluate(columns, rows, output.data());
+
+    for (size_t row = 0; row < rows; ++row) {
+        calc._variable_map["x"]->value = xcol[row];
+        calc._variable_map["y"]->value = ycol[row];
+        EXPECT_DOUBLE_EQ(output[row], ast->calc()) << "row " << row;
+    }
+}
+
+TEST(Batch, NegateAndFunctionCall) {
+    auto twice = [](double val) -> double { return 2 * val; };
+    Calculator calc;
+    auto var = calc.parse("x");
+    auto* uop = new UnaryOp;
+    uop->op = UnaryOp::Operation::Negative;
+    uop->node = var;
+    std::vector<NodePtr> args = { NodePtr(uop) };
+    NodePtr call(new FunctionCallWithArgs<1>(toFnPtr(+twice), args));
+    auto batch = BatchEvaluator::create(call);
+    ASSERT_TRUE(batch);
+
+    std::vector<double> xcol = { 1.0, 2.0, 3.0, 4.0, 5.0 };
+    std::vector<double> output(xcol.size());
+    batch->evaluate({ xcol.data() }, xcol.size(), output.data());
+    EXPECT_EQ(output, (std::vector<double>{ -2.0, -4.0, -6.0, -8.0, -10.0 }));
+}
+
+TEST(Batch, LeafExpressions) {
+    Calculator calc;
+    auto constant = BatchEvaluator::create(calc.parse("2.5"));
+    ASSERT_TRUE(constant);
+    std::vector<double> output(3);
+    constant->evaluate(std::vector<const double*>{}, output.size(), output.data());
+    EXPECT_EQ(output, (std::vector<double>{ 2.5, 2.5, 2.5 }));
+
+    auto variable = BatchEvaluator::create(calc.parse("x"));
+    ASSERT_TRUE(variable);
+    std::vector<double> xcol = { 7.0, 8.0, 9.0 };
+    variable->evaluate({ xcol.data() }, xcol.size(), output.data());
+    EXPECT_EQ(output, xcol);
+}
+
+// ===== Context.h =====
+
+TEST(Context, EvaluatesWithOwnBindings) {
+    Calculator calc;
+    auto expr = SharedExpression::compile(calc.parse("x*x+y"));
+    ASSERT_TRUE(expr);
+    EXPECT_EQ(expr->slots(), 2U);
+    EvalContext first(expr);
+    EvalContext second(expr);
+    EXPECT_TRUE(first.set("x", 3.0));
+    EXPECT_TRUE(first.set("y", 1.0));
+    EXPECT_TRUE(second.set("x", 0.5));
+    EXPECT_FALSE(second.set("z", 9.0));
+    EXPECT_DOUBLE_EQ(first.evaluate(), 10.0);
+    EXPECT_DOUBLE_EQ(second.evaluate(), 0.25);
+    EXPECT_DOUBLE_EQ(calc._variable_map["x"]->value, 0.0);  // AST untouched
+}
+
+TEST(Context, SlotLookup) {
+    Calculator calc;
+    auto expr = SharedExpression::compile(calc.parse("b-a"));
+    ASSERT_TRUE(expr);
+    ASSERT_EQ(expr->names().size(), 2U);
+    EXPECT_EQ(expr->names()[0], "b");
+    EXPECT_EQ(expr->slot("a"), std::optional<size_t>(1));
+    EXPECT_FALSE(expr->slot("c"));
+    EvalContext ctx(expr);
+    ctx.set(size_t(0), 5.0);
+    ctx.set(size_t(1), 2.0);
+    EXPECT_DOUBLE_EQ(ctx.get(0), 5.0);
+    EXPECT_DOUBLE_EQ(ctx.evaluate(), 3.0);
+}
+
+TEST(Context, BatchUsesSlotOrder) {
+    Calculator calc;
+    auto expr = SharedExpression::compile(calc.parse("b-a*2"));
+    ASSERT_TRUE(expr);
+    BatchEvaluator batch = expr->batch();
+    std::vector<double> b = { 10, 20, 30 };
+    std::vector<double> a = { 1, 2, 3 };
+    std::vector<double> out(3);
+    batch.evaluate({ b.data(), a.data() }, 3, out.data());
+    EXPECT_EQ(out, (std::vector<double>{ 8, 16, 24 }));
+}
+
+TEST(Context, OutlivesSourceTree) {
+    Pointer<SharedExpression> expr;
+    {
+        Calculator calc;
+        expr = SharedExpression::compile(calc.parse("x+2"));
+    }
+    ASSERT_TRUE(expr);
+    EvalContext ctx(expr);
+    ctx.set("x", 1.0);
+    EXPECT_DOUBLE_EQ(ctx.evaluate(), 3.0);
+}
+
+TEST(Context, UncompilableTreeFails) {
+    EXPECT_FALSE(SharedExpression::compile(NodePtr(new TestNode)));
+    EXPECT_FALSE(SharedExpression::compile(NodePtr()));
+}
+
+TEST(Context, ConcurrentEvaluation) {
+    Calculator calc;
+    auto expr = SharedExpression::compile(calc.parse("x*3+1"));
+    ASSERT_TRUE(expr);
+    constexpr int kThreads = 4;
+    std::vector<double> sums(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([expr, t, &sums] {
+            EvalContext ctx(expr);
+            for (int k = 0; k < 1000; ++k) {
+                ctx.set("x", double(t));
+                sums[t] += ctx.evaluate();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int t = 0; t < kThreads; ++t) {
+        EXPECT_DOUBLE_EQ(sums[t], 1000.0 * (3.0 * t + 1));
+    }
+}
+
+// ===== Generator.h =====
+
+namespace {
+
+// Counts leaf operands (numbers and variables) and the deepest nesting.
+void shape(const std::string& text, size_t& leaves, size_t& depth) {
+    leaves = 0;
+    depth = 0;
+    size_t level = 0;
+    for (size_t j = 0; j < text.size(); ++j) {
+        char chr = text[j];
+        bool starts = j == 0 || std::string("+-*/(,").find(text[j - 1]) != std::string::npos;
+        if (starts && (std::isdigit(static_cast<unsigned char>(chr)) != 0 || chr == 'v')) {
+            ++leaves;
+        }
+        if (chr == '(') {
+            depth = std::max(depth, ++level);
+        } else if (chr == ')') {
+            --level;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(Generator, Deterministic) {
+    GeneratorOptions opts;
+    opts.terms = 50;
+    opts.depth = 3;
+    opts.call_percent = 30;
+    EXPECT_EQ(ExpressionGenerator::generate(opts), ExpressionGenerator::generate(opts));
+    ExpressionGenerator generator(opts);
+    EXPECT_NE(generator.generate(), generator.generate());
+    opts.seed = 2;
+    EXPECT_NE(ExpressionGenerator::generate(opts), ExpressionGenerator::generate(GeneratorOptions{}));
+}
+
+TEST(Generator, ShapeAndParse) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    for (size_t terms : { 1, 7, 200 }) {
+        for (size_t depth : { 0, 2, 6 }) {
+            GeneratorOptions opts;
+            opts.terms = terms;
+            opts.depth = depth;
+            opts.variables = 4;
+            opts.call_percent = 25;
+            opts.seed = terms * 10 + depth;
+            std::string text = ExpressionGenerator::generate(opts);
+            size_t leaves;
+            size_t nesting;
+            shape(text, leaves, nesting);
+            EXPECT_EQ(leaves, terms) << text;
+            EXPECT_LE(nesting, depth) << text;
+            EXPECT_TRUE(parser.parse(text)) << text;
+        }
+    }
+}
+
+TEST(Generator, VariablesOnlyWhenRequested) {
+    GeneratorOptions opts;
+    opts.terms = 100;
+    opts.variables = 0;
+    EXPECT_EQ(ExpressionGenerator::generate(opts).find('v'), std::string::npos);
+    opts.variables = 3;
+    std::string text = ExpressionGenerator::generate(opts);
+    EXPECT_NE(text.find("v0"), std::string::npos);
+    EXPECT_EQ(text.find("v3"), std::string::npos);
+}
+
+// ===== Gradient.h =====
+
+namespace {
+
+double gradientCube(double val) {
+    return val * val * val;
+}
+
+// Central-difference partial of text with respect to slot, as a reference.
+double numericPartial(const Program& prog, std::vector<double> slots, size_t slot) {
+    double step = 1e-6 * std::max(1.0, std::fabs(slots[slot]));
+    double arg = slots[slot];
+    slots[slot] = arg + step;
+    double high = prog.run(slots.data());
+    slots[slot] = arg - step;
+    double low = prog.run(slots.data());
+    return (high - low) / (2 * step);
+}
+
+}  // namespace
+
+TEST(Gradient, ArithmeticRules) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = GradientExpression::create(parser.parse("x*y + x/y - -x - (y-3)"));
+    ASSERT_TRUE(expr);
+    calc._variable_map["x"]->value = 2.0;
+    calc._variable_map["y"]->value = 4.0;
+    EXPECT_DOUBLE_EQ(expr->calc(), 8.0 + 0.5 + 2.0 - 1.0);
+    EXPECT_DOUBLE_EQ(expr->partial("x"), 4.0 + 0.25 + 1.0);      // y + 1/y + 1
+    EXPECT_DOUBLE_EQ(expr->partial("y"), 2.0 - 2.0 / 16 - 1.0);  // x - x/y² - 1
+    EXPECT_EQ(expr->partial("z"), 0.0);
+    ASSERT_EQ(expr->partials().size(), 2U);
+}
+
+TEST(Gradient, SharedOperandsAccumulate) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = GradientExpression::create(parser.parse("x*x*x + pow(x,x)"));
+    ASSERT_TRUE(expr);
+    double slots[] = { 1.5 };
+    double value = expr->run(slots);
+    EXPECT_DOUBLE_EQ(value, 1.5 * 1.5 * 1.5 + std::pow(1.5, 1.5));
+    // d/dx x^x = x^x (log x + 1)
+    EXPECT_NEAR(expr->partials()[0], 3 * 1.5 * 1.5 + std::pow(1.5, 1.5) * (std::log(1.5) + 1), 1e-12);
+}
+
+TEST(Gradient, IntrinsicsMatchFiniteDifferences) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    const char* formulas[] = {
+        "sqrt(x*x+y*y)",
+        "exp(x/4)*log(y)",
+        "pow(y,x)",
+        "abs(x-y)*3",
+        "min(x,y)+max(x*2,y)",
+        "floor(y)*x",
+    };
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(0.3, 5.0);
+    for (const char* text : formulas) {
+        auto expr = GradientExpression::create(parser.parse(text));
+        ASSERT_TRUE(expr) << text;
+        for (int trial = 0; trial < 20; ++trial) {
+            std::vector<double> slots(expr->program().variables.size());
+            for (double& slot : slots) {
+                slot = dist(rng);
+            }
+            EXPECT_DOUBLE_EQ(expr->run(slots.data()), expr->program().run(slots.data())) << text;
+            for (size_t slot = 0; slot < slots.size(); ++slot) {
+                double expected = numericPartial(expr->program(), slots, slot);
+                EXPECT_NEAR(expr->partials()[slot], expected, 1e-5 * std::max(1.0, std::fabs(expected))) << text;
+            }
+        }
+    }
+}
+
+TEST(Gradient, EdgeCases) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = GradientExpression::create(parser.parse("abs(x) + 0*sqrt(x) + pow(x,2) + floor(x)"));
+    ASSERT_TRUE(expr);
+    double zero[] = { 0.0 };
+    expr->run(zero);
+    EXPECT_EQ(expr->partials()[0], 0.0);  // no NaN from sqrt'(0) or 0^-1
+    auto ties = GradientExpression::create(parser.parse("min(x,y)"));
+    double equal[] = { 2.0, 2.0 };
+    ties->run(equal);
+    EXPECT_EQ(ties->partials()[0], 0.0);  // x < y is false, so y was selected
+    EXPECT_EQ(ties->partials()[1], 1.0);
+    auto constant = GradientExpression::create(parser.parse("4"));
+    EXPECT_EQ(constant->calc(), 4.0);
+    EXPECT_TRUE(constant->partials().empty());
+}
+
+TEST(Gradient, UserFunctionsUseCentralDifferences) {
+    Calculator calc;
+    calc._function_map["cube"] = Function{ "cube", 1, toFnPtr(&gradientCube) };
+    PrecedenceParser parser(calc);
+    auto expr = GradientExpression::create(parser.parse("cube(x*2)+x"));
+    ASSERT_TRUE(expr);
+    double slots[] = { 1.5 };
+    EXPECT_DOUBLE_EQ(expr->run(slots), 27.0 + 1.5);
+    EXPECT_NEAR(expr->partials()[0], 2 * 3 * 9.0 + 1, 1e-8);
+}
+
+// ===== Image.h =====
+
+namespace {
+
+double imageScale(double val) {
+    return 3 * val;
+}
+
+// Builds an image of a few named formulas, calling the user function
+// "scale" and several intrinsics.
+std::vector<char> sampleImage(Calculator& calc, std::vector<Program>& programs) {
+    PrecedenceParser parser(calc);
+    ImageWriter writer(calc);
+    const char* formulas[][2] = {
+        { "sum", "x+y*2" },
+        { "call", "scale(x)-max(y,1.5)/4" },
+        { "roots", "sqrt(x*x+y*y)+pow(x,2)+floor(y)" },
+        { "constant", "42" },
+    };
+    for (const auto& formula : formulas) {
+        auto prog = Compiler::compile(parser.parse(formula[1]));
+        EXPECT_TRUE(prog && writer.add(formula[0], *prog)) << formula[1];
+        programs.push_back(std::move(*prog));
+    }
+    Writer out;
+    writer.write(out);
+    return out.data;
+}
+
+}  // namespace
+
+TEST(Image, RoundTrip) {
+    Calculator calc;
+    calc._function_map["scale"] = Function{ "scale", 1, toFnPtr(&imageScale) };
+    std::vector<Program> programs;
+    std::vector<char> bytes = sampleImage(calc, programs);
+
+    Calculator loader;  // a different Calculator providing the same function
+    loader._function_map["scale"] = Function{ "scale", 1, toFnPtr(&imageScale) };
+    auto image = ExpressionImage::load(std::string_view(bytes.data(), bytes.size()), loader);
+    ASSERT_TRUE(image);
+    EXPECT_TRUE(image->verify());
+    ASSERT_EQ(image->size(), 4U);
+    EXPECT_EQ(image->name(1), "call");
+    ASSERT_EQ(image->slots(0), 2U);
+    EXPECT_EQ(image->slot(0, 0), "x");
+    EXPECT_EQ(image->slot(0, 1), "y");
+    EXPECT_EQ(image->slots(3), 0U);
+    for (double x : { -2.0, 0.5, 7.0 }) {
+        for (size_t j = 0; j < programs.size(); ++j) {
+            double slots[] = { x, x / 3 };
+            EXPECT_EQ(image->run(j, slots), programs[j].run(slots)) << image->name(j);
+        }
+    }
+    // Copying out binds the slots to the loading Calculator's variables.
+    Program copy = image->program(2, loader);
+    loader._variable_map["x"]->value = 3.0;
+    loader._variable_map["y"]->value = 4.5;
+    EXPECT_DOUBLE_EQ(copy.calc(), std::sqrt(29.25) + 9.0 + 4.0);
+}
+
+TEST(Image, DeterministicAndDeduplicated) {
+    Calculator calc;
+    calc._function_map["scale"] = Function{ "scale", 1, toFnPtr(&imageScale) };
+    std::vector<Program> programs;
+    std::vector<char> first = sampleImage(calc, programs);
+    std::vector<char> second = sampleImage(calc, programs);
+    EXPECT_EQ(first, second);
+    const auto* header = reinterpret_cast<const ImageHeader*>(first.data());
+    // "x" and "y" are stored once each, next to the names and "scale".
+    EXPECT_EQ(header->strings.count, std::string("sumxycallscaleroots" "constant").size());
+    EXPECT_EQ(header->size, first.size());
+}
+
+TEST(Image, SaveAndOpen) {
+    Calculator calc;
+    ImageWriter writer(calc);
+    ASSERT_TRUE(writer.add("area", calc.parse("width*height")));
+    char path[] = "/tmp/calculator_image_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    ASSERT_TRUE(writer.save(path));
+    auto image = ExpressionImage::open(path, calc);
+    ASSERT_TRUE(image);
+    double slots[] = { 3.0, 4.0 };
+    EXPECT_EQ(image->run(0, slots), 12.0);
+    ExpressionImage moved = std::move(*image);  // views stay on the mapping
+    EXPECT_EQ(moved.run(0, slots), 12.0);
+    unlink(path);
+    EXPECT_FALSE(ExpressionImage::open("/nonexistent/calculator_image", calc));
+}
+
+TEST(Image, RejectsMalformedImages) {
+    Calculator calc;
+    calc._function_map["scale"] = Function{ "scale", 1, toFnPtr(&imageScale) };
+    std::vector<Program> programs;
+    const std::vector<char> bytes = sampleImage(calc, programs);
+    auto load = [&](std::vector<char> image, size_t skip = 0) {
+        return ExpressionImage::load(std::string_view(image.data() + skip, image.size() - skip), calc).has_value();
+    };
+    EXPECT_TRUE(load(bytes));
+
+    std::vector<char> bad = bytes;
+    bad[0] = 'X';
+    EXPECT_FALSE(load(bad));  // magic
+    bad = bytes;
+    reinterpret_cast<ImageHeader*>(bad.data())->version = kImageVersion + 1;
+    EXPECT_FALSE(load(bad));
+    bad = bytes;
+    reinterpret_cast<ImageHeader*>(bad.data())->byte_order = 0x04030201;
+    EXPECT_FALSE(load(bad));
+    bad.assign(bytes.begin(), bytes.end() - 8);
+    EXPECT_FALSE(load(bad));  // truncated
+    bad = bytes;
+    reinterpret_cast<ImageHeader*>(bad.data())->code.count = 1U << 30;
+    EXPECT_FALSE(load(bad));  // section past the end
+    bad = bytes;
+    bad.insert(bad.begin(), 4, '\0');
+    EXPECT_FALSE(load(bad, 4));  // misaligned
+
+    Calculator missing;  // does not provide "scale"
+    EXPECT_FALSE(ExpressionImage::load(std::string_view(bytes.data(), bytes.size()), missing));
+    Calculator arity;
+    arity._function_map["scale"] = Function{ "scale", 2, toFnPtr(&imageScale) };
+    EXPECT_FALSE(ExpressionImage::load(std::string_view(bytes.data(), bytes.size()), arity));
+
+    // A forward operand loads (instructions are not checked) but fails verify().
+    bad = bytes;
+    const auto* header = reinterpret_cast<const ImageHeader*>(bad.data());
+    auto* code = reinterpret_cast<Instruction*>(bad.data() + header->code.offset);
+    code[2].lhs = 5;
+    auto image = ExpressionImage::load(std::string_view(bad.data(), bad.size()), calc);
+    ASSERT_TRUE(image);
+    EXPECT_FALSE(image->verify());
+}
+
+// ===== Incremental.h =====
+
+TEST(Incremental, RecomputesOnlyChangedPaths) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = IncrementalExpression::create(parser.parse("a*b+c*d"));
+    ASSERT_TRUE(expr);
+    expr->set("a", 1.0);
+    expr->set("b", 2.0);
+    expr->set("c", 3.0);
+    expr->set("d", 4.0);
+    EXPECT_DOUBLE_EQ(expr->calc(), 14.0);
+    EXPECT_EQ(expr->stats().recomputed, 7U);
+    EXPECT_TRUE(expr->set("c", 5.0));
+    EXPECT_DOUBLE_EQ(expr->calc(), 22.0);
+    EXPECT_EQ(expr->stats().recomputed, 3U);  // c, c*d, root
+    EXPECT_DOUBLE_EQ(expr->calc(), 22.0);
+    EXPECT_EQ(expr->stats().recomputed, 0U);
+    EXPECT_EQ(expr->stats().evaluations, 3U);
+    EXPECT_EQ(expr->stats().total, 10U);
+}
+
+TEST(Incremental, UnchangedValueStopsPropagation) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = IncrementalExpression::create(parser.parse("a*b+c"));
+    ASSERT_TRUE(expr);
+    expr->set("c", 1.0);
+    EXPECT_DOUBLE_EQ(expr->calc(), 1.0);  // a == 0
+    expr->set("b", 7.0);
+    EXPECT_DOUBLE_EQ(expr->calc(), 1.0);
+    EXPECT_EQ(expr->stats().recomputed, 2U);  // b, a*b; root untouched
+    expr->set("c", 1.0);
+    EXPECT_DOUBLE_EQ(expr->calc(), 1.0);
+    EXPECT_EQ(expr->stats().recomputed, 0U);
+}
+
+TEST(Incremental, PicksUpDirectAssignment) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto expr = IncrementalExpression::create(parser.parse("x-y"));
+    ASSERT_TRUE(expr);
+    EXPECT_DOUBLE_EQ(expr->calc(), 0.0);
+    calc._variable_map["x"]->value = 4.0;
+    EXPECT_DOUBLE_EQ(expr->calc(), 4.0);
+    EXPECT_EQ(expr->stats().recomputed, 2U);
+    EXPECT_TRUE(expr->set("y", 1.5));
+    EXPECT_DOUBLE_EQ(calc._variable_map["y"]->value, 1.5);
+    EXPECT_FALSE(expr->set("z", 1.0));
+}
+
+TEST(Incremental, MatchesTreeWithCallsAndSharing) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse("log(x)*y+log(x)/(y-z)");
+    auto expr = IncrementalExpression::create(ast);
+    ASSERT_TRUE(expr);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(1.0, 5.0);
+    const char* names[] = { "x", "y", "z" };
+    for (int k = 0; k < 50; ++k) {
+        expr->set(names[k % 3], dist(rng));
+        EXPECT_DOUBLE_EQ(expr->calc(), ast->calc());
+    }
+}
+
+TEST(Incremental, UncompilableTreeFails) {
+    EXPECT_FALSE(IncrementalExpression::create(NodePtr(new TestNode)));
+}
+
+// ===== Intrinsics.h =====
+
+TEST(Intrinsics, ParsedAsIntrinsicCalls) {
+    Calculator calc;
+    for (const IntrinsicInfo& info : intrinsicTable()) {
+        std::vector<NodePtr> args(intrinsicArity(info.op), NodePtr(new Constant(2.0)));
+        auto call = calc.createFunctionCall(info.name, args);
+        ASSERT_TRUE(call) << info.name;
+        EXPECT_TRUE(call.as<IntrinsicCall>()) << info.name;
+        EXPECT_EQ(call->intrinsic, info.op);
+        EXPECT_EQ(call->fnptr, intrinsicFunction(info.op));
+        EXPECT_DOUBLE_EQ(call->calc(), applyIntrinsic(info.op, 2.0, 2.0)) << info.name;
+    }
+    std::vector<NodePtr> one = { NodePtr(new Constant(2.0)) };
+    EXPECT_FALSE(calc.createFunctionCall("pow", one));  // wrong arity
+}
+
+TEST(Intrinsics, PerfectHashLookup) {
+    for (const IntrinsicInfo& info : intrinsicTable()) {
+        EXPECT_EQ(findIntrinsic(info.name), info.op) << info.name;
+    }
+    static_assert(findIntrinsic("floor") == Intrinsic::Floor, "constexpr lookup");
+    EXPECT_EQ(findIntrinsic(""), Intrinsic::None);
+    EXPECT_EQ(findIntrinsic("mi"), Intrinsic::None);
+    EXPECT_EQ(findIntrinsic("mix"), Intrinsic::None);
+    EXPECT_EQ(findIntrinsic("sqrtx"), Intrinsic::None);
+    EXPECT_EQ(findIntrinsic("SQRT"), Intrinsic::None);
+}
+
+TEST(Intrinsics, UserFunctionOverridesBuiltin) {
+    auto twice = [](double val) { return 2 * val; };
+    Calculator calc;
+    calc._function_map["sqrt"] = Function{ "sqrt", 1, toFnPtr(+twice) };
+    std::vector<NodePtr> args = { NodePtr(new Constant(9.0)) };
+    auto call = calc.createFunctionCall("sqrt", args);
+    ASSERT_TRUE(call);
+    EXPECT_FALSE(call.as<IntrinsicCall>());
+    EXPECT_DOUBLE_EQ(call->calc(), 18.0);
+    auto prog = Compiler::compile(call);
+    ASSERT_TRUE(prog);
+    EXPECT_EQ(prog->code.back().code, OpCode::Call);
+}
+
+TEST(Intrinsics, Semantics) {
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Abs, -0.0, 0), 0.0);
+    EXPECT_FALSE(std::signbit(applyIntrinsic(Intrinsic::Abs, -0.0, 0)));
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Floor, -1.5, 0), -2.0);
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Pow, 2.0, 10.0), 1024.0);
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Min, 1.0, 2.0), 1.0);
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Max, 1.0, 2.0), 2.0);
+    EXPECT_EQ(applyIntrinsic(Intrinsic::Min, nan, 2.0), 2.0);  // second operand, like minsd
+    EXPECT_TRUE(std::isnan(applyIntrinsic(Intrinsic::Max, 2.0, nan)));
+}
+
+TEST(Intrinsics, AllBackendsAgree) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    const char* texts[] = { "sqrt(x*x+y*y)", "exp(-x)*log(y)", "pow(x,y)-pow(y,0.5)", "abs(x-y)+floor(x*3)",
+        "min(x,y)*max(x,-y)", "max(min(x,2),sqrt(abs(y)))" };
+    std::vector<double> xs = { -2.5, -1.0, -0.0, 0.25, 1.0, 3.75, 10.0 };
+    std::vector<double> ys = { 0.5, 2.0, 0.0, 1.5, -3.0, 4.0, 7.25 };
+    std::vector<const double*> columns = { xs.data(), ys.data() };
+    for (const char* text : texts) {
+        NodePtr ast = parser.parse(text);
+        ASSERT_TRUE(ast) << text;
+        auto prog = Compiler::compile(ast);
+        ASSERT_TRUE(prog) << text;
+        ASSERT_EQ(prog->variables.size(), 2U);
+        ASSERT_EQ(prog->variables[0]->name, "x");
+        auto batch = BatchEvaluator::create(ast);
+        ASSERT_TRUE(batch);
+        std::vector<double> out(xs.size());
+        batch->evaluate(columns, xs.size(), out.data());
+        auto native = JitCompiler::compile(*prog);
+        auto incremental = IncrementalExpression::create(ast);
+        ASSERT_TRUE(incremental);
+        for (size_t row = 0; row < xs.size(); ++row) {
+            calc._variable_map["x"]->value = xs[row];
+            calc._variable_map["y"]->value = ys[row];
+            double expected = ast->calc();
+            auto same = [expected](double actual) {
+                return std::isnan(expected) ? std::isnan(actual) : actual == expected;
+            };
+            EXPECT_TRUE(same(prog->calc())) << text << " row " << row;
+            EXPECT_TRUE(same(out[row])) << text << " row " << row;
+            EXPECT_TRUE(same(incremental->calc())) << text << " row " << row;
+            if (native) {
+                EXPECT_TRUE(same(native->calc())) << text << " row " << row;
+            }
+        }
+    }
+}
+
+TEST(Intrinsics, CompiledToOpcodes) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto prog = Compiler::compile(parser.parse("pow(x,2)+sqrt(x)"));
+    ASSERT_TRUE(prog);
+    EXPECT_TRUE(prog->callees.empty());
+    size_t intrinsics = 0;
+    for (const Instruction& ins : prog->code) {
+        intrinsics += isIntrinsic(ins.code) ? 1 : 0;
+    }
+    EXPECT_EQ(intrinsics, 2U);
+}
+
+TEST(Intrinsics, OptimizerFoldsAndKeepsTag) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    EXPECT_DOUBLE_EQ(Optimizer::run(parser.parse("sqrt(16)+max(1,3)"))->calc(), 7.0);
+    NodePtr opt = Optimizer::run(parser.parse("floor(x)"));
+    auto call = opt.as<IntrinsicCall>();
+    ASSERT_TRUE(call);
+    EXPECT_EQ(call->intrinsic, Intrinsic::Floor);
+}
+
+// ===== Jit.h =====
+
+TEST(Jit, MatchesInterpreter) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    calc.internVariable("x")->value = 1.5;
+    calc.internVariable("y")->value = -4.0;
+    for (const char* text : { "42", "x", "x+y", "x-y*2", "(x-y)*(x+y)/3", "-x", "2-(x*y)",
+             "x/(y-y)", "log(x)*y+log(2)", "1-2-3-4-5" }) {
+        auto ast = parser.parse(text);
+        ASSERT_TRUE(ast) << text;
+        auto prog = Compiler::compile(ast);
+        ASSERT_TRUE(prog) << text;
+        auto native = JitCompiler::compile(*prog);
+        ASSERT_TRUE(native) << text;
+        EXPECT_DOUBLE_EQ(native->calc(), prog->calc()) << text;
+    }
+}
+
+TEST(Jit, RunWithSlots) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto prog = Compiler::compile(parser.parse("x*x-y"));
+    ASSERT_TRUE(prog);
+    auto native = JitCompiler::compile(*prog);
+    ASSERT_TRUE(native);
+    double slots[] = { 3.0, 1.0 };
+    EXPECT_DOUBLE_EQ(native->run(slots), 8.0);
+}
+
+TEST(Jit, CallsWithManyArguments) {
+    auto sum8 = [](double aa, double bb, double cc, double dd, double ee, double ff, double gg, double hh) {
+        return aa + (2 * bb) + (3 * cc) + (4 * dd) + (5 * ee) + (6 * ff) + (7 * gg) + (8 * hh);
+    };
+    auto zero = []() -> double { return 0.5; };
+    Calculator calc;
+    calc._function_map["sum8"] = Function{ "sum8", 8, toFnPtr(+sum8) };
+    calc._function_map["zero"] = Function{ "zero", 0, toFnPtr(+zero) };
+    PrecedenceParser parser(calc);
+    calc.internVariable("x")->value = 2.0;
+    auto prog = Compiler::compile(parser.parse("x+sum8(1,x,3,x*2,5,6,7,zero())*x"));
+    ASSERT_TRUE(prog);
+    auto native = JitCompiler::compile(*prog);
+    ASSERT_TRUE(native);
+    EXPECT_DOUBLE_EQ(native->calc(), prog->calc());
+}
+
+TEST(Jit, TooManyArgumentsRejected) {
+    std::vector<NodePtr> args;
+    for (int j = 0; j < 9; ++j) {
+        args.emplace_back(new Constant(1.0));
+    }
+    auto sum9 = [](double, double, double, double, double, double, double, double, double) { return 0.0; };
+    NodePtr call = fn_call_factory_table[9](nullptr, toFnPtr(+sum9), args);
+    auto prog = Compiler::compile(call);
+    ASSERT_TRUE(prog);
+    EXPECT_FALSE(JitCompiler::compile(*prog));
+}
+
+TEST(Jit, TieredPromotion) {
+    Calculator calc;
+    calc.internVariable("x")->value = 2.0;
+    TieredExpression expr(calc.parse("x*3+1"), TierPolicy{ 2, 4 });
+    EXPECT_DOUBLE_EQ(expr.calc(), 7.0);
+    EXPECT_DOUBLE_EQ(expr.calc(), 7.0);
+    EXPECT_EQ(expr.tier(), TieredExpression::Tier::Tree);
+    EXPECT_DOUBLE_EQ(expr.calc(), 7.0);
+    EXPECT_EQ(expr.tier(), TieredExpression::Tier::Bytecode);
+    expr.calc();
+    calc._variable_map["x"]->value = 3.0;
+    EXPECT_DOUBLE_EQ(expr.calc(), 10.0);
+    EXPECT_EQ(expr.tier(), TieredExpression::Tier::Native);
+    EXPECT_EQ(expr.evaluations(), 5U);
+}
+
+TEST(Jit, TieredStaysOnTreeWhenUncompilable) {
+    TieredExpression expr(NodePtr(new TestNode), TierPolicy{ 0, 0 });
+    EXPECT_DOUBLE_EQ(expr.calc(), 42.0);
+    EXPECT_DOUBLE_EQ(expr.calc(), 42.0);
+    EXPECT_EQ(expr.tier(), TieredExpression::Tier::Tree);
+}
+
+// ===== Numeric.h =====
+
+TEST(Numeric, FixedSumsAreExact) {
+    using Cents = Fixed<2>;
+    Cents sum = Cents::fromDouble(0.1) + Cents::fromDouble(0.2);
+    EXPECT_EQ(sum.raw, 30);
+    EXPECT_EQ(sum, Cents::fromDouble(0.3));
+    EXPECT_NE(0.1 + 0.2, 0.3);
+    EXPECT_EQ((Cents::fromDouble(19.99) - Cents::fromDouble(20)).raw, -1);
+    EXPECT_EQ((-Cents::fromDouble(1.5)).raw, -150);
+}
+
+TEST(Numeric, FixedRoundsHalfAwayFromZero) {
+    using Cents = Fixed<2>;
+    Cents half = Cents::fromDouble(0.5);
+    EXPECT_EQ((Cents::fromDouble(1.25) * half).raw, 63);
+    EXPECT_EQ((Cents::fromDouble(-1.25) * half).raw, -63);
+    EXPECT_EQ((Cents::fromDouble(1.24) * half).raw, 62);
+    EXPECT_EQ((Cents::fromDouble(1) / Cents::fromDouble(3)).raw, 33);
+    EXPECT_EQ((Cents::fromDouble(2) / Cents::fromDouble(3)).raw, 67);
+    EXPECT_EQ((Cents::fromDouble(-2) / Cents::fromDouble(3)).raw, -67);
+    EXPECT_EQ((Cents::fromDouble(2) / Cents::fromDouble(-3)).raw, -67);
+    EXPECT_EQ(Cents::fromDouble(0.125).raw, 13);
+}
+
+TEST(Numeric, FixedEdgeCases) {
+    using Units = Fixed<4>;
+    // Products and dividends beyond 64 bits take the 128-bit path.
+    Units million = Units::fromDouble(1e6);
+    EXPECT_EQ((million * million).toDouble(), 1e12);
+    EXPECT_EQ(((million * million) / million).raw, million.raw);
+    EXPECT_EQ((Units::fromRaw(-5) / Units::fromRaw(-1)).raw, 50000);
+    EXPECT_EQ((Units::fromRaw(3) / Units::fromRaw(std::numeric_limits<int64_t>::min())).raw, 0);
+    // Division by zero saturates; conversions of NaN and huge values too.
+    EXPECT_EQ((Units::fromDouble(1) / Units()).raw, std::numeric_limits<int64_t>::max());
+    EXPECT_EQ((Units::fromDouble(-1) / Units()).raw, std::numeric_limits<int64_t>::min());
+    EXPECT_EQ((Units() / Units()).raw, 0);
+    EXPECT_EQ(Units::fromDouble(std::nan("")).raw, 0);
+    EXPECT_EQ(Units::fromDouble(1e300).raw, std::numeric_limits<int64_t>::max());
+    EXPECT_EQ(Units::fromDouble(-1e300).raw, std::numeric_limits<int64_t>::min());
+    // Intrinsics computed in Fixed.
+    using Traits = ValueTraits<Units>;
+    EXPECT_EQ(Traits::intrinsic(Intrinsic::Floor, Units::fromDouble(-1.5), Units()), Units::fromDouble(-2));
+    EXPECT_EQ(Traits::intrinsic(Intrinsic::Floor, Units::fromDouble(2.75), Units()), Units::fromDouble(2));
+    EXPECT_EQ(Traits::intrinsic(Intrinsic::Abs, Units::fromDouble(-0.25), Units()), Units::fromDouble(0.25));
+    EXPECT_EQ(Traits::intrinsic(Intrinsic::Sqrt, Units::fromDouble(2.25), Units()), Units::fromDouble(1.5));
+}
+
+namespace {
+
+// Formulas over x and y covering every operator, intrinsic and a user call.
+const std::vector<std::string_view>& valueFormulas() {
+    static const std::vector<std::string_view> formulas = {
+        "x*1.5 - y/4 + 2", "-(x - y) * (x + 0.25)", "min(x, y) + max(x, 3) - abs(y - x)",
+        "sqrt(x*x + y*y) + floor(y / 3)", "pow(x, 2) + exp(y / 10) - log(x + 1)", "half(x + y) * 2",
+    };
+    return formulas;
+}
+
+double half(double value) {
+    return value / 2;
+}
+
+// Parses formula with the user function half() registered.
+NodePtr parseValueFormula(Calculator& calc, std::string_view formula) {
+    calc._function_map["half"] = Function{ "half", 1, toFnPtr(&half) };
+    PrecedenceParser parser(calc);
+    return parser.parse(formula);
+}
+
+}  // namespace
+
+TEST(Numeric, CalcAsMatchesCalc) {
+    for (std::string_view formula : valueFormulas()) {
+        Calculator calc;
+        NodePtr ast = parseValueFormula(calc, formula);
+        ASSERT_TRUE(ast) << formula;
+        calc._variable_map["x"]->value = 2.5;
+        calc._variable_map["y"]->value = 7.25;
+        double expected = ast->calc();
+        EXPECT_EQ(calcAs<double>(ast.get()), expected) << formula;
+        EXPECT_NEAR(calcAs<float>(ast.get()), expected, 1e-5 * std::fabs(expected)) << formula;
+        EXPECT_NEAR(calcAs<Fixed<6>>(ast.get()).toDouble(), expected, 1e-5) << formula;
+    }
+}
+
+TEST(Numeric, CalcAsOnDagsAndUntaggedNodes) {
+    Calculator calc;
+    NodePtr square = calc.parse("x*x");
+    NodePtr sum(new BinaryOp(BinaryOp::Operation::Addition, square, calc.parse("(x*x)")));
+    NodePtr ast(new BinaryOp(BinaryOp::Operation::Multiplication, sum, NodePtr(new TestNode)));
+    NodePtr dag = Optimizer::run(ast);
+    ASSERT_TRUE(dag.as<DagRoot>());
+    for (double value : { 0.5, -3.0, 1e10 }) {
+        calc._variable_map["x"]->value = value;
+        EXPECT_EQ(calcAs<double>(ast.get()), ast->calc());
+        EXPECT_EQ(calcAs<double>(dag.get()), dag->calc());
+        EXPECT_EQ(calcAs<double>(dag.get()), 84.0 * value * value);
+    }
+}
+
+TEST(Numeric, FixedFormulaIsExact) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse("0.1 + 0.2 - 0.3");
+    ASSERT_TRUE(ast);
+    EXPECT_NE(ast->calc(), 0.0);
+    EXPECT_EQ(calcAs<Fixed<2>>(ast.get()).raw, 0);
+    auto prog = Compiler::compile(ast);
+    ASSERT_TRUE(prog);
+    EXPECT_EQ(TypedProgram<Fixed<2>>(*prog).run(nullptr).raw, 0);
+}
+
+namespace {
+
+// Evaluates valueFormulas() in T with calcAs(), TypedProgram and
+// BasicBatchEvaluator, which must agree exactly.
+template <typename T>
+void expectTypedEvaluatorsAgree() {
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> cents(1, 100000);
+    const size_t rows = kBatchBlock + 37;
+    for (std::string_view formula : valueFormulas()) {
+        Calculator calc;
+        NodePtr ast = parseValueFormula(calc, formula);
+        ASSERT_TRUE(ast) << formula;
+        auto prog = Compiler::compile(ast);
+        ASSERT_TRUE(prog) << formula;
+        ASSERT_EQ(prog->variables.size(), 2U) << formula;
+        TypedProgram<T> typed(*prog);
+        auto batch = BasicBatchEvaluator<T>::create(ast);
+        ASSERT_TRUE(batch) << formula;
+
+        std::vector<std::vector<T>> columns(2, std::vector<T>(rows));
+        for (auto& column : columns) {
+            for (T& value : column) {
+                value = ValueTraits<T>::fromDouble(cents(rng) / 100.0);
+            }
+        }
+        std::vector<T> output(rows);
+        batch->evaluate({ columns[0].data(), columns[1].data() }, rows, output.data());
+        for (size_t row = 0; row < rows; ++row) {
+            std::array<T, 2> slots = { columns[0][row], columns[1][row] };
+            for (size_t slot = 0; slot < slots.size(); ++slot) {
+                prog->variables[slot]->value = ValueTraits<T>::toDouble(slots[slot]);
+            }
+            T expected = calcAs<T>(ast.get());
+            EXPECT_EQ(typed.run(slots.data()), expected) << formula << " row " << row;
+            EXPECT_EQ(output[row], expected) << formula << " row " << row;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(Numeric, FloatEvaluatorsAgree) {
+    expectTypedEvaluatorsAgree<float>();
+}
+
+TEST(Numeric, FixedEvaluatorsAgree) {
+    expectTypedEvaluatorsAgree<Fixed<4>>();
+}
+
+// ===== Optimizer.h =====
+
+namespace {
+
+int g_calls = 0;
+double countedSquare(double val) {
+    ++g_calls;
+    return val * val;
+}
+
+// Builds f(arg) for a one-argument function.
+NodePtr call1(double (*func)(double), const NodePtr& arg) {
+    return NodePtr(new FunctionCallWithArgs<1>(toFnPtr(func), { arg }));
+}
+
+}  // namespace
+
+TEST(Optimizer, FoldsConstantSubtrees) {
+    Calculator calc;
+    Optimizer optimizer;
+    NodePtr folded = optimizer.optimize(calc.parse("(2*3.5)/7"));
+    auto cst = folded.as<Constant>();
+    ASSERT_TRUE(cst);
+    EXPECT_DOUBLE_EQ(cst->value, 1.0);
+    EXPECT_EQ(optimizer.stats().folded, 2U);
+    EXPECT_EQ(optimizer.stats().unwrapped, 1U);
+}
+
+TEST(Optimizer, RemovesParentheses) {
+    Calculator calc;
+    NodePtr opt = Optimizer::run(calc.parse("((x))*(y)"));
+    auto binop = opt.as<BinaryOp>();
+    ASSERT_TRUE(binop);
+    EXPECT_TRUE(binop->left.as<Variable>());
+    EXPECT_TRUE(binop->right.as<Variable>());
+}
+
+TEST(Optimizer, FoldsNegationAndCalls) {
+    auto* uop = new UnaryOp;
+    uop->op = UnaryOp::Operation::Negative;
+    uop->node = NodePtr(new Constant(3.0));
+    Optimizer optimizer;
+    NodePtr opt = optimizer.optimize(call1(&countedSquare, NodePtr(uop)));
+    auto cst = opt.as<Constant>();
+    ASSERT_TRUE(cst);
+    EXPECT_DOUBLE_EQ(cst->value, 9.0);
+}
+
+TEST(Optimizer, MergesIdenticalSubtrees) {
+    Calculator calc;
+    NodePtr ast = calc.parse("(x*y)+(x*y)");
+    Optimizer optimizer;
+    NodePtr opt = optimizer.optimize(ast);
+    EXPECT_EQ(optimizer.stats().merged, 1U);
+    EXPECT_EQ(optimizer.stats().shared, 1U);
+
+    auto root = opt.as<DagRoot>();
+    ASSERT_TRUE(root);
+    auto sum = root->node.as<BinaryOp>();
+    ASSERT_TRUE(sum);
+    EXPECT_EQ(sum->left.get(), sum->right.get());
+    EXPECT_TRUE(sum->left.as<Shared>());
+
+    calc._variable_map["x"]->value = 2.0;
+    calc._variable_map["y"]->value = 5.0;
+    EXPECT_DOUBLE_EQ(opt->calc(), ast->calc());
+    calc._variable_map["y"]->value = 6.0;
+    EXPECT_DOUBLE_EQ(opt->calc(), 24.0);
+}
+
+TEST(Optimizer, SharedSubtreeEvaluatedOncePerCall) {
+    Calculator calc;
+    NodePtr var = calc.parse("x");
+    NodePtr ast(new BinaryOp(BinaryOp::Operation::Addition, call1(&countedSquare, var),
+        NodePtr(new Parenthesis(call1(&countedSquare, var)))));
+    NodePtr opt = Optimizer::run(ast);
+    calc._variable_map["x"]->value = 3.0;
+
+    g_calls = 0;
+    EXPECT_DOUBLE_EQ(ast->calc(), 18.0);
+    EXPECT_EQ(g_calls, 2);
+
+    g_calls = 0;
+    EXPECT_DOUBLE_EQ(opt->calc(), 18.0);
+    EXPECT_DOUBLE_EQ(opt->calc(), 18.0);
+    EXPECT_EQ(g_calls, 2);  // once per calc()
+
+    auto prog = Compiler::compile(opt);
+    ASSERT_TRUE(prog);
+    g_calls = 0;
+    EXPECT_DOUBLE_EQ(prog->calc(), 18.0);
+    EXPECT_EQ(g_calls, 1);
+}
+
+TEST(Optimizer, ImpureFunctionsKept) {
+    Calculator calc;
+    NodePtr var = calc.parse("x");
+    NodePtr ast(new BinaryOp(BinaryOp::Operation::Addition, call1(&countedSquare, var),
+        call1(&countedSquare, var)));
+    Optimizer optimizer(Optimizer::Options{ false });
+    NodePtr opt = optimizer.optimize(ast);
+    EXPECT_EQ(optimizer.stats().merged, 0U);
+    EXPECT_FALSE(opt.as<DagRoot>());
+}
+
+TEST(Optimizer, InputTreeUnchanged) {
+    Calculator calc;
+    NodePtr ast = calc.parse("(1+2)*x");
+    Optimizer::run(ast);
+    auto binop = ast.as<BinaryOp>();
+    ASSERT_TRUE(binop);
+    EXPECT_TRUE(binop->left.as<Parenthesis>());
+}
+
+// ===== ParseCache.h =====
+
+TEST(ParseCache, HitReturnsSameEntry) {
+    Calculator calc;
+    ParseCache cache(calc, 4);
+    auto first = cache.get("2+3*4");
+    ASSERT_TRUE(first);
+    auto second = cache.get(std::string("2+3*4"));
+    EXPECT_EQ(first.get(), second.get());
+    EXPECT_DOUBLE_EQ(second->calc(), 14.0);
+    EXPECT_EQ(cache.stats().hits, 1U);
+    EXPECT_EQ(cache.stats().misses, 1U);
+    EXPECT_EQ(cache.stats().evictions, 0U);
+}
+
+TEST(ParseCache, EvictsLeastRecentlyUsed) {
+    Calculator calc;
+    ParseCache cache(calc, 2);
+    cache.get("1");
+    cache.get("2");
+    cache.get("1");  // "2" is now the least recently used
+    cache.get("3");
+    EXPECT_EQ(cache.size(), 2U);
+    EXPECT_EQ(cache.stats().evictions, 1U);
+    EXPECT_TRUE(cache.peek("1"));
+    EXPECT_FALSE(cache.peek("2"));
+    EXPECT_TRUE(cache.peek("3"));
+}
+
+TEST(ParseCache, EvictedEntryStaysUsable) {
+    Calculator calc;
+    ParseCache cache(calc, 1);
+    auto held = cache.get("x*2");
+    cache.get("5");
+    EXPECT_FALSE(cache.peek("x*2"));
+    calc._variable_map["x"]->value = 4.0;
+    EXPECT_DOUBLE_EQ(held->calc(), 8.0);
+}
+
+TEST(ParseCache, CompileOnInsert) {
+    Calculator calc;
+    ParseCache cache(calc, 8, true);
+    auto entry = cache.get("(x+1)*x");
+    ASSERT_TRUE(entry);
+    ASSERT_TRUE(entry->program);
+    calc._variable_map["x"]->value = 3.0;
+    EXPECT_DOUBLE_EQ(entry->calc(), 12.0);
+}
+
+TEST(ParseCache, FailedParseNotCached) {
+    Calculator calc;
+    ParseCache cache(calc, 8);
+    EXPECT_FALSE(cache.get(""));
+    EXPECT_FALSE(cache.get(""));
+    EXPECT_EQ(cache.size(), 0U);
+    EXPECT_EQ(cache.stats().misses, 2U);
+}
+
+// ===== PrecedenceParser.h =====
+
+TEST(PrecedenceParser, MatchesRotatingParser) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    for (const char* text : { "42", "2+3", "2+3*4", "2*3+4", "(2+3)*4", "((2+3))*4", "10/4", "-5+10",
+             "3.14", "0.5+0.5", "1/0", "2*3*4+5", "1+2*3+4*5" }) {
+        auto expected = calc.parse(text);
+        auto actual = parser.parse(text);
+        ASSERT_TRUE(actual) << text;
+        EXPECT_DOUBLE_EQ(actual->calc(), expected->calc()) << text;
+    }
+}
+
+TEST(PrecedenceParser, LeftAssociative) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    EXPECT_DOUBLE_EQ(parser.parse("10-2+3")->calc(), 11.0);
+    EXPECT_DOUBLE_EQ(parser.parse("2-3-4")->calc(), -5.0);
+    EXPECT_DOUBLE_EQ(parser.parse("64/4/2")->calc(), 8.0);
+    EXPECT_DOUBLE_EQ(parser.parse("1+2*3-4/2")->calc(), 5.0);
+}
+
+TEST(PrecedenceParser, VariablesAreInterned) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto ast = parser.parse(" x * ( y + 1 ) ");
+    ASSERT_TRUE(ast);
+    calc._variable_map["x"]->value = 2.0;
+    calc._variable_map["y"]->value = 3.0;
+    EXPECT_DOUBLE_EQ(ast->calc(), 8.0);
+    EXPECT_EQ(calc.parse("x")->calc(), 2.0);
+}
+
+TEST(PrecedenceParser, UnaryOperators) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    calc.internVariable("x")->value = 3.0;
+    EXPECT_DOUBLE_EQ(parser.parse("-x*2")->calc(), -6.0);
+    EXPECT_DOUBLE_EQ(parser.parse("2*-x")->calc(), -6.0);
+    EXPECT_DOUBLE_EQ(parser.parse("--x")->calc(), 3.0);
+    EXPECT_DOUBLE_EQ(parser.parse("-(1+x)")->calc(), -4.0);
+    EXPECT_TRUE(parser.parse("-5").as<Constant>());
+}
+
+TEST(PrecedenceParser, FunctionCalls) {
+    Calculator calc;
+    auto max2 = [](double lhs, double rhs) -> double { return lhs > rhs ? lhs : rhs; };
+    auto zero = []() -> double { return 0.0; };
+    calc._function_map["max"] = Function{ "max", 2, toFnPtr(+max2) };
+    calc._function_map["zero"] = Function{ "zero", 0, toFnPtr(+zero) };
+    PrecedenceParser parser(calc);
+    EXPECT_NEAR(parser.parse("log(1)+2")->calc(), 2.0, 1e-12);
+    EXPECT_DOUBLE_EQ(parser.parse("max(1+2, 2*2)*2")->calc(), 8.0);
+    EXPECT_DOUBLE_EQ(parser.parse("max(max(1,5),(3))")->calc(), 5.0);
+    EXPECT_DOUBLE_EQ(parser.parse("zero()+1")->calc(), 1.0);
+    EXPECT_FALSE(parser.parse("max(1)"));     // wrong arity
+    EXPECT_FALSE(parser.parse("nosuch(1)"));  // unknown function
+}
+
+TEST(PrecedenceParser, SyntaxErrors) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    EXPECT_FALSE(parser.parse(""));
+    EXPECT_FALSE(parser.parse("2+"));
+    EXPECT_FALSE(parser.parse("(2+3"));
+    EXPECT_FALSE(parser.parse("*3"));
+}
+
+TEST(PrecedenceParser, StopsAtTrailingInput) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto ast = parser.parse("2+3)");
+    ASSERT_TRUE(ast);
+    EXPECT_DOUBLE_EQ(ast->calc(), 5.0);
+    EXPECT_EQ(*calc.it, ')');
+}
+
+TEST(PrecedenceParser, ParseAllRejectsTrailingInput) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    EXPECT_FALSE(parser.parseAll("2+3)"));
+    EXPECT_FALSE(parser.parseAll("2+"));
+    auto ast = parser.parseAll(" 2+3 ");
+    ASSERT_TRUE(ast);
+    EXPECT_DOUBLE_EQ(ast->calc(), 5.0);
+    Arena arena;
+    EXPECT_FALSE(parser.parseAll("2 3", arena));
+    EXPECT_TRUE(parser.parseAll("2*3", arena));
+}
+
+TEST(PrecedenceParser, LongChainsAndDeepNesting) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    std::string chain = "1";
+    for (int j = 0; j < 10000; ++j) {
+        chain += "+1";
+    }
+    auto sum = parser.parse(chain);
+    ASSERT_TRUE(sum);
+    EXPECT_DOUBLE_EQ(sum->calc(), 10001.0);
+
+    std::string nested = std::string(2000, '(') + "7" + std::string(2000, ')');
+    auto deep = parser.parse(nested);
+    ASSERT_TRUE(deep);
+    EXPECT_DOUBLE_EQ(deep->calc(), 7.0);
+}
+
+TEST(PrecedenceParser, ArenaMode) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    Arena arena;
+    auto ast = parser.parse("(1+2)*3", arena);
+    ASSERT_TRUE(ast);
+    EXPECT_TRUE(ast->_arena);
+    EXPECT_DOUBLE_EQ(ast->calc(), 9.0);
+}
+
+// ===== Profiler.h =====
+
+namespace {
+
+// Parses text with PrecedenceParser, recording source spans into spans.
+NodePtr parseWithSpans(Calculator& calc, const std::string& text, SourceSpans& spans) {
+    calc._spans = &spans;
+    NodePtr ast = PrecedenceParser(calc).parse(text);
+    calc._spans = nullptr;
+    return ast;
+}
+
+// Source text of the span recorded for node.
+std::string spanText(const std::string& text, const std::optional<SourceSpan>& span) {
+    return span ? text.substr(span->begin, span->end - span->begin) : std::string();
+}
+
+}  // namespace
+
+TEST(Profiler, RecordsSourceSpans) {
+    Calculator calc;
+    SourceSpans spans;
+    std::string text = "-x * (y + 2) - max(x, 3)";
+    NodePtr ast = parseWithSpans(calc, text, spans);
+    ASSERT_TRUE(ast);
+    auto sub = ast.as<BinaryOp>();
+    ASSERT_TRUE(sub);
+    EXPECT_EQ(spanText(text, spans.at(sub.get())), text);
+    auto mul = sub->left.as<BinaryOp>();
+    ASSERT_TRUE(mul);
+    EXPECT_EQ(spanText(text, spans.at(mul.get())), "-x * (y + 2)");
+    EXPECT_EQ(spanText(text, spans.at(mul->left.get())), "-x");
+    EXPECT_EQ(spanText(text, spans.at(mul->right.get())), "(y + 2)");
+    EXPECT_EQ(spanText(text, spans.at(sub->right.get())), "max(x, 3)");
+}
+
+TEST(Profiler, CountsEvaluations) {
+    Calculator calc;
+    SourceSpans spans;
+    std::string text = "x*y + sqrt(x)";
+    NodePtr ast = parseWithSpans(calc, text, spans);
+    ASSERT_TRUE(ast);
+    calc._variable_map["x"]->value = 4.0;
+    calc._variable_map["y"]->value = 3.0;
+    Profiler profiler;
+    profiler.attach(ast, &spans);
+    for (int k = 0; k < 5; ++k) {
+        EXPECT_DOUBLE_EQ(ast->calc(), 14.0);
+    }
+    std::vector<Profiler::Entry> entries = profiler.entries();
+    ASSERT_EQ(entries.size(), 3U);
+    std::vector<std::string> texts;
+    for (const Profiler::Entry& entry : entries) {
+        EXPECT_EQ(entry.count, 5U);
+        EXPECT_LE(entry.self, entry.cycles);
+        texts.push_back(spanText(text, entry.span));
+    }
+    std::sort(texts.begin(), texts.end());
+    EXPECT_EQ(texts, (std::vector<std::string>{ "sqrt(x)", "x*y", "x*y + sqrt(x)" }));
+    profiler.reset();
+    for (const Profiler::Entry& entry : profiler.entries()) {
+        EXPECT_EQ(entry.count, 0U);
+    }
+}
+
+TEST(Profiler, DetachRestoresTree) {
+    Calculator calc;
+    NodePtr ast = calc.parse("(1+2)*3-4");
+    Node* original = ast.get();
+    {
+        Profiler profiler;
+        profiler.attach(ast);
+        EXPECT_NE(ast.get(), original);
+        EXPECT_DOUBLE_EQ(ast->calc(), 5.0);
+    }
+    EXPECT_EQ(ast.get(), original);
+    Profiler profiler;
+    profiler.attach(ast);
+    profiler.detach();
+    EXPECT_EQ(ast.get(), original);
+    EXPECT_TRUE(profiler.entries().empty());
+    EXPECT_DOUBLE_EQ(ast->calc(), 5.0);
+}
+
+TEST(Profiler, DetachAfterTreeEdit) {
+    Calculator calc;
+    NodePtr ast = calc.parse("(x+1)*2");
+    auto mul = ast.as<BinaryOp>();
+    ASSERT_TRUE(mul);
+    ASSERT_EQ(mul->left->kind, NodeKind::Parenthesis);
+    Profiler profiler;
+    profiler.attach(ast);
+    // The parenthesis holds a wrapped slot; the profiler keeps it alive.
+    mul->left = NodePtr(new Constant(3.0));
+    profiler.detach();
+    EXPECT_EQ(ast.get(), mul.get());
+    EXPECT_DOUBLE_EQ(ast->calc(), 6.0);
+}
+
+TEST(Profiler, SharedSubtreesCountedPerUse) {
+    Calculator calc;
+    NodePtr dag = Optimizer::run(calc.parse("(x+1)*(x+1)"));
+    calc._variable_map["x"]->value = 2.0;
+    Profiler profiler;
+    profiler.attach(dag);
+    EXPECT_DOUBLE_EQ(dag->calc(), 9.0);
+    std::vector<Profiler::Entry> entries = profiler.entries();
+    ASSERT_EQ(entries.size(), 2U);
+    // The shared x+1 is one entry reached through both operands; Shared
+    // caches its value, so it is evaluated once.
+    for (const Profiler::Entry& entry : entries) {
+        EXPECT_FALSE(entry.span);
+        EXPECT_EQ(entry.count, 1U);
+    }
+    profiler.detach();
+    EXPECT_DOUBLE_EQ(dag->calc(), 9.0);
+}
+
+TEST(Profiler, ReportsHotNodes) {
+    Calculator calc;
+    SourceSpans spans;
+    std::string text = "x*2 + 1";
+    NodePtr ast = parseWithSpans(calc, text, spans);
+    Profiler profiler;
+    profiler.attach(ast, &spans);
+    ast->calc();
+    char buffer[1024] = {};
+    FILE* out = fmemopen(buffer, sizeof(buffer) - 1, "w");
+    ASSERT_NE(out, nullptr);
+    profiler.report(out, text);
+    (void)fclose(out);
+    std::string report = buffer;
+    EXPECT_NE(report.find("Profile: 1 evaluations"), std::string::npos) << report;
+    EXPECT_NE(report.find("x*2 [0,3)"), std::string::npos) << report;
+    EXPECT_NE(report.find("x*2 + 1 [0,7)"), std::string::npos) << report;
+}
+
+TEST(Profiler, ReportsIntrinsicNamesWithoutSpans) {
+    Calculator calc;
+    NodePtr ast = PrecedenceParser(calc).parse("sqrt(x)");
+    ASSERT_TRUE(ast);
+    Profiler profiler;
+    profiler.attach(ast);
+    ast->calc();
+    char buffer[1024] = {};
+    FILE* out = fmemopen(buffer, sizeof(buffer) - 1, "w");
+    ASSERT_NE(out, nullptr);
+    profiler.report(out, "sqrt(x)");
+    (void)fclose(out);
+    std::string report = buffer;
+    EXPECT_NE(report.find("  sqrt\n"), std::string::npos) << report;
+    EXPECT_EQ(report.find("FunctionCall"), std::string::npos) << report;
+}
+
+// ===== Protocol.h =====
+
+TEST(Protocol, ParsesDescription) {
+    auto formulas = parseDescription("area r\nk\nhyp a b\n");
+    ASSERT_TRUE(formulas);
+    ASSERT_EQ(formulas->size(), 3U);
+    EXPECT_EQ((*formulas)[0].name, "area");
+    EXPECT_EQ((*formulas)[0].variables, std::vector<std::string>{ "r" });
+    EXPECT_TRUE((*formulas)[1].variables.empty());
+    EXPECT_EQ((*formulas)[2].variables, (std::vector<std::string>{ "a", "b" }));
+    EXPECT_TRUE(parseDescription("")->empty());
+    EXPECT_FALSE(parseDescription("area r"));
+    EXPECT_FALSE(parseDescription("area  r\n"));
+    EXPECT_FALSE(parseDescription("\n"));
+}
+
+TEST(Protocol, FramePadding) {
+    EXPECT_EQ(framePadding(0), 0U);
+    EXPECT_EQ(framePadding(1), 7U);
+    EXPECT_EQ(framePadding(8), 0U);
+    EXPECT_EQ(framePadding(13), 3U);
+}
+
+// ===== Scan.h =====
+
+namespace {
+
+// Per-byte reference for scanRun().
+template <typename Runs>
+size_t scalarRun(const std::string& text, size_t first) {
+    while (first < text.size() && inRuns<Runs>(text[first])) {
+        ++first;
+    }
+    return first;
+}
+
+}  // namespace
+
+TEST(Scan, RunEndsAtEveryLength) {
+    // Runs of every length up to several vectors, ending at a stop byte or
+    // at the end of the buffer.
+    for (size_t length = 0; length <= 100; ++length) {
+        std::string text(length, '7');
+        const char* end = scanRun<DigitRuns>(text.data(), text.data() + text.size());
+        EXPECT_EQ(end, text.data() + length);
+        text += '+';
+        end = scanRun<DigitRuns>(text.data(), text.data() + text.size());
+        EXPECT_EQ(end, text.data() + length);
+    }
+}
+
+TEST(Scan, MatchesScalarScan) {
+    std::mt19937 rng(3);
+    std::string alphabet = " \t\n\r\v\f09azAZ_+-*/()., \x80\xFF\x1F@[`{";
+    std::uniform_int_distribution<size_t> pick(0, alphabet.size() - 1);
+    std::string text;
+    for (int k = 0; k < 4000; ++k) {
+        // Mix long runs with noise so that runs cross vector boundaries.
+        char chr = alphabet[pick(rng)];
+        text.append(k % 7 == 0 ? 40 : 1, chr);
+    }
+    for (size_t first = 0; first <= text.size(); ++first) {
+        const char* begin = text.data() + first;
+        const char* end = text.data() + text.size();
+        EXPECT_EQ(scanRun<SpaceRuns>(begin, end) - text.data(), scalarRun<SpaceRuns>(text, first));
+        EXPECT_EQ(scanRun<DigitRuns>(begin, end) - text.data(), scalarRun<DigitRuns>(text, first));
+        EXPECT_EQ(scanRun<IdentifierRuns>(begin, end) - text.data(), scalarRun<IdentifierRuns>(text, first));
+    }
+}
+
+TEST(Scan, RangeEdges) {
+    // Bytes just outside each range, including '/' and ':' around the digits
+    // and the bytes that wrap around in the subtract.
+    for (char stop : { '/', ':', '@', '[', '`', '{', '\x08', '\x0E', '\x1F', '!', '\x80', '\xFF', '\0' }) {
+        std::string text = std::string(40, 'a') + stop;
+        EXPECT_EQ(scanRun<IdentifierRuns>(text.data(), text.data() + text.size()), text.data() + 40) << int(stop);
+        text = std::string(40, '5') + stop;
+        EXPECT_EQ(scanRun<DigitRuns>(text.data(), text.data() + text.size()), text.data() + 40) << int(stop);
+        text = std::string(40, '\t') + stop;
+        EXPECT_EQ(scanRun<SpaceRuns>(text.data(), text.data() + text.size()), text.data() + 40) << int(stop);
+    }
+}
+
+TEST(Scan, LexerSkipsLongRuns) {
+    std::string text = std::string(70, ' ') + std::string(50, 'v') + "9*" + std::string(33, '3') + "+";
+    Lexer lexer;
+    lexer.reset(text);
+    EXPECT_TRUE(lexer.skip(Interpreter::isspace()));
+    EXPECT_EQ(lexer.it - lexer.code.begin(), 70);
+    EXPECT_TRUE(lexer.skip(isidentifier()));
+    EXPECT_EQ(lexer.it - lexer.code.begin(), 121);
+    EXPECT_TRUE(lexer.test(ischar('*')));
+    EXPECT_TRUE(lexer.skip(Interpreter::isdigit()));
+    EXPECT_EQ(*lexer.it, '+');
+    EXPECT_FALSE(lexer.skip(Interpreter::isdigit()));
+}
+
+// ===== Server.h =====
+
+namespace {
+
+// Socket path unique to this process.
+std::string serverPath(const char* name) {
+    return "/tmp/calculator_test_" + std::to_string(getpid()) + "_" + name + ".sock";
+}
+
+FormulaCatalog testFormulas() {
+    FormulaCatalog formulas;
+    EXPECT_EQ(formulas.load("# comment\n\npoly = x*x - 2*y\r\nhyp=sqrt(a*a+b*b)\nk=1+2\n"), 0U);
+    return formulas;
+}
+
+}  // namespace
+
+TEST(Server, FormulaCatalogLoad) {
+    FormulaCatalog formulas = testFormulas();
+    ASSERT_EQ(formulas.size(), 3U);
+    EXPECT_EQ(formulas.name(0), "poly");
+    EXPECT_EQ(formulas.find("hyp"), 1U);
+    EXPECT_FALSE(formulas.find("x"));
+    EXPECT_EQ(formulas.describe(), "poly x y\nhyp a b\nk\n");
+    EXPECT_FALSE(formulas.add("poly", "x"));    // taken
+    EXPECT_FALSE(formulas.add("bad name", "x"));
+    EXPECT_FALSE(formulas.add("bad", "x+"));
+    EXPECT_FALSE(formulas.add("bad", "x y"));
+    EXPECT_EQ(formulas.load("ok=x\nnoequals\nlater=y\n"), 2U);
+    EXPECT_TRUE(formulas.find("ok"));
+    EXPECT_FALSE(formulas.find("later"));
+}
+
+TEST(Server, AnswersPipelinedRequests) {
+    std::string path = serverPath("pipelined");
+    auto server = Server::listen(testFormulas(), path.c_str(), Server::Options{ 2, false });
+    ASSERT_TRUE(server) << strerror(errno);
+    auto client = ServerClient::connect(path.c_str());
+    ASSERT_TRUE(client) << strerror(errno);
+
+    // Batches of 1 row (interpreter), 3 rows and more than a block (Batch.h).
+    std::vector<uint32_t> sizes = { 1, 3, 300, 1, 0 };
+    std::vector<std::vector<double>> inputs;
+    client->describe(100);
+    for (size_t j = 0; j < sizes.size(); ++j) {
+        std::vector<double> columns(2 * sizes[j]);
+        for (size_t k = 0; k < columns.size(); ++k) {
+            columns[k] = static_cast<double>(k) * 0.5 - static_cast<double>(j);
+        }
+        client->evaluate(j, static_cast<uint32_t>(j % 2), sizes[j], columns.data(), columns.size());
+        inputs.push_back(std::move(columns));
+    }
+    client->evaluate(99, 2, 2, nullptr, 0);
+    ASSERT_TRUE(client->flush());
+
+    Response response;
+    ASSERT_TRUE(client->receive(response));
+    EXPECT_EQ(response.header.tag, 100U);
+    EXPECT_EQ(response.header.rows, 3U);
+    EXPECT_EQ(response.text, "poly x y\nhyp a b\nk\n");
+    for (size_t j = 0; j < sizes.size(); ++j) {
+        ASSERT_TRUE(client->receive(response));
+        EXPECT_EQ(response.header.tag, j);
+        EXPECT_EQ(response.status(), ResponseStatus::Ok);
+        ASSERT_EQ(response.values.size(), sizes[j]);
+        const std::vector<double>& columns = inputs[j];
+        for (size_t row = 0; row < sizes[j]; ++row) {
+            double first = columns[row];
+            double second = columns[sizes[j] + row];
+            double expected = j % 2 == 0 ? first * first - 2 * second : std::sqrt(first * first + second * second);
+            EXPECT_DOUBLE_EQ(response.values[row], expected) << j << " " << row;
+        }
+    }
+    ASSERT_TRUE(client->receive(response));
+    EXPECT_EQ(response.header.tag, 99U);
+    EXPECT_EQ(response.values, (std::vector<double>{ 3.0, 3.0 }));
+
+    ServerStats stats = server->stats();
+    EXPECT_EQ(stats.requests, sizes.size() + 2);
+    EXPECT_EQ(stats.rows, 305U + 2U);
+    EXPECT_EQ(stats.errors, 0U);
+}
+
+TEST(Server, ErrorsKeepTheConnection) {
+    std::string path = serverPath("errors");
+    auto server = Server::listen(testFormulas(), path.c_str(), Server::Options{ 1, false });
+    ASSERT_TRUE(server);
+    auto client = ServerClient::connect(path.c_str());
+    ASSERT_TRUE(client);
+    double values[3] = { 1, 2, 3 };
+    client->evaluate(1, 7, 1, values, 2);                               // no formula 7
+    client->evaluate(2, 0, 1, values, 3);                               // poly has 2 slots
+    client->queue(static_cast<RequestType>(9), 3, 0, 0, nullptr, 0);  // unknown type
+    client->evaluate(4, 0, 1, values, 2);
+    ASSERT_TRUE(client->flush());
+
+    Response response;
+    std::vector<ResponseStatus> expected = { ResponseStatus::UnknownFormula, ResponseStatus::BadSize,
+        ResponseStatus::UnknownType, ResponseStatus::Ok };
+    for (size_t j = 0; j < expected.size(); ++j) {
+        ASSERT_TRUE(client->receive(response));
+        EXPECT_EQ(response.header.tag, j + 1);
+        EXPECT_EQ(response.status(), expected[j]);
+    }
+    EXPECT_EQ(response.values, std::vector<double>{ -3.0 });
+    EXPECT_EQ(server->stats().errors, 3U);
+
+    // A formula without variables takes an empty payload for any row count,
+    // but its results must still fit in a frame.
+    client->evaluate(5, 2, UINT32_MAX, nullptr, 0);
+    client->evaluate(6, 2, static_cast<uint32_t>(kMaxFrameBytes / sizeof(double) + 1), nullptr, 0);
+    client->evaluate(7, 2, 3, nullptr, 0);
+    ASSERT_TRUE(client->flush());
+    for (ResponseStatus status : { ResponseStatus::BadSize, ResponseStatus::BadSize, ResponseStatus::Ok }) {
+        ASSERT_TRUE(client->receive(response));
+        EXPECT_EQ(response.status(), status) << response.header.tag;
+    }
+    EXPECT_EQ(response.values, (std::vector<double>{ 3.0, 3.0, 3.0 }));
+
+    // A header announcing more than kMaxFrameBytes closes the connection.
+    sockaddr_un addr;
+    ASSERT_TRUE(unixAddress(path.c_str(), addr));
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)), 0);
+    RequestHeader header{};
+    header.size = static_cast<uint32_t>(kMaxFrameBytes + kFrameAlignment);
+    header.type = static_cast<uint16_t>(RequestType::Evaluate);
+    EXPECT_EQ(::send(fd, &header, sizeof(header), 0), static_cast<ssize_t>(sizeof(header)));
+    char byte;
+    EXPECT_EQ(::recv(fd, &byte, 1, 0), 0);
+    ::close(fd);
+}
+
+TEST(Server, ManyConnectionsAcrossWorkers) {
+    std::string path = serverPath("connections");
+    auto server = Server::listen(testFormulas(), path.c_str(), Server::Options{ 3, false });
+    ASSERT_TRUE(server);
+    std::vector<std::thread> threads;
+    std::atomic<int> failures{ 0 };
+    for (int t = 0; t < 6; ++t) {
+        threads.emplace_back([&path, &failures, t] {
+            auto client = ServerClient::connect(path.c_str());
+            if (!client) {
+                ++failures;
+                return;
+            }
+            Response response;
+            for (int k = 0; k < 200; ++k) {
+                double values[2] = { static_cast<double>(t), static_cast<double>(k) };
+                client->evaluate(static_cast<uint64_t>(k), 1, 1, values, 2);
+                if (k % 10 == 9) {
+                    if (!client->flush()) {
+                        ++failures;
+                        return;
+                    }
+                    for (int j = k - 9; j <= k; ++j) {
+                        if (!client->receive(response) || response.header.tag != static_cast<uint64_t>(j)
+                            || response.values.size() != 1 || response.values[0] != std::hypot(t, j)) {
+                            ++failures;
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(server->stats().requests, 1200U);
+    EXPECT_EQ(server->stats().connections, 6U);
+}
+
+TEST(Server, StopClosesEveryConnection) {
+    // Open descriptors of this process (the listing's own included).
+    auto descriptors = [] {
+        auto entries = std::filesystem::directory_iterator("/proc/self/fd");
+        return std::distance(begin(entries), end(entries));
+    };
+    auto before = descriptors();
+    std::string path = serverPath("stop");
+    for (int round = 0; round < 5; ++round) {
+        auto server = Server::listen(testFormulas(), path.c_str(), Server::Options{ 4, false });
+        ASSERT_TRUE(server);
+        // Some connections are still waiting for their worker's first
+        // event when the server stops.
+        std::vector<ServerClient> clients;
+        for (int j = 0; j < 32; ++j) {
+            auto client = ServerClient::connect(path.c_str());
+            ASSERT_TRUE(client);
+            clients.push_back(std::move(*client));
+        }
+        server->stop();
+    }
+    EXPECT_EQ(descriptors(), before);
+}
+
+TEST(Server, ReplacesStaleSocketOnly) {
+    std::string path = serverPath("stale");
+    {
+        auto first = Server::listen(testFormulas(), path.c_str(), Server::Options{ 1, false });
+        ASSERT_TRUE(first);
+        auto second = Server::listen(testFormulas(), path.c_str(), Server::Options{ 1, false });
+        ASSERT_TRUE(second);
+    }
+    FILE* file = fopen(path.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    fclose(file);
+    EXPECT_FALSE(Server::listen(testFormulas(), path.c_str()));
+    unlink(path.c_str());
+    EXPECT_FALSE(ServerClient::connect(path.c_str()));
+}
+
+// ===== StaticExpression.h =====
+
+namespace {
+
+struct StaticHypot {
+    static constexpr std::string_view text = "sqrt(x*x + y*y)";
+};
+struct StaticMixed {
+    static constexpr std::string_view text = " 10 - 2 + 3*-x / (y - -2.5e-3) - -(max(x, 1.5) + pow(y, 2)) ";
+};
+struct StaticConstant {
+    static constexpr std::string_view text = "2*3.25";
+};
+
+struct StaticPoint {
+    double y;
+    double x;
+};
+
+// Evaluates text with PrecedenceParser after binding x and y.
+double runtimeValue(Calculator& calc, std::string_view text, double xval, double yval) {
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(text);
+    EXPECT_TRUE(ast) << text;
+    calc._variable_map["x"]->value = xval;
+    calc._variable_map["y"]->value = yval;
+    return ast->calc();
+}
+
+}  // namespace
+
+// Parsing happens entirely at compile time.
+static_assert(StaticParser::parse("1 + 2*x").valid());
+static_assert(StaticParser::parse("1 + 2*x").size == 5);
+static_assert(StaticParser::parse("a + b*a").num_variables == 2);
+static_assert(*StaticParser::parse("a + b*a").slot("b") == 1);
+static_assert(!StaticParser::parse("a + b").slot("c"));
+static_assert(StaticExpression<StaticHypot>::slot("y") == 1U);
+static_assert(StaticExpression<StaticHypot>::variable(0) == "x");
+
+TEST(StaticExpression, RejectsInvalidText) {
+    constexpr StaticProgram dangling = StaticParser::parse("1 +");
+    EXPECT_FALSE(dangling.valid());
+    EXPECT_EQ(dangling.error_offset, 3U);
+    constexpr StaticProgram unclosed = StaticParser::parse("(1 + 2");
+    EXPECT_FALSE(unclosed.valid());
+    constexpr StaticProgram trailing = StaticParser::parse("1 + 2 x");
+    EXPECT_FALSE(trailing.valid());
+    constexpr StaticProgram unknown = StaticParser::parse("scale(x)");
+    EXPECT_FALSE(unknown.valid());
+    constexpr StaticProgram arity = StaticParser::parse("pow(x)");
+    EXPECT_FALSE(arity.valid());
+    constexpr StaticProgram inexact = StaticParser::parse("0.12345678901234567891");
+    EXPECT_FALSE(inexact.valid());
+    EXPECT_TRUE(StaticParser::parse("1e22 + 5e-22 + 0.000").valid());
+}
+
+TEST(StaticExpression, MatchesRuntimeParser) {
+    Calculator calc;
+    using Hypot = StaticExpression<StaticHypot>;
+    using Mixed = StaticExpression<StaticMixed>;
+    for (double xval : { -3.0, 0.0, 0.1, 2.0, 1e10 }) {
+        for (double yval : { -2.5e-3, 0.7, 4.0 }) {
+            std::array<double, 2> slots = { xval, yval };
+            EXPECT_EQ(Hypot::eval(slots), runtimeValue(calc, StaticHypot::text, xval, yval));
+            double expected = runtimeValue(calc, StaticMixed::text, xval, yval);
+            double actual = Mixed::eval(slots);
+            EXPECT_TRUE(actual == expected || (std::isnan(actual) && std::isnan(expected)))
+                << xval << " " << yval << ": " << actual << " vs " << expected;
+        }
+    }
+    EXPECT_EQ(StaticExpression<StaticConstant>::eval(static_cast<const double*>(nullptr)), 6.5);
+}
+
+TEST(StaticExpression, BindsMembersAndColumns) {
+    using Hypot = StaticExpression<StaticHypot>;
+    StaticPoint point{ 4.0, 3.0 };
+    EXPECT_DOUBLE_EQ((Hypot::evalMembers<&StaticPoint::x, &StaticPoint::y>(point)), 5.0);
+    std::vector<double> xs = { 3.0, 5.0, 8.0 };
+    std::vector<double> ys = { 4.0, 12.0, 15.0 };
+    const double* columns[] = { xs.data(), ys.data() };
+    std::vector<double> out(3);
+    Hypot::evaluate(columns, out.size(), out.data());
+    EXPECT_EQ(out, (std::vector<double>{ 5.0, 13.0, 17.0 }));
+}
+
+// ===== Symbols.h =====
+
+TEST(Symbols, DenseIdsInInsertionOrder) {
+    SymbolMap<int> map;
+    EXPECT_EQ(map.intern("x"), 0U);
+    EXPECT_EQ(map.intern("a_rather_long_variable_name"), 1U);
+    EXPECT_EQ(map.intern("x"), 0U);
+    map["y"] = 7;
+    EXPECT_EQ(map.id("y"), std::optional<uint32_t>(2));
+    EXPECT_EQ(map.name(1), "a_rather_long_variable_name");
+    EXPECT_EQ(map.at(2), 7);
+    ASSERT_EQ(map.size(), 3U);
+    std::vector<std::string> names;
+    for (const auto& entry : map) {
+        names.push_back(entry.first);
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{ "x", "a_rather_long_variable_name", "y" }));
+}
+
+TEST(Symbols, FindDoesNotIntern) {
+    SymbolMap<int> map;
+    EXPECT_EQ(map.find("x"), nullptr);
+    map["x"] = 1;
+    EXPECT_EQ(map.find("y"), nullptr);
+    EXPECT_FALSE(map.id("y"));
+    EXPECT_EQ(map.size(), 1U);
+    ASSERT_NE(map.find("x"), nullptr);
+    EXPECT_EQ(*map.find("x"), 1);
+}
+
+TEST(Symbols, SurvivesRehash) {
+    SymbolMap<size_t> map;
+    for (size_t j = 0; j < 1000; ++j) {
+        map["v" + std::to_string(j)] = j;
+    }
+    ASSERT_EQ(map.size(), 1000U);
+    for (size_t j = 0; j < 1000; ++j) {
+        std::string name = "v" + std::to_string(j);
+        EXPECT_EQ(map.id(name), std::optional<uint32_t>(static_cast<uint32_t>(j)));
+        EXPECT_EQ(map.at(static_cast<uint32_t>(j)), j);
+    }
+}
+
+TEST(Symbols, CalculatorInternsVariables) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto ast = parser.parse("alpha*beta+alpha");
+    ASSERT_TRUE(ast);
+    EXPECT_EQ(calc._variable_map.size(), 2U);
+    EXPECT_EQ(calc._variable_map.id("alpha"), std::optional<uint32_t>(0));
+    EXPECT_EQ(calc.internVariable("alpha"), calc._variable_map.at(0));
+    ASSERT_NE(calc.findFunction("max"), nullptr);
+    EXPECT_EQ(calc.findFunction("max")->intrinsic, Intrinsic::Max);
+    EXPECT_EQ(calc.findFunction("nope"), nullptr);
+}
+
+// ===== Window.h =====
+
+namespace {
+
+// The aggregate of the last length values of history, recomputed.
+double windowByScan(WindowOp op, const std::vector<double>& history, size_t length) {
+    size_t first = history.size() > length ? history.size() - length : 0;
+    auto begin = history.begin() + static_cast<std::ptrdiff_t>(first);
+    auto count = static_cast<double>(history.end() - begin);
+    double sum = 0;
+    for (auto it = begin; it != history.end(); ++it) {
+        sum += *it;
+    }
+    switch (op) {
+        case WindowOp::Sum: return sum;
+        case WindowOp::Mean: return sum / count;
+        case WindowOp::Min:
+        case WindowOp::Max: {
+            if (std::any_of(begin, history.end(), [](double value) { return std::isnan(value); })) {
+                return std::nan("");
+            }
+            return op == WindowOp::Min ? *std::min_element(begin, history.end()) : *std::max_element(begin, history.end());
+        }
+        case WindowOp::Stddev: {
+            double squares = 0;
+            for (auto it = begin; it != history.end(); ++it) {
+                squares += (*it - sum / count) * (*it - sum / count);
+            }
+            return std::sqrt(squares / count);
+        }
+        case WindowOp::None: break;
+    }
+    return 0.0;
+}
+
+}  // namespace
+
+TEST(Window, FindsNames) {
+    EXPECT_EQ(findWindow("msum"), WindowOp::Sum);
+    EXPECT_EQ(findWindow("mmean"), WindowOp::Mean);
+    EXPECT_EQ(findWindow("mmin"), WindowOp::Min);
+    EXPECT_EQ(findWindow("mmax"), WindowOp::Max);
+    EXPECT_EQ(findWindow("mstd"), WindowOp::Stddev);
+    EXPECT_EQ(findWindow("sum"), WindowOp::None);
+}
+
+TEST(Window, MatchesRecomputation) {
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> dist(-1000.0, 1000.0);
+    for (WindowOp op : { WindowOp::Sum, WindowOp::Mean, WindowOp::Min, WindowOp::Max, WindowOp::Stddev }) {
+        for (size_t length : { 1, 2, 5, 64, 100 }) {
+            RollingWindow window(op, length);
+            std::vector<double> history;
+            for (int j = 0; j < 1000; ++j) {
+                // Runs of repeats exercise ties in the min/max queues, and
+                // the odd infinity or NaN has to leave no trace once it has
+                // left the window.
+                double value = j % 7 < 3 ? std::round(dist(rng) / 100) : dist(rng);
+                if (j % 97 == 50 || j % 151 == 50) {
+                    value = j % 97 == 50 ? HUGE_VAL : -HUGE_VAL;
+                } else if (j % 211 == 70) {
+                    value = std::nan("");
+                }
+                history.push_back(value);
+                double expected = windowByScan(op, history, length);
+                double actual = window.push(value);
+                if (!std::isfinite(expected)) {
+                    if (std::isnan(expected)) {
+                        EXPECT_TRUE(std::isnan(actual)) << actual << " sample " << j;
+                    } else {
+                        EXPECT_EQ(actual, expected) << "sample " << j;
+                    }
+                    continue;
+                }
+                if (op == WindowOp::Stddev) {
+                    // Near zero the square root magnifies rounding errors of
+                    // the variance, which are relative to the samples' scale.
+                    actual *= actual;
+                    expected *= expected;
+                }
+                EXPECT_NEAR(actual, expected, 1e-9 * (1000 + std::fabs(expected)))
+                    << kWindowNames[static_cast<size_t>(op) - 1] << " length " << length << " sample " << j;
+            }
+        }
+    }
+}
+
+TEST(Window, MonotonicSequences) {
+    RollingWindow min(WindowOp::Min, 3);
+    RollingWindow max(WindowOp::Max, 3);
+    std::vector<double> minima;
+    std::vector<double> maxima;
+    for (double value : { 1.0, 2.0, 3.0, 4.0, 5.0, 4.0, 3.0, 2.0, 1.0 }) {
+        minima.push_back(min.push(value));
+        maxima.push_back(max.push(value));
+    }
+    EXPECT_EQ(minima, (std::vector<double>{ 1, 1, 1, 2, 3, 4, 3, 2, 1 }));
+    EXPECT_EQ(maxima, (std::vector<double>{ 1, 2, 3, 4, 5, 5, 5, 4, 3 }));
+}
+
+TEST(Window, SumDoesNotDrift) {
+    // Large and small samples alternate; without compensation the small ones
+    // are lost when a large one leaves the window.
+    RollingWindow window(WindowOp::Sum, 2);
+    double sum = 0;
+    for (int j = 0; j < 100000; ++j) {
+        sum = window.push(j % 2 == 0 ? 1e16 : 1.0);
+    }
+    EXPECT_EQ(sum, 1e16 + 1.0);
+    for (int j = 0; j < 2; ++j) {
+        sum = window.push(0.25);
+    }
+    EXPECT_EQ(sum, 0.5);
+}
+
+TEST(Window, NonFiniteSamplesLeave) {
+    for (WindowOp op : { WindowOp::Sum, WindowOp::Mean }) {
+        RollingWindow window(op, 2);
+        std::vector<double> results;
+        for (double value : { 1.0, HUGE_VAL, 1.0, 1.0, 1.0 }) {
+            results.push_back(window.push(value));
+        }
+        double full = op == WindowOp::Sum ? 2.0 : 1.0;
+        EXPECT_EQ(results, (std::vector<double>{ 1.0, HUGE_VAL, HUGE_VAL, full, full }));
+    }
+    for (WindowOp op : { WindowOp::Sum, WindowOp::Min, WindowOp::Stddev }) {
+        RollingWindow window(op, 2);
+        window.push(1.0);
+        EXPECT_TRUE(std::isnan(window.push(std::nan(""))));
+        EXPECT_TRUE(std::isnan(window.push(1.0)));
+        EXPECT_EQ(window.push(1.0), op == WindowOp::Sum ? 2.0 : op == WindowOp::Min ? 1.0 : 0.0);
+    }
+}
+
+TEST(Window, ConstantSamplesHaveNoSpread) {
+    RollingWindow window(WindowOp::Stddev, 10);
+    for (int j = 0; j < 1000; ++j) {
+        EXPECT_EQ(window.push(0.1), 0.0) << j;
+    }
+}
+
+TEST(Window, ParsesWindowCalls) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    Pointer<Variable> x = calc.internVariable("x");
+    NodePtr ast = parser.parse("msum(x, 3) + mmax(x*x, 2)");
+    ASSERT_TRUE(ast);
+    std::vector<double> results;
+    for (double value : { 1.0, -3.0, 2.0, 4.0 }) {
+        x->value = value;
+        results.push_back(ast->calc());
+    }
+    EXPECT_EQ(results, (std::vector<double>{ 1 + 1, -2 + 9, 0 + 9, 3 + 16 }));
+
+    for (const char* text : { "msum(x)", "msum(x, 0)", "msum(x, 2.5)", "msum(x, -3)", "msum(x, y)",
+             "msum(x, 1+1)", "msum(x, 1e9)", "msum(x, 2, 3)" }) {
+        EXPECT_FALSE(parser.parse(text)) << text;
+    }
+    EXPECT_TRUE(parser.parse("mstd(x, 67108864)").as<WindowCall>());
+}
+
+TEST(Window, RegisteredFunctionsTakePrecedence) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    auto add = [](double lhs, double rhs) -> double { return lhs + rhs; };
+    calc._function_map["msum"] = Function{ "msum", 2, toFnPtr(+add) };
+    NodePtr ast = parser.parse("msum(4, 3)");
+    ASSERT_TRUE(ast);
+    EXPECT_FALSE(ast.as<WindowCall>());
+    EXPECT_EQ(ast->calc(), 7.0);
+    EXPECT_EQ(ast->calc(), 7.0);
+}
+
+TEST(Window, OptimizerKeepsWindowsApart) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse("msum(3, 2) + msum(3, 2)");
+    ASSERT_TRUE(ast);
+    Optimizer optimizer;
+    NodePtr optimized = optimizer.optimize(ast);
+    EXPECT_EQ(optimizer.stats().folded, 0u);
+    EXPECT_EQ(optimizer.stats().merged, 0u);
+    EXPECT_EQ(optimized->calc(), 6.0);
+    EXPECT_EQ(optimized->calc(), 12.0);
+    EXPECT_EQ(optimized->calc(), 12.0);
+    // The optimized tree has windows of its own.
+    EXPECT_EQ(ast->calc(), 6.0);
+}
+
+TEST(Window, TreeWalkOnly) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse("1 + mmean(x, 4)");
+    ASSERT_TRUE(ast);
+    EXPECT_FALSE(Compiler::compile(ast));
+    EXPECT_EQ(calcAs<float>(ast.get()), 1.0f);
+}
+
+TEST(Window, WriterRoundTrip) {
+    Calculator calc;
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse("mmin(x*2, 10) + mstd(x, 1000)");
+    ASSERT_TRUE(ast);
+    Writer writer;
+    writer.write(ast);
+    EXPECT_EQ(std::string(writer.data.begin(), writer.data.end()), "mmin(x*2,10)+mstd(x,1000)");
+}
+
+// ===== Writer.h =====
+
+namespace {
+
+std::string text(const Writer& writer) {
+    return std::string(writer.data.begin(), writer.data.end());
+}
+
+// Parses source with PrecedenceParser and writes the tree back out.
+std::string reprint(Calculator& calc, const std::string& source) {
+    PrecedenceParser parser(calc);
+    NodePtr ast = parser.parse(source);
+    EXPECT_TRUE(ast) << source;
+    Writer writer;
+    writer.names(calc._function_map);
+    writer.write(ast);
+    return text(writer);
+}
+
+double writerCube(double val) {
+    return val * val * val;
+}
+
+}  // namespace
+
+TEST(Writer, WriteDouble) {
+    Writer writer;
+    writer.write(3.14);
+    std::string result(writer.data.begin(), writer.data.end());
+    EXPECT_NE(result.find("3.14"), std::string::npos);
+}
+
+TEST(Writer, WriteDoubleShortestRoundTrip) {
+    for (double value : { 0.1, 1.0 / 3, 2.5e-300, 1e21, 123456789.0, 5e-324, -0.0, 0.30000000000000004 }) {
+        Writer writer;
+        writer.write(value);
+        std::string result = text(writer);
+        EXPECT_EQ(std::strtod(result.c_str(), nullptr), value) << result;
+        EXPECT_EQ(std::signbit(std::strtod(result.c_str(), nullptr)), std::signbit(value)) << result;
+    }
+    Writer writer;
+    writer.write(0.1);
+    writer.write(',');
+    writer.write(100.0);
+    EXPECT_EQ(text(writer), "0.1,100");
+}
+
+TEST(Writer, MinimalParentheses) {
+    Calculator calc;
+    const char* cases[][2] = {
+        { "2 + 3 * 4", "2+3*4" },
+        { "(2 + 3) * 4", "(2+3)*4" },
+        { "((x))", "x" },
+        { "10 - 2 + 3", "10-2+3" },
+        { "10 - (2 + 3)", "10-(2+3)" },
+        { "a * (b * c)", "a*(b*c)" },
+        { "(a / b) / c", "a/b/c" },
+        { "-(x + 1) * -y", "-(x+1)*-y" },
+        { "x - -y", "x--y" },
+        { "max(x + 1, (2)) / (sqrt(y))", "max(x+1,2)/sqrt(y)" },
+    };
+    for (const auto& entry : cases) {
+        EXPECT_EQ(reprint(calc, entry[0]), entry[1]) << entry[0];
+    }
+}
+
+TEST(Writer, RoundTripsGeneratedExpressions) {
+    Calculator calc;
+    calc._function_map["cube"] = Function{ "cube", 1, toFnPtr(&writerCube) };
+    PrecedenceParser parser(calc);
+    GeneratorOptions opts;
+    opts.terms = 40;
+    opts.depth = 4;
+    opts.variables = 4;
+    opts.call_percent = 20;
+    opts.functions = { { "cube", 1 }, { "min", 2 }, { "sqrt", 1 } };
+    for (const auto& entry : calc._variable_map) {
+        entry.second->value = 0.0;
+    }
+    for (uint64_t seed = 1; seed <= 50; ++seed) {
+        opts.seed = seed;
+        std::string source = ExpressionGenerator::generate(opts);
+        std::string printed = reprint(calc, source);
+        // Writing is idempotent and the value is preserved bit for bit.
+        EXPECT_EQ(reprint(calc, printed), printed) << source;
+        for (auto& entry : calc._variable_map) {
+            entry.second->value = 1.25 + static_cast<double>(entry.first.size());
+        }
+        double expected = parser.parse(source)->calc();
+        double actual = parser.parse(printed)->calc();
+        EXPECT_TRUE(actual == expected || (std::isnan(actual) && std::isnan(expected))) << source;
+        EXPECT_LE(printed.size(), source.size()) << source;
+    }
+}
+
+TEST(Writer, FoldedAndSharedNodes) {
+    Calculator calc;
+    NodePtr dag = Optimizer::run(calc.parse("(x+1)*(x+1)"));
+    ASSERT_TRUE(dag.as<DagRoot>());
+    Writer writer;
+    writer.write(dag);
+    EXPECT_EQ(text(writer), "(x+1)*(x+1)");
+    // Folded constants: negative, infinite and NaN.
+    const char* folded[][2] = { { "x*(0-3)", "x*-3" }, { "x*(1/0)", "x*(1/0)" }, { "x-(0/0)", "x-0/0" } };
+    for (const auto& entry : folded) {
+        Writer out;
+        out.write(Optimizer::run(calc.parse(entry[0])));
+        EXPECT_EQ(text(out), entry[1]) << entry[0];
+    }
+    Writer unknown;
+    NodePtr call = NodePtr(new FunctionCallWithArgs<1>(toFnPtr(&writerCube), { dag }));
+    unknown.visit(call.get());
+    EXPECT_EQ(text(unknown).substr(0, 2), "?(");
+}
+
+TEST(Writer, WriteStringView) {
+    Writer writer;
+    writer.write(std::string_view("hello"));
+    std::string result(writer.data.begin(), writer.data.end());
+    EXPECT_EQ(result, "hello");
+}
+
+TEST(Writer, WriteAppends) {
+    Writer writer;
+    writer.write(std::string_view("ab"));
+    writer.write(std::string_view("cd"));
+    std::string result(writer.data.begin(), writer.data.end());
+    EXPECT_EQ(result, "abcd");
+}
+
+TEST(Writer, WriteRawAndAlign) {
+    Writer writer;
+    writer.write(std::string_view("a"));
+    writer.align(4);
+    uint32_t word = 0x01020304;
+    writer.writeRaw(word);
+    ASSERT_EQ(writer.data.size(), 8U);
+    EXPECT_EQ(writer.data[1], 0);
+    EXPECT_EQ(memcmp(writer.data.data() + 4, &word, 4), 0);
+    writer.align(4);
+    EXPECT_EQ(writer.data.size(), 8U);
 }
 
 // NOLINTEND(readability-magic-numbers)